@@ -0,0 +1,1136 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <locale.h>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "../brutefir/global.h"
+#include "../brutefir/brutefir.hpp"
+#include "../brutefir/raw2real.hpp"
+#include "../brutefir/real2raw.hpp"
+#include "../brutefir/dither.hpp"
+#include "../brutefir/simd.hpp"
+#include "../brutefir/bfir_path.hpp"
+#include "../brutefir/metrics.hpp"
+#include "../brutefir/thread_pool.hpp"
+#include "../brutefir/timestamp.h"
+#include "../brutefir/sysarch.h"
+#include "../brutefir/util.hpp"
+#include "../brutefir/pinfo.h"
+
+#define SAMPLING_RATE        44100
+
+// blocks of different input are cycled so the input
+// conversion does not always read the same cache lines
+#define INPUT_BLOCKS         8
+
+// each case runs for at least this many blocks, and the
+// minimum time
+#define MIN_TIMED_BLOCKS     16
+
+// input noise peak, low enough that the output rarely clips
+#define INPUT_PEAK           0.25
+
+// The engine stages reported for each case, in the order
+// of METRICS_STAGE_*.
+static const char *stage_names[METRICS_STAGE_OUTPUT + 1] =
+{
+    "input", "fft", "mix", "mac", "ifft", "output"
+};
+
+// A sample format and its size in bytes.
+struct bench_format
+{
+    const char *name;
+    int format;
+    int bytes;
+};
+
+static const struct bench_format formats[] =
+{
+    { "s16_le", BF_SAMPLE_FORMAT_S16_LE, 2 },
+    { "s24_le", BF_SAMPLE_FORMAT_S24_LE, 3 },
+    { "s32_le", BF_SAMPLE_FORMAT_S32_LE, 4 },
+    { "float_le", BF_SAMPLE_FORMAT_FLOAT_LE, 4 }
+};
+
+#define FORMAT_COUNT ((int)(sizeof(formats) / sizeof(formats[0])))
+
+// the longest short length verified, lengths up to it end
+// within or just past a group of samples of the kernels
+#define VERIFY_MAX_SHORT     9
+
+// the full block length verified after the short lengths
+#define VERIFY_BLOCK         4096
+
+// samples past the end of a converted block that are checked
+// to be left alone
+#define VERIFY_GUARD         8
+
+// the size of the verified buffers, for a block of the widest
+// samples at the widest spacing
+#define VERIFY_RAW_SIZE      ((VERIFY_BLOCK + VERIFY_GUARD) * 8 * 8)
+
+// A sample format verified against the scalar conversions.
+struct verify_format
+{
+    const char *name;
+    int bytes;
+    bool isfloat;
+    bool swap;
+};
+
+static const struct verify_format verify_formats[] =
+{
+    { "s8", 1, false, false },
+    { "s16_le", 2, false, false },
+    { "s16_be", 2, false, true },
+    { "s24_le", 3, false, false },
+    { "s24_be", 3, false, true },
+    { "s32_le", 4, false, false },
+    { "s32_be", 4, false, true },
+    { "float_le", 4, true, false },
+    { "float_be", 4, true, true },
+    { "float64_le", 8, true, false },
+    { "float64_be", 8, true, true }
+};
+
+#define VERIFY_FORMAT_COUNT ((int)(sizeof(verify_formats) / sizeof(verify_formats[0])))
+
+// the sample spacings verified: contiguous, stereo, 5.1 and 7.1
+static const int verify_spacings[] = { 1, 2, 6, 8 };
+
+#define VERIFY_SPACING_COUNT ((int)(sizeof(verify_spacings) / sizeof(verify_spacings[0])))
+
+// The matrix of cases to run.  Cases with a block size
+// larger than the filter length are skipped.
+struct bench_matrix
+{
+    std::vector<int> lengths;
+    std::vector<int> block_sizes;
+    std::vector<int> realsizes;
+    std::vector<int> channels;
+    std::vector<int> formats;
+    double min_seconds;
+};
+
+// The timing of one case.
+struct bench_result
+{
+    int n_blocks;
+    long blocks_run;
+    double setup_seconds;
+    double seconds;
+    uint64_t cycles;
+    uint64_t stage_cycles[METRICS_STAGE_COUNT];
+};
+
+// Prints engine messages to the standard error.
+//
+// Parameters:
+//   message  the message
+static void
+print_message(const char *message)
+{
+    std::string str(message);
+
+    boost::trim_right(str);
+    fprintf(stderr, "%s\n", str.c_str());
+}
+
+// Prints the usage of the program.
+static void
+print_usage()
+{
+    fprintf(stderr,
+            "Usage: bfir_bench [options]\n"
+            "\n"
+            "Times the convolution engine over a matrix of cases and writes\n"
+            "the results as JSON.\n"
+            "\n"
+            "Options:\n"
+            "  -o <file>     output file (default: standard output)\n"
+            "  -l <n,...>    filter lengths in taps (default: 1024,4096,16384,\n"
+            "                65536,262144,1048576)\n"
+            "  -b <n,...>    block sizes (default: 256,1024,4096)\n"
+            "  -p <n,...>    precision in bytes, 4 or 8 (default: 4,8)\n"
+            "  -c <n,...>    channel counts (default: 1,2,8)\n"
+            "  -f <name,...> input and output formats, s16_le, s24_le, s32_le\n"
+            "                or float_le (default: all)\n"
+            "  -m <seconds>  minimum time per case (default: 0.5)\n"
+            "  -w <dir>      directory for FFTW wisdom (default: ~/brutefir)\n"
+            "  --verify      compare the vector sample conversions with the\n"
+            "                scalar ones instead of timing the engine\n");
+}
+
+// Parses a comma separated list of integers, each limited
+// to a range.
+//
+// Parameters:
+//   data    the list
+//   min     the minimum value
+//   max     the maximum value
+//   values  returns the values
+//
+// Returns:
+//   true if successful, false otherwise.
+static bool
+parse_list(const std::string &data,
+           int min,
+           int max,
+           std::vector<int> *values)
+{
+    std::vector<std::string> items;
+
+    boost::split(items, data, boost::is_any_of(","));
+    values->clear();
+
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        int val;
+
+        try
+        {
+            val = boost::lexical_cast<int>(boost::trim_copy(items[i]));
+        }
+        catch (const boost::bad_lexical_cast &)
+        {
+            return false;
+        }
+
+        if (val < min || val > max)
+        {
+            return false;
+        }
+
+        values->push_back(val);
+    }
+
+    return !values->empty();
+}
+
+// Parses a comma separated list of format names.
+//
+// Parameters:
+//   data    the list
+//   values  returns the indexes into formats
+//
+// Returns:
+//   true if successful, false otherwise.
+static bool
+parse_formats(const std::string &data,
+              std::vector<int> *values)
+{
+    std::vector<std::string> items;
+
+    boost::split(items, data, boost::is_any_of(","));
+    values->clear();
+
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        std::string name = boost::to_lower_copy(boost::trim_copy(items[i]));
+        int n;
+
+        for (n = 0; n < FORMAT_COUNT; n++)
+        {
+            if (name == formats[n].name)
+            {
+                break;
+            }
+        }
+
+        if (n == FORMAT_COUNT)
+        {
+            return false;
+        }
+
+        values->push_back(n);
+    }
+
+    return !values->empty();
+}
+
+// Gets the next value of a linear congruential generator,
+// so every run and every build times the same data.
+//
+// Parameters:
+//   state  the generator state, updated on return
+//
+// Returns:
+//   A value in the range [-1, 1).
+static double
+next_random(uint32_t *state)
+{
+    *state = *state * 1664525 + 1013904223;
+
+    return (double)(*state >> 8) / (double)(1 << 23) - 1.0;
+}
+
+// Fills a buffer with noise in a sample format.
+//
+// Parameters:
+//   buf       the buffer
+//   n_values  the number of samples
+//   format    the sample format
+//   state     the generator state, updated on return
+static void
+fill_input(uint8_t *buf,
+           int n_values,
+           const struct bench_format *format,
+           uint32_t *state)
+{
+    int n;
+
+    for (n = 0; n < n_values; n++)
+    {
+        double value = INPUT_PEAK * next_random(state);
+        uint8_t *p = &buf[n * format->bytes];
+        int32_t ival;
+        float fval;
+
+        switch (format->format)
+        {
+        case BF_SAMPLE_FORMAT_S16_LE:
+            ival = (int32_t)(value * 32767.0);
+            p[0] = (uint8_t)ival;
+            p[1] = (uint8_t)(ival >> 8);
+            break;
+        case BF_SAMPLE_FORMAT_S24_LE:
+            ival = (int32_t)(value * 8388607.0);
+            p[0] = (uint8_t)ival;
+            p[1] = (uint8_t)(ival >> 8);
+            p[2] = (uint8_t)(ival >> 16);
+            break;
+        case BF_SAMPLE_FORMAT_S32_LE:
+            ival = (int32_t)(value * 2147483647.0);
+            memcpy(p, &ival, sizeof(int32_t));
+            break;
+        default:
+            fval = (float)value;
+            memcpy(p, &fval, sizeof(float));
+            break;
+        }
+    }
+}
+
+// Fills the coefficients of each channel with noise.
+//
+// Parameters:
+//   coeffs      the coefficients, one buffer per channel
+//   n_channels  the number of channels
+//   length      the number of taps
+//   realsize    the size of a coefficient in bytes
+static void
+fill_coeffs(void **coeffs,
+            int n_channels,
+            int length,
+            int realsize)
+{
+    uint32_t state = 1;
+    int n, i;
+
+    for (n = 0; n < n_channels; n++)
+    {
+        for (i = 0; i < length; i++)
+        {
+            if (realsize == 4)
+            {
+                ((float *)coeffs[n])[i] = (float)next_random(&state);
+            }
+            else
+            {
+                ((double *)coeffs[n])[i] = next_random(&state);
+            }
+        }
+    }
+}
+
+// Runs a case.  All filter blocks are convolved before the
+// timing starts, so the timed blocks do the full work of the
+// filter length.
+//
+// Parameters:
+//   length       the filter length in taps
+//   block_size   the block size
+//   realsize     the precision in bytes
+//   n_channels   the number of channels
+//   format       the input and output format
+//   min_seconds  the minimum time
+//   result       returns the timing
+//
+// Returns:
+//   true if successful, false otherwise.
+static bool
+run_case(int length,
+         int block_size,
+         int realsize,
+         int n_channels,
+         const struct bench_format *format,
+         double min_seconds,
+         struct bench_result *result)
+{
+    brutefir *filter;
+    void *coeffs[BF_MAXCHANNELS];
+    uint8_t *inbuf, *outbuf;
+    uint64_t stage_cycles[METRICS_STAGE_COUNT];
+    volatile uint64_t ts[2];
+    uint32_t state = 2;
+    int block_bytes = block_size * n_channels * format->bytes;
+    int n, i;
+    double start;
+    bool ok = true;
+
+    memset(result, 0, sizeof(struct bench_result));
+    result->n_blocks = util::get_next_multiple(length, block_size) / block_size;
+
+    inbuf = (uint8_t *) _aligned_malloc(INPUT_BLOCKS * block_bytes, ALIGNMENT);
+    outbuf = (uint8_t *) _aligned_malloc(block_bytes, ALIGNMENT);
+
+    for (n = 0; n < INPUT_BLOCKS; n++)
+    {
+        fill_input(&inbuf[n * block_bytes], block_size * n_channels, format, &state);
+    }
+
+    for (n = 0; n < n_channels; n++)
+    {
+        coeffs[n] = _aligned_malloc(length * realsize, ALIGNMENT);
+    }
+
+    fill_coeffs(coeffs, n_channels, length, realsize);
+
+    start = metrics::get_time();
+
+    filter = new brutefir(block_size,
+                          result->n_blocks,
+                          realsize,
+                          n_channels,
+                          format->format,
+                          format->format,
+                          SAMPLING_RATE,
+                          false,
+                          POOL_PRIORITY_NORMAL);
+
+    // the scale keeps the output level close to the input level
+    if ((filter->set_coeff(coeffs, n_channels, length, result->n_blocks, 1.0 / sqrt((double)length)) < 0) ||
+        !filter->is_initialized())
+    {
+        pinfo("Could not set the filter coefficients.");
+        ok = false;
+        goto exit;
+    }
+
+    result->setup_seconds = metrics::get_time() - start;
+
+    // fill the input history of every filter block
+    for (n = 0; n < result->n_blocks + 2; n++)
+    {
+        if (filter->run(&inbuf[(n % INPUT_BLOCKS) * block_bytes], outbuf) != 0)
+        {
+            ok = false;
+            goto exit;
+        }
+    }
+
+    start = metrics::get_time();
+
+    do
+    {
+        n = (int)(result->blocks_run % INPUT_BLOCKS);
+
+        timestamp(&ts[0]);
+
+        if (filter->run(&inbuf[n * block_bytes], outbuf) != 0)
+        {
+            ok = false;
+            goto exit;
+        }
+
+        timestamp(&ts[1]);
+
+        filter->get_stage_cycles(stage_cycles);
+
+        for (i = 0; i < METRICS_STAGE_COUNT; i++)
+        {
+            result->stage_cycles[i] += stage_cycles[i];
+        }
+
+        result->cycles += ts[1] - ts[0];
+        result->blocks_run++;
+        result->seconds = metrics::get_time() - start;
+    }
+    while ((result->blocks_run < MIN_TIMED_BLOCKS) || (result->seconds < min_seconds));
+
+exit:
+    delete filter;
+
+    for (n = 0; n < n_channels; n++)
+    {
+        _aligned_free(coeffs[n]);
+    }
+
+    _aligned_free(outbuf);
+    _aligned_free(inbuf);
+
+    return ok;
+}
+
+// Writes the results of a case as a JSON object.  Stage times
+// are in microseconds per block, converted from time stamp
+// counter cycles with the rate measured over the case.
+//
+// Parameters:
+//   out         the output stream
+//   length      the filter length in taps
+//   block_size  the block size
+//   realsize    the precision in bytes
+//   n_channels  the number of channels
+//   format      the input and output format
+//   result      the timing
+static void
+write_result(FILE *out,
+             int length,
+             int block_size,
+             int realsize,
+             int n_channels,
+             const struct bench_format *format,
+             const struct bench_result *result)
+{
+    double cycle_rate = (result->seconds > 0.0) ? result->cycles / result->seconds : 0.0;
+    double audio_seconds = (double)result->blocks_run * block_size / SAMPLING_RATE;
+    double usec;
+    int i;
+
+    fprintf(out,
+            "    {\"length\": %d, \"block_size\": %d, \"realsize\": %d, "
+            "\"channels\": %d, \"format\": \"%s\", \"filter_blocks\": %d, "
+            "\"blocks_run\": %ld, \"setup_seconds\": %.6f,\n",
+            length, block_size, realsize, n_channels, format->name,
+            result->n_blocks, result->blocks_run, result->setup_seconds);
+
+    fprintf(out, "     \"stages\": {");
+
+    for (i = 0; i <= METRICS_STAGE_OUTPUT; i++)
+    {
+        usec = 0.0;
+
+        if (cycle_rate > 0.0)
+        {
+            usec = 1e6 * result->stage_cycles[i] / (cycle_rate * result->blocks_run);
+        }
+
+        fprintf(out, "%s\"%s\": %.3f", (i > 0) ? ", " : "", stage_names[i], usec);
+    }
+
+    fprintf(out,
+            "},\n"
+            "     \"block_usec\": %.3f, \"realtime_factor\": %.3f}",
+            1e6 * result->seconds / result->blocks_run,
+            (result->seconds > 0.0) ? audio_seconds / result->seconds : 0.0);
+}
+
+// Returns the next number of the random sequence used to
+// fill the verified buffers.
+//
+// Returns:
+//   The number.
+static uint32_t
+verify_rand()
+{
+    static uint32_t state = 1;
+
+    state = state * 1664525 + 1013904223;
+    return state;
+}
+
+// Fills a raw buffer with random bytes, and the samples of
+// floating point formats with finite random values, since a
+// NaN need not keep its payload through a conversion.
+//
+// Parameters:
+//   rawbuf     the raw buffer
+//   size       the size of the buffer in bytes
+//   format     the sample format
+//   spacing    the distance between samples in samples
+//   n_samples  the number of samples
+static void
+fill_raw(uint8_t *rawbuf,
+         int size,
+         const struct verify_format *format,
+         int spacing,
+         int n_samples)
+{
+    uint8_t value[8];
+    float f;
+    double d;
+    int n, i;
+
+    for (n = 0; n < size; n++)
+    {
+        rawbuf[n] = (uint8_t)(verify_rand() >> 24);
+    }
+
+    if (!format->isfloat)
+    {
+        return;
+    }
+
+    for (n = 0; n < n_samples; n++)
+    {
+        d = 2.0 * (int32_t)verify_rand() / 2147483648.0;
+        f = (float)d;
+
+        if (format->bytes == 4)
+        {
+            memcpy(value, &f, 4);
+        }
+        else
+        {
+            memcpy(value, &d, 8);
+        }
+
+        for (i = 0; i < format->bytes; i++)
+        {
+            rawbuf[n * spacing * format->bytes + i] =
+                value[format->swap ? format->bytes - 1 - i : i];
+        }
+    }
+}
+
+// Fills a buffer with random samples up to a quarter beyond the
+// full scale of a format, so that clipping is exercised.
+//
+// Parameters:
+//   realbuf    the samples
+//   realsize   the precision in bytes
+//   format     the sample format
+//   n_samples  the number of samples
+static void
+fill_real(void *realbuf,
+          int realsize,
+          const struct verify_format *format,
+          int n_samples)
+{
+    double scale = format->isfloat ? 1.0 : (double)(1 << (format->bytes * 8 - 1));
+    double d;
+    int n;
+
+    for (n = 0; n < n_samples; n++)
+    {
+        d = 1.25 * scale * (int32_t)verify_rand() / 2147483648.0;
+
+        if (realsize == 4)
+        {
+            ((float *)realbuf)[n] = (float)d;
+        }
+        else
+        {
+            ((double *)realbuf)[n] = d;
+        }
+    }
+}
+
+// Compares two overflow records.
+//
+// Returns:
+//   true if they are the same, false otherwise.
+static bool
+same_overflow(const struct bfoverflow_t *a,
+              const struct bfoverflow_t *b)
+{
+    return (a->n_overflows == b->n_overflows) &&
+           (a->intlargest == b->intlargest) &&
+           (memcmp(&a->largest, &b->largest, sizeof(double)) == 0) &&
+           (memcmp(&a->max, &b->max, sizeof(double)) == 0);
+}
+
+// Resets an overflow record the way the engine does.
+//
+// Parameters:
+//   overflow  the record
+//   format    the sample format
+static void
+reset_overflow(struct bfoverflow_t *overflow,
+               const struct verify_format *format)
+{
+    memset(overflow, 0, sizeof(struct bfoverflow_t));
+    overflow->max = format->isfloat ? 1.0 : (double)(1 << (format->bytes * 8 - 1)) - 1.0;
+}
+
+// Reports a conversion that differs between the vector kernels
+// and the scalar code.
+static void
+report_difference(const char *what,
+                  const struct verify_format *format,
+                  int realsize,
+                  int spacing,
+                  int n_samples)
+{
+    fprintf(stderr, "%s differs: %s, realsize %d, spacing %d, %d samples\n",
+            what, format->name, realsize, spacing, n_samples);
+}
+
+// Converts raw input samples with and without the vector kernels
+// and compares the results, including the samples just past the
+// end, which neither may write.
+//
+// Returns:
+//   true if the results are the same, false otherwise.
+static bool
+verify_input(const struct verify_format *format,
+             int realsize,
+             int spacing,
+             int n_samples,
+             uint8_t *rawbuf,
+             uint8_t *simd_buf,
+             uint8_t *scalar_buf)
+{
+    int size = (n_samples + VERIFY_GUARD) * realsize;
+    int i;
+
+    fill_raw(rawbuf, VERIFY_RAW_SIZE, format, spacing, n_samples);
+
+    memset(simd_buf, 0xA5, size);
+    memset(scalar_buf, 0xA5, size);
+
+    for (i = 0; i < 2; i++)
+    {
+        simd::set_enabled(i == 0);
+
+        if (realsize == 4)
+        {
+            raw2real::raw2realf((i == 0) ? simd_buf : scalar_buf, rawbuf, format->bytes, 0,
+                                format->isfloat, spacing, format->swap, n_samples);
+        }
+        else
+        {
+            raw2real::raw2reald((i == 0) ? simd_buf : scalar_buf, rawbuf, format->bytes, 0,
+                                format->isfloat, spacing, format->swap, n_samples);
+        }
+    }
+
+    simd::set_enabled(true);
+
+    if (memcmp(simd_buf, scalar_buf, size) != 0)
+    {
+        report_difference("input", format, realsize, spacing, n_samples);
+        return false;
+    }
+
+    return true;
+}
+
+// Converts samples to raw output without dither with and without
+// the vector kernels and compares the results, including the bytes
+// between the samples, which neither may write.
+//
+// Returns:
+//   true if the results are the same, false otherwise.
+static bool
+verify_output(const struct verify_format *format,
+              int realsize,
+              int spacing,
+              int n_samples,
+              uint8_t *realbuf,
+              uint8_t *simd_buf,
+              uint8_t *scalar_buf,
+              dither *dither)
+{
+    struct bfoverflow_t overflow[2];
+    int i;
+
+    fill_real(realbuf, realsize, format, n_samples);
+
+    memset(simd_buf, 0xA5, VERIFY_RAW_SIZE);
+    memset(scalar_buf, 0xA5, VERIFY_RAW_SIZE);
+
+    for (i = 0; i < 2; i++)
+    {
+        simd::set_enabled(i == 0);
+        reset_overflow(&overflow[i], format);
+
+        if (realsize == 4)
+        {
+            real2raw::real2rawf_no_dither((i == 0) ? simd_buf : scalar_buf, realbuf,
+                                          format->bytes * 8, format->bytes, 0,
+                                          format->isfloat, spacing, format->swap,
+                                          n_samples, &overflow[i], dither);
+        }
+        else
+        {
+            real2raw::real2rawd_no_dither((i == 0) ? simd_buf : scalar_buf, realbuf,
+                                          format->bytes * 8, format->bytes, 0,
+                                          format->isfloat, spacing, format->swap,
+                                          n_samples, &overflow[i], dither);
+        }
+    }
+
+    simd::set_enabled(true);
+
+    if ((memcmp(simd_buf, scalar_buf, VERIFY_RAW_SIZE) != 0) ||
+        !same_overflow(&overflow[0], &overflow[1]))
+    {
+        report_difference("output", format, realsize, spacing, n_samples);
+        return false;
+    }
+
+    return true;
+}
+
+// Runs a sequence of dithered output loops of every verified
+// length with and without the vector kernels, each with its own
+// dither, and compares the TPDF noise and the results of each
+// loop.  The generators carry over from loop to loop, so loops
+// that end within a group of random numbers are covered.
+//
+// Returns:
+//   true if the results are the same, false otherwise.
+static bool
+verify_dither(const struct verify_format *format,
+              int realsize,
+              int spacing,
+              uint8_t *realbuf,
+              uint8_t *simd_buf,
+              uint8_t *scalar_buf)
+{
+    struct dither_state_t state[2];
+    struct bfoverflow_t overflow[2];
+    dither *dithers[2];
+    bool ok = true;
+    int n_samples;
+    int n, i;
+
+    for (i = 0; i < 2; i++)
+    {
+        dithers[i] = new dither(1, realsize, VERIFY_BLOCK, &state[i]);
+    }
+
+    for (n = 0; ok && n <= VERIFY_MAX_SHORT + 1; n++)
+    {
+        n_samples = (n <= VERIFY_MAX_SHORT) ? n : VERIFY_BLOCK;
+
+        fill_real(realbuf, realsize, format, n_samples);
+
+        memset(simd_buf, 0xA5, VERIFY_RAW_SIZE);
+        memset(scalar_buf, 0xA5, VERIFY_RAW_SIZE);
+
+        for (i = 0; i < 2; i++)
+        {
+            simd::set_enabled(i == 0);
+            reset_overflow(&overflow[i], format);
+
+            dithers[i]->dither_preloop_real2int_hp_tpdf(&state[i], n_samples);
+
+            if (realsize == 4)
+            {
+                real2raw::real2rawf_hp_tpdf((i == 0) ? simd_buf : scalar_buf, realbuf,
+                                            format->bytes * 8, format->bytes, 0,
+                                            false, spacing, format->swap, n_samples,
+                                            &overflow[i], &state[i], dithers[i]);
+            }
+            else
+            {
+                real2raw::real2rawd_hp_tpdf((i == 0) ? simd_buf : scalar_buf, realbuf,
+                                            format->bytes * 8, format->bytes, 0,
+                                            false, spacing, format->swap, n_samples,
+                                            &overflow[i], &state[i], dithers[i]);
+            }
+        }
+
+        simd::set_enabled(true);
+
+        if ((memcmp(state[0].noise, state[1].noise, n_samples * realsize) != 0) ||
+            (memcmp(state[0].taus, state[1].taus, sizeof(state[0].taus)) != 0) ||
+            (state[0].rand != state[1].rand))
+        {
+            report_difference("TPDF noise", format, realsize, spacing, n_samples);
+            ok = false;
+        }
+        else if ((memcmp(simd_buf, scalar_buf, VERIFY_RAW_SIZE) != 0) ||
+                 !same_overflow(&overflow[0], &overflow[1]))
+        {
+            report_difference("dithered output", format, realsize, spacing, n_samples);
+            ok = false;
+        }
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        delete dithers[i];
+    }
+
+    return ok;
+}
+
+// Verifies that the vector conversion kernels give the same
+// results as the scalar code they replace, for every sample
+// format, byte order, precision and verified spacing, with the
+// lengths up to VERIFY_MAX_SHORT, which end within or just past
+// a group of samples, and a full block.
+//
+// Returns:
+//   The number of conversions that differ.
+static int
+verify_kernels()
+{
+    uint8_t *rawbuf, *realbuf, *simd_buf, *scalar_buf;
+    struct dither_state_t state[2];
+    dither *dithers[2];
+    int n_checks = 0, n_failed = 0;
+    int f, p, s, n;
+    int realsize, spacing, n_samples;
+
+    if (!simd::is_supported())
+    {
+        fprintf(stderr, "The vector kernels are not supported, nothing to verify.\n");
+        return 0;
+    }
+
+    rawbuf = (uint8_t *)_aligned_malloc(VERIFY_RAW_SIZE, ALIGNMENT);
+    realbuf = (uint8_t *)_aligned_malloc(VERIFY_RAW_SIZE, ALIGNMENT);
+    simd_buf = (uint8_t *)_aligned_malloc(VERIFY_RAW_SIZE, ALIGNMENT);
+    scalar_buf = (uint8_t *)_aligned_malloc(VERIFY_RAW_SIZE, ALIGNMENT);
+
+    // the conversions without dither only use the dither to
+    // quantize, which has no state
+    dithers[0] = new dither(1, 4, VERIFY_BLOCK, &state[0]);
+    dithers[1] = new dither(1, 8, VERIFY_BLOCK, &state[1]);
+
+    for (f = 0; f < VERIFY_FORMAT_COUNT; f++)
+    for (p = 0; p < 2; p++)
+    for (s = 0; s < VERIFY_SPACING_COUNT; s++)
+    {
+        const struct verify_format *format = &verify_formats[f];
+
+        realsize = (p == 0) ? 4 : 8;
+        spacing = verify_spacings[s];
+
+        for (n = 0; n <= VERIFY_MAX_SHORT + 1; n++)
+        {
+            n_samples = (n <= VERIFY_MAX_SHORT) ? n : VERIFY_BLOCK;
+
+            n_failed += verify_input(format, realsize, spacing, n_samples,
+                                     rawbuf, simd_buf, scalar_buf) ? 0 : 1;
+
+            n_failed += verify_output(format, realsize, spacing, n_samples,
+                                      realbuf, simd_buf, scalar_buf, dithers[p]) ? 0 : 1;
+
+            n_checks += 2;
+        }
+
+        if (!format->isfloat)
+        {
+            n_failed += verify_dither(format, realsize, spacing,
+                                      realbuf, simd_buf, scalar_buf) ? 0 : 1;
+            n_checks++;
+        }
+    }
+
+    delete dithers[1];
+    delete dithers[0];
+
+    _aligned_free(scalar_buf);
+    _aligned_free(simd_buf);
+    _aligned_free(realbuf);
+    _aligned_free(rawbuf);
+
+    fprintf(stderr, "%d conversions verified, %d differ.\n", n_checks, n_failed);
+
+    return n_failed;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct bench_matrix matrix;
+    struct bench_result result;
+    std::string out_filename;
+    std::string work_dir;
+    FILE *out = stdout;
+    int n_cases = 0, n_failed = 0;
+    bool verify = false;
+    int n;
+
+    static const int default_lengths[] = { 1024, 4096, 16384, 65536, 262144, 1048576 };
+    static const int default_block_sizes[] = { 256, 1024, 4096 };
+    static const int default_realsizes[] = { 4, 8 };
+    static const int default_channels[] = { 1, 2, 8 };
+
+    setlocale(LC_ALL, "");
+
+    matrix.lengths.assign(default_lengths, default_lengths + 6);
+    matrix.block_sizes.assign(default_block_sizes, default_block_sizes + 3);
+    matrix.realsizes.assign(default_realsizes, default_realsizes + 2);
+    matrix.channels.assign(default_channels, default_channels + 3);
+    matrix.min_seconds = 0.5;
+
+    for (n = 0; n < FORMAT_COUNT; n++)
+    {
+        matrix.formats.push_back(n);
+    }
+
+    for (n = 1; n < argc; n++)
+    {
+        std::string arg(argv[n]);
+        bool ok;
+
+        if (arg == "--verify")
+        {
+            verify = true;
+            continue;
+        }
+
+        if (n + 1 >= argc)
+        {
+            print_usage();
+            return 2;
+        }
+
+        std::string data(argv[++n]);
+
+        if (arg == "-o")
+        {
+            out_filename = data;
+            ok = true;
+        }
+        else if (arg == "-w")
+        {
+            work_dir = data;
+            ok = true;
+        }
+        else if (arg == "-l")
+        {
+            ok = parse_list(data, 1, 16 * 1048576, &matrix.lengths);
+        }
+        else if (arg == "-b")
+        {
+            // the convolver transforms blocks of twice the block size
+            ok = parse_list(data, 16, 1048576, &matrix.block_sizes);
+
+            for (size_t i = 0; ok && i < matrix.block_sizes.size(); i++)
+            {
+                ok = ((matrix.block_sizes[i] & (matrix.block_sizes[i] - 1)) == 0);
+            }
+        }
+        else if (arg == "-p")
+        {
+            ok = parse_list(data, 4, 8, &matrix.realsizes);
+
+            for (size_t i = 0; ok && i < matrix.realsizes.size(); i++)
+            {
+                ok = (matrix.realsizes[i] == 4 || matrix.realsizes[i] == 8);
+            }
+        }
+        else if (arg == "-c")
+        {
+            ok = parse_list(data, 1, BF_MAXCHANNELS, &matrix.channels);
+        }
+        else if (arg == "-f")
+        {
+            ok = parse_formats(data, &matrix.formats);
+        }
+        else if (arg == "-m")
+        {
+            try
+            {
+                matrix.min_seconds = boost::lexical_cast<double>(data);
+                ok = (matrix.min_seconds >= 0.0);
+            }
+            catch (const boost::bad_lexical_cast &)
+            {
+                ok = false;
+            }
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            print_usage();
+            return 2;
+        }
+    }
+
+    if (verify)
+    {
+        return (verify_kernels() == 0) ? 0 : 1;
+    }
+
+    if (!out_filename.empty() && (out = fopen(out_filename.c_str(), "w")) == NULL)
+    {
+        fprintf(stderr, "Could not open output file %s.\n", out_filename.c_str());
+        return 2;
+    }
+
+    set_print_callback(&print_message);
+
+    // FFTW wisdom is kept between runs, so plans are measured
+    // once per size
+    bfir_path::set_path(util::str2wstr(work_dir));
+
+    fprintf(out, "{\"sampling_rate\": %d, \"min_seconds\": %.3f, \"cases\": [\n",
+            SAMPLING_RATE, matrix.min_seconds);
+
+    for (size_t l = 0; l < matrix.lengths.size(); l++)
+    for (size_t b = 0; b < matrix.block_sizes.size(); b++)
+    for (size_t p = 0; p < matrix.realsizes.size(); p++)
+    for (size_t c = 0; c < matrix.channels.size(); c++)
+    for (size_t f = 0; f < matrix.formats.size(); f++)
+    {
+        int length = matrix.lengths[l];
+        int block_size = matrix.block_sizes[b];
+        const struct bench_format *format = &formats[matrix.formats[f]];
+
+        if (block_size > length)
+        {
+            continue;
+        }
+
+        fprintf(stderr, "length %d, block %d, realsize %d, %d channels, %s\n",
+                length, block_size, matrix.realsizes[p], matrix.channels[c], format->name);
+
+        if (!run_case(length,
+                      block_size,
+                      matrix.realsizes[p],
+                      matrix.channels[c],
+                      format,
+                      matrix.min_seconds,
+                      &result))
+        {
+            n_failed++;
+            continue;
+        }
+
+        if (n_cases > 0)
+        {
+            fprintf(out, ",\n");
+        }
+
+        write_result(out, length, block_size, matrix.realsizes[p], matrix.channels[c], format, &result);
+        n_cases++;
+    }
+
+    fprintf(out, "\n]}\n");
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+    thread_pool::shutdown();
+
+    fprintf(stderr, "%d cases run, %d failed.\n", n_cases, n_failed);
+
+    return (n_failed == 0) ? 0 : 1;
+}
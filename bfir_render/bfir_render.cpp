@@ -0,0 +1,683 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <sndfile.h>
+
+#include "../brutefir/global.h"
+#include "../brutefir/brutefir.hpp"
+#include "../brutefir/preprocessor.hpp"
+#include "../brutefir/buffer.hpp"
+#include "../brutefir/bfir_path.hpp"
+#include "../brutefir/cache.hpp"
+#include "../brutefir/metrics.hpp"
+#include "../brutefir/thread_pool.hpp"
+#include "../brutefir/atomic.h"
+#include "../brutefir/util.hpp"
+#include "../brutefir/pinfo.h"
+
+// filter parameters, the same as the plug-in
+#define REALSIZE             8
+#define FILTER_LEN           1024
+#define EQ_FILTER_BLOCKS     64
+
+// settings are in steps of a tenth of a dB as with the
+// command line interface
+#define LEVEL_STEPS_PER_DB   10
+#define LEVEL_RANGE_MIN      (-20 * LEVEL_STEPS_PER_DB)
+#define LEVEL_RANGE_MAX      (20 * LEVEL_STEPS_PER_DB)
+
+// A filter built for one format, shared by all workers.
+struct render_filter
+{
+    std::wstring filename;
+    double scale;
+    int n_blocks;
+    int n_frames;
+};
+
+// The engine of a worker and the filter it was set up with.
+struct render_engine
+{
+    brutefir *filter;
+    int n_channels;
+    int sampling_rate;
+    std::wstring filename;
+};
+
+// The files to render and the state shared by the workers.
+struct render_job
+{
+    std::vector<std::string> files;
+    std::string output_dir;
+    bool tail;
+
+    struct filter_settings settings;
+
+    // filters by number of channels and sampling rate
+    std::map<std::pair<int, int>, struct render_filter> filters;
+    boost::mutex filters_mutex;
+
+    volatile long next_file;
+    volatile long n_failed;
+};
+
+static boost::mutex print_mutex;
+
+// Prints engine messages to the standard error.
+//
+// Parameters:
+//   message  the message
+static void
+print_message(const char *message)
+{
+    std::string str(message);
+
+    boost::trim_right(str);
+
+    boost::lock_guard<boost::mutex> lock(print_mutex);
+    fprintf(stderr, "%s\n", str.c_str());
+}
+
+// Prints the usage of the program.
+static void
+print_usage()
+{
+    fprintf(stderr,
+            "Usage: bfir_render [options] <input file>...\n"
+            "\n"
+            "Convolves sound files with the plug-in filter settings.\n"
+            "\n"
+            "Options:\n"
+            "  -c <file>  filter settings, one command per line\n"
+            "  -o <dir>   output directory (required)\n"
+            "  -j <n>     number of files rendered at once (default: one per core)\n"
+            "  -w <dir>   directory for generated filters (default: ~/brutefir)\n"
+            "  -t         keep the filter tail after the end of the input\n"
+            "  -m         convert the filter to minimum phase\n"
+            "  -r         trim the filter tail below the noise floor\n");
+}
+
+// Parses an integer setting and limits it to a range.
+//
+// Parameters:
+//   data   the setting value
+//   min    the minimum value
+//   max    the maximum value
+//   value  returns the value
+//
+// Returns:
+//   true if successful, false otherwise.
+static bool
+parse_setting(const std::string &data,
+              int min,
+              int max,
+              int *value)
+{
+    try
+    {
+        *value = boost::lexical_cast<int>(data);
+    }
+    catch (const boost::bad_lexical_cast &)
+    {
+        return false;
+    }
+
+    if (*value < min) *value = min;
+    if (*value > max) *value = max;
+
+    return true;
+}
+
+// Loads filter settings from a file.  Each line holds a command
+// of the command line interface, such as "EQEN 1", "EQM12 -30"
+// or "F1FN /filters/room.wav".  "F<n>RS <0 | 1>" enables resampling
+// of impulse file n.  Empty lines and lines starting with '#' are
+// ignored.
+//
+// Parameters:
+//   filename  the settings filename
+//   settings  returns the settings
+//
+// Returns:
+//   true if successful, false otherwise.
+static bool
+load_settings(const std::string &filename,
+              struct filter_settings *settings)
+{
+    std::ifstream in(filename.c_str());
+    std::string line;
+    int line_number = 0;
+
+    if (!in)
+    {
+        fprintf(stderr, "Could not open settings file %s.\n", filename.c_str());
+        return false;
+    }
+
+    while (std::getline(in, line))
+    {
+        std::string op, data;
+        size_t pos;
+        int val = 0, n = 0;
+        bool ok = true;
+
+        line_number++;
+        boost::trim(line);
+
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        pos = line.find_first_of(" \t");
+        op = boost::to_upper_copy(line.substr(0, pos));
+        data = (pos == std::string::npos) ? "" : boost::trim_copy(line.substr(pos));
+
+        if (boost::starts_with(op, "EQM"))
+        {
+            ok = parse_setting(op.substr(3), 0, BAND_COUNT - 1, &n) &&
+                 parse_setting(data, LEVEL_RANGE_MIN, LEVEL_RANGE_MAX, &val);
+
+            if (ok)
+            {
+                settings->eq_mag[n] = (double)val / LEVEL_STEPS_PER_DB;
+            }
+        }
+        else if (op == "EQEN")
+        {
+            ok = parse_setting(data, 0, 1, &val);
+            settings->eq_enable = (val != 0);
+        }
+        else if (op == "EQLV")
+        {
+            ok = parse_setting(data, LEVEL_RANGE_MIN, LEVEL_RANGE_MAX, &val);
+            settings->eq_scale = FROM_DB((double)val / LEVEL_STEPS_PER_DB);
+        }
+        else if (op.size() == 4 && op[0] == 'F' && op[1] >= '1' && op[1] < '1' + FILTER_FILE_COUNT)
+        {
+            struct filter_file_settings &file = settings->files[op[1] - '1'];
+            std::string setting = op.substr(2);
+
+            if (setting == "EN")
+            {
+                ok = parse_setting(data, 0, 1, &val);
+                file.enable = (val != 0);
+            }
+            else if (setting == "RS")
+            {
+                ok = parse_setting(data, 0, 1, &val);
+                file.resample = (val != 0);
+            }
+            else if (setting == "LV")
+            {
+                ok = parse_setting(data, LEVEL_RANGE_MIN, LEVEL_RANGE_MAX, &val);
+                file.scale = FROM_DB((double)val / LEVEL_STEPS_PER_DB);
+            }
+            else if (setting == "FN")
+            {
+                // "?" indicates no file
+                file.filename = (data == "?") ? L"" : util::str2wstr(data);
+                ok = !data.empty();
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s:%d: invalid setting \"%s\".\n",
+                    filename.c_str(), line_number, line.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Gets the filter for a format, building it the first time
+// the format is seen.  Building is serialized since workers
+// would otherwise generate the same files at once.
+//
+// Parameters:
+//   job            the render job
+//   n_channels     the number of channels
+//   sampling_rate  the sampling rate
+//   filter         returns the filter
+//
+// Returns:
+//   true if a filter is enabled for the format, false otherwise.
+static bool
+get_filter(struct render_job *job,
+           int n_channels,
+           int sampling_rate,
+           struct render_filter *filter)
+{
+    std::pair<int, int> key(n_channels, sampling_rate);
+    std::map<std::pair<int, int>, struct render_filter>::iterator it;
+
+    boost::lock_guard<boost::mutex> lock(job->filters_mutex);
+
+    it = job->filters.find(key);
+
+    if (it == job->filters.end())
+    {
+        struct render_filter f;
+        int file_channels, file_rate;
+
+        f.n_blocks = 0;
+        f.n_frames = 0;
+        f.filename = preprocessor::build_filter(job->settings,
+                                                FILTER_LEN,
+                                                EQ_FILTER_BLOCKS,
+                                                REALSIZE,
+                                                n_channels,
+                                                sampling_rate,
+                                                &f.scale);
+
+        if (!f.filename.empty() &&
+            buffer::get_snd_file_params(f.filename.c_str(),
+                                        &file_channels,
+                                        &f.n_frames,
+                                        &file_rate))
+        {
+            f.n_blocks = util::get_next_multiple(f.n_frames, FILTER_LEN) / FILTER_LEN;
+        }
+
+        it = job->filters.insert(std::make_pair(key, f)).first;
+    }
+
+    *filter = it->second;
+
+    return (filter->n_blocks > 0);
+}
+
+// Convolves a sound file, reading and writing a filter block
+// at a time.  The output has the format of the input.
+//
+// Parameters:
+//   job       the render job
+//   filename  the input filename
+//   engine    the engine of the worker, replaced if the format changes
+//   inbuf     a buffer of FILTER_LEN frames of BF_MAXCHANNELS floats
+//   outbuf    a buffer of FILTER_LEN frames of BF_MAXCHANNELS floats
+//
+// Returns:
+//   true if successful, false otherwise.
+static bool
+render_file(struct render_job *job,
+            const std::string &filename,
+            struct render_engine *engine,
+            float *inbuf,
+            float *outbuf)
+{
+    struct render_filter filter;
+    boost::filesystem::path out_path;
+    std::string out_filename;
+    SNDFILE *in_file, *out_file;
+    SF_INFO in_info, out_info;
+    sf_count_t frames, remaining, n_written = 0;
+    double start = metrics::get_time();
+    double seconds;
+    bool ok = true;
+
+    out_path = boost::filesystem::path(job->output_dir) /
+               boost::filesystem::path(filename).filename();
+    out_filename = out_path.string();
+
+    if (boost::filesystem::exists(out_path) &&
+        boost::filesystem::equivalent(out_path, boost::filesystem::path(filename)))
+    {
+        pinfo("%s: the output would replace the input.", filename.c_str());
+        return false;
+    }
+
+    in_info.format = 0;
+    in_file = buffer::open_snd_file(util::str2wstr(filename).c_str(), SFM_READ, &in_info);
+
+    if (in_file == NULL)
+    {
+        pinfo("%s: %s", filename.c_str(), sf_strerror(NULL));
+        return false;
+    }
+
+    if (in_info.channels > BF_MAXCHANNELS)
+    {
+        pinfo("%s: %d channels, at most %d are supported.",
+              filename.c_str(), in_info.channels, BF_MAXCHANNELS);
+        sf_close(in_file);
+        return false;
+    }
+
+    if (!get_filter(job, in_info.channels, in_info.samplerate, &filter))
+    {
+        pinfo("%s: no filter for %d channels at %d Hz.",
+              filename.c_str(), in_info.channels, in_info.samplerate);
+        sf_close(in_file);
+        return false;
+    }
+
+    // Engines are kept between files of the same format, so
+    // the FFTW plans and coefficients are only prepared once
+    // per format by each worker
+    if ((engine->filter == NULL) ||
+        (engine->n_channels != in_info.channels) ||
+        (engine->sampling_rate != in_info.samplerate) ||
+        (engine->filename != filter.filename))
+    {
+        delete engine->filter;
+
+        engine->filter = new brutefir(FILTER_LEN,
+                                      filter.n_blocks,
+                                      REALSIZE,
+                                      in_info.channels,
+                                      BF_SAMPLE_FORMAT_FLOAT_LE,
+                                      BF_SAMPLE_FORMAT_FLOAT_LE,
+                                      in_info.samplerate,
+                                      false,
+                                      POOL_PRIORITY_NORMAL);
+
+        engine->n_channels = in_info.channels;
+        engine->sampling_rate = in_info.samplerate;
+        engine->filename = filter.filename;
+
+        if ((engine->filter->set_coeff(filter.filename.c_str(), filter.n_blocks, filter.scale) < 0) ||
+            !engine->filter->is_initialized())
+        {
+            pinfo("%s: could not load the filter coefficients.", filename.c_str());
+            delete engine->filter;
+            engine->filter = NULL;
+            sf_close(in_file);
+            return false;
+        }
+    }
+    else
+    {
+        engine->filter->reset();
+    }
+
+    out_info = in_info;
+    out_file = buffer::open_snd_file(util::str2wstr(out_filename).c_str(), SFM_WRITE, &out_info);
+
+    if (out_file == NULL)
+    {
+        pinfo("%s: %s", out_filename.c_str(), sf_strerror(NULL));
+        sf_close(in_file);
+        return false;
+    }
+
+    // Integer formats are clipped rather than wrapped around
+    sf_command(out_file, SFC_SET_CLIPPING, NULL, SF_TRUE);
+
+    // The number of frames left to write is known once the
+    // end of the input is reached
+    remaining = -1;
+
+    while (remaining != 0)
+    {
+        frames = 0;
+
+        if (remaining < 0)
+        {
+            frames = sf_readf_float(in_file, inbuf, FILTER_LEN);
+
+            if (frames < FILTER_LEN)
+            {
+                remaining = frames + (job->tail ? filter.n_frames - 1 : 0);
+            }
+        }
+
+        memset(inbuf + frames * in_info.channels, 0,
+               (size_t)(FILTER_LEN - frames) * in_info.channels * sizeof(float));
+
+        if (engine->filter->run(inbuf, outbuf) != 0)
+        {
+            pinfo("%s: filter processing error.", filename.c_str());
+            ok = false;
+            break;
+        }
+
+        frames = FILTER_LEN;
+
+        if ((remaining >= 0) && (remaining < frames))
+        {
+            frames = remaining;
+        }
+
+        if (sf_writef_float(out_file, outbuf, frames) != frames)
+        {
+            pinfo("%s: %s", out_filename.c_str(), sf_strerror(out_file));
+            ok = false;
+            break;
+        }
+
+        n_written += frames;
+
+        if (remaining > 0)
+        {
+            remaining -= frames;
+        }
+    }
+
+    sf_close(out_file);
+    sf_close(in_file);
+
+    if (!ok)
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(out_path, ec);
+        return false;
+    }
+
+    seconds = metrics::get_time() - start;
+
+    pinfo("%s: %ld frames in %.2f s (%.1fx real time).",
+          filename.c_str(),
+          (long)n_written,
+          seconds,
+          (seconds > 0) ? ((double)n_written / in_info.samplerate) / seconds : 0.0);
+
+    return true;
+}
+
+// Renders files until none are left.
+//
+// Parameters:
+//   job  the render job
+static void
+render_worker(struct render_job *job)
+{
+    struct render_engine engine;
+    float *inbuf, *outbuf;
+    long n;
+
+    engine.filter = NULL;
+    engine.n_channels = 0;
+    engine.sampling_rate = 0;
+
+    inbuf = (float *) _aligned_malloc(FILTER_LEN * BF_MAXCHANNELS * sizeof(float), ALIGNMENT);
+    outbuf = (float *) _aligned_malloc(FILTER_LEN * BF_MAXCHANNELS * sizeof(float), ALIGNMENT);
+
+    while ((n = atomic_add(&job->next_file, 1) - 1) < (long)job->files.size())
+    {
+        if (!render_file(job, job->files[n], &engine, inbuf, outbuf))
+        {
+            atomic_add(&job->n_failed, 1);
+        }
+    }
+
+    delete engine.filter;
+
+    _aligned_free(outbuf);
+    _aligned_free(inbuf);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct render_job job;
+    std::string settings_filename;
+    std::string work_dir;
+    struct pool_group_t workers;
+    unsigned int n_workers = boost::thread::hardware_concurrency();
+    int n;
+
+    // File names are converted to wide characters with the
+    // encoding of the environment
+    setlocale(LC_ALL, "");
+
+    job.tail = false;
+    job.next_file = 0;
+    job.n_failed = 0;
+    job.settings.min_phase = false;
+    job.settings.trim = false;
+    job.settings.eq_enable = false;
+    job.settings.eq_scale = 1.0;
+
+    for (n = 0; n < BAND_COUNT; n++)
+    {
+        job.settings.eq_mag[n] = 0.0;
+    }
+
+    for (n = 0; n < FILTER_FILE_COUNT; n++)
+    {
+        job.settings.files[n].enable = false;
+        job.settings.files[n].resample = false;
+        job.settings.files[n].scale = 1.0;
+    }
+
+    for (n = 1; n < argc; n++)
+    {
+        std::string arg(argv[n]);
+
+        if ((arg == "-c" || arg == "-o" || arg == "-j" || arg == "-w") && (n + 1 >= argc))
+        {
+            print_usage();
+            return 2;
+        }
+
+        if (arg == "-c")
+        {
+            settings_filename = argv[++n];
+        }
+        else if (arg == "-o")
+        {
+            job.output_dir = argv[++n];
+        }
+        else if (arg == "-j")
+        {
+            int val;
+
+            if (!parse_setting(argv[++n], 1, 256, &val))
+            {
+                print_usage();
+                return 2;
+            }
+
+            n_workers = (unsigned int)val;
+        }
+        else if (arg == "-w")
+        {
+            work_dir = argv[++n];
+        }
+        else if (arg == "-t")
+        {
+            job.tail = true;
+        }
+        else if (arg == "-m")
+        {
+            job.settings.min_phase = true;
+        }
+        else if (arg == "-r")
+        {
+            job.settings.trim = true;
+        }
+        else if (!arg.empty() && arg[0] == '-')
+        {
+            print_usage();
+            return 2;
+        }
+        else
+        {
+            job.files.push_back(arg);
+        }
+    }
+
+    if (job.output_dir.empty() || job.files.empty())
+    {
+        print_usage();
+        return 2;
+    }
+
+    if (!settings_filename.empty() && !load_settings(settings_filename, &job.settings))
+    {
+        return 2;
+    }
+
+    try
+    {
+        boost::filesystem::create_directories(job.output_dir);
+    }
+    catch (const boost::filesystem::filesystem_error &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+
+    if (n_workers == 0)
+    {
+        n_workers = 1;
+    }
+
+    if (n_workers > job.files.size())
+    {
+        n_workers = (unsigned int)job.files.size();
+    }
+
+    set_print_callback(&print_message);
+
+    // Generated filters are cached between runs
+    bfir_path::set_path(util::str2wstr(work_dir));
+    cache::load();
+
+    // Files are rendered as background tasks of the shared thread
+    // pool, so the blocks of the engines run first
+    thread_pool::init_group(&workers, POOL_PRIORITY_BACKGROUND);
+
+    for (unsigned int i = 0; i < n_workers; i++)
+    {
+        thread_pool::submit(&workers, boost::bind(&render_worker, &job));
+    }
+
+    thread_pool::wait(&workers);
+    thread_pool::shutdown();
+
+    cache::save();
+
+    fprintf(stderr, "%d of %d files rendered.\n",
+            (int)(job.files.size() - job.n_failed), (int)job.files.size());
+
+    return (job.n_failed == 0) ? 0 : 1;
+}
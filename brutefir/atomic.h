@@ -0,0 +1,104 @@
+#ifdef __cplusplus
+extern "C" {
+#endif 
+
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+#pragma intrinsic(_InterlockedExchange)
+#pragma intrinsic(_InterlockedExchangeAdd)
+#pragma intrinsic(_InterlockedCompareExchange)
+#pragma intrinsic(_ReadWriteBarrier)
+#endif
+
+/*
+ * Loads a value published by another thread. Reads made after
+ * the load will not be reordered before it (acquire).
+ */
+static inline long
+atomic_load(volatile long *p)
+{
+#if defined(_MSC_VER)
+    long value = *p;
+    _ReadWriteBarrier();
+    return value;
+#else
+    /* a plain load, a locked add would write the cache line */
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+ * Publishes a value to other threads. Writes made before the
+ * store will be visible to a thread that loads the value (release).
+ */
+static inline void
+atomic_store(volatile long *p,
+             long value)
+{
+#if defined(_MSC_VER)
+    _InterlockedExchange(p, value);
+#else
+    __sync_synchronize();
+    *p = value;
+    __sync_synchronize();
+#endif
+}
+
+/*
+ * Keeps memory accesses from being reordered across this point.
+ */
+static inline void
+atomic_fence(void)
+{
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+/*
+ * Adds to a value and returns the result.
+ */
+static inline long
+atomic_add(volatile long *p,
+           long value)
+{
+#if defined(_MSC_VER)
+    return _InterlockedExchangeAdd(p, value) + value;
+#else
+    return __sync_add_and_fetch(p, value);
+#endif
+}
+
+/*
+ * Replaces the value with exchange if it equals comparand.
+ * Returns the initial value.
+ */
+static inline long
+atomic_cas(volatile long *p,
+           long exchange,
+           long comparand)
+{
+#if defined(_MSC_VER)
+    return _InterlockedCompareExchange(p, exchange, comparand);
+#else
+    return __sync_val_compare_and_swap(p, comparand, exchange);
+#endif
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif 
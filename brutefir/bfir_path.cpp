@@ -11,6 +11,7 @@
 
 #include "bfir_path.hpp"
 #include "defs.h"
+#include "util.hpp"
 
 namespace bfir_path
 {
@@ -25,7 +26,7 @@ namespace bfir_path
     tilde_expansion(const std::wstring path)
     {
         std::wstring full_path;
-        wchar_t *home_dir = NULL;
+        std::wstring home_dir;
         size_t tilde_pos;
         size_t slash_pos;
 
@@ -35,10 +36,24 @@ namespace bfir_path
             return path;
         }
 
-        home_dir = _wgetenv(L"USERPROFILE");
+#if defined(_WIN32)
+        const wchar_t *env = _wgetenv(L"USERPROFILE");
+
+        if (env != NULL)
+        {
+            home_dir.assign(env);
+        }
+#else
+        const char *env = getenv("HOME");
+
+        if (env != NULL)
+        {
+            home_dir = util::str2wstr(env);
+        }
+#endif
 
         // return path if no home directory
-        if (home_dir == NULL)
+        if (home_dir.empty())
         {
             return path;
         }
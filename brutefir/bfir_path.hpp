@@ -12,7 +12,7 @@
 
 namespace bfir_path
 {
-    const std::wstring default_file_path = L"~\\brutefir";
+    const std::wstring default_file_path = L"~" PATH_SEPARATOR_STR L"brutefir";
     static std::wstring app_file_path = L"";
 
     std::wstring
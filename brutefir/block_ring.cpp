@@ -0,0 +1,115 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#include <string.h>
+
+#include "global.h"
+#include "block_ring.hpp"
+#include "atomic.h"
+
+// Constructor for the class.  One slot more than the capacity is
+// allocated, so that a full ring can be told from an empty one.
+//
+// Parameters:
+//   n_blocks    the number of blocks the ring can hold
+//   block_size  the size of a block in bytes
+block_ring::block_ring(int n_blocks,
+                       size_t block_size)
+    : m_n_slots(n_blocks + 1), m_block_size(block_size), m_head(0), m_tail(0)
+{
+    // keep every block aligned for the conversion kernels
+    m_block_size = (m_block_size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+
+    m_data = (uint8_t *)_aligned_malloc(m_n_slots * m_block_size, ALIGNMENT);
+    memset(m_data, 0, m_n_slots * m_block_size);
+}
+
+// Destructor for the class.
+block_ring::~block_ring()
+{
+    _aligned_free(m_data);
+}
+
+// Gets the block to fill next.  Called by the producer.
+//
+// Returns:
+//   The block, or NULL if the ring is full.
+void *
+block_ring::write_block()
+{
+    long head = m_head;
+    long next = (head + 1) % m_n_slots;
+
+    if (next == atomic_load(&m_tail))
+    {
+        return NULL;
+    }
+
+    return m_data + head * m_block_size;
+}
+
+// Passes the block returned by write_block to the consumer.
+void
+block_ring::commit_write()
+{
+    atomic_store(&m_head, (m_head + 1) % m_n_slots);
+}
+
+// Gets the oldest block written.  Called by the consumer.
+//
+// Returns:
+//   The block, or NULL if the ring is empty.
+void *
+block_ring::read_block()
+{
+    long tail = m_tail;
+
+    if (tail == atomic_load(&m_head))
+    {
+        return NULL;
+    }
+
+    return m_data + tail * m_block_size;
+}
+
+// Returns the block returned by read_block to the producer.
+void
+block_ring::commit_read()
+{
+    atomic_store(&m_tail, (m_tail + 1) % m_n_slots);
+}
+
+// Gets the number of blocks written and not yet read.  May be
+// called from either thread.
+//
+// Returns:
+//   The number of blocks.
+int
+block_ring::get_count()
+{
+    long head = atomic_load(&m_head);
+    long tail = atomic_load(&m_tail);
+
+    return (int)((head - tail + m_n_slots) % m_n_slots);
+}
+
+// Gets the number of blocks the ring can hold.
+//
+// Returns:
+//   The number of blocks.
+int
+block_ring::get_capacity()
+{
+    return m_n_slots - 1;
+}
+
+// Empties the ring.  Neither thread may use it meanwhile.
+void
+block_ring::reset()
+{
+    atomic_store(&m_head, 0);
+    atomic_store(&m_tail, 0);
+}
@@ -0,0 +1,58 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _BLOCK_RING_HPP_
+#define _BLOCK_RING_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A ring of fixed size blocks passed from one producer thread to
+// one consumer thread without locks.  The producer fills the block
+// returned by write_block and commits it, the consumer reads the
+// block returned by read_block and releases it.
+class block_ring
+{
+public:
+    block_ring(int n_blocks,
+               size_t block_size);
+    ~block_ring();
+
+    void *
+    write_block();
+
+    void
+    commit_write();
+
+    void *
+    read_block();
+
+    void
+    commit_read();
+
+    int
+    get_count();
+
+    int
+    get_capacity();
+
+    void
+    reset();
+
+private:
+    int m_n_slots;
+    size_t m_block_size;
+    uint8_t *m_data;
+
+    // written only by the producer and the consumer respectively,
+    // kept on separate cache lines
+    volatile long m_head;
+    char m_pad1[64];
+    volatile long m_tail;
+    char m_pad2[64];
+};
+
+#endif
@@ -5,19 +5,40 @@
  * This program is open source. For license terms, see the LICENSE file.
  *
  */
-#include <malloc.h>
 #include <string.h>
 #include <float.h>
+#include <math.h>
+#include <boost/bind.hpp>
 
 #include "global.h"
 #include "brutefir.hpp"
 #include "fftw_convolver.hpp"
 #include "dither.hpp"
+#include "delay.hpp"
 #include "coeff.hpp"
+#include "coeff_store.hpp"
 #include "buffer.hpp"
+#include "mapped_file.hpp"
+#include "simd.hpp"
+#include "metrics.hpp"
+#include "thread_pool.hpp"
+#include "atomic.h"
+#include "timestamp.h"
 #include "pinfo.h"
 
-// Constructor for the class.
+// subsample delay filter, delays are set in 1/100 samples
+#define SUBDELAY_STEP_COUNT    100
+#define SUBDELAY_HALF_LENGTH   32
+#define SUBDELAY_KAISER_BETA   9.0
+
+// blocks are processed on the thread pool from this many filter
+// blocks in all channels, in ranges of at least RANGE_MIN_BLOCKS
+#define PARALLEL_MIN_BLOCKS    16
+#define RANGE_MIN_BLOCKS       16
+
+// Constructor for the class.  The channels of a block are run as
+// thread pool tasks of the given priority, POOL_PRIORITY_REALTIME
+// only for a filter that plays back.
 brutefir::brutefir(int filter_length,
                    int filter_blocks,
                    int realsize,
@@ -25,9 +46,20 @@ brutefir::brutefir(int filter_length,
                    int in_format,
                    int out_format,
                    int sampling_rate,
-                   bool apply_dither)
-    : m_initialized(false), bfconf(NULL), baseptr(NULL), m_convolver(NULL), m_dither(NULL)
+                   bool apply_dither,
+                   int priority)
+    : m_initialized(false), m_coeff_set(NULL), m_ready_blocks(m_own_ready_blocks),
+      m_convolver(NULL), m_dither(NULL), m_delay(NULL), m_delay_enabled(false),
+      m_subdelay_ready(false), bfconf(NULL), basesize(0), baseptr(NULL)
 {
+    memset((void *)m_own_ready_blocks, 0, BF_MAXCHANNELS * sizeof(long));
+    memset(stage_cycles, 0, METRICS_STAGE_COUNT * sizeof(uint64_t));
+    memset(delays, 0, BF_MAXCHANNELS * sizeof(struct bfdelay_t));
+    memset(tasks, 0, BF_MAXCHANNELS * BF_MAXRANGES * sizeof(struct bftask_t));
+    max_ranges = 1;
+
+    thread_pool::init_group(&m_group, priority);
+
     bfconf = (struct bfconf_t *) malloc(sizeof(struct bfconf_t));
     memset(bfconf, 0, sizeof(struct bfconf_t));
 
@@ -50,6 +82,7 @@ brutefir::~brutefir()
     free_coeff();
 
     // free objects
+    delete m_delay;
     delete m_convolver;
     delete m_dither;
 
@@ -63,18 +96,38 @@ brutefir::~brutefir()
 
 // Returns a value indicating whether the filter is initialized.
 //
+// When coefficients are loaded in the background, the filter is
+// initialized as soon as the first block of every channel is ready.
+//
 // Returns:
 //   True if initialized, false otherwise.
 bool
 brutefir::is_initialized()
 {
-    return m_initialized;
+    int n;
+
+    if (!m_initialized)
+    {
+        return false;
+    }
+
+    for (n = 0; n < bfconf->n_channels; n++)
+    {
+        if (atomic_load(&m_ready_blocks[n]) == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 // Sets coefficients from the specified sound file.
 //
 // Supported formats are any that the libsndfile library
-// can process.
+// can process.  Coefficients of uncompressed files are shared
+// with all engines using the same file, block size, precision
+// and scale.
 //
 // Parameters:
 //   filename      the coefficient filename
@@ -94,6 +147,61 @@ brutefir::set_coeff(const wchar_t *filename,
     int n_coeffs;
     int length;
     void **coeffs;
+    uint64_t key;
+    bool created;
+    mapped_file mapping;
+    struct mapped_coeff_t mc;
+
+    // uncompressed files are converted straight from a mapping into
+    // the coefficient blocks without an intermediate copy
+    if (mapping.open(filename) && coeff::map_snd_coeff(&mapping, &mc))
+    {
+        if ((mc.n_channels != bfconf->n_channels) ||
+            (mc.sampling_rate != bfconf->sampling_rate))
+        {
+            pinfo("Incompatible file %s: format %u channels %u Hz.",
+                  filename,
+                  bfconf->n_channels,
+                  bfconf->sampling_rate);
+
+            return -1;
+        }
+
+        free_coeff();
+
+        if (!coeff_store::get_key(filename,
+                                  bfconf->filter_length,
+                                  bfconf->realsize,
+                                  coeff_blocks,
+                                  scale,
+                                  &key))
+        {
+            pinfo("Error loading coefficients from sound file %s.", filename);
+            return -2;
+        }
+
+        use_coeff_set(coeff_store::acquire(key,
+                                           mc.n_channels,
+                                           coeff_blocks,
+                                           bfconf->filter_length,
+                                           bfconf->realsize,
+                                           &created));
+
+        // the engine that created the set transforms the blocks,
+        // the others wait for it
+        if (created ? !coeff_store::load(m_coeff_set, m_convolver, mc, scale)
+                    : !coeff_store::wait(m_coeff_set))
+        {
+            pinfo("Error preprocessing coefficients from sound file %s.", filename);
+            free_coeff();
+            return -2;
+        }
+
+        m_initialized = true;
+        return mc.n_channels;
+    }
+
+    mapping.close();
 
     // check compatibility of sound file
     if (!buffer::check_snd_file(filename, bfconf->n_channels, bfconf->sampling_rate))
@@ -151,6 +259,8 @@ brutefir::set_coeff(const wchar_t *filename,
         bfconf->coeffs[n].intname = n;
         bfconf->coeffs[n].n_channels = 1;
         bfconf->coeffs[n].channels[0] = n;
+
+        atomic_store(&m_ready_blocks[n], coeff_blocks);
     }
 
     if (n < n_coeffs)
@@ -164,6 +274,97 @@ brutefir::set_coeff(const wchar_t *filename,
     return n_coeffs;
 }
 
+// Sets coefficients from the specified sound file, transforming
+// the filter blocks on a background thread.
+//
+// Blocks are processed in order and each one is used by the run
+// loop as soon as it is ready, so filtering starts once the first
+// block of every channel has been transformed regardless of the
+// filter length. Files which cannot be mapped into memory are
+// loaded synchronously.
+//
+// The blocks are shared like those of set_coeff, an engine using
+// a file that is already loading uses the blocks as they become
+// ready.
+//
+// Parameters:
+//   filename      the coefficient filename
+//   coeff_blocks  the number of coefficient blocks
+//   scale         the scaling factor
+//
+// Returns:
+//   the number of channels extracted
+//    -1 if incompatible file
+//    -2 if coefficients could not be loaded
+int
+brutefir::set_coeff_async(const wchar_t *filename,
+                          int coeff_blocks,
+                          double scale)
+{
+    uint64_t key;
+    bool created;
+    mapped_file *mapping;
+    struct mapped_coeff_t mc;
+
+    mapping = new mapped_file();
+
+    if (!mapping->open(filename) || !coeff::map_snd_coeff(mapping, &mc))
+    {
+        delete mapping;
+        return set_coeff(filename, coeff_blocks, scale);
+    }
+
+    if ((mc.n_channels != bfconf->n_channels) ||
+        (mc.sampling_rate != bfconf->sampling_rate))
+    {
+        pinfo("Incompatible file %s: format %u channels %u Hz.",
+              filename,
+              bfconf->n_channels,
+              bfconf->sampling_rate);
+
+        delete mapping;
+        return -1;
+    }
+
+    // free existing coefficient memory
+    free_coeff();
+
+    if (!coeff_store::get_key(filename,
+                              bfconf->filter_length,
+                              bfconf->realsize,
+                              coeff_blocks,
+                              scale,
+                              &key))
+    {
+        pinfo("Error loading coefficients from sound file %s.", filename);
+
+        delete mapping;
+        return -2;
+    }
+
+    use_coeff_set(coeff_store::acquire(key,
+                                       mc.n_channels,
+                                       coeff_blocks,
+                                       bfconf->filter_length,
+                                       bfconf->realsize,
+                                       &created));
+
+    // the loader of the store takes ownership of the mapping, an
+    // existing set is already loaded or loading
+    if (created)
+    {
+        coeff_store::load_async(m_coeff_set, mapping, mc, scale);
+    }
+    else
+    {
+        delete mapping;
+    }
+
+    m_initialized = true;
+
+    return mc.n_channels;
+}
+
 // Overload function to set coefficients from the given data array.
 //
 // Parameters:
@@ -214,6 +415,8 @@ brutefir::set_coeff(void **coeffs,
         bfconf->coeffs[n].intname = n;
         bfconf->coeffs[n].n_channels = 1;
         bfconf->coeffs[n].channels[0] = n;
+
+        atomic_store(&m_ready_blocks[n], coeff_blocks);
     }
 
     if (n < n_coeffs)
@@ -234,6 +437,10 @@ brutefir::set_coeff(void **coeffs,
 // Input and output buffers must be of the size specified
 // in the constructor.
 //
+// When there are enough filter blocks, the channels and ranges of
+// their filter blocks are processed in parallel on the thread pool
+// as real time tasks.
+//
 // Parameters:
 //   inbuf   the input buffer
 //   outbuf  the output buffer
@@ -245,93 +452,101 @@ int
 brutefir::run(void *inbuf,
               void *outbuf)
 {
-    int n, i;
-    int convblock;
-    struct bfoverflow_t of;
+    int n, r, i;
+    int fdl_blocks;
+    int count, total;
+    bool parallel, failed;
+    struct bftask_t *task;
 
-    for (n = 0; n < bfconf->n_channels; n++)
-    {
-        // convert inputs
-        m_convolver->convolver_raw2cbuf(inbuf,
-                                        input_timecbuf[n][curbuf],
-                                        input_timecbuf[n][!curbuf],
-                                        &bfconf->inputs[n].bf,
-                                        NULL,
-                                        NULL);
+    memset(stage_cycles, 0, METRICS_STAGE_COUNT * sizeof(uint64_t));
 
-        // transform to frequency domain
-        m_convolver->convolver_time2freq(input_timecbuf[n][curbuf], input_freqcbuf[n]);
+    fdl_blocks = bfconf->n_blocks + bfconf->n_delay_blocks;
+    curblock = (int)(blockcounter % (unsigned int)fdl_blocks);
+    total = 0;
 
-        if (procblocks[n] < bfconf->n_blocks)
+    // split the filter blocks to convolve into ranges
+    for (n = 0; n < bfconf->n_channels; n++)
+    {
+        if (procblocks[n] < fdl_blocks)
         {
             procblocks[n]++;
         }
 
-        curblock = (int)(blockcounter % (unsigned int)bfconf->n_blocks);
+        count = (fdl_blocks == 1) ? 1 : get_active_blocks(n);
+        total += count;
 
-        // mix and scale inputs prior to convolution
-        m_convolver->convolver_mixnscale(&input_freqcbuf[n],
-                                         cbuf[n][curblock],
-                                         &bfconf->inputs[n].bf.sf.scale,
-                                         1,
-                                         CONVOLVER_MIXMODE_INPUT);
+        n_ranges[n] = count / RANGE_MIN_BLOCKS;
 
-        if (bfconf->n_blocks == 1)
+        if (n_ranges[n] > max_ranges)
         {
-            // curblock is always zero and cbuf points at ocbuf when n_blocks == 1
-            m_convolver->convolver_convolve_inplace(cbuf[n][0],
-                                                    bfconf->coeffs[n].data[0]);
+            n_ranges[n] = max_ranges;
         }
-        else
-        {
-            // run convolver
-            m_convolver->convolver_convolve(cbuf[n][curblock],
-                                            bfconf->coeffs[n].data[0],
-                                            ocbuf[n]);
 
-            for (i = 1; i < bfconf->coeffs[n].n_blocks && i < procblocks[n]; i++)
-            {
-                convblock = (int)((blockcounter - i) % (unsigned int)bfconf->n_blocks);
+        if (n_ranges[n] < 1)
+        {
+            n_ranges[n] = 1;
+        }
 
-                m_convolver->convolver_convolve_add(cbuf[n][convblock],
-                                                    bfconf->coeffs[n].data[i],
-                                                    ocbuf[n]);
-            }
+        for (r = 0; r < n_ranges[n]; r++)
+        {
+            task = &tasks[n][r];
+
+            task->first_block = (int)((int64_t)count * r / n_ranges[n]);
+            task->end_block = (int)((int64_t)count * (r + 1) / n_ranges[n]);
+            task->inbuf = inbuf;
+            task->outbuf = outbuf;
+            task->failed = false;
+            memset(task->cycles, 0, METRICS_STAGE_COUNT * sizeof(uint64_t));
         }
 
-        // mix and scale convolve outputs prior to conversion to time domain.
-        m_convolver->convolver_mixnscale(&ocbuf[n],
-                                         output_freqcbuf[n],
-                                         &bfconf->outputs[n].bf.sf.scale,
-                                         1,
-                                         CONVOLVER_MIXMODE_OUTPUT);
+        pending_ranges[n] = n_ranges[n];
+    }
 
-        // transform back to time domain
-        // ocbuf[0] happens to be free, that's why we use it
-        m_convolver->convolver_freq2time(output_freqcbuf[n], ocbuf[0]);
+    // short filters take less time than waking the workers
+    parallel = (total >= PARALLEL_MIN_BLOCKS) &&
+               ((bfconf->n_channels > 1) || (n_ranges[0] > 1)) &&
+               (thread_pool::get_worker_count() > 1);
 
-        // Check if there is NaN or Inf values, and abort if so. We cannot
-        // afford to check all values, but NaN/Inf tend to spread, so
-        // checking only one value usually catches the problem.
-        if ((bfconf->realsize == sizeof(float) && !_finite((double)((float *) ocbuf[0])[0])) ||
-            (bfconf->realsize == sizeof(double) && !_finite(((double *) ocbuf[0])[0])))
+    for (n = 0; n < bfconf->n_channels; n++)
+    {
+        for (r = 0; r < n_ranges[n]; r++)
         {
-            pinfo("NaN or Inf values in the system! Invalid input? Aborting.\n");
-            return -1;
+            if (parallel)
+            {
+                thread_pool::submit(&m_group, boost::bind(&brutefir::run_task, &tasks[n][r]));
+            }
+            else
+            {
+                run_task(&tasks[n][r]);
+            }
         }
+    }
+
+    if (parallel)
+    {
+        thread_pool::wait(&m_group);
+    }
 
-        // write to output buffer
-        of = overflow[n];
+    failed = false;
 
-        m_convolver->convolver_cbuf2raw(ocbuf[0],
-                                        outbuf,
-                                        &bfconf->outputs[n].bf,
-                                        bfconf->outputs[n].apply_dither,
-                                        &bfconf->dither_state[n],
-                                        &of);
+    for (n = 0; n < bfconf->n_channels; n++)
+    {
+        for (r = 0; r < n_ranges[n]; r++)
+        {
+            for (i = 0; i < METRICS_STAGE_COUNT; i++)
+            {
+                stage_cycles[i] += tasks[n][r].cycles[i];
+            }
+
+            failed = failed || tasks[n][r].failed;
+        }
+    }
 
-        overflow[n] = of;
-   }
+    if (failed)
+    {
+        pinfo("NaN or Inf values in the system! Invalid input? Aborting.\n");
+        return -1;
+    }
 
     // swap convolve buffers
     curbuf = !curbuf;
@@ -342,12 +557,195 @@ brutefir::run(void *inbuf,
     return 0;
 }
 
-// Resets the filter state.
+// Runs a part of the processing of a block.  The part that
+// finishes last for its channel also writes the output.
+//
+// Parameters:
+//   task  the part
+void
+brutefir::run_task(struct bftask_t *task)
+{
+    brutefir *owner = task->owner;
+
+    if (task->range == 0)
+    {
+        owner->process_input(task);
+    }
+
+    owner->convolve_range(task);
+
+    if (atomic_add(&owner->pending_ranges[task->channel], -1) == 0)
+    {
+        owner->process_output(task);
+    }
+}
+
+// Converts the input of a channel, shifting it by delays shorter
+// than a block, and mixes its transform into the input history.
+//
+// Parameters:
+//   task  the first part of the channel
+void
+brutefir::process_input(struct bftask_t *task)
+{
+    int n = task->channel;
+    volatile uint64_t ts;
+
+    timestamp(&ts);
+
+    // convert inputs, shifting them by delays shorter than a block
+    m_convolver->convolver_raw2cbuf(task->inbuf,
+                                    input_timecbuf[n][curbuf],
+                                    input_timecbuf[n][!curbuf],
+                                    &bfconf->inputs[n].bf,
+                                    m_delay_enabled ? &brutefir::delay_input : NULL,
+                                    &delays[n]);
+
+    add_stage_cycles(task->cycles, METRICS_STAGE_INPUT, &ts);
+
+    // transform to frequency domain
+    m_convolver->convolver_time2freq(input_timecbuf[n][curbuf], input_freqcbuf[n]);
+
+    add_stage_cycles(task->cycles, METRICS_STAGE_FFT, &ts);
+
+    // mix and scale inputs prior to convolution
+    m_convolver->convolver_mixnscale(&input_freqcbuf[n],
+                                     cbuf[n][curblock],
+                                     &bfconf->inputs[n].bf.sf.scale,
+                                     1,
+                                     CONVOLVER_MIXMODE_INPUT);
+
+    add_stage_cycles(task->cycles, METRICS_STAGE_MIX, &ts);
+}
+
+// Convolves a range of filter blocks with the input blocks they
+// apply to.  Only the first range uses the current input block, the
+// others only read older blocks and may run alongside the input.
+//
+// Parameters:
+//   task  the part
+void
+brutefir::convolve_range(struct bftask_t *task)
+{
+    int n = task->channel;
+    int i, convblock;
+    int fdl_blocks = bfconf->n_blocks + bfconf->n_delay_blocks;
+    void *outcbuf = rangecbuf[n][task->range];
+    volatile uint64_t ts;
+
+    timestamp(&ts);
+
+    if (fdl_blocks == 1)
+    {
+        // curblock is always zero and cbuf points at ocbuf when fdl_blocks == 1
+        m_convolver->convolver_convolve_inplace(cbuf[n][0],
+                                                bfconf->coeffs[n].data[0]);
+    }
+    else if (task->first_block == task->end_block)
+    {
+        // no blocks are loaded or the delayed input has not arrived yet
+        memset(outcbuf, 0, convbufsize);
+    }
+    else
+    {
+        // whole blocks of delay are taken from older input blocks
+        for (i = task->first_block; i < task->end_block; i++)
+        {
+            convblock = (int)((blockcounter - i - delays[n].blocks) % (unsigned int)fdl_blocks);
+
+            if (i == task->first_block)
+            {
+                m_convolver->convolver_convolve(cbuf[n][convblock],
+                                                bfconf->coeffs[n].data[i],
+                                                outcbuf);
+            }
+            else
+            {
+                m_convolver->convolver_convolve_add(cbuf[n][convblock],
+                                                    bfconf->coeffs[n].data[i],
+                                                    outcbuf);
+            }
+        }
+    }
+
+    add_stage_cycles(task->cycles, METRICS_STAGE_MAC, &ts);
+}
+
+// Sums the ranges of a channel, transforms the sum back to the
+// time domain and writes it to the output buffer.
+//
+// Parameters:
+//   task  the part that finished last
+void
+brutefir::process_output(struct bftask_t *task)
+{
+    int n = task->channel;
+    int r;
+    double scales[BF_MAXRANGES];
+    struct bfoverflow_t of;
+    struct bfscan_t scan;
+    volatile uint64_t ts;
+
+    timestamp(&ts);
+
+    for (r = 0; r < n_ranges[n]; r++)
+    {
+        scales[r] = bfconf->outputs[n].bf.sf.scale;
+    }
+
+    // mix and scale convolve outputs prior to conversion to time domain.
+    m_convolver->convolver_mixnscale(rangecbuf[n],
+                                     output_freqcbuf[n],
+                                     scales,
+                                     n_ranges[n],
+                                     CONVOLVER_MIXMODE_OUTPUT);
+
+    add_stage_cycles(task->cycles, METRICS_STAGE_MIX, &ts);
+
+    // transform back to time domain
+    // ocbuf[n] is no longer needed, that's why we use it
+    m_convolver->convolver_freq2time(output_freqcbuf[n], ocbuf[n]);
+
+    add_stage_cycles(task->cycles, METRICS_STAGE_IFFT, &ts);
+
+    // Check the whole block for NaN or Inf values, and abort if
+    // there are any. The same pass measures peak and clipping.
+    scan_output(n, ocbuf[n], &scan);
+    update_levels(n, &scan);
+
+    if (scan.n_nonfinite > 0)
+    {
+        task->failed = true;
+        return;
+    }
+
+    // write to output buffer
+    of = overflow[n];
+
+    m_convolver->convolver_cbuf2raw(ocbuf[n],
+                                    task->outbuf,
+                                    &bfconf->outputs[n].bf,
+                                    bfconf->outputs[n].apply_dither,
+                                    &bfconf->dither_state[n],
+                                    &of);
+
+    overflow[n] = of;
+
+    add_stage_cycles(task->cycles, METRICS_STAGE_OUTPUT, &ts);
+}
+
+// Resets the filter state.  Audio held in the convolution
+// buffers is discarded, so the next block starts from silence.
 void
 brutefir::reset()
 {
     int n;
 
+    if (baseptr != NULL)
+    {
+        memset(baseptr, 0, basesize);
+    }
+
     for (n = 0; n < bfconf->n_channels; n++)
     {
         overflow[n].n_overflows = 0;
@@ -357,9 +755,26 @@ brutefir::reset()
         last_overflow[n].n_overflows = 0;
         last_overflow[n].largest = 0;
         last_overflow[n].intlargest = 0;
+
+        atomic_store(&meters[n].n_blocks, 0);
+        atomic_store(&meters[n].n_nonfinite, 0);
+        atomic_store(&meters[n].n_clipped, 0);
+        atomic_store(&meters[n].peak, 0);
+        atomic_store(&meters[n].held_peak, 0);
+
+        if (delays[n].db != NULL)
+        {
+            m_delay->clear_buffer(delays[n].db, bfconf->realsize);
+        }
+
+        if (delays[n].subrest != NULL)
+        {
+            memset(delays[n].subrest, 0, m_delay->subsample_filterblocksize() * bfconf->realsize);
+        }
     }
 
     memset(procblocks, 0, BF_MAXCHANNELS * sizeof(int));
+    memset(stage_cycles, 0, METRICS_STAGE_COUNT * sizeof(uint64_t));
 
     curbuf = 0;
     curblock = 0;
@@ -387,6 +802,401 @@ brutefir::check_overflows()
     }
 }
 
+// Gets the output levels of a channel. May be called from any thread.
+//
+// Parameters:
+//   channel  the output channel
+//   levels   the levels, overwritten on return
+//
+// Returns:
+//   True on success, false if the channel does not exist.
+bool
+brutefir::get_levels(int channel,
+                     struct bflevels_t *levels)
+{
+    int32_t bits;
+    float peak;
+
+    if (channel < 0 || channel >= bfconf->n_channels)
+    {
+        return false;
+    }
+
+    levels->n_blocks = (unsigned int)atomic_load(&meters[channel].n_blocks);
+    levels->n_nonfinite = (unsigned int)atomic_load(&meters[channel].n_nonfinite);
+    levels->n_clipped = (unsigned int)atomic_load(&meters[channel].n_clipped);
+
+    bits = (int32_t)atomic_load(&meters[channel].peak);
+    memcpy(&peak, &bits, sizeof(float));
+    levels->peak = peak;
+
+    bits = (int32_t)atomic_load(&meters[channel].held_peak);
+    memcpy(&peak, &bits, sizeof(float));
+    levels->held_peak = peak;
+
+    return true;
+}
+
+// Charges the cycles since the last time stamp to a processing
+// stage and takes a new time stamp.
+//
+// Parameters:
+//   cycles  the cycles of each stage
+//   stage   the processing stage, one of METRICS_STAGE_*
+//   ts      the last time stamp, updated on return
+void
+brutefir::add_stage_cycles(uint64_t *cycles,
+                           int stage,
+                           volatile uint64_t *ts)
+{
+    volatile uint64_t now;
+
+    timestamp(&now);
+    cycles[stage] += now - *ts;
+    *ts = now;
+}
+
+// Gets the time stamp counter cycles spent in each processing
+// stage by the last run, summed over the threads that ran it.
+//
+// Parameters:
+//   cycles  the cycles, METRICS_STAGE_COUNT values overwritten on return
+void
+brutefir::get_stage_cycles(uint64_t *cycles)
+{
+    memcpy(cycles, stage_cycles, METRICS_STAGE_COUNT * sizeof(uint64_t));
+}
+
+// Gets the number of filter blocks currently convolved for a
+// channel, which grows while blocks are loaded and the input
+// history fills.
+//
+// Parameters:
+//   channel  the channel
+//
+// Returns:
+//   The number of active blocks.
+int
+brutefir::get_active_blocks(int channel)
+{
+    int ready, filled;
+
+    if (channel < 0 || channel >= bfconf->n_channels)
+    {
+        return 0;
+    }
+
+    ready = (int)atomic_load(&m_ready_blocks[channel]);
+
+    // input blocks older than the delay
+    filled = procblocks[channel] - delays[channel].blocks;
+
+    if (filled < 0)
+    {
+        filled = 0;
+    }
+
+    return (ready < filled) ? ready : filled;
+}
+
+// Gets the delay common to all channels, the shortest of the
+// channel delays as applied.  A channel filtered by the subsample
+// filter is further delayed by its half length.
+//
+// Returns:
+//   The delay in seconds.
+double
+brutefir::get_common_delay()
+{
+    double delay, common = 0.0;
+    int n;
+
+    for (n = 0; n < bfconf->n_channels; n++)
+    {
+        delay = (double)delays[n].blocks * bfconf->filter_length + delays[n].samples;
+
+        if (delays[n].substep > 0)
+        {
+            delay += SUBDELAY_HALF_LENGTH + (double)delays[n].substep / SUBDELAY_STEP_COUNT;
+        }
+
+        if (n == 0 || delay < common)
+        {
+            common = delay;
+        }
+    }
+
+    return common / bfconf->sampling_rate;
+}
+
+// Sets the thread pool priority of the tasks of the filter, as
+// given to the constructor.  Must not be called while the filter
+// is running.
+//
+// Parameters:
+//   priority  the priority, POOL_PRIORITY_REALTIME only for a
+//             filter that plays back
+void
+brutefir::set_priority(int priority)
+{
+    m_group.priority = priority;
+}
+
+// Sets the alignment delay of a channel.  The delay takes effect
+// with the next block; audio held by a shorter delay is discarded.
+// Must not be called while the filter is running.
+//
+// Parameters:
+//   channel  the channel
+//   delay    the delay in samples, up to BF_MAXDELAY_SECONDS
+//
+// Returns:
+//    0 if successful
+//   -1 if the channel is invalid
+int
+brutefir::set_delay(int channel,
+                    double delay)
+{
+    double max_delay = floor(BF_MAXDELAY_SECONDS * bfconf->sampling_rate);
+
+    if (channel < 0 || channel >= bfconf->n_channels || m_delay == NULL)
+    {
+        return -1;
+    }
+
+    if (!(delay > 0.0))
+    {
+        delay = 0.0;
+    }
+
+    if (delay > max_delay)
+    {
+        delay = max_delay;
+    }
+
+    delays[channel].delay = delay;
+    update_delays();
+
+    return 0;
+}
+
+// Splits the delays of all channels into whole blocks, whole
+// samples and subsample filter steps.  The subsample filter
+// delays by its half length, so while any channel has a fraction,
+// the other channels are delayed as much in whole samples.
+void
+brutefir::update_delays()
+{
+    int n, whole, step;
+    bool subdelay = false;
+
+    for (n = 0; n < bfconf->n_channels; n++)
+    {
+        whole = (int)floor(delays[n].delay);
+        step = (int)floor((delays[n].delay - whole) * SUBDELAY_STEP_COUNT + 0.5);
+
+        if (step > 0 && step < SUBDELAY_STEP_COUNT)
+        {
+            subdelay = true;
+        }
+    }
+
+    if (subdelay && !m_subdelay_ready)
+    {
+        if (m_delay->subsample_init(m_convolver,
+                                    SUBDELAY_STEP_COUNT,
+                                    SUBDELAY_HALF_LENGTH,
+                                    SUBDELAY_KAISER_BETA,
+                                    bfconf->filter_length,
+                                    bfconf->realsize))
+        {
+            for (n = 0; n < bfconf->n_channels; n++)
+            {
+                delays[n].subrest = _aligned_malloc(m_delay->subsample_filterblocksize() * bfconf->realsize,
+                                                    ALIGNMENT);
+                memset(delays[n].subrest, 0, m_delay->subsample_filterblocksize() * bfconf->realsize);
+
+                // channels are filtered in parallel, each needs its own work buffer
+                delays[n].subbuf = _aligned_malloc(2 * m_delay->subsample_filterblocksize() * bfconf->realsize,
+                                                   ALIGNMENT);
+            }
+
+            m_subdelay_ready = true;
+        }
+        else
+        {
+            pinfo("Subsample delays are not available, delays are rounded to whole samples.");
+        }
+    }
+
+    subdelay = subdelay && m_subdelay_ready;
+
+    m_delay_enabled = false;
+
+    for (n = 0; n < bfconf->n_channels; n++)
+    {
+        whole = (int)floor(delays[n].delay);
+        step = (int)floor((delays[n].delay - whole) * SUBDELAY_STEP_COUNT + 0.5);
+
+        if (step == SUBDELAY_STEP_COUNT)
+        {
+            whole++;
+            step = 0;
+        }
+
+        if (!subdelay)
+        {
+            // round to the nearest sample
+            if (2 * step >= SUBDELAY_STEP_COUNT)
+            {
+                whole++;
+            }
+
+            step = 0;
+        }
+        else if (step == 0)
+        {
+            whole += SUBDELAY_HALF_LENGTH;
+        }
+
+        delays[n].blocks = whole / bfconf->filter_length;
+        delays[n].samples = whole % bfconf->filter_length;
+        delays[n].substep = step;
+
+        if (whole > 0 || step > 0)
+        {
+            m_delay_enabled = true;
+        }
+    }
+}
+
+// Shifts a converted input block by the part of the delay shorter
+// than a block.  Called by the convolver before the block is
+// transformed.
+//
+// Parameters:
+//   realbuf  the input block
+//   arg      the delay of the channel
+//
+// The number of samples passed by the convolver is always the
+// filter length, which the delay already knows.
+void
+brutefir::delay_input(void *realbuf,
+                      int,
+                      void *arg)
+{
+    struct bfdelay_t *d = (struct bfdelay_t *)arg;
+    brutefir *owner = d->owner;
+
+    owner->m_delay->update(d->db, realbuf, owner->bfconf->realsize, 1, d->samples, NULL);
+
+    if (d->substep != 0)
+    {
+        owner->m_delay->subsample_update(owner->m_convolver, realbuf, d->subrest, d->subbuf, d->substep);
+    }
+}
+
+// Scans an output block for NaN or Inf values, clipping and peak
+// level in a single pass.
+//
+// Parameters:
+//   index    the output channel
+//   realbuf  the time domain output block
+//   scan     the scan results, overwritten on return
+void
+brutefir::scan_output(int index,
+                      const void *realbuf,
+                      struct bfscan_t *scan)
+{
+    double sample, clip = overflow[index].max;
+    int n;
+
+    if (bfconf->realsize == sizeof(float))
+    {
+        if (simd::scan_realf((const float *)realbuf, bfconf->filter_length, clip, scan))
+        {
+            return;
+        }
+    }
+    else
+    {
+        if (simd::scan_reald((const double *)realbuf, bfconf->filter_length, clip, scan))
+        {
+            return;
+        }
+    }
+
+    scan->n_nonfinite = 0;
+    scan->n_clipped = 0;
+    scan->peak = 0.0;
+
+    for (n = 0; n < bfconf->filter_length; n++)
+    {
+        if (bfconf->realsize == sizeof(float))
+        {
+            sample = fabs((double)((const float *)realbuf)[n]);
+        }
+        else
+        {
+            sample = fabs(((const double *)realbuf)[n]);
+        }
+
+        if (!_finite(sample))
+        {
+            scan->n_nonfinite++;
+        }
+        else
+        {
+            if (sample > clip)
+            {
+                scan->n_clipped++;
+            }
+
+            if (sample > scan->peak)
+            {
+                scan->peak = sample;
+            }
+        }
+    }
+}
+
+// Adds the results of an output block scan to the channel levels.
+//
+// Parameters:
+//   index  the output channel
+//   scan   the scan results
+void
+brutefir::update_levels(int index,
+                        const struct bfscan_t *scan)
+{
+    int32_t bits;
+    float peak;
+
+    // non-negative floats order the same as their bits, so the held
+    // peak can be compared without converting back
+    peak = (float)(scan->peak / overflow[index].max);
+    memcpy(&bits, &peak, sizeof(float));
+
+    atomic_store(&meters[index].peak, bits);
+
+    if (bits > (int32_t)atomic_load(&meters[index].held_peak))
+    {
+        atomic_store(&meters[index].held_peak, bits);
+    }
+
+    if (scan->n_nonfinite > 0)
+    {
+        atomic_add(&meters[index].n_nonfinite, (long)scan->n_nonfinite);
+    }
+
+    if (scan->n_clipped > 0)
+    {
+        atomic_add(&meters[index].n_clipped, (long)scan->n_clipped);
+    }
+
+    atomic_add(&meters[index].n_blocks, 1);
+}
+
 // Gets the full scale value for specified sample size.
 //
 // Parameters:
@@ -668,6 +1478,7 @@ brutefir::init_channels(int n_channels,
     // initialize overflow structure
     memset(overflow, 0, sizeof(struct bfoverflow_t) * bfconf->n_channels);
     memset(last_overflow, 0, sizeof(struct bfoverflow_t) * bfconf->n_channels);
+    memset(meters, 0, sizeof(struct bfmeter_t) * bfconf->n_channels);
 
     for (n = 0; n < bfconf->n_channels; n++)
     {
@@ -707,9 +1518,7 @@ brutefir::init_convolver(int filter_length,
 
     // initialize dither array
     m_dither = new dither(bfconf->n_channels,
-                          bfconf->sampling_rate,
                           bfconf->realsize,
-                          bfconf->max_dither_table_size,
                           bfconf->filter_length,
                           bfconf->dither_state);
 
@@ -740,6 +1549,7 @@ brutefir::init_buffers()
 {
     int n, i;
     int memsize;
+    int fdl_blocks;
     uint8_t *memptr;
 
     if (bfconf->n_channels == 0)
@@ -748,10 +1558,36 @@ brutefir::init_buffers()
         return -1;
     }
 
-    // allocate void *cbuf[n_channels][n_blocks]
+    // Input blocks are kept for the filter blocks and for the
+    // whole blocks of the longest delay, which may be lengthened
+    // by rounding and by the subsample filter
+    bfconf->n_delay_blocks = ((int)(BF_MAXDELAY_SECONDS * bfconf->sampling_rate) +
+                              SUBDELAY_HALF_LENGTH + 1) / bfconf->filter_length;
+    fdl_blocks = bfconf->n_blocks + bfconf->n_delay_blocks;
+
+    // long filters are convolved in ranges on the thread pool,
+    // as many as there are workers
+    max_ranges = bfconf->n_blocks / RANGE_MIN_BLOCKS;
+
+    if (max_ranges > BF_MAXRANGES)
+    {
+        max_ranges = BF_MAXRANGES;
+    }
+
+    if (max_ranges > 1 && max_ranges > thread_pool::get_worker_count())
+    {
+        max_ranges = thread_pool::get_worker_count();
+    }
+
+    if (max_ranges < 1)
+    {
+        max_ranges = 1;
+    }
+
+    // allocate void *cbuf[n_channels][fdl_blocks]
     for (n = 0; n < bfconf->n_channels; n++)
     {
-        cbuf[n] = (void **) _aligned_malloc(bfconf->n_blocks * sizeof(void *), ALIGNMENT);
+        cbuf[n] = (void **) _aligned_malloc(fdl_blocks * sizeof(void *), ALIGNMENT);
     }
 
     // allocate input/output convolve buffers
@@ -760,21 +1596,23 @@ brutefir::init_buffers()
               bfconf->n_channels * convbufsize +         // input_freqcbuf
               bfconf->n_channels * convbufsize;          // output_freqcbuf
 
-    if (bfconf->n_blocks > 1)
+    if (fdl_blocks > 1)
     {
-        memsize += bfconf->n_channels * bfconf->n_blocks * convbufsize;  // cbuf
+        memsize += bfconf->n_channels * fdl_blocks * convbufsize;  // cbuf
+        memsize += bfconf->n_channels * (max_ranges - 1) * convbufsize;  // rangecbuf
     }
 
     baseptr = (uint8_t *) _aligned_malloc(memsize, ALIGNMENT);
     memset(baseptr, 0, memsize);
+    basesize = memsize;
 
     memptr = baseptr;
 
-    if (bfconf->n_blocks > 1)
+    if (fdl_blocks > 1)
     {
         for (n = 0; n < bfconf->n_channels; n++)
         {
-            for (i = 0; i < bfconf->n_blocks; i++)
+            for (i = 0; i < fdl_blocks; i++)
             {
                 cbuf[n][i] = memptr;
                 memptr += convbufsize;
@@ -782,6 +1620,14 @@ brutefir::init_buffers()
 
             ocbuf[n] = memptr;
             memptr += convbufsize;
+
+            rangecbuf[n][0] = ocbuf[n];
+
+            for (i = 1; i < max_ranges; i++)
+            {
+                rangecbuf[n][i] = memptr;
+                memptr += convbufsize;
+            }
         }
     }
     else
@@ -789,10 +1635,21 @@ brutefir::init_buffers()
         for (n = 0; n < bfconf->n_channels; n++)
         {
             cbuf[n][0] = ocbuf[n] = memptr;
+            rangecbuf[n][0] = ocbuf[n];
             memptr += convbufsize;
         }
     }
 
+    for (n = 0; n < bfconf->n_channels; n++)
+    {
+        for (i = 0; i < BF_MAXRANGES; i++)
+        {
+            tasks[n][i].owner = this;
+            tasks[n][i].channel = n;
+            tasks[n][i].range = i;
+        }
+    }
+
     for (n = 0; n < bfconf->n_channels; n++)
     {
         input_timecbuf[n][0] = memptr;
@@ -806,6 +1663,18 @@ brutefir::init_buffers()
         memptr += convbufsize;
     }
 
+    // delays shorter than a block are shifted in the time domain
+    m_delay = new delay();
+
+    for (n = 0; n < bfconf->n_channels; n++)
+    {
+        delays[n].owner = this;
+        delays[n].db = m_delay->allocate_buffer(bfconf->filter_length,
+                                                0,
+                                                bfconf->filter_length - 1,
+                                                bfconf->realsize);
+    }
+
     return 0;
 }
 
@@ -828,6 +1697,46 @@ brutefir::free_buffers()
             _aligned_free(cbuf[n]);
             cbuf[n] = NULL;
         }
+
+        if (delays[n].db != NULL)
+        {
+            m_delay->free_buffer(delays[n].db);
+            delays[n].db = NULL;
+        }
+
+        if (delays[n].subrest != NULL)
+        {
+            _aligned_free(delays[n].subrest);
+            delays[n].subrest = NULL;
+        }
+
+        if (delays[n].subbuf != NULL)
+        {
+            _aligned_free(delays[n].subbuf);
+            delays[n].subbuf = NULL;
+        }
+    }
+}
+
+// Uses the coefficient blocks of a shared set.
+//
+// Parameters:
+//   set  the coefficient set, the engine owns a reference
+void
+brutefir::use_coeff_set(struct coeff_set_t *set)
+{
+    int n;
+
+    m_coeff_set = set;
+    m_ready_blocks = set->ready_blocks;
+
+    for (n = 0; n < set->n_channels; n++)
+    {
+        bfconf->coeffs[n].data = set->data[n];
+        bfconf->coeffs[n].n_blocks = set->n_blocks;
+        bfconf->coeffs[n].intname = n;
+        bfconf->coeffs[n].n_channels = 1;
+        bfconf->coeffs[n].channels[0] = n;
     }
 }
 
@@ -837,8 +1746,24 @@ brutefir::free_coeff()
 {
     int n, i;
 
+    if (m_coeff_set != NULL)
+    {
+        // shared blocks are freed by the store with the last reference
+        for (n = 0; n < bfconf->n_channels; n++)
+        {
+            bfconf->coeffs[n].data = NULL;
+        }
+
+        coeff_store::release(m_coeff_set);
+
+        m_coeff_set = NULL;
+        m_ready_blocks = m_own_ready_blocks;
+    }
+
     for (n = 0; n < bfconf->n_channels; n++)
     {
+        atomic_store(&m_ready_blocks[n], 0);
+
         if (bfconf->coeffs[n].data != NULL)
         {
             for (i = 0; i < bfconf->coeffs[n].n_blocks; i++)
@@ -8,9 +8,67 @@
 #ifndef _BRUTEFIR_HPP_
 #define _BRUTEFIR_HPP_
 
+#include <boost/thread.hpp>
+
 #include "global.h"
 #include "fftw_convolver.hpp"
 #include "dither.hpp"
+#include "delay.hpp"
+#include "mapped_file.hpp"
+#include "coeff.hpp"
+#include "coeff_store.hpp"
+#include "metrics.hpp"
+#include "thread_pool.hpp"
+
+// The filter blocks of a channel are convolved in up to this many
+// ranges in parallel.
+#define BF_MAXRANGES 8
+
+// Output levels of a channel, written by the processing thread and
+// read without locks. Peaks are stored as the bits of a float.
+struct bfmeter_t
+{
+    volatile long n_blocks;
+    volatile long n_nonfinite;
+    volatile long n_clipped;
+    volatile long peak;
+    volatile long held_peak;
+};
+
+class brutefir;
+
+// Alignment delay of a channel.  Whole filter blocks are taken from
+// older input blocks, the remaining samples are shifted before the
+// forward transform and a fraction goes through a subsample filter.
+struct bfdelay_t
+{
+    brutefir *owner;
+    double delay;       // requested delay in samples
+    int blocks;         // whole filter blocks
+    int samples;        // remaining whole samples
+    int substep;        // fraction in subsample filter steps, or 0
+    delaybuffer_t *db;  // shifts the remaining samples
+    void *subrest;      // subsample filter overlap
+    void *subbuf;       // subsample filter work buffer
+};
+
+// A part of the processing of a block, run on the thread pool.
+// The first part of a channel converts and transforms the input
+// and convolves the first range of filter blocks, the other parts
+// convolve the later ranges.  The part that finishes last sums the
+// ranges and writes the output of the channel.
+struct bftask_t
+{
+    brutefir *owner;
+    int channel;
+    int range;
+    int first_block;    // first filter block of the range
+    int end_block;      // one past the last filter block
+    void *inbuf;
+    void *outbuf;
+    bool failed;        // NaN or Inf values in the output
+    uint64_t cycles[METRICS_STAGE_COUNT];
+};
 
 class brutefir
 {
@@ -22,7 +80,8 @@ public:
              int in_format,
              int out_format,
              int sampling_rate,
-             bool apply_dither);
+             bool apply_dither,
+             int priority);
     
     ~brutefir();
 
@@ -34,6 +93,11 @@ public:
               int coeff_blocks,
               double scale);
 
+    int
+    set_coeff_async(const wchar_t *filename,
+                    int coeff_blocks,
+                    double scale);
+
     int
     set_coeff(void **coeffs,
               int n_coeffs,
@@ -51,6 +115,26 @@ public:
     void
     check_overflows();
 
+    bool
+    get_levels(int channel,
+               struct bflevels_t *levels);
+
+    void
+    get_stage_cycles(uint64_t *cycles);
+
+    int
+    set_delay(int channel,
+              double delay);
+
+    int
+    get_active_blocks(int channel);
+
+    double
+    get_common_delay();
+
+    void
+    set_priority(int priority);
+
 private:
     double 
     get_full_scale(int bytes);
@@ -78,6 +162,40 @@ private:
     void
     print_overflows();
 
+    void
+    scan_output(int index,
+                const void *realbuf,
+                struct bfscan_t *scan);
+
+    void
+    update_levels(int index,
+                  const struct bfscan_t *scan);
+
+    static void
+    add_stage_cycles(uint64_t *cycles,
+                     int stage,
+                     volatile uint64_t *ts);
+
+    static void
+    run_task(struct bftask_t *task);
+
+    void
+    process_input(struct bftask_t *task);
+
+    void
+    convolve_range(struct bftask_t *task);
+
+    void
+    process_output(struct bftask_t *task);
+
+    void
+    update_delays();
+
+    static void
+    delay_input(void *realbuf,
+                int n_samples,
+                void *arg);
+
     int 
     init_convolver(int filter_length, 
                    int filter_blocks, 
@@ -99,10 +217,24 @@ private:
     void
     free_coeff();
 
+    void
+    use_coeff_set(struct coeff_set_t *set);
+
     bool m_initialized;
 
+    // coefficients shared through the store, or NULL if owned
+    struct coeff_set_t *m_coeff_set;
+
+    // ready blocks of the shared set or of the owned coefficients
+    volatile long *m_ready_blocks;
+    volatile long m_own_ready_blocks[BF_MAXCHANNELS];
+
     fftw_convolver *m_convolver;
     dither *m_dither;
+    delay *m_delay;
+
+    bool m_delay_enabled;
+    bool m_subdelay_ready;
 
     struct bfconf_t *bfconf;
 
@@ -111,6 +243,7 @@ private:
     int curblock;
     unsigned int blockcounter;
 
+    int basesize;
     uint8_t *baseptr;
 
     void *input_timecbuf[BF_MAXCHANNELS][2];
@@ -121,10 +254,26 @@ private:
     void **cbuf[BF_MAXCHANNELS];
     void *ocbuf[BF_MAXCHANNELS];
 
+    // convolution outputs of the ranges, the first one is ocbuf
+    void *rangecbuf[BF_MAXCHANNELS][BF_MAXRANGES];
+    int max_ranges;
+
     int procblocks[BF_MAXCHANNELS];
 
+    // the parts of the current block, by channel and range
+    struct bftask_t tasks[BF_MAXCHANNELS][BF_MAXRANGES];
+    int n_ranges[BF_MAXCHANNELS];
+    volatile long pending_ranges[BF_MAXCHANNELS];
+    struct pool_group_t m_group;
+
+    struct bfdelay_t delays[BF_MAXCHANNELS];
+
+    uint64_t stage_cycles[METRICS_STAGE_COUNT];
+
     struct bfoverflow_t overflow[BF_MAXCHANNELS];
     struct bfoverflow_t last_overflow[BF_MAXCHANNELS];
+
+    struct bfmeter_t meters[BF_MAXCHANNELS];
 };
 
 #endif
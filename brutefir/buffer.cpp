@@ -1,13 +1,16 @@
-#include <malloc.h>
 #include <string.h>
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <math.h>
 #include <boost/generator_iterator.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
 
+#if defined(_WIN32)
 #include <Windows.h>
 #define ENABLE_SNDFILE_WINDOWS_PROTOTYPES 1
+#endif
 #include <sndfile.h>
 
 #include <samplerate.h>
@@ -18,10 +21,35 @@
 #include "buffer.hpp"
 #include "util.hpp"
 #include "bfir_path.hpp"
-#include "hash.h"
+#include "cache.hpp"
+#include "thread_pool.hpp"
+
+// number of frames resampled per block
+#define RESAMPLE_BLOCK_FRAMES 65536
 
 namespace buffer
 {
+    // Opens a sound file by its wide character name.
+    //
+    // Parameters:
+    //   filename  the sound filename
+    //   mode      SFM_READ or SFM_WRITE
+    //   sf_info   the format of the file
+    //
+    // Returns:
+    //   The sound file, or NULL if it could not be opened.
+    SNDFILE *
+    open_snd_file(const wchar_t *filename,
+                  int mode,
+                  SF_INFO *sf_info)
+    {
+#if defined(_WIN32)
+        return sf_wchar_open(filename, mode, sf_info);
+#else
+        return sf_open(util::wstr2str(filename).c_str(), mode, sf_info);
+#endif
+    }
+
     // Loads the given sound file into an interlaced buffer.
     //
     // Parameters:
@@ -49,7 +77,7 @@ namespace buffer
 
         // open the sound file
         sf_info.format = 0;
-        snd_file = sf_wchar_open(filename, SFM_READ, &sf_info);
+        snd_file = open_snd_file(filename, SFM_READ, &sf_info);
 
         if (snd_file == NULL)
         {
@@ -121,7 +149,7 @@ namespace buffer
         sf_info.frames = n_frames;
         sf_info.samplerate = sampling_rate;
 
-        snd_file = sf_wchar_open(filename, SFM_WRITE, &sf_info);
+        snd_file = open_snd_file(filename, SFM_WRITE, &sf_info);
 
         if (snd_file != NULL)
         {
@@ -161,7 +189,7 @@ namespace buffer
 
         // open the sound file
         sf_info.format = 0;
-        snd_file = sf_wchar_open(filename, SFM_READ, &sf_info);
+        snd_file = open_snd_file(filename, SFM_READ, &sf_info);
 
         if (snd_file == NULL)
         {
@@ -210,9 +238,70 @@ namespace buffer
         return result;
     }
 
+    // Resamples a block of a single channel, appending the
+    // generated frames to the output buffer.
+    //
+    // Parameters:
+    //   state        the resampler state of the channel
+    //   in           the input samples
+    //   in_frames    the number of input samples
+    //   out          the output buffer
+    //   out_frames   the capacity of the output buffer
+    //   ratio        the output to input sampling rate ratio
+    //   end          true if this is the last block of input
+    //   frames_gen   returns the number of generated frames
+    //   error        returns the resampler error code
+    static void
+    resample_block(SRC_STATE *state,
+                   float *in,
+                   long in_frames,
+                   float *out,
+                   long out_frames,
+                   double ratio,
+                   bool end,
+                   long *frames_gen,
+                   int *error)
+    {
+        SRC_DATA src_data;
+
+        *frames_gen = 0;
+        *error = 0;
+
+        src_data.src_ratio = ratio;
+        src_data.end_of_input = end ? 1 : 0;
+        src_data.data_in = in;
+        src_data.input_frames = in_frames;
+
+        // keep processing until all input is consumed and,
+        // on the last block, until the filter is drained.
+        do
+        {
+            src_data.data_out = &out[*frames_gen];
+            src_data.output_frames = out_frames - *frames_gen;
+
+            *error = src_process(state, &src_data);
+
+            if (*error != 0)
+            {
+                break;
+            }
+
+            src_data.data_in += src_data.input_frames_used;
+            src_data.input_frames -= src_data.input_frames_used;
+            *frames_gen += src_data.output_frames_gen;
+        }
+        while ((*frames_gen < out_frames) &&
+               ((src_data.input_frames > 0) ||
+                (end && (src_data.output_frames_gen > 0))));
+    }
+
     // Resamples the specified sound file to the specified
     // number of channels and sampling rate.
     //
+    // The file is processed in blocks of RESAMPLE_BLOCK_FRAMES with
+    // each channel resampled on its own thread, so memory use does
+    // not depend on the length of the file.
+    //
     // Parameters:
     //   filename        the sound filename
     //   n_channels      the number of channels
@@ -222,108 +311,255 @@ namespace buffer
     //   The filename of the resampled sound file or
     //   empty string on error.
     std::wstring
-    buffer::resample_snd_file(const wchar_t *filename,
-                              int n_channels,
-                              int sampling_rate)
+    resample_snd_file(const wchar_t *filename,
+                      int n_channels,
+                      int sampling_rate)
     {
+        int n, i;
+        int error = 0;
         int src_n_channels;
-        int src_n_frames;
-        int src_sampling_rate;
-        int realsize;
-        void *src_buffer;
-        void *dst_buffer;
-        void **temp_buffer;
-        SRC_DATA src_data;
-        int error = 1;
+        double ratio;
+        long out_capacity;
+        long out_frames;
+        sf_count_t frames_read;
+        sf_count_t total_read = 0;
+        sf_count_t total_written = 0;
+        sf_count_t total_frames;
+        bool end;
+
+        float *inbuf = NULL;
+        float *outbuf = NULL;
+        float *in[BF_MAXCHANNELS];
+        float *out[BF_MAXCHANNELS];
+        SRC_STATE *state[BF_MAXCHANNELS];
+        long frames_gen[BF_MAXCHANNELS];
+        int errors[BF_MAXCHANNELS];
+
+        SNDFILE *src_file = NULL;
+        SNDFILE *dst_file = NULL;
+        SF_INFO src_info;
+        SF_INFO dst_info;
+
         std::wstring dst_filename;
-        std::wstringstream out;
-        std::string str;
-        long hash_code;
-
-        // generate a hash code of the bands array
-        str = util::wstr2str(filename);
-        hash_code = DJBHash((char *)str.c_str(), str.size());
-
-        // generate a temporary filename
-        out << "ir-" << std::hex << hash_code;
-        out << "-" << std::dec << n_channels 
-            << "-" << sampling_rate 
-            << ".wav";
-        
-        dst_filename = bfir_path::append_temp_path(out.str());
-
-        // resample if the file does not already exist
-        if (!boost::filesystem::exists(dst_filename))
+        std::wstring temp_filename;
+        uint64_t key;
+
+        if ((n_channels <= 0) || (n_channels > BF_MAXCHANNELS) ||
+            !cache::hash_file(filename, &key))
         {
-            // the resampler library only handles single-precision float,
-            // so set the realsize to 4.
-            realsize = 4;
-        
-            // get sound file parameters
-            if (get_snd_file_params(filename,
-                                    &src_n_channels,
-                                    &src_n_frames,
-                                    &src_sampling_rate))
+            return dst_filename;
+        }
+
+        // the cache key covers the source contents and the
+        // conversion parameters
+        key = cache::hash_data(&n_channels, sizeof(n_channels), key);
+        key = cache::hash_data(&sampling_rate, sizeof(sampling_rate), key);
+
+        dst_filename = cache::get_filename(L"ir", key);
+
+        // resample if the file is not already cached
+        if (cache::lookup(dst_filename))
+        {
+            return dst_filename;
+        }
+
+        temp_filename = cache::get_temp_filename(dst_filename);
+
+        memset(state, 0, sizeof(state));
+        memset(in, 0, sizeof(in));
+        memset(out, 0, sizeof(out));
+
+        // open the source file
+        src_info.format = 0;
+        src_file = open_snd_file(filename, SFM_READ, &src_info);
+
+        if ((src_file == NULL) || (src_info.channels < n_channels))
+        {
+            error = 1;
+            goto exit;
+        }
+
+        src_n_channels = src_info.channels;
+
+        // the output length follows from the ratio so that
+        // upsampled output is not truncated.
+        ratio = (double)sampling_rate / (double)src_info.samplerate;
+        total_frames = (sf_count_t)ceil(src_info.frames * ratio);
+        out_capacity = (long)ceil(RESAMPLE_BLOCK_FRAMES * ratio) + RESAMPLE_BLOCK_FRAMES;
+
+        // the resampler library only handles single-precision float
+        dst_info.channels = n_channels;
+        dst_info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT | SF_ENDIAN_LITTLE;
+        dst_info.frames = total_frames;
+        dst_info.samplerate = sampling_rate;
+
+        dst_file = open_snd_file(temp_filename.c_str(), SFM_WRITE, &dst_info);
+
+        if (dst_file == NULL)
+        {
+            error = 1;
+            goto exit;
+        }
+
+        inbuf = (float *)_aligned_malloc(RESAMPLE_BLOCK_FRAMES * src_n_channels * sizeof(float), ALIGNMENT);
+        outbuf = (float *)_aligned_malloc(out_capacity * n_channels * sizeof(float), ALIGNMENT);
+
+        for (n = 0; n < n_channels; n++)
+        {
+            in[n] = (float *)_aligned_malloc(RESAMPLE_BLOCK_FRAMES * sizeof(float), ALIGNMENT);
+            out[n] = (float *)_aligned_malloc(out_capacity * sizeof(float), ALIGNMENT);
+            state[n] = src_new(SRC_SINC_BEST_QUALITY, 1, &error);
+
+            if (state[n] == NULL)
+            {
+                error = (error != 0) ? error : 1;
+                goto exit;
+            }
+        }
+
+        do
+        {
+            // read the next block
+            frames_read = sf_readf_float(src_file, inbuf, RESAMPLE_BLOCK_FRAMES);
+            total_read += frames_read;
+            end = (frames_read < RESAMPLE_BLOCK_FRAMES) || (total_read >= src_info.frames);
+
+            // split the channels to keep, discarding the rest
+            for (n = 0; n < n_channels; n++)
             {
-                if (src_n_channels >= n_channels)
+                raw2real::raw2realf(in[n],
+                                    &(((uint8_t *)inbuf)[n * sizeof(float)]),
+                                    sizeof(float),
+                                    0,
+                                    true,
+                                    src_n_channels,
+                                    false,
+                                    (int)frames_read);
+            }
+
+            // resample the channels in parallel
+            struct pool_group_t group;
+
+            thread_pool::init_group(&group, POOL_PRIORITY_BACKGROUND);
+
+            for (n = 0; n < n_channels; n++)
+            {
+                thread_pool::submit(&group, boost::bind(&resample_block,
+                                                        state[n],
+                                                        in[n],
+                                                        (long)frames_read,
+                                                        out[n],
+                                                        out_capacity,
+                                                        ratio,
+                                                        end,
+                                                        &frames_gen[n],
+                                                        &errors[n]));
+            }
+
+            thread_pool::wait(&group);
+
+            out_frames = out_capacity;
+
+            for (n = 0; n < n_channels; n++)
+            {
+                if (errors[n] != 0)
+                {
+                    error = errors[n];
+                    goto exit;
+                }
+
+                if (frames_gen[n] < out_frames)
                 {
-                    // load the source buffer from file
-                    src_buffer = buffer::load_from_snd_file(filename,
-                                                            &src_n_channels,
-                                                            &src_n_frames,
-                                                            realsize,
-                                                            -1,
-                                                            false);
-
-                    if (src_buffer != NULL)
-                    {
-                        if (src_n_channels > n_channels)
-                        {
-                            // deinterlace the buffer
-                            temp_buffer = deinterlace(src_buffer, src_n_channels, src_n_frames, realsize);
-                            _aligned_free(src_buffer);
-
-                            // re-interlace the buffer to discard extra channels
-                            src_buffer = interlace(temp_buffer, n_channels, src_n_frames, realsize);
-                            _aligned_free(temp_buffer);
-                        }
-
-                        // allocate memory for the destination buffer
-                        dst_buffer = _aligned_malloc(src_n_frames * n_channels * realsize, ALIGNMENT);
-                        memset(dst_buffer, 0, src_n_frames * n_channels * realsize);
-
-                        src_data.data_in = (float *)src_buffer;
-                        src_data.data_out = (float *)dst_buffer;
-                        src_data.input_frames = src_n_frames;
-                        src_data.output_frames = src_n_frames;
-                        src_data.src_ratio = (double) src_sampling_rate / (double) sampling_rate;
-
-                        // resample the buffer
-                        error = src_simple(&src_data, SRC_SINC_BEST_QUALITY, n_channels);
-
-                        if (error == 0)
-                        {
-                            // save to temporary file
-                            save_to_snd_file(
-                                dst_filename.c_str(), 
-                                dst_buffer, 
-                                n_channels, 
-                                (int)src_data.output_frames_gen,
-                                realsize,
-                                sampling_rate);
-                        }
-
-                        // free buffer memory
-                        _aligned_free(src_buffer);
-                        _aligned_free(dst_buffer);
-                    }
+                    out_frames = frames_gen[n];
                 }
             }
 
-            if (error != 0)
+            if (total_written + out_frames > total_frames)
+            {
+                out_frames = (long)(total_frames - total_written);
+            }
+
+            // interlace and write the completed block
+            for (n = 0; n < n_channels; n++)
             {
-                dst_filename.clear();
+                for (i = 0; i < out_frames; i++)
+                {
+                    outbuf[i * n_channels + n] = out[n][i];
+                }
             }
+
+            if (sf_writef_float(dst_file, outbuf, out_frames) != out_frames)
+            {
+                error = 1;
+                goto exit;
+            }
+
+            total_written += out_frames;
+        }
+        while (!end);
+
+        // pad the tail if the resampler produced fewer frames
+        // than the ratio calls for
+        memset(outbuf, 0, out_capacity * n_channels * sizeof(float));
+
+        while (total_written < total_frames)
+        {
+            out_frames = (long)(((total_frames - total_written) < out_capacity)
+                                 ? (total_frames - total_written)
+                                 : out_capacity);
+
+            sf_writef_float(dst_file, outbuf, out_frames);
+            total_written += out_frames;
+        }
+
+exit:
+        for (n = 0; n < BF_MAXCHANNELS; n++)
+        {
+            if (state[n] != NULL)
+            {
+                src_delete(state[n]);
+            }
+
+            if (in[n] != NULL)
+            {
+                _aligned_free(in[n]);
+            }
+
+            if (out[n] != NULL)
+            {
+                _aligned_free(out[n]);
+            }
+        }
+
+        if (inbuf != NULL)
+        {
+            _aligned_free(inbuf);
+        }
+
+        if (outbuf != NULL)
+        {
+            _aligned_free(outbuf);
+        }
+
+        if (src_file != NULL)
+        {
+            sf_close(src_file);
+        }
+
+        if (dst_file != NULL)
+        {
+            sf_close(dst_file);
+        }
+
+        if (error != 0)
+        {
+            // do not leave a partial file behind
+            cache::cancel(dst_filename, temp_filename);
+            dst_filename.clear();
+        }
+        else
+        {
+            cache::insert(dst_filename, temp_filename);
         }
 
         return dst_filename;
@@ -10,6 +10,10 @@
 #include <ctime>
 #include <boost/random.hpp>
 
+// defined by sndfile.h
+struct SNDFILE_tag;
+struct SF_INFO;
+
 namespace buffer
 {
     // define the random number generator
@@ -18,6 +22,11 @@ namespace buffer
     // seeded random number generator
     static base_generator_type generator(static_cast<unsigned int>(std::time(NULL)));
 
+    struct SNDFILE_tag *
+    open_snd_file(const wchar_t *filename,
+                  int mode,
+                  struct SF_INFO *sf_info);
+
     void *
     load_from_snd_file(const wchar_t *filename,
                        int *n_channels,
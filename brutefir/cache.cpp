@@ -0,0 +1,687 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#include <time.h>
+#include <string.h>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "cache.hpp"
+#include "bfir_path.hpp"
+#include "util.hpp"
+#include "pinfo.h"
+
+// name of the index file in the temporary file path
+#define CACHE_INDEX_FILENAME    L"cache.idx"
+
+// size of the blocks read when hashing a file
+#define CACHE_HASH_BLOCK_SIZE   (1024 * 1024)
+
+#define CACHE_HASH_PRIME        0x100000001b3ULL
+
+namespace cache
+{
+    struct cache_entry_t
+    {
+        uint64_t size;
+        uint64_t last_access;
+    };
+
+    struct source_entry_t
+    {
+        uint64_t size;
+        uint64_t mtime;
+        uint64_t hash;
+    };
+
+    typedef std::map<std::wstring, struct cache_entry_t> entry_map;
+    typedef std::map<std::wstring, struct source_entry_t> source_map;
+
+    // cached files keyed by their name in the temporary path
+    static entry_map entries;
+
+    // content hashes of source files keyed by their full path
+    static source_map sources;
+
+    static uint64_t total_size = 0;
+    static uint64_t max_size = CACHE_DEFAULT_MAX_SIZE;
+    static uint64_t hits = 0;
+    static uint64_t misses = 0;
+    static uint64_t evictions = 0;
+
+    // lookups share the index, updates own it
+    static boost::shared_mutex index_mutex;
+
+    // serializes access time and counter updates made by lookups
+    static boost::mutex touch_mutex;
+
+    // names of files being generated, a lookup of one of them waits
+    // until it has been inserted or cancelled
+    static std::set<std::wstring> pending;
+    static boost::mutex pending_mutex;
+    static boost::condition_variable pending_done;
+
+    // Returns the name of a cached file within the temporary path.
+    static std::wstring
+    get_entry_name(const std::wstring filename)
+    {
+        return boost::filesystem::path(filename).filename().wstring();
+    }
+
+    // Removes the content hashes of source files that were deleted
+    // or modified since they were hashed.  The index must be locked
+    // exclusively.
+    static void
+    prune_sources()
+    {
+        source_map::iterator it;
+
+        for (it = sources.begin(); it != sources.end(); )
+        {
+            try
+            {
+                if ((boost::filesystem::file_size(it->first) == it->second.size) &&
+                    ((uint64_t)boost::filesystem::last_write_time(it->first) == it->second.mtime))
+                {
+                    it++;
+                    continue;
+                }
+            }
+            catch(boost::filesystem::filesystem_error)
+            {
+            }
+
+            sources.erase(it++);
+        }
+    }
+
+    // Ends the generation of a file and wakes the lookups waiting
+    // for it.
+    //
+    // Parameters:
+    //   name  the name of the entry
+    static void
+    finish(const std::wstring name)
+    {
+        boost::lock_guard<boost::mutex> lock(pending_mutex);
+
+        pending.erase(name);
+        pending_done.notify_all();
+    }
+
+    // Removes least recently used files until the total size is
+    // within the limit.  The index must be locked exclusively.
+    //
+    // Parameters:
+    //   keep  the name of an entry that must not be evicted
+    static void
+    evict(const std::wstring keep)
+    {
+        std::vector<std::pair<uint64_t, std::wstring> > order;
+        std::vector<std::pair<uint64_t, std::wstring> >::iterator it;
+        entry_map::iterator entry;
+
+        if (total_size <= max_size)
+        {
+            return;
+        }
+
+        for (entry = entries.begin(); entry != entries.end(); entry++)
+        {
+            if (entry->first != keep)
+            {
+                order.push_back(std::make_pair(entry->second.last_access, entry->first));
+            }
+        }
+
+        std::sort(order.begin(), order.end());
+
+        for (it = order.begin(); (it < order.end()) && (total_size > max_size); it++)
+        {
+            entry = entries.find(it->second);
+
+            try
+            {
+                boost::filesystem::remove(bfir_path::append_temp_path(it->second));
+            }
+            catch(boost::filesystem::filesystem_error)
+            {
+                continue;
+            }
+
+            total_size -= entry->second.size;
+            entries.erase(entry);
+            evictions++;
+        }
+
+        prune_sources();
+    }
+
+    // Writes the index file.  The index must be locked exclusively.
+    //
+    // Returns:
+    //   true if successful, false otherwise.
+    static bool
+    write_index()
+    {
+        entry_map::iterator entry;
+        source_map::iterator source;
+
+        boost::filesystem::ofstream file(boost::filesystem::path(bfir_path::append_temp_path(CACHE_INDEX_FILENAME)));
+
+        if (!file.is_open())
+        {
+            pinfo("Failed to save the cache index.");
+            return false;
+        }
+
+        for (entry = entries.begin(); entry != entries.end(); entry++)
+        {
+            file << "E\t" << util::wstr2str(entry->first) << "\t"
+                 << entry->second.size << " " << entry->second.last_access << "\n";
+        }
+
+        for (source = sources.begin(); source != sources.end(); source++)
+        {
+            file << "S\t" << util::wstr2str(source->first) << "\t"
+                 << source->second.size << " " << source->second.mtime << " "
+                 << std::hex << source->second.hash << std::dec << "\n";
+        }
+
+        return true;
+    }
+
+    // Hashes a block of data.
+    //
+    // Parameters:
+    //   data  the data to hash
+    //   size  the number of bytes
+    //   seed  the initial value, or the result of a previous call to
+    //         continue hashing
+    //
+    // Returns:
+    //   The 64-bit hash value.
+    uint64_t
+    hash_data(const void *data,
+              size_t size,
+              uint64_t seed)
+    {
+        const uint8_t *p = (const uint8_t *)data;
+        uint64_t hash = seed;
+        uint64_t word;
+
+        // FNV-1a over 64-bit words with an extra shift to fold
+        // the high bits back in
+        while (size >= sizeof(uint64_t))
+        {
+            memcpy(&word, p, sizeof(uint64_t));
+            hash = (hash ^ word) * CACHE_HASH_PRIME;
+            hash ^= hash >> 32;
+
+            p += sizeof(uint64_t);
+            size -= sizeof(uint64_t);
+        }
+
+        while (size > 0)
+        {
+            hash = (hash ^ *p) * CACHE_HASH_PRIME;
+            p++;
+            size--;
+        }
+
+        return hash;
+    }
+
+    // Hashes a string.
+    //
+    // Parameters:
+    //   str   the string to hash
+    //   seed  the initial value
+    //
+    // Returns:
+    //   The 64-bit hash value.
+    uint64_t
+    hash_string(const std::wstring str,
+                uint64_t seed)
+    {
+        return hash_data(str.c_str(), str.size() * sizeof(wchar_t), seed);
+    }
+
+    // Hashes the contents of a file.  The hash is remembered
+    // together with the size and modification time of the file,
+    // so an unmodified file is only read once.
+    //
+    // Parameters:
+    //   filename  the name of the file
+    //   hash      returns the 64-bit hash value
+    //
+    // Returns:
+    //   true if successful, false otherwise.
+    bool
+    hash_file(const std::wstring filename,
+              uint64_t *hash)
+    {
+        struct source_entry_t source;
+        source_map::iterator it;
+        std::vector<char> buf(CACHE_HASH_BLOCK_SIZE);
+
+        try
+        {
+            source.size = boost::filesystem::file_size(filename);
+            source.mtime = (uint64_t)boost::filesystem::last_write_time(filename);
+        }
+        catch(boost::filesystem::filesystem_error)
+        {
+            return false;
+        }
+
+        {
+            boost::shared_lock<boost::shared_mutex> lock(index_mutex);
+
+            it = sources.find(filename);
+
+            if ((it != sources.end()) &&
+                (it->second.size == source.size) &&
+                (it->second.mtime == source.mtime))
+            {
+                *hash = it->second.hash;
+                return true;
+            }
+        }
+
+        boost::filesystem::ifstream file(boost::filesystem::path(filename), std::ios::in | std::ios::binary);
+
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        source.hash = hash_data(&source.size, sizeof(source.size), CACHE_KEY_SEED);
+
+        while (file)
+        {
+            file.read(&buf[0], buf.size());
+
+            if (file.gcount() > 0)
+            {
+                source.hash = hash_data(&buf[0], (size_t)file.gcount(), source.hash);
+            }
+        }
+
+        {
+            boost::unique_lock<boost::shared_mutex> lock(index_mutex);
+            sources[filename] = source;
+        }
+
+        *hash = source.hash;
+        return true;
+    }
+
+    // Returns the full name of the cached file for a key.
+    //
+    // Parameters:
+    //   prefix  a prefix describing the kind of file
+    //   key     the cache key
+    //
+    // Returns:
+    //   The filename in the temporary path.
+    std::wstring
+    get_filename(const std::wstring prefix,
+                 uint64_t key)
+    {
+        std::wstringstream out;
+
+        out << prefix << "-" << std::hex;
+        out.width(16);
+        out.fill(L'0');
+        out << key << ".wav";
+
+        return bfir_path::append_temp_path(out.str());
+    }
+
+    // Checks whether a file is cached and marks it as
+    // recently used.  If another thread is generating the file,
+    // waits until it is done.
+    //
+    // If the file is not cached, the caller must generate it under
+    // the name returned by get_temp_filename and then call insert,
+    // or call cancel if it fails.  Until then, lookups of the file
+    // by other threads wait.
+    //
+    // Parameters:
+    //   filename  the full name of the cached file
+    //
+    // Returns:
+    //   true if the file is cached and intact, false otherwise.
+    bool
+    lookup(const std::wstring filename)
+    {
+        bool found = false;
+        uint64_t size;
+        std::wstring name = get_entry_name(filename);
+        entry_map::iterator it;
+
+        boost::unique_lock<boost::mutex> wait_lock(pending_mutex);
+
+        while (pending.find(name) != pending.end())
+        {
+            pending_done.wait(wait_lock);
+        }
+
+        {
+            boost::shared_lock<boost::shared_mutex> lock(index_mutex);
+
+            it = entries.find(name);
+
+            if (it != entries.end())
+            {
+                try
+                {
+                    size = boost::filesystem::file_size(filename);
+                    found = (size == it->second.size);
+                }
+                catch(boost::filesystem::filesystem_error)
+                {
+                    found = false;
+                }
+            }
+
+            boost::lock_guard<boost::mutex> touch(touch_mutex);
+
+            if (found)
+            {
+                it->second.last_access = (uint64_t)time(NULL);
+                hits++;
+            }
+            else
+            {
+                misses++;
+            }
+        }
+
+        // the caller generates the file
+        if (!found)
+        {
+            pending.insert(name);
+        }
+
+        return found;
+    }
+
+    // Returns a name to generate a cached file under.  The name is
+    // unique, so that a file is never read while it is written.
+    //
+    // Parameters:
+    //   filename  the full name of the cached file
+    //
+    // Returns:
+    //   The temporary filename in the temporary path.
+    std::wstring
+    get_temp_filename(const std::wstring filename)
+    {
+        boost::filesystem::path unique = boost::filesystem::unique_path(L"%%%%%%%%%%%%%%%%");
+
+        return filename + L"." + unique.wstring() + L".tmp";
+    }
+
+    // Adds a newly generated file to the cache, evicting least
+    // recently used files if the size limit is exceeded, and
+    // updates the index file.  The file is renamed from its
+    // temporary name, replacing the cached file in one step.
+    //
+    // Parameters:
+    //   filename       the full name of the cached file
+    //   temp_filename  the name the file was generated under
+    void
+    insert(const std::wstring filename,
+           const std::wstring temp_filename)
+    {
+        struct cache_entry_t entry;
+        std::wstring name = get_entry_name(filename);
+        entry_map::iterator it;
+
+        try
+        {
+            entry.size = boost::filesystem::file_size(temp_filename);
+            boost::filesystem::rename(temp_filename, filename);
+        }
+        catch(boost::filesystem::filesystem_error)
+        {
+            cancel(filename, temp_filename);
+            return;
+        }
+
+        entry.last_access = (uint64_t)time(NULL);
+
+        {
+            boost::unique_lock<boost::shared_mutex> lock(index_mutex);
+
+            it = entries.find(name);
+
+            if (it != entries.end())
+            {
+                total_size -= it->second.size;
+            }
+
+            entries[name] = entry;
+            total_size += entry.size;
+
+            evict(name);
+
+            // keep the index on disk current in case the
+            // session does not end cleanly
+            write_index();
+        }
+
+        finish(name);
+    }
+
+    // Gives up generating a file after lookup did not find it.
+    // A partially written file is deleted.
+    //
+    // Parameters:
+    //   filename       the full name of the cached file
+    //   temp_filename  the name the file was generated under
+    void
+    cancel(const std::wstring filename,
+           const std::wstring temp_filename)
+    {
+        try
+        {
+            boost::filesystem::remove(temp_filename);
+        }
+        catch(boost::filesystem::filesystem_error)
+        {
+        }
+
+        finish(get_entry_name(filename));
+    }
+
+    // Removes a file from the cache and deletes it.
+    //
+    // Parameters:
+    //   filename  the full name of the cached file
+    void
+    remove(const std::wstring filename)
+    {
+        entry_map::iterator it;
+
+        boost::unique_lock<boost::shared_mutex> lock(index_mutex);
+
+        it = entries.find(get_entry_name(filename));
+
+        if (it != entries.end())
+        {
+            total_size -= it->second.size;
+            entries.erase(it);
+        }
+
+        try
+        {
+            boost::filesystem::remove(filename);
+        }
+        catch(boost::filesystem::filesystem_error)
+        {
+        }
+
+        prune_sources();
+    }
+
+    // Sets the limit for the total size of cached files.
+    //
+    // Parameters:
+    //   size  the size limit in bytes
+    void
+    set_max_size(uint64_t size)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(index_mutex);
+
+        max_size = size;
+        evict(L"");
+    }
+
+    // Returns cache usage statistics.
+    //
+    // Parameters:
+    //   stats  returns the statistics
+    void
+    get_stats(struct cache_stats_t *stats)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(index_mutex);
+        boost::lock_guard<boost::mutex> touch(touch_mutex);
+
+        stats->hits = hits;
+        stats->misses = misses;
+        stats->evictions = evictions;
+        stats->size = total_size;
+        stats->max_size = max_size;
+        stats->n_entries = (int)entries.size();
+    }
+
+    // Loads the cache index saved by a previous session.  Entries
+    // whose files are missing or modified are dropped, and files in
+    // the temporary path that are not indexed are deleted.
+    //
+    // Returns:
+    //   true if successful, false otherwise.
+    bool
+    load()
+    {
+        std::string line;
+        std::string type;
+        std::string name;
+        std::wstring temp_path;
+        struct cache_entry_t entry;
+        struct source_entry_t source;
+        entry_map::iterator it;
+
+        boost::unique_lock<boost::shared_mutex> lock(index_mutex);
+
+        entries.clear();
+        sources.clear();
+        total_size = 0;
+
+        boost::filesystem::ifstream file(boost::filesystem::path(bfir_path::append_temp_path(CACHE_INDEX_FILENAME)));
+
+        while (file.is_open() && std::getline(file, line))
+        {
+            std::istringstream in(line);
+
+            std::getline(in, type, '\t');
+            std::getline(in, name, '\t');
+
+            if (type == "E")
+            {
+                in >> entry.size >> entry.last_access;
+
+                if (!in.fail())
+                {
+                    entries[util::str2wstr(name)] = entry;
+                }
+            }
+            else if (type == "S")
+            {
+                in >> source.size >> source.mtime >> std::hex >> source.hash;
+
+                if (!in.fail())
+                {
+                    sources[util::str2wstr(name)] = source;
+                }
+            }
+        }
+
+        file.close();
+
+        // verify the indexed files
+        for (it = entries.begin(); it != entries.end(); )
+        {
+            try
+            {
+                if (boost::filesystem::file_size(bfir_path::append_temp_path(it->first)) == it->second.size)
+                {
+                    total_size += it->second.size;
+                    it++;
+                    continue;
+                }
+            }
+            catch(boost::filesystem::filesystem_error)
+            {
+            }
+
+            entries.erase(it++);
+        }
+
+        // remove files that are not indexed
+        temp_path = bfir_path::append_temp_path(L"");
+
+        try
+        {
+            boost::filesystem::directory_iterator end;
+
+            for (boost::filesystem::directory_iterator dir(temp_path); dir != end; dir++)
+            {
+                // temporary files are left over from generations
+                // that did not finish
+                if (((dir->path().extension() == L".wav") &&
+                     (entries.find(dir->path().filename().wstring()) == entries.end())) ||
+                    (dir->path().extension() == L".tmp"))
+                {
+                    boost::filesystem::remove(dir->path());
+                }
+            }
+        }
+        catch(boost::filesystem::filesystem_error)
+        {
+        }
+
+        evict(L"");
+
+        return true;
+    }
+
+    // Saves the cache index so that cached files survive
+    // to the next session.
+    //
+    // Returns:
+    //   true if successful, false otherwise.
+    bool
+    save()
+    {
+        boost::unique_lock<boost::shared_mutex> lock(index_mutex);
+
+        return write_index();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _CACHE_HPP_
+#define _CACHE_HPP_
+
+#include <string>
+#include <stdint.h>
+
+// default limit for the total size of cached files
+#define CACHE_DEFAULT_MAX_SIZE  ((uint64_t)1024 * 1024 * 1024)
+
+// seed for cache keys
+#define CACHE_KEY_SEED          0xcbf29ce484222325ULL
+
+struct cache_stats_t
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t size;
+    uint64_t max_size;
+    int n_entries;
+};
+
+namespace cache
+{
+    uint64_t
+    hash_data(const void *data,
+              size_t size,
+              uint64_t seed);
+
+    uint64_t
+    hash_string(const std::wstring str,
+                uint64_t seed);
+
+    bool
+    hash_file(const std::wstring filename,
+              uint64_t *hash);
+
+    std::wstring
+    get_filename(const std::wstring prefix,
+                 uint64_t key);
+
+    bool
+    lookup(const std::wstring filename);
+
+    std::wstring
+    get_temp_filename(const std::wstring filename);
+
+    void
+    insert(const std::wstring filename,
+           const std::wstring temp_filename);
+
+    void
+    cancel(const std::wstring filename,
+           const std::wstring temp_filename);
+
+    void
+    remove(const std::wstring filename);
+
+    void
+    set_max_size(uint64_t max_size);
+
+    void
+    get_stats(struct cache_stats_t *stats);
+
+    bool
+    load();
+
+    bool
+    save();
+}
+
+#endif
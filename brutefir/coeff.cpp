@@ -5,21 +5,81 @@
  * This program is open source. For license terms, see the LICENSE file.
  *
  */
-#include <malloc.h>
 #include <string.h>
-#include <io.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include "global.h"
 #include "coeff.hpp"
 #include "fftw_convolver.hpp"
 #include "raw2real.hpp"
 #include "buffer.hpp"
+#include "mapped_file.hpp"
 #include "pinfo.h"
 
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_IEEE_FLOAT 0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
 namespace coeff
 {
+    // Reads a 16-bit value from a RIFF (little endian) or
+    // RIFX (big endian) header.
+    static uint16_t
+    read_u16(const uint8_t *p,
+             bool big_endian)
+    {
+        return big_endian ? (uint16_t)((p[0] << 8) | p[1])
+                          : (uint16_t)((p[1] << 8) | p[0]);
+    }
+
+    // Reads a 32-bit value from a RIFF (little endian) or
+    // RIFX (big endian) header.
+    static uint32_t
+    read_u32(const uint8_t *p,
+             bool big_endian)
+    {
+        return big_endian
+            ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]
+            : ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+    }
+
+    // Converts frames of a single channel of mapped sample data
+    // into the "float" format. Integer samples are not normalized.
+    //
+    // Parameters:
+    //   mc        the mapped coefficient data
+    //   channel   the channel to convert
+    //   offset    the first frame to convert
+    //   n_frames  the number of frames to convert
+    //   realsize  the "float" size
+    //   realbuf   the destination buffer
+    static void
+    convert_mapped_frames(struct mapped_coeff_t *mc,
+                          int channel,
+                          int offset,
+                          int n_frames,
+                          int realsize,
+                          void *realbuf)
+    {
+        uint8_t *rawbuf;
+
+        rawbuf = (uint8_t *)mc->data +
+                 ((size_t)offset * mc->n_channels + channel) * mc->sf.bytes;
+
+        if (realsize == 4)
+        {
+            raw2real::raw2realf(realbuf, rawbuf, mc->sf.bytes, (mc->sf.bytes - mc->sf.sbytes) << 3,
+                                mc->sf.isfloat, mc->n_channels, mc->sf.swap, n_frames);
+        }
+        else
+        {
+            raw2real::raw2reald(realbuf, rawbuf, mc->sf.bytes, (mc->sf.bytes - mc->sf.sbytes) << 3,
+                                mc->sf.isfloat, mc->n_channels, mc->sf.swap, n_frames);
+        }
+    }
+
     // Returns a coefficient set representing a dirac impulse.
     //
     // Parameters:
@@ -160,9 +220,47 @@ namespace coeff
         int n_items;
         uint8_t *rawbuf = NULL;
         uint8_t *curp = NULL;
-        void *realbuf;
+        void *realbuf = NULL;
         FILE *file;
         errno_t err;
+        mapped_file mapping;
+        struct mapped_coeff_t mc;
+
+        // convert straight from a mapping of the file when possible
+        if (mapping.open(filename))
+        {
+            mc.data = mapping.data();
+            mc.n_channels = 1;
+            mc.n_frames = (int)(mapping.size() / sf->bytes);
+            mc.sampling_rate = 0;
+            mc.sf = *sf;
+
+            if (max_length > 0 && mc.n_frames > max_length)
+            {
+                mc.n_frames = max_length;
+            }
+
+            *length = mc.n_frames;
+            realbuf = _aligned_malloc((*length) * realsize, ALIGNMENT);
+            convert_mapped_frames(&mc, 0, 0, *length, realsize, realbuf);
+
+            if (realsize == 4)
+            {
+                for (n_items = 0; n_items < *length; n_items++)
+                {
+                    ((float *)realbuf)[n_items] *= (float)sf->scale;
+                }
+            }
+            else
+            {
+                for (n_items = 0; n_items < *length; n_items++)
+                {
+                    ((double *)realbuf)[n_items] *= sf->scale;
+                }
+            }
+
+            return realbuf;
+        }
 
         err = _wfopen_s(&file, filename, L"rb");
         if (err == 0)
@@ -227,11 +325,139 @@ namespace coeff
         return realbuf;
     }
 
+    // Parses the header of a mapped uncompressed WAV file
+    // (PCM 16/24/32-bit or IEEE float 32/64-bit, RIFF or RIFX).
+    //
+    // Parameters:
+    //   file  the mapped file
+    //   mc    returns the location and format of the sample data
+    //
+    // Returns:
+    //   true if the sample data can be converted directly from
+    //   the mapping, otherwise false.
+    bool
+    map_snd_coeff(mapped_file *file,
+                  struct mapped_coeff_t *mc)
+    {
+        const uint8_t *p;
+        uint64_t size, pos, body, chunk_size, data_size = 0;
+        bool big_endian;
+        bool fmt_found = false;
+        int tag = 0, n_channels = 0, block_align = 0, bytes;
+
+        p = file->data();
+        size = file->size();
+        mc->data = NULL;
+
+        if (p == NULL || size < 12 || memcmp(&p[8], "WAVE", 4) != 0)
+        {
+            return false;
+        }
+
+        if (memcmp(p, "RIFF", 4) == 0)
+        {
+            big_endian = false;
+        }
+        else if (memcmp(p, "RIFX", 4) == 0)
+        {
+            big_endian = true;
+        }
+        else
+        {
+            return false;
+        }
+
+        for (pos = 12; pos + 8 <= size; pos = body + chunk_size + (chunk_size & 1))
+        {
+            chunk_size = read_u32(&p[pos + 4], big_endian);
+            body = pos + 8;
+
+            if (memcmp(&p[pos], "fmt ", 4) == 0)
+            {
+                if (chunk_size < 16 || chunk_size > size - body)
+                {
+                    return false;
+                }
+
+                tag = read_u16(&p[body], big_endian);
+                n_channels = read_u16(&p[body + 2], big_endian);
+                mc->sampling_rate = (int)read_u32(&p[body + 4], big_endian);
+                block_align = read_u16(&p[body + 12], big_endian);
+
+                // the sub format GUID begins with the format tag
+                if (tag == WAV_FORMAT_EXTENSIBLE && chunk_size >= 40)
+                {
+                    tag = read_u16(&p[body + 24], big_endian);
+                }
+
+                fmt_found = true;
+            }
+            else if (memcmp(&p[pos], "data", 4) == 0)
+            {
+                // the size of files still being written may be unset
+                data_size = (chunk_size > size - body) ? size - body : chunk_size;
+                mc->data = &p[body];
+                break;
+            }
+        }
+
+        if (!fmt_found || mc->data == NULL || n_channels <= 0 ||
+            block_align % n_channels != 0)
+        {
+            return false;
+        }
+
+        bytes = block_align / n_channels;
+
+        mc->sf.isfloat = (tag == WAV_FORMAT_IEEE_FLOAT);
+        mc->sf.bytes = bytes;
+        mc->sf.sbytes = bytes;
+    #ifdef __BIG_ENDIAN__
+        mc->sf.swap = !big_endian;
+    #else
+        mc->sf.swap = big_endian;
+    #endif
+
+        if (tag == WAV_FORMAT_IEEE_FLOAT && (bytes == 4 || bytes == 8))
+        {
+            mc->sf.scale = 1.0;
+            mc->sf.format = (bytes == 4)
+                ? (big_endian ? BF_SAMPLE_FORMAT_FLOAT_BE : BF_SAMPLE_FORMAT_FLOAT_LE)
+                : (big_endian ? BF_SAMPLE_FORMAT_FLOAT64_BE : BF_SAMPLE_FORMAT_FLOAT64_LE);
+        }
+        else if (tag == WAV_FORMAT_PCM && bytes >= 2 && bytes <= 4)
+        {
+            // normalize to the same range libsndfile returns
+            mc->sf.scale = 1.0 / (double)(1U << ((bytes << 3) - 1));
+            mc->sf.format = (bytes == 2)
+                ? (big_endian ? BF_SAMPLE_FORMAT_S16_BE : BF_SAMPLE_FORMAT_S16_LE)
+                : (bytes == 3)
+                ? (big_endian ? BF_SAMPLE_FORMAT_S24_BE : BF_SAMPLE_FORMAT_S24_LE)
+                : (big_endian ? BF_SAMPLE_FORMAT_S32_BE : BF_SAMPLE_FORMAT_S32_LE);
+        }
+        else
+        {
+            // 8-bit (unsigned) and compressed data is left to libsndfile
+            return false;
+        }
+
+        if (data_size / block_align == 0 || data_size / block_align > INT_MAX)
+        {
+            return false;
+        }
+
+        mc->n_channels = n_channels;
+        mc->n_frames = (int)(data_size / block_align);
+
+        return true;
+    }
+
     // Processes the specified coefficient sound file and
     // returns a coefficient set for each channel.
     //
-    // Supported formats are any that the libsndfile library
-    // can process.
+    // Uncompressed WAV files are mapped into memory and converted
+    // directly into the per-channel buffers. Other formats are
+    // read with the libsndfile library.
     //
     // Parameters:
     //   filename    the filename to load
@@ -249,10 +475,52 @@ namespace coeff
                    int max_length,
                    int *n_coeffs)
     {
+        int n, i;
         int n_channels;
         int n_frames;
         void *buffer;
         void **coeffs = NULL;
+        mapped_file mapping;
+        struct mapped_coeff_t mc;
+
+        if (mapping.open(filename) && map_snd_coeff(&mapping, &mc))
+        {
+            n_frames = (max_length > 0 && mc.n_frames > max_length) ? max_length : mc.n_frames;
+            coeffs = (void **)_aligned_malloc(mc.n_channels * sizeof(void *), ALIGNMENT);
+
+            for (n = 0; n < mc.n_channels; n++)
+            {
+                coeffs[n] = _aligned_malloc(n_frames * realsize, ALIGNMENT);
+                convert_mapped_frames(&mc, n, 0, n_frames, realsize, coeffs[n]);
+
+                if (mc.sf.scale == 1.0)
+                {
+                    continue;
+                }
+
+                if (realsize == 4)
+                {
+                    for (i = 0; i < n_frames; i++)
+                    {
+                        ((float *)coeffs[n])[i] *= (float)mc.sf.scale;
+                    }
+                }
+                else
+                {
+                    for (i = 0; i < n_frames; i++)
+                    {
+                        ((double *)coeffs[n])[i] *= mc.sf.scale;
+                    }
+                }
+            }
+
+            *length = n_frames;
+            *n_coeffs = mc.n_channels;
+
+            return coeffs;
+        }
+
+        mapping.close();
 
         buffer = buffer::load_from_snd_file(filename,
                                             &n_channels,
@@ -276,6 +544,111 @@ namespace coeff
         return coeffs;
     }
 
+    // Preprocesses a single filter block of a channel of mapped
+    // coefficient data in preparation for convolution.
+    //
+    // Parameters:
+    //   convolver      an instance of the convolver to use
+    //   mc             the mapped coefficient data
+    //   channel        the channel to process
+    //   block          the index of the filter block
+    //   filter_length  the length of filter blocks
+    //   realsize       the "float" size
+    //   scale          the scale factor to apply
+    //   realbuf        a scratch buffer of filter_length samples
+    //
+    // Returns:
+    //   The preprocessed coefficient block, or NULL on error.
+    void *
+    preprocess_mapped_block(fftw_convolver *convolver,
+                            struct mapped_coeff_t *mc,
+                            int channel,
+                            int block,
+                            int filter_length,
+                            int realsize,
+                            double scale,
+                            void *realbuf)
+    {
+        int count;
+
+        count = mc->n_frames - block * filter_length;
+        count = (count < 0) ? 0 : (count > filter_length) ? filter_length : count;
+
+        if (count > 0)
+        {
+            convert_mapped_frames(mc, channel, block * filter_length, count, realsize, realbuf);
+        }
+
+        // the integer normalization is folded into the block scale
+        return convolver->convolver_coeffs2cbuf(realbuf,
+                                                count,
+                                                scale * mc->sf.scale,
+                                                NULL);
+    }
+
+    // Preprocesses a channel of mapped coefficient data in preparation
+    // for convolution. Each filter block is converted from the mapping
+    // and transformed in turn so no full-length copy is made.
+    //
+    // Parameters:
+    //   convolver      an instance of the convolver to use
+    //   mc             the mapped coefficient data
+    //   channel        the channel to process
+    //   filter_length  the length of filter blocks to split coefficients into
+    //   coeff_blocks   the number of blocks to split coefficients into
+    //   realsize       the "float" size
+    //   scale          the scale factor to apply
+    //
+    // Returns:
+    //   Buffers containing preprocessed coefficient blocks, or NULL
+    //   on error.
+    void **
+    preprocess_mapped_coeff(fftw_convolver *convolver,
+                            struct mapped_coeff_t *mc,
+                            int channel,
+                            int filter_length,
+                            int coeff_blocks,
+                            int realsize,
+                            double scale)
+    {
+        int n, i;
+        void *realbuf;
+        void **cbuf;
+
+        cbuf = (void **) _aligned_malloc(coeff_blocks * sizeof(void *), ALIGNMENT);
+        realbuf = _aligned_malloc(filter_length * realsize, ALIGNMENT);
+
+        for (n = 0; n < coeff_blocks; n++)
+        {
+            cbuf[n] = preprocess_mapped_block(convolver,
+                                              mc,
+                                              channel,
+                                              n,
+                                              filter_length,
+                                              realsize,
+                                              scale,
+                                              realbuf);
+
+            if (cbuf[n] == NULL)
+            {
+                pinfo("Failed to preprocess coefficient block %u.", n);
+
+                for (i = 0; i < n; i++)
+                {
+                    _aligned_free(cbuf[i]);
+                }
+
+                _aligned_free(cbuf);
+                cbuf = NULL;
+                break;
+            }
+        }
+
+        _aligned_free(realbuf);
+
+        return cbuf;
+    }
+
     // Preprocesses a coefficient set in preparation for convolution.
     //
     // Parameters:
@@ -10,6 +10,18 @@
 
 #include "global.h"
 #include "fftw_convolver.hpp"
+#include "mapped_file.hpp"
+
+// Describes the sample data of an uncompressed coefficient
+// file which is mapped into memory.
+struct mapped_coeff_t
+{
+    const uint8_t *data;
+    int n_channels;
+    int n_frames;
+    int sampling_rate;
+    struct sample_format_t sf;
+};
 
 namespace coeff
 {
@@ -38,6 +50,29 @@ namespace coeff
                    int max_length,
                    int *n_coeffs);
 
+    bool
+    map_snd_coeff(mapped_file *file,
+                  struct mapped_coeff_t *mc);
+
+    void *
+    preprocess_mapped_block(fftw_convolver *convolver,
+                            struct mapped_coeff_t *mc,
+                            int channel,
+                            int block,
+                            int filter_length,
+                            int realsize,
+                            double scale,
+                            void *realbuf);
+
+    void **
+    preprocess_mapped_coeff(fftw_convolver *convolver,
+                            struct mapped_coeff_t *mc,
+                            int channel,
+                            int filter_length,
+                            int coeff_blocks,
+                            int realsize,
+                            double scale);
+
     void **
     preprocess_coeff(fftw_convolver *convolver,
                      void *coeffs,
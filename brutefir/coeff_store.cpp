@@ -0,0 +1,444 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#include <string.h>
+#include <map>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "global.h"
+#include "coeff_store.hpp"
+#include "fftw_convolver.hpp"
+#include "mapped_file.hpp"
+#include "coeff.hpp"
+#include "cache.hpp"
+#include "atomic.h"
+#include "pinfo.h"
+
+namespace coeff_store
+{
+    typedef std::map<uint64_t, struct coeff_set_t *> set_map;
+
+    // sets that new engines may share, keyed by their contents
+    static set_map sets;
+
+    // all sets, including failed sets still referenced by engines
+    static int n_sets = 0;
+    static int n_references = 0;
+    static uint64_t total_size = 0;
+
+    // guards the index, reference counts and load states
+    static boost::mutex store_mutex;
+
+    // signalled when a set has finished loading
+    static boost::condition_variable loaded;
+
+    // Removes a set from the index so that no new engine shares it.
+    // The store must be locked.
+    //
+    // Parameters:
+    //   set  the coefficient set
+    static void
+    unindex(struct coeff_set_t *set)
+    {
+        set_map::iterator it;
+
+        if (!set->indexed)
+        {
+            return;
+        }
+
+        it = sets.find(set->key);
+
+        if ((it != sets.end()) && (it->second == set))
+        {
+            sets.erase(it);
+        }
+
+        set->indexed = false;
+    }
+
+    // Marks a set as loaded and wakes the engines waiting for it.
+    // A set that failed to load is removed from the index so the
+    // next engine loads it again.
+    //
+    // Parameters:
+    //   set      the coefficient set
+    //   success  true if all blocks were loaded
+    static void
+    finish(struct coeff_set_t *set,
+           bool success)
+    {
+        boost::lock_guard<boost::mutex> lock(store_mutex);
+
+        set->complete = true;
+        set->failed = !success;
+
+        if (!success)
+        {
+            unindex(set);
+        }
+
+        loaded.notify_all();
+    }
+
+    // Transforms one block of all channels of a set, publishing
+    // the block of each channel once it is ready.
+    //
+    // Parameters:
+    //   set        the coefficient set
+    //   convolver  the convolver used for the transforms
+    //   mc         the mapped coefficient data
+    //   scale      the scaling factor
+    //   realbuf    a buffer of filter_length reals
+    //   block      the block
+    //
+    // Returns:
+    //   true if successful, false if aborted or on error.
+    static bool
+    load_block(struct coeff_set_t *set,
+               fftw_convolver *convolver,
+               struct mapped_coeff_t *mc,
+               double scale,
+               void *realbuf,
+               int block)
+    {
+        int n;
+        void *data;
+
+        for (n = 0; n < set->n_channels; n++)
+        {
+            if (atomic_load(&set->loader_abort) != 0)
+            {
+                return false;
+            }
+
+            data = coeff::preprocess_mapped_block(convolver,
+                                                  mc,
+                                                  n,
+                                                  block,
+                                                  set->filter_length,
+                                                  set->realsize,
+                                                  scale,
+                                                  realbuf);
+
+            if (data == NULL)
+            {
+                pinfo("Error preprocessing coefficient %u block %u.", n, block);
+                return false;
+            }
+
+            set->data[n][block] = data;
+            atomic_store(&set->ready_blocks[n], block + 1);
+        }
+
+        return true;
+    }
+
+    // Loads one block of a set as a background pool task and queues
+    // the next block, so that engine blocks waiting in the pool run
+    // between the blocks of a long filter.  The first task creates
+    // the convolver of the load, the last one frees it.
+    //
+    // Parameters:
+    //   set        the coefficient set
+    //   mapping    the mapped file, deleted by the last task
+    //   mc         the mapped coefficient data
+    //   scale      the scaling factor
+    //   convolver  the convolver of the load, or NULL for the first task
+    //   realbuf    a buffer of filter_length reals, or NULL for the first task
+    //   block      the block
+    static void
+    load_task(struct coeff_set_t *set,
+              mapped_file *mapping,
+              struct mapped_coeff_t mc,
+              double scale,
+              fftw_convolver *convolver,
+              void *realbuf,
+              int block)
+    {
+        bool success = true;
+
+        if (convolver == NULL)
+        {
+            convolver = new fftw_convolver(set->filter_length, set->realsize, NULL);
+            realbuf = _aligned_malloc(set->filter_length * set->realsize, ALIGNMENT);
+        }
+
+        if (block < set->n_blocks)
+        {
+            success = load_block(set, convolver, &mc, scale, realbuf, block);
+        }
+
+        if (success && (block + 1 < set->n_blocks))
+        {
+            thread_pool::submit(&set->loader, boost::bind(&load_task,
+                                                          set,
+                                                          mapping,
+                                                          mc,
+                                                          scale,
+                                                          convolver,
+                                                          realbuf,
+                                                          block + 1));
+            return;
+        }
+
+        _aligned_free(realbuf);
+        delete convolver;
+        delete mapping;
+
+        finish(set, success);
+    }
+
+    // Calculates the key of a set of coefficients loaded from a file.
+    //
+    // Parameters:
+    //   filename       the coefficient filename
+    //   filter_length  the length of filter blocks
+    //   realsize       the "float" size
+    //   n_blocks       the number of filter blocks
+    //   scale          the scaling factor
+    //   key            returns the key
+    //
+    // Returns:
+    //   true if successful, false if the file could not be read.
+    bool
+    get_key(const wchar_t *filename,
+            int filter_length,
+            int realsize,
+            int n_blocks,
+            double scale,
+            uint64_t *key)
+    {
+        if (!cache::hash_file(filename, key))
+        {
+            return false;
+        }
+
+        *key = cache::hash_data(&filter_length, sizeof(filter_length), *key);
+        *key = cache::hash_data(&realsize, sizeof(realsize), *key);
+        *key = cache::hash_data(&n_blocks, sizeof(n_blocks), *key);
+        *key = cache::hash_data(&scale, sizeof(scale), *key);
+
+        return true;
+    }
+
+    // Takes a reference to the set with the given key, creating an
+    // empty set if there is none.  The engine that creates a set
+    // must load it with load() or load_async().
+    //
+    // Parameters:
+    //   key            the key of the set
+    //   n_channels     the number of channels
+    //   n_blocks       the number of filter blocks
+    //   filter_length  the length of filter blocks
+    //   realsize       the "float" size
+    //   created        returns true if the set was created
+    //
+    // Returns:
+    //   The coefficient set.
+    struct coeff_set_t *
+    acquire(uint64_t key,
+            int n_channels,
+            int n_blocks,
+            int filter_length,
+            int realsize,
+            bool *created)
+    {
+        int n;
+        struct coeff_set_t *set;
+        set_map::iterator it;
+
+        boost::lock_guard<boost::mutex> lock(store_mutex);
+
+        it = sets.find(key);
+
+        if (it != sets.end())
+        {
+            it->second->refcount++;
+            n_references++;
+
+            *created = false;
+            return it->second;
+        }
+
+        set = new coeff_set_t();
+
+        set->key = key;
+        set->refcount = 1;
+        set->indexed = true;
+        set->complete = false;
+        set->failed = false;
+        set->n_channels = n_channels;
+        set->n_blocks = n_blocks;
+        set->filter_length = filter_length;
+        set->realsize = realsize;
+        set->loader_abort = 0;
+
+        thread_pool::init_group(&set->loader, POOL_PRIORITY_BACKGROUND);
+
+        for (n = 0; n < BF_MAXCHANNELS; n++)
+        {
+            set->data[n] = NULL;
+            set->ready_blocks[n] = 0;
+        }
+
+        for (n = 0; n < n_channels; n++)
+        {
+            set->data[n] = (void **) _aligned_malloc(n_blocks * sizeof(void *), ALIGNMENT);
+            memset(set->data[n], 0, n_blocks * sizeof(void *));
+        }
+
+        sets.insert(std::make_pair(key, set));
+
+        n_sets++;
+        n_references++;
+        total_size += (uint64_t)n_channels * n_blocks * 2 * filter_length * realsize;
+
+        *created = true;
+        return set;
+    }
+
+    // Loads the blocks of a newly created set on the calling thread.
+    //
+    // Parameters:
+    //   set        the coefficient set
+    //   convolver  the convolver used for the transforms
+    //   mc         the mapped coefficient data
+    //   scale      the scaling factor
+    //
+    // Returns:
+    //   true if successful, false otherwise.
+    bool
+    load(struct coeff_set_t *set,
+         fftw_convolver *convolver,
+         struct mapped_coeff_t mc,
+         double scale)
+    {
+        int i;
+        bool success = true;
+        void *realbuf;
+
+        realbuf = _aligned_malloc(set->filter_length * set->realsize, ALIGNMENT);
+
+        for (i = 0; (i < set->n_blocks) && success; i++)
+        {
+            success = load_block(set, convolver, &mc, scale, realbuf, i);
+        }
+
+        _aligned_free(realbuf);
+
+        finish(set, success);
+
+        return success;
+    }
+
+    // Loads the blocks of a newly created set in the background on
+    // the thread pool.  Engines use each block as soon as it is
+    // published.
+    //
+    // Parameters:
+    //   set      the coefficient set
+    //   mapping  the mapped file, the loader takes ownership
+    //   mc       the mapped coefficient data
+    //   scale    the scaling factor
+    void
+    load_async(struct coeff_set_t *set,
+               mapped_file *mapping,
+               struct mapped_coeff_t mc,
+               double scale)
+    {
+        thread_pool::submit(&set->loader, boost::bind(&load_task,
+                                                      set,
+                                                      mapping,
+                                                      mc,
+                                                      scale,
+                                                      (fftw_convolver *)NULL,
+                                                      (void *)NULL,
+                                                      0));
+    }
+
+    // Waits until a set has finished loading.
+    //
+    // Parameters:
+    //   set  the coefficient set
+    //
+    // Returns:
+    //   true if all blocks were loaded, false on error.
+    bool
+    wait(struct coeff_set_t *set)
+    {
+        boost::unique_lock<boost::mutex> lock(store_mutex);
+
+        while (!set->complete)
+        {
+            loaded.wait(lock);
+        }
+
+        return !set->failed;
+    }
+
+    // Drops a reference to a set.  The last reference stops the
+    // loader and frees the blocks.
+    //
+    // Parameters:
+    //   set  the coefficient set
+    void
+    release(struct coeff_set_t *set)
+    {
+        int n, i;
+
+        {
+            boost::lock_guard<boost::mutex> lock(store_mutex);
+
+            n_references--;
+
+            if (--set->refcount > 0)
+            {
+                return;
+            }
+
+            unindex(set);
+
+            n_sets--;
+            total_size -= (uint64_t)set->n_channels * set->n_blocks * 2 * set->filter_length * set->realsize;
+        }
+
+        atomic_store(&set->loader_abort, 1);
+        thread_pool::wait(&set->loader);
+
+        for (n = 0; n < set->n_channels; n++)
+        {
+            for (i = 0; i < set->n_blocks; i++)
+            {
+                if (set->data[n][i] != NULL)
+                {
+                    _aligned_free(set->data[n][i]);
+                }
+            }
+
+            _aligned_free(set->data[n]);
+        }
+
+        delete set;
+    }
+
+    // Gets the statistics of the store.
+    //
+    // Parameters:
+    //   stats  returns the statistics
+    void
+    get_stats(struct coeff_store_stats_t *stats)
+    {
+        boost::lock_guard<boost::mutex> lock(store_mutex);
+
+        stats->n_sets = n_sets;
+        stats->n_references = n_references;
+        stats->size = total_size;
+    }
+}
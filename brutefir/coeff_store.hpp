@@ -0,0 +1,91 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _COEFF_STORE_HPP_
+#define _COEFF_STORE_HPP_
+
+#include <stdint.h>
+
+#include "global.h"
+#include "thread_pool.hpp"
+
+class fftw_convolver;
+class mapped_file;
+struct mapped_coeff_t;
+
+// A set of transformed coefficient blocks shared by all engines
+// that filter with the same coefficients.  Engines only read the
+// blocks, each block is published by raising the ready count of
+// its channel once it has been transformed.
+struct coeff_set_t
+{
+    uint64_t key;
+    int refcount;
+    bool indexed;           // new engines may still share the set
+    bool complete;          // loading has finished or failed
+    bool failed;
+
+    int n_channels;
+    int n_blocks;
+    int filter_length;
+    int realsize;
+
+    void **data[BF_MAXCHANNELS];
+    volatile long ready_blocks[BF_MAXCHANNELS];
+
+    // background load, one block of all channels per pool task
+    struct pool_group_t loader;
+    volatile long loader_abort;
+};
+
+struct coeff_store_stats_t
+{
+    int n_sets;
+    int n_references;
+    uint64_t size;
+};
+
+namespace coeff_store
+{
+    bool
+    get_key(const wchar_t *filename,
+            int filter_length,
+            int realsize,
+            int n_blocks,
+            double scale,
+            uint64_t *key);
+
+    struct coeff_set_t *
+    acquire(uint64_t key,
+            int n_channels,
+            int n_blocks,
+            int filter_length,
+            int realsize,
+            bool *created);
+
+    bool
+    load(struct coeff_set_t *set,
+         fftw_convolver *convolver,
+         struct mapped_coeff_t mc,
+         double scale);
+
+    void
+    load_async(struct coeff_set_t *set,
+               mapped_file *mapping,
+               struct mapped_coeff_t mc,
+               double scale);
+
+    bool
+    wait(struct coeff_set_t *set);
+
+    void
+    release(struct coeff_set_t *set);
+
+    void
+    get_stats(struct coeff_store_stats_t *stats);
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _COMPAT_H_
+#define _COMPAT_H_
+
+/*
+ * The engine is written against the Microsoft C runtime. Other
+ * platforms get equivalents of the few runtime functions it uses
+ * that have no standard counterpart.
+ */
+#if defined(_MSC_VER)
+
+#include <malloc.h>
+#include <io.h>
+#include <float.h>
+
+#else
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <wchar.h>
+#include <alloca.h>
+#include <malloc.h>
+
+typedef int errno_t;
+
+#define _alloca(size) alloca(size)
+#define _finite(x) isfinite(x)
+
+static inline void *
+_aligned_malloc(size_t size, size_t alignment)
+{
+    void *p;
+
+    if (posix_memalign(&p, alignment, (size > 0) ? size : 1) != 0)
+    {
+        return NULL;
+    }
+
+    return p;
+}
+
+static inline void
+_aligned_free(void *p)
+{
+    free(p);
+}
+
+/*
+ * There is no aligned realloc, so the block is moved to a new
+ * aligned allocation. The usable size of the old block bounds
+ * the copy, it is at least the size it was allocated with.
+ */
+static inline void *
+_aligned_realloc(void *p, size_t size, size_t alignment)
+{
+    void *q;
+    size_t old_size;
+
+    if (p == NULL)
+    {
+        return _aligned_malloc(size, alignment);
+    }
+
+    if ((q = _aligned_malloc(size, alignment)) == NULL)
+    {
+        return NULL;
+    }
+
+    old_size = malloc_usable_size(p);
+    memcpy(q, p, (old_size < size) ? old_size : size);
+    free(p);
+
+    return q;
+}
+
+static inline errno_t
+fopen_s(FILE **stream, const char *filename, const char *mode)
+{
+    if ((*stream = fopen(filename, mode)) == NULL)
+    {
+        return errno;
+    }
+
+    return 0;
+}
+
+/*
+ * Wide paths are converted to the multibyte encoding of the
+ * current locale, which is UTF-8 on the systems this targets.
+ */
+static inline errno_t
+_wfopen_s(FILE **stream, const wchar_t *filename, const wchar_t *mode)
+{
+    char mbs_filename[4096];
+    char mbs_mode[16];
+
+    *stream = NULL;
+
+    if (wcstombs(mbs_filename, filename, sizeof(mbs_filename)) >= sizeof(mbs_filename) ||
+        wcstombs(mbs_mode, mode, sizeof(mbs_mode)) >= sizeof(mbs_mode))
+    {
+        errno = EINVAL;
+        return EINVAL;
+    }
+
+    return fopen_s(stream, mbs_filename, mbs_mode);
+}
+
+#endif
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
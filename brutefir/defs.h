@@ -13,11 +13,17 @@ extern "C" {
 #define _DEFS_H_
 
 #include "sysarch.h"
+#include "compat.h"
 
 #define inline __inline
 
+#if defined(_WIN32)
 #define PATH_SEPARATOR_CHAR L'\\'
 #define PATH_SEPARATOR_STR L"\\"
+#else
+#define PATH_SEPARATOR_CHAR L'/'
+#define PATH_SEPARATOR_STR L"/"
+#endif
 
 #endif
 
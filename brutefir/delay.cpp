@@ -7,7 +7,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <malloc.h>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -17,13 +16,28 @@
 #include "delay.hpp"
 #include "firwindow.h"
 #include "fftw_convolver.hpp"
-#include "timestamp.h"
 
 delay::delay()
     : subdelay_filter(NULL)
 {
 }
 
+delay::~delay()
+{
+    int n;
+
+    if (subdelay_filter != NULL)
+    {
+        for (n = -subdelay_step_count + 1; n < subdelay_step_count; n++)
+        {
+            _aligned_free(subdelay_filter[n]->coeffs);
+            free(subdelay_filter[n]);
+        }
+
+        free(&subdelay_filter[-subdelay_step_count]);
+    }
+}
+
 void
 delay::update(delaybuffer_t *db,
              void *buf,
@@ -54,10 +68,10 @@ delay::update(delaybuffer_t *db,
 }
 
 delaybuffer_t *
-delay_allocate_buffer(int fragment_size,
-                      int initdelay,
-                      int maxdelay,
-                      int sample_size)
+delay::allocate_buffer(int fragment_size,
+                       int initdelay,
+                       int maxdelay,
+                       int sample_size)
 {
     delaybuffer_t *db;
     int n, delay;
@@ -139,6 +153,74 @@ delay_allocate_buffer(int fragment_size,
     return db;
 }
 
+void
+delay::clear_buffer(delaybuffer_t *db,
+                    int sample_size)
+{
+    int n, size;
+
+    size = db->fragsize * sample_size;
+
+    for (n = 0; n < db->n_fbufs_cap; n++)
+    {
+        memset(db->fbufs[n], 0, size);
+    }
+
+    if (db->rbuf != NULL)
+    {
+        memset(db->rbuf, 0, db->n_rest * sample_size);
+    }
+
+    if (db->shortbuf[0] != NULL)
+    {
+        // short buffers fit the largest delay, at most a fragment
+        size = (db->maxdelay > 0) ? db->maxdelay : db->curdelay;
+
+        if (size > db->fragsize)
+        {
+            size = db->fragsize;
+        }
+
+        size *= sample_size;
+
+        memset(db->shortbuf[0], 0, size);
+        memset(db->shortbuf[1], 0, size);
+    }
+
+    db->curbuf = 0;
+}
+
+void
+delay::free_buffer(delaybuffer_t *db)
+{
+    int n;
+
+    if (db == NULL)
+    {
+        return;
+    }
+
+    for (n = 0; n < db->n_fbufs_cap; n++)
+    {
+        _aligned_free(db->fbufs[n]);
+    }
+
+    free(db->fbufs);
+
+    if (db->rbuf != NULL)
+    {
+        _aligned_free(db->rbuf);
+    }
+
+    if (db->shortbuf[0] != NULL)
+    {
+        _aligned_free(db->shortbuf[0]);
+        _aligned_free(db->shortbuf[1]);
+    }
+
+    free(db);
+}
+
 int
 delay::subsample_filterblocksize(void)
 {
@@ -149,20 +231,20 @@ void
 delay::subsample_update(fftw_convolver *convolver,
                         void *buf,
                         void *rest,
+                        void *buffer, // 2 x filterblocksize
                         int subdelay)
 {
     void *cbuf_low, *cbuf_high, *cbuffer;
     int i, blocksize;
-    uint64_t t1, t2;
 
     if (subdelay <= -subdelay_step_count || subdelay >= subdelay_step_count)
     {
         return;
     }
 
-    timestamp(&t1);
+    // the FFTW plans are made for aligned buffers
     blocksize = subdelay_filterblock_size * realsize;
-    cbuffer = alloca(blocksize << 1);
+    cbuffer = buffer;
     cbuf_low = cbuffer;
     cbuf_high = &((uint8_t *)cbuf_low)[blocksize];
 
@@ -174,9 +256,6 @@ delay::subsample_update(fftw_convolver *convolver,
         convolver->convolver_td_convolve(subdelay_filter[subdelay], cbuffer);
         memcpy(&((uint8_t *)buf)[i], cbuf_low, blocksize);
     }
-
-    timestamp(&t2);
-    t2 -= t1;
 }
 
 bool
@@ -301,7 +380,7 @@ delay::sample_sinc(int half_length,
         }
     }
 
-    firwindow_kaiser(filter, filter_length, offset, 9, realsize);
+    firwindow_kaiser(filter, filter_length, offset, kaiser_beta, realsize);
     return filter;
 }
 
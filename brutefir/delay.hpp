@@ -33,6 +33,8 @@ class delay
 public:
     delay();
 
+    ~delay();
+
     // optional_target_buf has sample_spacing == 1
     void
     update(delaybuffer_t *db,
@@ -48,6 +50,13 @@ public:
                     int maxdelay,
                     int sample_size);
 
+    void
+    clear_buffer(delaybuffer_t *db,
+                 int sample_size);
+
+    void
+    free_buffer(delaybuffer_t *db);
+
     int
     subsample_filterblocksize(void);
 
@@ -55,6 +64,7 @@ public:
     subsample_update(fftw_convolver *convolver,
                      void *buf,
                      void *rest,
+                     void *buffer,
                      int subdelay);
 
     bool
@@ -4,211 +4,192 @@
  * This program is open source. For license terms, see the LICENSE file.
  *
  */
-#include <malloc.h>
 #include <string.h>
+#include <math.h>
 
 #include "global.h"
 #include "dither.hpp"
+#include "simd.hpp"
 #include "pinfo.h"
 
-// desired spacing between channels in random number table in seconds
-#define RANDTAB_SPACING 10
-#define MIN_RANDTAB_SPACING 1
-
 #define TAUSWORTHE(s,a,b,c,d) ((s & c) << d) ^ (((s <<a) ^ s) >> b)
 #define LCG(n) ((69069 * n) & 0xFFFFFFFFU)
 
+// the number of interleaved random number generators per channel
+#define TAUS_LANES 4
+
 dither::dither(int n_channels,
-               int sample_rate,
                int _realsize,
-               int max_size,
                int max_samples_per_loop,
                struct dither_state_t *dither_state)
-    : dither_randtab(NULL), dither_randmap(NULL), dither_randmap_ptr(NULL)
+    : dither_buffers(NULL)
 {
-    int n, spacing = RANDTAB_SPACING * sample_rate, minspacing;
+    int n, i, k, size;
     uint32_t state[3];
+    uint8_t *p;
 
     realsize = _realsize;
 
-    minspacing = 
-        (MIN_RANDTAB_SPACING * sample_rate > max_samples_per_loop) 
-            ? MIN_RANDTAB_SPACING * sample_rate 
-            : max_samples_per_loop;
-
-    if (spacing < minspacing)
-    {
-        spacing = minspacing;
-    }
+    // round up to complete groups of random numbers
+    max_samples_per_loop = (max_samples_per_loop + TAUS_LANES - 1) & ~(TAUS_LANES - 1);
+    size = max_samples_per_loop * (realsize + sizeof(int32_t));
 
-    if (max_size > 0)
-    {
-        if (n_channels * spacing > max_size)
-        {
-            spacing = max_size / n_channels;
-        }
-    }
+    dither_buffers = _aligned_malloc(n_channels * size, ALIGNMENT);
+    p = (uint8_t *)dither_buffers;
 
-    if (spacing < minspacing)
+    for (n = 0; n < n_channels; n++, p += size)
     {
-        pinfo("Maximum dither table size %d bytes is too small, must "
-              "at least be %d bytes.\n", max_size,
-              n_channels * sample_rate * minspacing);
-        throw;
-    }
-
-    dither_randtab_size = n_channels * spacing + 1;
+        memset(&dither_state[n], 0, sizeof(struct dither_state_t));
 
-    pinfo("Dither table size is %d bytes.\n"
-          "Generating random numbers.", dither_randtab_size);
+        dither_state[n].noise = p;
+        dither_state[n].samples = (int32_t *)&p[max_samples_per_loop * realsize];
 
-    tausinit(state, 0);
+        // each channel and lane has its own generator
+        for (i = 0; i < TAUS_LANES; i++)
+        {
+            tausinit(state, n * TAUS_LANES + i + 1);
 
-    dither_randtab = (int8_t *) _aligned_malloc(dither_randtab_size, ALIGNMENT);
+            for (k = 0; k < 3; k++)
+            {
+                dither_state[n].taus[k * TAUS_LANES + i] = state[k];
+            }
+        }
+    }
+}
 
-    for (n = 0; n < dither_randtab_size; n++)
+dither::~dither()
+{
+    if (dither_buffers != NULL)
     {
-        dither_randtab[n] = (int8_t)(tausrand(state) & 0x000000FF);
+        _aligned_free(dither_buffers);
+        dither_buffers = NULL;
     }
+}
 
-    // make a map for conversion of integer dither random numbers to
-    // floating point ranging from -1.0 to +1.0, plus an offset of +0.5,
-    // used to make the sample truncation be mid-tread requantisation
-    dither_randmap_ptr = _aligned_malloc(realsize * 511, ALIGNMENT);
-    dither_randmap = &((uint8_t *)dither_randmap_ptr)[256 * realsize];
+// Generates the high pass TPDF dither for the next loop. The
+// dither is the difference of consecutive 8-bit random numbers,
+// scaled to -1.0 to +1.0, plus an offset of +0.5 used to make the
+// sample truncation be mid-tread requantisation.
+void
+dither::dither_preloop_real2int_hp_tpdf(struct dither_state_t *state,
+                                        int samples_per_loop)
+{
+    uint32_t *s;
+    int32_t r;
+    int n, lane;
 
     if (realsize == 4)
     {
-        ((float *)dither_randmap)[-256] = -0.5;
-
-        for (n = -255; n < 254; n++)
+        if (simd::tpdf_noisef((float *)state->noise, state->taus, &state->rand, samples_per_loop))
         {
-            ((float *)dither_randmap)[n] =
-                0.5 + 1.0 / 255.0 + 1.0 / 255.0 * (float)n;
+            return;
         }
-
-        ((float *)dither_randmap)[254] = 1.5;
     }
     else
     {
-        ((double *)dither_randmap)[-256] = -0.5;
-        
-        for (n = -255; n < 254; n++)
+        if (simd::tpdf_noised((double *)state->noise, state->taus, &state->rand, samples_per_loop))
         {
-            ((double *)dither_randmap)[n] =
-                0.5 + 1.0 / 255.0 + 1.0 / 255.0 * (double)n;
+            return;
         }
-        
-        ((double *)dither_randmap)[254] = 1.5;
     }
 
-    for (n = 0; n < n_channels; n++)
+    for (n = 0; n < samples_per_loop; n++)
     {
-        memset(&dither_state[n], 0, sizeof(struct dither_state_t));
-        dither_state[n].randtab_ptr = n * spacing + 1;
-    }
-}
+        lane = n & (TAUS_LANES - 1);
+        s = state->taus;
 
-dither::~dither()
-{
-    if (dither_randtab != NULL)
-    {
-        _aligned_free(dither_randtab);
-        dither_randtab = NULL;
-    }
+        s[lane] = TAUSWORTHE(s[lane], 13, 19, (uint32_t)4294967294U, 12);
+        s[TAUS_LANES + lane] = TAUSWORTHE(s[TAUS_LANES + lane], 2, 25, (uint32_t)4294967288U, 4);
+        s[2 * TAUS_LANES + lane] = TAUSWORTHE(s[2 * TAUS_LANES + lane], 3, 11, (uint32_t)4294967280U, 17);
 
-    if (dither_randmap_ptr != NULL)
-    {
-        _aligned_free(dither_randmap_ptr);
-        dither_randmap_ptr = NULL;
-    }
-}
+        r = (int8_t)((s[lane] ^ s[TAUS_LANES + lane] ^ s[2 * TAUS_LANES + lane]) & 0x000000FF);
 
-void
-dither::dither_preloop_real2int_hp_tpdf(struct dither_state_t *state,
-                                        int samples_per_loop)
-{
-    if (state->randtab_ptr + samples_per_loop >= dither_randtab_size)
-    {
-        dither_randtab[0] = dither_randtab[state->randtab_ptr - 1];
-        state->randtab_ptr = 1;
-    }
+        if (realsize == 4)
+        {
+            ((float *)state->noise)[n] = 0.5f + (float)(r - state->rand + 1) * (1.0f / 255.0f);
+        }
+        else
+        {
+            ((double *)state->noise)[n] = 0.5 + (double)(r - state->rand + 1) * (1.0 / 255.0);
+        }
 
-    state->randtab = &dither_randtab[state->randtab_ptr];
-    state->randtab_ptr += samples_per_loop;
+        state->rand = r;
+    }
 }
 
-int32_t
-dither::ditherf_real2int_hp_tpdf(float real_sample,
+// Quantizes a loop of samples with the high pass TPDF dither
+// generated by dither_preloop_real2int_hp_tpdf. The error feedback
+// makes each sample depend on the previous one, so the loop is
+// serial, but saturation is branch free and the overflow statistics
+// are only written back once per loop.
+//
+// Returns:
+//   The quantized samples.
+int32_t *
+dither::ditherf_real2int_hp_tpdf(const float *realbuf,
+                                 int n_samples,
                                  float rmin, // (float)imin
                                  float rmax, // (float)imax
                                  int32_t imin,
                                  int32_t imax,
                                  struct bfoverflow_t *overflow,
-                                 struct dither_state_t *state,
-                                 int loop_counter)
+                                 struct dither_state_t *state)
 {
-    int32_t sample;
-    float dithered_sample;
+    const float *noise = (const float *)state->noise;
+    int32_t *samples = state->samples;
+    int32_t sample, mask, magnitude, intlargest = 0;
+    unsigned int n_overflows = 0;
+    float real_sample, dithered_sample, peak, largest = 0;
+    float sf0 = state->sf[0], sf1 = state->sf[1];
+    bool under, over, clipped;
+    int n;
+
+    for (n = 0; n < n_samples; n++)
+    {
+        // apply error feedback, with coefficients {1, -1} (high pass)
+        real_sample = realbuf[n] + sf0 - sf1;
+        sf1 = sf0;
 
-    // apply error feedback, with coefficients {1, -1} (high pass)
-    real_sample += state->sf[0] - state->sf[1];
-    state->sf[1] = state->sf[0];
+        // apply dither and offset, then truncate downwards
+        dithered_sample = real_sample + noise[n];
+        sample = (int32_t)dithered_sample - (dithered_sample < 0);
 
-    // apply dither and offset
-    dithered_sample = real_sample +
-                      ((float *)dither_randmap)[state->randtab[loop_counter] -
-                      state->randtab[loop_counter - 1]];
+        under = (dithered_sample <= rmin);
+        over = (dithered_sample > rmax);
+        clipped = under | over;
 
-    if (dithered_sample < 0)
-    {
-        if (dithered_sample <= rmin)
-        {
-            sample = imin;
-            overflow->n_overflows++;
+        sample = under ? imin : sample;
+        sample = over ? imax : sample;
 
-            if (real_sample < -overflow->largest)
-            {
-                overflow->largest = (double)-dithered_sample;
-            }
-        }
-        else
-        {
-            sample = (int32_t)dithered_sample;
-            sample--;
+        // peaks of clipped samples and of the samples in range
+        n_overflows += clipped;
+        peak = fabsf(dithered_sample);
+        largest = (clipped && peak > largest) ? peak : largest;
 
-            if (sample < -overflow->intlargest)
-            {
-                overflow->intlargest = -sample;
-            }
-        }
+        mask = sample >> 31;
+        magnitude = clipped ? 0 : (sample ^ mask) - mask;
+        intlargest = (magnitude > intlargest) ? magnitude : intlargest;
+
+        sf0 = real_sample - (float)sample;
+        samples[n] = sample;
     }
-    else
-    {
-        if (dithered_sample > rmax)
-        {
-            sample = imax;
-            overflow->n_overflows++;
 
-            if (real_sample > overflow->largest)
-            {
-                overflow->largest = (double)dithered_sample;
-            }
-        }
-        else
-        {
-            sample = (int32_t)dithered_sample;
+    state->sf[0] = sf0;
+    state->sf[1] = sf1;
 
-            if (sample > overflow->intlargest)
-            {
-                overflow->intlargest = sample;
-            }
-        }
+    overflow->n_overflows += n_overflows;
+
+    if ((double)largest > overflow->largest)
+    {
+        overflow->largest = (double)largest;
     }
 
-    state->sf[0] = real_sample - (float)sample;
+    if (intlargest > overflow->intlargest)
+    {
+        overflow->intlargest = intlargest;
+    }
 
-    return sample;
+    return samples;
 }
 
 int32_t
@@ -273,77 +254,76 @@ dither::ditherf_real2int_no_dither(float real_sample,
     return sample;
 }
 
-int32_t
-dither::ditherd_real2int_hp_tpdf(double real_sample,
+// Quantizes a loop of samples with the high pass TPDF dither
+// generated by dither_preloop_real2int_hp_tpdf.
+//
+// Returns:
+//   The quantized samples.
+int32_t *
+dither::ditherd_real2int_hp_tpdf(const double *realbuf,
+                                 int n_samples,
                                  double rmin, // (double)imin
                                  double rmax, // (double)imax
                                  int32_t imin,
                                  int32_t imax,
                                  struct bfoverflow_t *overflow,
-                                 struct dither_state_t *state,
-                                 int loop_counter)
+                                 struct dither_state_t *state)
 {
-    int32_t sample;
-    double dithered_sample;
+    const double *noise = (const double *)state->noise;
+    int32_t *samples = state->samples;
+    int32_t sample, mask, magnitude, intlargest = 0;
+    unsigned int n_overflows = 0;
+    double real_sample, dithered_sample, peak, largest = 0;
+    double sd0 = state->sd[0], sd1 = state->sd[1];
+    bool under, over, clipped;
+    int n;
+
+    for (n = 0; n < n_samples; n++)
+    {
+        // apply error feedback, with coefficients {1, -1} (high pass)
+        real_sample = realbuf[n] + sd0 - sd1;
+        sd1 = sd0;
 
-    // apply error feedback, with coefficients {1, -1} (high pass)
-    real_sample += state->sd[0] - state->sd[1];
-    state->sd[1] = state->sd[0];
+        // apply dither and offset, then truncate downwards
+        dithered_sample = real_sample + noise[n];
+        sample = (int32_t)dithered_sample - (dithered_sample < 0);
 
-    // apply dither and offset
-    dithered_sample = real_sample +
-                      ((double *)dither_randmap)[state->randtab[loop_counter] -
-                              state->randtab[loop_counter - 1]];
+        under = (dithered_sample <= rmin);
+        over = (dithered_sample > rmax);
+        clipped = under | over;
 
-    if (dithered_sample < 0)
-    {
-        if (dithered_sample <= rmin)
-        {
-            sample = imin;
-            overflow->n_overflows++;
+        sample = under ? imin : sample;
+        sample = over ? imax : sample;
 
-            if (real_sample < -overflow->largest)
-            {
-                overflow->largest = (double)-dithered_sample;
-            }
-        }
-        else
-        {
-            sample = (int32_t)dithered_sample;
-            sample--;
+        // peaks of clipped samples and of the samples in range
+        n_overflows += clipped;
+        peak = fabs(dithered_sample);
+        largest = (clipped && peak > largest) ? peak : largest;
 
-            if (sample < -overflow->intlargest)
-            {
-                overflow->intlargest = -sample;
-            }
-        }
+        mask = sample >> 31;
+        magnitude = clipped ? 0 : (sample ^ mask) - mask;
+        intlargest = (magnitude > intlargest) ? magnitude : intlargest;
+
+        sd0 = real_sample - (double)sample;
+        samples[n] = sample;
     }
-    else
-    {
-        if (dithered_sample > rmax)
-        {
-            sample = imax;
-            overflow->n_overflows++;
 
-            if (real_sample > overflow->largest)
-            {
-                overflow->largest = (double)dithered_sample;
-            }
-        }
-        else
-        {
-            sample = (int32_t)dithered_sample;
+    state->sd[0] = sd0;
+    state->sd[1] = sd1;
 
-            if (sample > overflow->intlargest)
-            {
-                overflow->intlargest = sample;
-            }
-        }
+    overflow->n_overflows += n_overflows;
+
+    if (largest > overflow->largest)
+    {
+        overflow->largest = largest;
     }
 
-    state->sd[0] = real_sample - (double)sample;
+    if (intlargest > overflow->intlargest)
+    {
+        overflow->intlargest = intlargest;
+    }
 
-    return sample;
+    return samples;
 }
 
 int32_t
@@ -13,9 +13,7 @@ class dither
 {
 public:
     dither(int n_channels,
-           int sample_rate,
            int realsize,
-           int max_size,
            int max_samples_per_loop,
            struct dither_state_t *dither_state);
 
@@ -25,15 +23,15 @@ public:
     dither_preloop_real2int_hp_tpdf(struct dither_state_t *state,
                                     int samples_per_loop);
 
-    int32_t
-    ditherf_real2int_hp_tpdf(float real_sample,
+    int32_t *
+    ditherf_real2int_hp_tpdf(const float *realbuf,
+                             int n_samples,
                              float rmin,  // (float)imin
                              float rmax,  // (float)imax
                              int32_t imin,
                              int32_t imax,
                              struct bfoverflow_t *overflow,
-                             struct dither_state_t *state,
-                             int loop_counter);
+                             struct dither_state_t *state);
 
     int32_t
     ditherf_real2int_no_dither(float real_sample,
@@ -43,15 +41,15 @@ public:
                                int32_t imax,
                                struct bfoverflow_t *overflow);
 
-    int32_t
-    ditherd_real2int_hp_tpdf(double real_sample,
+    int32_t *
+    ditherd_real2int_hp_tpdf(const double *realbuf,
+                             int n_samples,
                              double rmin,  // (double)imin
                              double rmax,  // (double)imax
                              int32_t imin,
                              int32_t imax,
                              struct bfoverflow_t *overflow,
-                             struct dither_state_t *state,
-                             int loop_counter);
+                             struct dither_state_t *state);
 
     int32_t
     ditherd_real2int_no_dither(double real_sample,
@@ -69,11 +67,8 @@ private:
     tausinit(uint32_t state[3],
              uint32_t seed);
 
-    int8_t *dither_randtab;
-    int dither_randtab_size;
-    void *dither_randmap;
-    void *dither_randmap_ptr;
+    void *dither_buffers;
     int realsize;
 };
 
-#endif
+#endif
\ No newline at end of file
@@ -0,0 +1,309 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "global.h"
+#include "engine_thread.hpp"
+#include "block_ring.hpp"
+#include "brutefir.hpp"
+#include "timestamp.h"
+#include "atomic.h"
+#include "pinfo.h"
+
+// the result at the start of an output block, padded so that the
+// samples after it stay aligned
+#define RESULT_SIZE ((sizeof(struct engine_block_t) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+// Constructor for the class.  Starts the thread.
+//
+// The caller may have at most n_blocks + 1 blocks pending, it takes
+// a processed block whenever it pushes one beyond n_blocks.
+//
+// Parameters:
+//   filter      the filter, used only by the thread from now on
+//   n_blocks    the number of blocks between input and output
+//   block_size  the size of an input or output block in bytes
+//   cpu         the processor to run the thread on, or -1 for any
+engine_thread::engine_thread(brutefir *filter,
+                             int n_blocks,
+                             int block_size,
+                             int cpu)
+    : m_filter(filter), m_cpu(cpu), m_pending(0), m_check_overflows(0), m_stop(0),
+      m_engine_waiting(0), m_caller_waiting(0)
+{
+    m_input = new block_ring(n_blocks + 1, block_size);
+    m_output = new block_ring(n_blocks + 1, RESULT_SIZE + block_size);
+
+    m_thread = new boost::thread(boost::bind(&engine_thread::run, this));
+}
+
+// Destructor for the class.  Blocks still pending are processed
+// before the thread stops.
+engine_thread::~engine_thread()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        atomic_store(&m_stop, 1);
+        m_input_ready.notify_one();
+    }
+
+    m_thread->join();
+
+    delete m_thread;
+    delete m_output;
+    delete m_input;
+}
+
+// Gets the input block to fill next.
+//
+// Returns:
+//   The block, or NULL if too many blocks are pending.
+void *
+engine_thread::get_input()
+{
+    // the output ring holds as many blocks as the input ring
+    if (m_pending >= m_input->get_capacity())
+    {
+        return NULL;
+    }
+
+    return m_input->write_block();
+}
+
+// Passes the filled input block to the thread.
+void
+engine_thread::push()
+{
+    m_input->commit_write();
+    m_pending++;
+
+    if (atomic_load(&m_engine_waiting) != 0)
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_input_ready.notify_one();
+    }
+}
+
+// Gets the oldest processed block, waiting for the thread if it
+// has not finished it yet.
+//
+// Parameters:
+//   result   returns the result of the filter run
+//   stalled  returns true if the caller had to wait
+//
+// Returns:
+//   The samples of the block, or NULL if no blocks are pending.
+void *
+engine_thread::get_output(struct engine_block_t **result,
+                          bool *stalled)
+{
+    uint8_t *block;
+
+    if (m_pending == 0)
+    {
+        return NULL;
+    }
+
+    *stalled = wait_outputs(1);
+
+    block = (uint8_t *)m_output->read_block();
+    *result = (struct engine_block_t *)block;
+
+    return block + RESULT_SIZE;
+}
+
+// Releases the block returned by get_output.
+void
+engine_thread::pop()
+{
+    m_output->commit_read();
+    m_pending--;
+}
+
+// Gets the number of blocks pushed and not yet popped.
+//
+// Returns:
+//   The number of blocks.
+int
+engine_thread::get_pending()
+{
+    return m_pending;
+}
+
+// Waits until the thread has processed every block pushed, after
+// which the filter may be changed until the next push.
+void
+engine_thread::drain()
+{
+    wait_outputs(m_pending);
+}
+
+// Waits for the pending blocks and drops them.
+void
+engine_thread::discard()
+{
+    drain();
+
+    while (m_pending > 0)
+    {
+        pop();
+    }
+}
+
+// Sets whether the thread prints overflows after each block.
+//
+// Parameters:
+//   enable  true to print overflows
+void
+engine_thread::set_check_overflows(bool enable)
+{
+    atomic_store(&m_check_overflows, enable ? 1 : 0);
+}
+
+// Processes input blocks until the class is destroyed.
+void
+engine_thread::run()
+{
+    uint8_t *inbuf, *outbuf;
+    struct engine_block_t *result;
+    volatile uint64_t ts[2];
+    double start;
+
+    set_priority();
+
+    for (;;)
+    {
+        inbuf = (uint8_t *)m_input->read_block();
+
+        if (inbuf == NULL)
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+
+            // a block pushed after the check above wakes the thread
+            atomic_store(&m_engine_waiting, 1);
+
+            if (atomic_load(&m_stop) != 0)
+            {
+                break;
+            }
+
+            if (m_input->get_count() == 0)
+            {
+                m_input_ready.wait(lock);
+            }
+
+            atomic_store(&m_engine_waiting, 0);
+            continue;
+        }
+
+        outbuf = (uint8_t *)m_output->write_block();
+        result = (struct engine_block_t *)outbuf;
+
+        start = metrics::get_time();
+        timestamp(&ts[0]);
+
+        result->status = m_filter->run(inbuf, outbuf + RESULT_SIZE);
+
+        timestamp(&ts[1]);
+
+        result->cycles = ts[1] - ts[0];
+        result->seconds = metrics::get_time() - start;
+        m_filter->get_stage_cycles(result->stage_cycles);
+
+        if ((result->status == 0) && (atomic_load(&m_check_overflows) != 0))
+        {
+            m_filter->check_overflows();
+        }
+
+        m_input->commit_read();
+        m_output->commit_write();
+
+        if (atomic_load(&m_caller_waiting) != 0)
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            m_output_ready.notify_one();
+        }
+    }
+}
+
+// Raises the priority of the calling thread above that of the
+// audio output, and pins it to the configured processor.  Real
+// time scheduling needs privileges on other platforms than
+// Windows, without them the thread keeps its priority.
+void
+engine_thread::set_priority()
+{
+#if defined(_WIN32)
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+
+    if (m_cpu >= 0)
+    {
+        if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << m_cpu) == 0)
+        {
+            pinfo("Cannot run the engine thread on processor %d.\n", m_cpu);
+        }
+    }
+#else
+    struct sched_param param;
+
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+#if defined(__linux__)
+    if (m_cpu >= 0)
+    {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(m_cpu, &set);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0)
+        {
+            pinfo("Cannot run the engine thread on processor %d.\n", m_cpu);
+        }
+    }
+#endif
+#endif
+}
+
+// Waits until a number of processed blocks are ready.
+//
+// Parameters:
+//   count  the number of blocks
+//
+// Returns:
+//   true if the caller had to wait.
+bool
+engine_thread::wait_outputs(int count)
+{
+    if (m_output->get_count() >= count)
+    {
+        return false;
+    }
+
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+
+    // a block finished after the check above wakes the caller
+    atomic_store(&m_caller_waiting, 1);
+
+    while (m_output->get_count() < count)
+    {
+        m_output_ready.wait(lock);
+    }
+
+    atomic_store(&m_caller_waiting, 0);
+
+    return true;
+}
@@ -0,0 +1,100 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _ENGINE_THREAD_HPP_
+#define _ENGINE_THREAD_HPP_
+
+#include <stdint.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "metrics.hpp"
+
+class brutefir;
+class block_ring;
+
+// The result of running the filter on a block.
+struct engine_block_t
+{
+    int status;                                 // returned by brutefir::run
+    uint64_t cycles;
+    double seconds;
+    uint64_t stage_cycles[METRICS_STAGE_COUNT];
+};
+
+// Runs a filter on a thread of its own.  The caller fills input
+// blocks and takes the processed blocks in the same order a number
+// of blocks later, so a block that takes longer than its duration
+// does not hold up the caller as long as the blocks in between
+// make up for it.  Blocks are passed through lock-free rings, the
+// threads only lock to sleep and wake each other.
+class engine_thread
+{
+public:
+    engine_thread(brutefir *filter,
+                  int n_blocks,
+                  int block_size,
+                  int cpu);
+    ~engine_thread();
+
+    void *
+    get_input();
+
+    void
+    push();
+
+    void *
+    get_output(struct engine_block_t **result,
+               bool *stalled);
+
+    void
+    pop();
+
+    int
+    get_pending();
+
+    void
+    drain();
+
+    void
+    discard();
+
+    void
+    set_check_overflows(bool enable);
+
+private:
+    void
+    run();
+
+    void
+    set_priority();
+
+    bool
+    wait_outputs(int count);
+
+    brutefir *m_filter;
+    int m_cpu;
+    int m_pending;              // blocks pushed and not yet popped
+
+    block_ring *m_input;
+    block_ring *m_output;       // a result followed by the samples
+
+    volatile long m_check_overflows;
+    volatile long m_stop;
+
+    // the threads set these before sleeping
+    volatile long m_engine_waiting;
+    volatile long m_caller_waiting;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_input_ready;
+    boost::condition_variable m_output_ready;
+
+    boost::thread *m_thread;
+};
+
+#endif
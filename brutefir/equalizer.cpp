@@ -5,7 +5,6 @@
  * This program is open source. For license terms, see the LICENSE file.
  *
  */
-#include <malloc.h>
 #include <string.h>
 #include <string>
 #include <sstream>
@@ -22,8 +21,8 @@
 #include "fftw_convolver.hpp"
 #include "buffer.hpp"
 #include "bfir_path.hpp"
+#include "cache.hpp"
 #include "log2.h"
-#include "hash.h"
 #include "pinfo.h"
 
 // Constructor for the class.
@@ -123,17 +122,21 @@ equalizer::generate(int n_bands,
     // generate a filename representing the equalizer parameters
     filename = make_filename(n_bands, freq, mag, phase);
 
-    // render the equalizer if the file does not already exist
-    if (!boost::filesystem::exists(filename))
+    // render the equalizer if the file is not already cached
+    if (!cache::lookup(filename))
     {
+        std::wstring temp_filename = cache::get_temp_filename(filename);
+
         if (m_equalizer.realsize == 4)
         {
-            render_f(&m_equalizer, filename.c_str());
+            render_f(&m_equalizer, temp_filename.c_str());
         }
         else
         {
-            render_d(&m_equalizer, filename.c_str());
+            render_d(&m_equalizer, temp_filename.c_str());
         }
+
+        cache::insert(filename, temp_filename);
     }
 
     return filename;
@@ -155,9 +158,8 @@ equalizer::make_filename(int n_bands,
                          double *mag,
                          double *phase)
 {
-    long hash_code;
+    uint64_t key;
     char *band_data;
-    std::wstringstream out;
 
     // copy the band data into a single byte array
     band_data = (char *) _alloca(3 * n_bands * sizeof(double));
@@ -165,18 +167,14 @@ equalizer::make_filename(int n_bands,
     memcpy(band_data + (n_bands * sizeof(double)), mag, n_bands * sizeof(double));
     memcpy(band_data + (2 * n_bands * sizeof(double)), phase, n_bands * sizeof(double));
 
-    // generate a hash code of the bands array
-    hash_code = DJBHash((char *)band_data, 3 * n_bands * sizeof(double));
-
-    // assemble the filename
-    out << "eq-" << std::hex << hash_code;
-    out << "-" << std::dec << (m_equalizer.taps >> 1)
-        << "-" << m_equalizer.realsize
-        << "-" << m_equalizer.n_channels
-        << "-" << m_equalizer.sampling_rate
-        << ".wav";
+    // generate a cache key of the bands array and the filter format
+    key = cache::hash_data(band_data, 3 * n_bands * sizeof(double), CACHE_KEY_SEED);
+    key = cache::hash_data(&m_equalizer.taps, sizeof(m_equalizer.taps), key);
+    key = cache::hash_data(&m_equalizer.realsize, sizeof(m_equalizer.realsize), key);
+    key = cache::hash_data(&m_equalizer.n_channels, sizeof(m_equalizer.n_channels), key);
+    key = cache::hash_data(&m_equalizer.sampling_rate, sizeof(m_equalizer.sampling_rate), key);
 
-    return bfir_path::append_temp_path(out.str());
+    return cache::get_filename(L"eq", key);
 }
 
 float
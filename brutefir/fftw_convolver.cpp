@@ -12,8 +12,6 @@
 #include <string.h>
 #include <math.h>
 #include <float.h>
-#include <intrin.h>
-#include <malloc.h>
 #include <sstream>
 
 #include <fftw3.h>
@@ -43,6 +41,8 @@ static int my_fftw_read_char(void *f) { return fgetc((FILE *) f); }
 #define fftwf_import_wisdom_from_file(f) fftwf_import_wisdom(my_fftw_read_char, (void*) (f))
 #define fftwl_import_wisdom_from_file(f) fftwl_import_wisdom(my_fftw_read_char, (void*) (f))
 
+boost::recursive_mutex fftw_convolver::planner_mutex;
+
 #define ifftplans fftplan_table[1][0]
 #define ifftplans_inplace fftplan_table[1][1]
 #define fftplans fftplan_table[0][0]
@@ -83,6 +83,9 @@ fftw_convolver::fftw_convolver(int length,
 
     filename = bfir_path::append_path(out.str());
 
+    // Engines may be created on several threads at once
+    boost::lock_guard<boost::recursive_mutex> lock(planner_mutex);
+
     if ((err = _wfopen_s(&stream, filename.c_str(), L"rt")) != 0)
     {
         if (errno != ENOENT)
@@ -660,6 +663,8 @@ fftw_convolver::create_fft_plan(int order,
 
     if (!bit_isset(&fftplan_generated[invert][inplace], order))
     {
+        boost::lock_guard<boost::recursive_mutex> lock(planner_mutex);
+
         pinfo("Creating %s%sFFTW plan of size %d using wisdom.",
               invert ? "inverse " : "forward ",
               inplace ? "in place " : "",
@@ -681,6 +686,8 @@ fftw_convolver::destroy_fft_plan(int order,
 {
     if (bit_isset(&fftplan_generated[invert][inplace], order))
     {
+        boost::lock_guard<boost::recursive_mutex> lock(planner_mutex);
+
         if (realsize == 4)
         {
             fftwf_destroy_plan((fftwf_plan)fftplan_table[invert][inplace][order]);
@@ -8,6 +8,9 @@
 #ifndef _FFTW_CONVOLVER_HPP_
 #define _FFTW_CONVOLVER_HPP_
 
+#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/locks.hpp>
+
 #include "global.h"
 #include "dither.hpp"
 
@@ -165,6 +168,10 @@ public:
     convolver_td_convolve(td_conv_t *tdc,
                           void *overlap_block);
 
+    // Serializes FFTW planning and wisdom, which are not thread safe.
+    // Plans may be executed concurrently without it.
+    static boost::recursive_mutex planner_mutex;
+
 private:
     void *
     get_fft_plan(int length,
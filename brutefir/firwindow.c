@@ -9,6 +9,7 @@
 #include <float.h>
 #include <assert.h>
 
+#include "compat.h"
 #include "firwindow.h"
 
 // zeroth order modified bessel function
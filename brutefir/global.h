@@ -19,6 +19,7 @@ extern "C" {
 
 // limits
 #define BF_MAXCHANNELS 8
+#define BF_MAXDELAY_SECONDS 0.1
 
 // sample formats
 #define BF_SAMPLE_FORMAT_S8 1
@@ -62,8 +63,10 @@ struct bfchannel_t
 
 struct dither_state_t
 {
-    int randtab_ptr;
-    int8_t *randtab;
+    uint32_t taus[12]; // four interleaved generator states
+    int32_t rand;      // last random number of the previous loop
+    void *noise;       // dither and offset of the current loop
+    int32_t *samples;  // quantized samples of the current loop
     float sf[2];
     double sd[2];
 };
@@ -81,11 +84,11 @@ struct bfconf_t
 {
     int filter_length;
     int n_blocks;
+    int n_delay_blocks; // input blocks kept for the longest delay
     int realsize;
     int sampling_rate;
 
     struct dither_state_t dither_state[BF_MAXCHANNELS];
-    int max_dither_table_size;
 
     int n_channels;
     struct bfchannel_t inputs[BF_MAXCHANNELS];
@@ -101,6 +104,22 @@ struct bfoverflow_t
     double max;
 };
 
+struct bfscan_t
+{
+    unsigned int n_nonfinite; // NaN or Inf samples in the block
+    unsigned int n_clipped;   // finite samples beyond the clip level
+    double peak;              // largest finite magnitude in the block
+};
+
+struct bflevels_t
+{
+    unsigned int n_blocks;
+    unsigned int n_nonfinite;
+    unsigned int n_clipped;
+    double peak;      // peak of the last block, relative to full scale
+    double held_peak; // peak since the last reset, relative to full scale
+};
+
 #endif
 
 #ifdef __cplusplus
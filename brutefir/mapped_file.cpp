@@ -0,0 +1,180 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include "util.hpp"
+#endif
+
+#include "mapped_file.hpp"
+
+#if !defined(_WIN32)
+#define INVALID_HANDLE_VALUE NULL
+#endif
+
+// Constructor for the class.
+mapped_file::mapped_file()
+    : m_file(INVALID_HANDLE_VALUE), m_mapping(NULL), m_data(NULL), m_size(0)
+{
+}
+
+// Destructor for the class.
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+// Maps the entire contents of the specified file read-only
+// into the address space of the process.
+//
+// Parameters:
+//   filename  the file to map
+//
+// Returns:
+//   true if the file was mapped, otherwise false.
+bool
+mapped_file::open(const wchar_t *filename)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER file_size;
+
+    close();
+
+    m_file = CreateFileW(filename,
+                         GENERIC_READ,
+                         FILE_SHARE_READ,
+                         NULL,
+                         OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                         NULL);
+
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    if (!GetFileSizeEx(m_file, &file_size) || (file_size.QuadPart == 0) ||
+        ((uint64_t)file_size.QuadPart > (uint64_t)(SIZE_MAX >> 1)))
+    {
+        close();
+        return false;
+    }
+
+    m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (m_mapping == NULL)
+    {
+        close();
+        return false;
+    }
+
+    m_data = (const uint8_t *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (m_data == NULL)
+    {
+        close();
+        return false;
+    }
+
+    m_size = (uint64_t)file_size.QuadPart;
+    return true;
+#else
+    struct stat file_stat;
+    void *data;
+    int fd;
+
+    close();
+
+    // The descriptor is not needed once the file is mapped
+    if ((fd = ::open(util::wstr2str(filename).c_str(), O_RDONLY)) == -1)
+    {
+        return false;
+    }
+
+    if ((fstat(fd, &file_stat) != 0) || (file_stat.st_size == 0) ||
+        ((uint64_t)file_stat.st_size > (uint64_t)(SIZE_MAX >> 1)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    // The file is read from start to end
+    madvise(data, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+
+    m_data = (const uint8_t *)data;
+    m_size = (uint64_t)file_stat.st_size;
+    return true;
+#endif
+}
+
+// Unmaps the file and releases the associated handles.
+void
+mapped_file::close()
+{
+#if defined(_WIN32)
+    if (m_data != NULL)
+    {
+        UnmapViewOfFile(m_data);
+        m_data = NULL;
+    }
+
+    if (m_mapping != NULL)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+    }
+
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_data != NULL)
+    {
+        munmap((void *)m_data, (size_t)m_size);
+        m_data = NULL;
+    }
+#endif
+
+    m_size = 0;
+}
+
+// Returns whether a file is currently mapped.
+bool
+mapped_file::is_open()
+{
+    return (m_data != NULL);
+}
+
+// Returns a pointer to the first byte of the mapped file.
+const uint8_t *
+mapped_file::data()
+{
+    return m_data;
+}
+
+// Returns the size of the mapped file in bytes.
+uint64_t
+mapped_file::size()
+{
+    return m_size;
+}
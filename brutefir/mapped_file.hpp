@@ -0,0 +1,41 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _MAPPED_FILE_HPP_
+#define _MAPPED_FILE_HPP_
+
+#include <stdint.h>
+
+class mapped_file
+{
+public:
+    mapped_file();
+    ~mapped_file();
+
+    bool
+    open(const wchar_t *filename);
+
+    void
+    close();
+
+    bool
+    is_open();
+
+    const uint8_t *
+    data();
+
+    uint64_t
+    size();
+
+private:
+    void *m_file;
+    void *m_mapping;
+
+    const uint8_t *m_data;
+    uint64_t m_size;
+};
+
+#endif
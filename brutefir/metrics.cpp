@@ -0,0 +1,247 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sched.h>
+#include <time.h>
+#define YieldProcessor() sched_yield()
+#endif
+#include <string.h>
+
+#include "metrics.hpp"
+#include "atomic.h"
+
+namespace metrics
+{
+    // A published copy of the metrics of one engine instance. The
+    // owner is the only writer and bumps the sequence number before
+    // and after each update, so readers retry while it is odd or
+    // when it changed during their copy.
+    struct metrics_slot_t
+    {
+        volatile long in_use;
+        volatile long seq;
+        struct metrics_t data;
+    };
+
+    // slots are never freed, so a reader can not outlive its slot
+    static struct metrics_slot_t slots[METRICS_MAX_SLOTS];
+
+    // Reserves a slot for an engine instance.
+    //
+    // Returns:
+    //   The slot index, or -1 if all slots are in use.
+    int
+    acquire()
+    {
+        struct metrics_t m;
+        int n;
+
+        for (n = 0; n < METRICS_MAX_SLOTS; n++)
+        {
+            if (atomic_cas(&slots[n].in_use, 1, 0) == 0)
+            {
+                memset(&m, 0, sizeof(struct metrics_t));
+                publish(n, &m);
+
+                return n;
+            }
+        }
+
+        return -1;
+    }
+
+    // Returns a slot for use by another engine instance.
+    //
+    // Parameters:
+    //   slot  the slot index, ignored if negative
+    void
+    release(int slot)
+    {
+        if (slot >= 0 && slot < METRICS_MAX_SLOTS)
+        {
+            atomic_store(&slots[slot].in_use, 0);
+        }
+    }
+
+    // Publishes metrics to a slot. Must only be called by the owner
+    // of the slot.
+    //
+    // Parameters:
+    //   slot  the slot index, ignored if negative
+    //   m     the metrics to publish
+    void
+    publish(int slot,
+            const struct metrics_t *m)
+    {
+        struct metrics_slot_t *s;
+
+        if (slot < 0 || slot >= METRICS_MAX_SLOTS)
+        {
+            return;
+        }
+
+        s = &slots[slot];
+
+        atomic_store(&s->seq, s->seq + 1);
+        atomic_fence();
+
+        memcpy(&s->data, m, sizeof(struct metrics_t));
+
+        atomic_fence();
+        atomic_store(&s->seq, s->seq + 1);
+    }
+
+    // Reads the metrics of a slot without blocking the owner.
+    //
+    // Parameters:
+    //   slot  the slot index
+    //   m     the metrics, overwritten on return
+    //
+    // Returns:
+    //   True if the slot is in use, false otherwise.
+    bool
+    read(int slot,
+         struct metrics_t *m)
+    {
+        struct metrics_slot_t *s;
+        long seq;
+
+        if (slot < 0 || slot >= METRICS_MAX_SLOTS)
+        {
+            return false;
+        }
+
+        s = &slots[slot];
+
+        if (atomic_load(&s->in_use) == 0)
+        {
+            return false;
+        }
+
+        do
+        {
+            while ((seq = atomic_load(&s->seq)) & 1)
+            {
+                YieldProcessor();
+            }
+
+            memcpy(m, (const void *)&s->data, sizeof(struct metrics_t));
+            atomic_fence();
+        }
+        while (atomic_load(&s->seq) != seq);
+
+        return true;
+    }
+
+    // Adds the timing of a processed block to unpublished metrics.
+    //
+    // Parameters:
+    //   m         the metrics
+    //   cycles    the processing time in time stamp counter cycles
+    //   seconds   the processing time in seconds
+    //   duration  the playback time of the block in seconds
+    void
+    add_block(struct metrics_t *m,
+              uint64_t cycles,
+              double seconds,
+              double duration)
+    {
+        int bin;
+
+        m->n_blocks++;
+        m->block_cycles += cycles;
+        m->block_seconds += seconds;
+        m->load = (duration > 0.0) ? seconds / duration : 0.0;
+
+        if (m->load > m->max_load)
+        {
+            m->max_load = m->load;
+        }
+
+        if (m->load >= 1.0)
+        {
+            m->n_overruns++;
+        }
+
+        bin = (int)(m->load / METRICS_HISTOGRAM_STEP);
+
+        if (bin >= METRICS_HISTOGRAM_BINS)
+        {
+            bin = METRICS_HISTOGRAM_BINS - 1;
+        }
+
+        m->histogram[bin]++;
+    }
+
+    // Estimates a block load percentile from the load histogram.
+    //
+    // Parameters:
+    //   m         the metrics
+    //   fraction  the percentile as a fraction, e.g. 0.99
+    //
+    // Returns:
+    //   The upper edge of the histogram bin holding the percentile,
+    //   as a fraction of the block duration.
+    double
+    get_load_percentile(const struct metrics_t *m,
+                        double fraction)
+    {
+        uint64_t count = 0, target;
+        int n;
+
+        if (m->n_blocks == 0)
+        {
+            return 0.0;
+        }
+
+        target = (uint64_t)(fraction * (double)m->n_blocks + 0.5);
+
+        for (n = 0; n < METRICS_HISTOGRAM_BINS - 1; n++)
+        {
+            count += m->histogram[n];
+
+            if (count >= target)
+            {
+                return (n + 1) * METRICS_HISTOGRAM_STEP;
+            }
+        }
+
+        // the last bin is open ended, report the largest load seen
+        return m->max_load;
+    }
+
+    // Gets the time from the performance counter.
+    //
+    // Returns:
+    //   The time in seconds.
+    double
+    get_time()
+    {
+#if defined(_WIN32)
+        static double period = 0.0;
+        LARGE_INTEGER count;
+
+        if (period == 0.0)
+        {
+            QueryPerformanceFrequency(&count);
+            period = 1.0 / (double)count.QuadPart;
+        }
+
+        QueryPerformanceCounter(&count);
+
+        return (double)count.QuadPart * period;
+#else
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+    }
+}
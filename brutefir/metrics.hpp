@@ -0,0 +1,89 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <stdint.h>
+
+#include "global.h"
+
+// maximum number of engine instances that can publish metrics
+#define METRICS_MAX_SLOTS       16
+
+// block load histogram, in 5% steps with the last bin for overruns
+#define METRICS_HISTOGRAM_BINS  21
+#define METRICS_HISTOGRAM_STEP  0.05
+
+// processing stages timed in time stamp counter cycles
+#define METRICS_STAGE_INPUT     0   // raw2cbuf
+#define METRICS_STAGE_FFT       1   // time2freq
+#define METRICS_STAGE_MIX       2   // mixnscale of inputs and outputs
+#define METRICS_STAGE_MAC       3   // convolve and convolve_add
+#define METRICS_STAGE_IFFT      4   // freq2time
+#define METRICS_STAGE_OUTPUT    5   // output scan and cbuf2raw
+#define METRICS_STAGE_RESAMPLE  6
+#define METRICS_STAGE_COUNT     7
+
+struct metrics_t
+{
+    int n_channels;
+    int sampling_rate;
+    int block_length;
+    int filter_blocks;
+    int active_blocks[BF_MAXCHANNELS];           // partitions being convolved
+    double latency;                              // seconds
+    int pipeline_blocks;                         // blocks queued for the engine thread, 0 without
+
+    uint64_t n_blocks;
+    uint64_t n_overruns;                         // blocks slower than real-time
+    uint64_t n_stalls;                           // times the host waited for the engine thread
+    uint64_t stage_cycles[METRICS_STAGE_COUNT];  // all blocks, per stage
+    uint64_t block_cycles;                       // all blocks
+    double block_seconds;                        // all blocks
+    double load;                                 // last block, fraction of its duration
+    double max_load;
+    unsigned int histogram[METRICS_HISTOGRAM_BINS];
+
+    double peak[BF_MAXCHANNELS];                 // relative to full scale
+    unsigned int n_clipped[BF_MAXCHANNELS];
+    unsigned int n_nonfinite[BF_MAXCHANNELS];
+
+    unsigned int n_rebuilds;
+    double rebuild_seconds;                      // last filter rebuild
+};
+
+namespace metrics
+{
+    int
+    acquire();
+
+    void
+    release(int slot);
+
+    void
+    publish(int slot,
+            const struct metrics_t *m);
+
+    bool
+    read(int slot,
+         struct metrics_t *m);
+
+    void
+    add_block(struct metrics_t *m,
+              uint64_t cycles,
+              double seconds,
+              double duration);
+
+    double
+    get_load_percentile(const struct metrics_t *m,
+                        double fraction);
+
+    double
+    get_time();
+}
+
+#endif
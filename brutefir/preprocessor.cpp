@@ -4,11 +4,16 @@
  * This program is open source. For license terms, see the LICENSE file.
  *
  */
-#include <io.h>
+#include <math.h>
+#include <string.h>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <fftw3.h>
 
 #include "global.h"
 #include "brutefir.hpp"
@@ -16,9 +21,31 @@
 #include "coeff.hpp"
 #include "buffer.hpp"
 #include "bfir_path.hpp"
+#include "cache.hpp"
 #include "util.hpp"
-#include "hash.h"
+#include "thread_pool.hpp"
 #include "numunion.h"
+#include "firwindow.h"
+#include "pinfo.h"
+
+// band used to estimate the gain for program material
+#define MUSIC_LOW_FREQ  20.0
+#define MUSIC_HIGH_FREQ 20000.0
+
+// transform length of the minimum phase conversion relative to the
+// impulse length, longer transforms reduce cepstral aliasing
+#define MIN_PHASE_FFT_FACTOR 4
+
+// floor of the magnitude response relative to its maximum, which
+// bounds the logarithm of zeros in the response
+#define MIN_PHASE_FLOOR_DB -200.0
+
+// energy of the trimmed tail relative to the energy of the impulse
+#define TRIM_THRESHOLD_DB  -80.0
+
+// length and shape of the fade out at the end of a trimmed impulse
+#define TRIM_FADE_LENGTH   256
+#define TRIM_KAISER_BETA   9.0
 
 namespace preprocessor
 {
@@ -41,11 +68,10 @@ namespace preprocessor
         int n_frames, g_frames = 0;
         int filter_blocks;
         int length;
-        long hash_code = 0;
+        uint64_t key = CACHE_KEY_SEED;
+        uint64_t file_key;
 
         std::vector<struct impulse_info>::iterator it;
-        std::wstring fn_concat;
-        std::wstringstream out;
         std::wstring m_out_filename;
 
         brutefir *filter;
@@ -58,7 +84,14 @@ namespace preprocessor
         // find the largest frame size
         for (it = impulse_info.begin(); it < impulse_info.end(); it++)
         {
-            fn_concat.append(it->filename);
+            // the cache key covers the contents and scale of each file
+            if (!cache::hash_file(it->filename, &file_key))
+            {
+                return m_out_filename;
+            }
+
+            key = cache::hash_data(&file_key, sizeof(file_key), key);
+            key = cache::hash_data(&it->scale, sizeof(it->scale), key);
 
             buffer::get_snd_file_params(it->filename.c_str(), &n_channels, &n_frames, &sampling_rate);
 
@@ -86,20 +119,17 @@ namespace preprocessor
         filter_blocks = length / filter_length;
 
         // assemble the output filename
-        hash_code = DJBHash((char *)fn_concat.c_str(), fn_concat.size());
-
-        out << "file-" << std::hex << hash_code
-            << "-" << std::dec << g_frames
-            << "-" << realsize
-            << "-" << g_channels
-            << "-" << g_sampling_rate
-            << ".wav";
+        key = cache::hash_data(&filter_length, sizeof(filter_length), key);
+        key = cache::hash_data(&realsize, sizeof(realsize), key);
 
-        m_out_filename = bfir_path::append_temp_path(out.str());
+        m_out_filename = cache::get_filename(L"file", key);
 
-        // run the impulse convolver if the output file does not already exist
-        if (!boost::filesystem::exists(m_out_filename))
+        // run the impulse convolver if the output file is not already cached
+        if (!cache::lookup(m_out_filename))
         {
+            std::wstring cache_filename = m_out_filename;
+            std::wstring temp_filename = cache::get_temp_filename(cache_filename);
+
             // instantiate filter
             filter = new brutefir(
                 filter_length,
@@ -109,7 +139,8 @@ namespace preprocessor
                 (realsize == 4) ? BF_SAMPLE_FORMAT_FLOAT_LE : BF_SAMPLE_FORMAT_FLOAT64_LE,
                 (realsize == 4) ? BF_SAMPLE_FORMAT_FLOAT_LE : BF_SAMPLE_FORMAT_FLOAT64_LE,
                 g_sampling_rate,
-                false);
+                false,
+                POOL_PRIORITY_BACKGROUND);
 
             // allocate the output buffer
             outbuf = _aligned_malloc(filter_length * filter_blocks * g_channels * realsize,
@@ -196,11 +227,17 @@ namespace preprocessor
             if (!m_out_filename.empty())
             {
                 // write the final output buffer to the output file
-                buffer::save_to_snd_file(m_out_filename.c_str(),
+                buffer::save_to_snd_file(temp_filename.c_str(),
                                          outbuf, g_channels,
                                          g_frames,
                                          realsize,
                                          g_sampling_rate);
+
+                cache::insert(m_out_filename, temp_filename);
+            }
+            else
+            {
+                cache::cancel(cache_filename, temp_filename);
             }
 
             // free the output buffer
@@ -232,165 +269,469 @@ namespace preprocessor
         return m_out_filename;
     }
 
-    // Calculates the attenuation in dB for an impulse response
-    // to avoid clipping.
+    // Converts a single channel of an impulse response to minimum
+    // phase with the same magnitude response.
+    //
+    // The real cepstrum of the impulse is folded onto positive
+    // quefrencies, which gives the cepstrum of the minimum phase
+    // impulse, and transformed back.
     //
     // Parameters:
-    //   filename       the name of impulse response file
-    //   filter_length  the length of convolution filter
-    //   realsize       the "float" size
-    //   attenuation    returns the attenuation in dB
-    //   n_channels     returns the number of channels in the file
-    //   n_frames       returns the number of frames in the file
-    //   sampling_rate  returns the sampling rate of the file
+    //   forward     an in-place real to complex plan of fft_length
+    //   inverse     an in-place complex to real plan of fft_length
+    //   coeffs      the impulse response samples, replaced with the
+    //               minimum phase impulse response
+    //   length      the number of impulse response samples
+    //   fft_length  the transform length
+    //   failed      set to true if the channel could not be converted
+    static void
+    min_phase_channel(fftw_plan forward,
+                      fftw_plan inverse,
+                      double *coeffs,
+                      int length,
+                      int fft_length,
+                      bool *failed)
+    {
+        int n;
+        double *buf;
+        fftw_complex *cbuf;
+        double mag;
+        double max_magnitude = 0;
+        double floor;
+        double scale = 1.0 / fft_length;
+
+        // in-place transforms need room for fft_length / 2 + 1 bins
+        buf = (double *)fftw_malloc((fft_length + 2) * sizeof(double));
+
+        if (buf == NULL)
+        {
+            *failed = true;
+            return;
+        }
+
+        cbuf = (fftw_complex *)buf;
+
+        memcpy(buf, coeffs, length * sizeof(double));
+        memset(&buf[length], 0, (fft_length + 2 - length) * sizeof(double));
+
+        fftw_execute_dft_r2c(forward, buf, cbuf);
+
+        for (n = 0; n <= fft_length / 2; n++)
+        {
+            mag = sqrt(cbuf[n][0] * cbuf[n][0] + cbuf[n][1] * cbuf[n][1]);
+
+            if (mag > max_magnitude)
+            {
+                max_magnitude = mag;
+            }
+
+            cbuf[n][0] = mag;
+        }
+
+        // a silent channel is left as it is
+        if (max_magnitude == 0)
+        {
+            fftw_free(buf);
+            return;
+        }
+
+        floor = max_magnitude * FROM_DB(MIN_PHASE_FLOOR_DB);
+
+        for (n = 0; n <= fft_length / 2; n++)
+        {
+            cbuf[n][0] = log((cbuf[n][0] > floor) ? cbuf[n][0] : floor);
+            cbuf[n][1] = 0;
+        }
+
+        // real cepstrum
+        fftw_execute_dft_c2r(inverse, cbuf, buf);
+
+        // fold the anti-causal part onto the causal part
+        buf[0] *= scale;
+
+        for (n = 1; n < fft_length / 2; n++)
+        {
+            buf[n] *= 2 * scale;
+        }
+
+        buf[fft_length / 2] *= scale;
+
+        memset(&buf[fft_length / 2 + 1], 0, (fft_length / 2 + 1) * sizeof(double));
+
+        fftw_execute_dft_r2c(forward, buf, cbuf);
+
+        // the exponential of the folded cepstrum is the minimum
+        // phase spectrum
+        for (n = 0; n <= fft_length / 2; n++)
+        {
+            mag = exp(cbuf[n][0]);
+
+            cbuf[n][0] = mag * cos(cbuf[n][1]);
+            cbuf[n][1] = mag * sin(cbuf[n][1]);
+        }
+
+        fftw_execute_dft_c2r(inverse, cbuf, buf);
+
+        for (n = 0; n < length; n++)
+        {
+            coeffs[n] = buf[n] * scale;
+        }
+
+        fftw_free(buf);
+    }
+
+    // Converts an impulse response to minimum phase.
     //
-    // Returns:
-    //   true if successful, false otherwise.
-    bool
-    calculate_attenuation(std::wstring filename,
-                          int filter_length,
-                          int realsize,
-                          double *attenuation,
-                          int *n_channels,
-                          int *n_frames,
-                          int *sampling_rate)
+    // Each channel is converted on its own thread.  A linear phase
+    // impulse has its energy in the middle, the minimum phase
+    // impulse with the same magnitude response has it at the start,
+    // which removes the latency of the linear phase impulse.
+    //
+    // Parameters:
+    //   filename  the name of the impulse response file
+    //
+    // Returns the name of the converted file or empty on error.
+    std::wstring
+    convert_min_phase(std::wstring filename)
     {
-        int n, i;
-        int length;
-        int filter_blocks;
+        int n;
+        int n_channels;
+        int n_frames;
+        int sampling_rate;
         int n_coeffs;
+        int length;
+        int fft_length;
+        int fft_factor = MIN_PHASE_FFT_FACTOR;
+        double floor_db = MIN_PHASE_FLOOR_DB;
+        uint64_t key;
+        double *planbuf;
+        void **coeffs;
+        void *outbuf;
+        fftw_plan forward = NULL;
+        fftw_plan inverse = NULL;
+        struct pool_group_t group;
+        bool *failed;
+        bool result = false;
+        std::wstring out_filename;
+        std::wstring temp_filename;
 
-        brutefir * filter = NULL;
-        bool status = false;
+        // the cache key covers the contents of the source file and
+        // the conversion parameters
+        if (!cache::hash_file(filename, &key) ||
+            !buffer::get_snd_file_params(filename.c_str(),
+                                         &n_channels,
+                                         &n_frames,
+                                         &sampling_rate))
+        {
+            return out_filename;
+        }
 
-        void **coeffs = NULL;
-        void *inbuf = NULL;
-        void *outbuf = NULL;
-        numunion_t *realbuf;
+        key = cache::hash_data(&fft_factor, sizeof(fft_factor), key);
+        key = cache::hash_data(&floor_db, sizeof(floor_db), key);
 
-        *attenuation = 0;
+        out_filename = cache::get_filename(L"minphase", key);
 
-        // get impulse response file parameters
-        if (!buffer::get_snd_file_params(filename.c_str(),
-                                        n_channels,
-                                        n_frames,
-                                        sampling_rate))
+        if (cache::lookup(out_filename))
         {
-            goto exit;
+            return out_filename;
         }
 
-        // calculate filter blocks
-        length = util::get_next_multiple(*n_frames, filter_length);
-        filter_blocks = length / filter_length;
+        temp_filename = cache::get_temp_filename(out_filename);
 
-        // instantiate filter
-        filter = new brutefir(
-            filter_length,
-            filter_blocks,
-            realsize,
-            *n_channels,
-            (realsize == 4) ? BF_SAMPLE_FORMAT_FLOAT_LE : BF_SAMPLE_FORMAT_FLOAT64_LE,
-            (realsize == 4) ? BF_SAMPLE_FORMAT_FLOAT_LE : BF_SAMPLE_FORMAT_FLOAT64_LE,
-            *sampling_rate,
-            false);
-
-        // allocate the output buffer
-        outbuf = _aligned_malloc(filter_length * *n_channels * realsize, ALIGNMENT);
-        memset(outbuf, 0, filter_length * *n_channels * realsize);
-
-        // load the impulse response from sound file
+        // load the impulse response in double precision
         coeffs = coeff::load_snd_coeff(filename.c_str(),
                                        &length,
-                                       realsize,
-                                       filter_length * filter_blocks,
+                                       8,
+                                       -1,
                                        &n_coeffs);
 
         if (coeffs == NULL)
         {
-            goto exit;
+            cache::cancel(out_filename, temp_filename);
+            out_filename.clear();
+            return out_filename;
         }
 
-        filter->set_coeff(coeffs, *n_channels, filter_length, filter_blocks, 1.0);
-
-        float max_valuef = 0;
-        double max_valued = 0;
+        fft_length = util::get_next_power_of_two(length) * MIN_PHASE_FFT_FACTOR;
 
-        // load full scale white noise into the input buffer
-        inbuf = buffer::load_white_noise(*n_channels,
-                                         filter_length * filter_blocks,
-                                         realsize);
+        // FFTW planning is not thread safe, so the plans are created
+        // here and executed on separate arrays by each pool task.
+        planbuf = (double *)fftw_malloc((fft_length + 2) * sizeof(double));
 
-        if (inbuf == NULL)
+        if (planbuf != NULL)
         {
-            goto exit;
+            boost::lock_guard<boost::recursive_mutex> lock(fftw_convolver::planner_mutex);
+            forward = fftw_plan_dft_r2c_1d(fft_length, planbuf, (fftw_complex *)planbuf, FFTW_ESTIMATE);
+            inverse = fftw_plan_dft_c2r_1d(fft_length, (fftw_complex *)planbuf, planbuf, FFTW_ESTIMATE);
         }
 
-        // run the filter
-        for (n = 0; n < filter_blocks; n++)
+        if ((forward != NULL) && (inverse != NULL))
         {
-            if (filter->run(&(((uint8_t *)inbuf)[n * filter_length * *n_channels * realsize]),
-                            outbuf)
-                            == 0)
+            failed = new bool[n_coeffs];
+
+            thread_pool::init_group(&group, POOL_PRIORITY_BACKGROUND);
+
+            for (n = 0; n < n_coeffs; n++)
             {
-                // find the largest value in the output
-                realbuf = (numunion_t *)outbuf;
+                failed[n] = false;
+
+                thread_pool::submit(&group, boost::bind(&min_phase_channel,
+                                                        forward,
+                                                        inverse,
+                                                        (double *)coeffs[n],
+                                                        length,
+                                                        fft_length,
+                                                        &failed[n]));
+            }
 
-                for (i = 0; i < filter_length * *n_channels; i++)
+            thread_pool::wait(&group);
+
+            // a channel left as it was would mix phase responses
+            result = true;
+
+            for (n = 0; n < n_coeffs; n++)
+            {
+                if (failed[n])
                 {
-                    if (realsize == 4)
-                    {
-                        if (fabs(realbuf->r32[i]) > max_valuef)
-                        {
-                            max_valuef = fabs(realbuf->r32[i]);
-                        }
-                    }
-                    else
-                    {
-                        if (fabs(realbuf->r64[i]) > max_valued)
-                        {
-                            max_valued = fabs(realbuf->r64[i]);
-                        }
-                    }
+                    result = false;
                 }
             }
+
+            delete [] failed;
         }
 
-        if (realsize == 4)
         {
-            if (max_valuef > 1)
+            boost::lock_guard<boost::recursive_mutex> lock(fftw_convolver::planner_mutex);
+
+            if (forward != NULL)
+            {
+                fftw_destroy_plan(forward);
+            }
+
+            if (inverse != NULL)
             {
-                *attenuation = -TO_DB(max_valuef);
+                fftw_destroy_plan(inverse);
             }
         }
+
+        if (planbuf != NULL)
+        {
+            fftw_free(planbuf);
+        }
+
+        if (result)
+        {
+            outbuf = buffer::interlace(coeffs, n_coeffs, length, 8);
+
+            buffer::save_to_snd_file(temp_filename.c_str(),
+                                     outbuf,
+                                     n_coeffs,
+                                     length,
+                                     8,
+                                     sampling_rate);
+
+            cache::insert(out_filename, temp_filename);
+
+            _aligned_free(outbuf);
+        }
         else
         {
-            if (max_valued > 1)
+            cache::cancel(out_filename, temp_filename);
+            out_filename.clear();
+        }
+
+        // free coefficients
+        for (n = 0; n < n_coeffs; n++)
+        {
+            if (coeffs[n] != NULL)
             {
-                *attenuation = -TO_DB(max_valued);
+                _aligned_free(coeffs[n]);
+                coeffs[n] = NULL;
             }
         }
 
-        status = true;
+        _aligned_free(coeffs);
+
+        return out_filename;
+    }
 
-exit:
-        // free the input buffer
-        if (inbuf != NULL)
+    // Finds the length of an impulse response channel without the
+    // tail whose energy is below the trim threshold.
+    //
+    // Parameters:
+    //   coeffs  the impulse response samples
+    //   length  the number of impulse response samples
+    //
+    // Returns:
+    //   The number of samples to keep.
+    static int
+    find_trim_length(const double *coeffs,
+                     int length)
+    {
+        int n;
+        double total = 0;
+        double tail = 0;
+        double threshold;
+
+        for (n = 0; n < length; n++)
         {
-            _aligned_free(inbuf);
-            inbuf = NULL;
+            total += coeffs[n] * coeffs[n];
         }
 
-        // free the output bilfer
-        if (outbuf != NULL)
+        threshold = total * pow(10, TRIM_THRESHOLD_DB / 10.0);
+
+        // sum the energy backwards from the end until the tail
+        // holds more than the threshold
+        for (n = length - 1; n >= 0; n--)
         {
-            _aligned_free(outbuf);
-            outbuf = NULL;
+            tail += coeffs[n] * coeffs[n];
+
+            if (tail > threshold)
+            {
+                return n + 1;
+            }
         }
 
-        // free coefficients
-        if (coeffs != NULL)
+        return 0;
+    }
+
+    // Trims the tail of an impulse response where the remaining
+    // energy is below the trim threshold, and fades out the end of
+    // the trimmed impulse with the falling half of a Kaiser window.
+    //
+    // All channels are trimmed to the same length.  The trimmed
+    // impulse is only used if it saves filter blocks, the number of
+    // blocks saved is reported.
+    //
+    // Parameters:
+    //   filename       the name of the impulse response file
+    //   filter_length  the length of convolution filter
+    //
+    // Returns:
+    //   The name of the trimmed file, the name of the impulse response
+    //   file if trimming saves no filter blocks, or empty on error.
+    std::wstring
+    trim_impulse(std::wstring filename,
+                 int filter_length)
+    {
+        int n, i;
+        int n_channels;
+        int n_frames;
+        int sampling_rate;
+        int n_coeffs;
+        int length;
+        int trim_length = 0;
+        int fade_length;
+        int blocks;
+        int trim_blocks;
+        double threshold = TRIM_THRESHOLD_DB;
+        double beta = TRIM_KAISER_BETA;
+        int fade = TRIM_FADE_LENGTH;
+        uint64_t key;
+        double *window;
+        void **coeffs;
+        void *outbuf;
+        std::wstring out_filename;
+        std::wstring temp_filename;
+
+        // the cache key covers the contents of the source file and
+        // the trim parameters
+        if (!cache::hash_file(filename, &key) ||
+            !buffer::get_snd_file_params(filename.c_str(),
+                                         &n_channels,
+                                         &n_frames,
+                                         &sampling_rate))
         {
-            for (n = 0; n < *n_channels; n++)
+            return out_filename;
+        }
+
+        key = cache::hash_data(&threshold, sizeof(threshold), key);
+        key = cache::hash_data(&beta, sizeof(beta), key);
+        key = cache::hash_data(&fade, sizeof(fade), key);
+
+        out_filename = cache::get_filename(L"trim", key);
+
+        if (!cache::lookup(out_filename))
+        {
+            temp_filename = cache::get_temp_filename(out_filename);
+
+            // load the impulse response in double precision
+            coeffs = coeff::load_snd_coeff(filename.c_str(),
+                                           &length,
+                                           8,
+                                           -1,
+                                           &n_coeffs);
+
+            if (coeffs == NULL)
+            {
+                cache::cancel(out_filename, temp_filename);
+                out_filename.clear();
+                return out_filename;
+            }
+
+            for (n = 0; n < n_coeffs; n++)
+            {
+                i = find_trim_length((const double *)coeffs[n], length);
+
+                if (i > trim_length)
+                {
+                    trim_length = i;
+                }
+            }
+
+            // the fade starts at the trim point
+            trim_length += fade;
+
+            if (trim_length < length)
+            {
+                fade_length = fade;
+            }
+            else
+            {
+                // nothing to trim, the file is kept as it is
+                trim_length = length;
+                fade_length = 0;
+            }
+
+            if (fade_length > 0)
+            {
+                // a window of twice the fade length, the second half
+                // falls from one to zero
+                window = (double *)_aligned_malloc(2 * fade_length * sizeof(double), ALIGNMENT);
+
+                for (i = 0; i < 2 * fade_length; i++)
+                {
+                    window[i] = 1.0;
+                }
+
+                firwindow_kaiser(window, 2 * fade_length, 0.0, beta, 8);
+
+                for (n = 0; n < n_coeffs; n++)
+                {
+                    for (i = 0; i < fade_length; i++)
+                    {
+                        ((double *)coeffs[n])[trim_length - fade_length + i] *= window[fade_length + i];
+                    }
+                }
+
+                _aligned_free(window);
+
+                outbuf = buffer::interlace(coeffs, n_coeffs, trim_length, 8);
+
+                buffer::save_to_snd_file(temp_filename.c_str(),
+                                         outbuf,
+                                         n_coeffs,
+                                         trim_length,
+                                         8,
+                                         sampling_rate);
+
+                cache::insert(out_filename, temp_filename);
+
+                _aligned_free(outbuf);
+            }
+
+            // free coefficients
+            for (n = 0; n < n_coeffs; n++)
             {
                 if (coeffs[n] != NULL)
                 {
@@ -400,14 +741,473 @@ exit:
             }
 
             _aligned_free(coeffs);
-            coeffs = NULL;
+
+            if (fade_length == 0)
+            {
+                // nothing was written
+                cache::cancel(out_filename, temp_filename);
+                return filename;
+            }
+        }
+        else if (!buffer::get_snd_file_params(out_filename.c_str(),
+                                              &n_channels,
+                                              &trim_length,
+                                              &sampling_rate))
+        {
+            out_filename.clear();
+            return out_filename;
         }
 
-        if (filter != NULL)
+        blocks = util::get_next_multiple(n_frames, filter_length) / filter_length;
+        trim_blocks = util::get_next_multiple(trim_length, filter_length) / filter_length;
+
+        if (trim_blocks >= blocks)
         {
-            delete filter;
+            return filename;
+        }
+
+        pinfo("Trimmed the impulse response from %u to %u blocks.", blocks, trim_blocks);
+
+        return out_filename;
+    }
+
+    // Analyzes a single channel of an impulse response.
+    //
+    // Parameters:
+    //   plan            an in-place halfcomplex plan of fft_length
+    //   coeffs          the impulse response samples
+    //   length          the number of impulse response samples
+    //   fft_length      the transform length
+    //   sampling_rate   the sampling rate
+    //   estimate_music  true to estimate the gain for program material
+    //   headroom        returns the analysis results
+    //   failed          set to true if the channel could not be analyzed
+    static void
+    analyze_channel(fftw_plan plan,
+                    const double *coeffs,
+                    int length,
+                    int fft_length,
+                    int sampling_rate,
+                    bool estimate_music,
+                    struct headroom_info *headroom,
+                    bool *failed)
+    {
+        int n;
+        double *buf;
+        double mag;
+        double freq;
+        double weight;
+        double sum_weight = 0;
+        double sum_power = 0;
+
+        headroom->peak_gain = 0;
+        headroom->max_magnitude = 0;
+        headroom->music_gain = 0;
+
+        buf = (double *)fftw_malloc(fft_length * sizeof(double));
+
+        if (buf == NULL)
+        {
+            *failed = true;
+            return;
+        }
+
+        // the worst-case input is full scale with the sign of each
+        // coefficient, which makes the peak gain the L1 norm.
+        for (n = 0; n < length; n++)
+        {
+            headroom->peak_gain += fabs(coeffs[n]);
+        }
+
+        memcpy(buf, coeffs, length * sizeof(double));
+        memset(&buf[length], 0, (fft_length - length) * sizeof(double));
+
+        fftw_execute_r2r(plan, buf, buf);
+
+        // the halfcomplex output holds the real part of bin n at
+        // buf[n] and the imaginary part at buf[fft_length - n].
+        for (n = 0; n <= fft_length / 2; n++)
+        {
+            if ((n == 0) || (n == fft_length / 2))
+            {
+                mag = fabs(buf[n]);
+            }
+            else
+            {
+                mag = sqrt(buf[n] * buf[n] + buf[fft_length - n] * buf[fft_length - n]);
+            }
+
+            if (mag > headroom->max_magnitude)
+            {
+                headroom->max_magnitude = mag;
+            }
+
+            if (estimate_music)
+            {
+                freq = (double)n * sampling_rate / fft_length;
+
+                // weight the audible band with a pink spectrum, which
+                // approximates the long term spectrum of most music.
+                if ((freq >= MUSIC_LOW_FREQ) && (freq <= MUSIC_HIGH_FREQ))
+                {
+                    weight = 1.0 / freq;
+                    sum_weight += weight;
+                    sum_power += weight * mag * mag;
+                }
+            }
+        }
+
+        if (sum_weight > 0)
+        {
+            headroom->music_gain = sqrt(sum_power / sum_weight);
+        }
+
+        fftw_free(buf);
+    }
+
+    // Analyzes the headroom required by an impulse response.
+    //
+    // Each channel is transformed once and analyzed on its own
+    // thread.  The results are deterministic and independent of
+    // the convolution filter length.
+    //
+    // Parameters:
+    //   filename        the name of impulse response file
+    //   headroom        returns the analysis results for each channel
+    //   n_frames        returns the number of frames in the file
+    //   sampling_rate   returns the sampling rate of the file
+    //   estimate_music  true to estimate the gain for program material
+    //
+    // Returns:
+    //   true if successful, false otherwise.
+    bool
+    analyze_headroom(std::wstring filename,
+                     std::vector<struct headroom_info> &headroom,
+                     int *n_frames,
+                     int *sampling_rate,
+                     bool estimate_music)
+    {
+        int n;
+        int n_channels;
+        int n_coeffs;
+        int length;
+        int fft_length;
+        double *planbuf;
+        void **coeffs;
+        bool *failed;
+        bool result = false;
+        fftw_plan plan = NULL;
+        struct pool_group_t group;
+
+        headroom.clear();
+
+        // get impulse response file parameters
+        if (!buffer::get_snd_file_params(filename.c_str(),
+                                         &n_channels,
+                                         n_frames,
+                                         sampling_rate))
+        {
+            return false;
+        }
+
+        // load the impulse response in double precision
+        coeffs = coeff::load_snd_coeff(filename.c_str(),
+                                       &length,
+                                       8,
+                                       -1,
+                                       &n_coeffs);
+
+        if (coeffs == NULL)
+        {
+            return false;
+        }
+
+        // zero pad to twice the length so that the magnitude
+        // response is also sampled between the bins.
+        fft_length = util::get_next_power_of_two(length) << 1;
+
+        // FFTW planning is not thread safe, so a single plan is
+        // created here and executed on separate arrays by each pool task.
+        planbuf = (double *)fftw_malloc(fft_length * sizeof(double));
+
+        if (planbuf != NULL)
+        {
+            boost::lock_guard<boost::recursive_mutex> lock(fftw_convolver::planner_mutex);
+            plan = fftw_plan_r2r_1d(fft_length, planbuf, planbuf, FFTW_R2HC, FFTW_ESTIMATE);
+        }
+
+        if (plan != NULL)
+        {
+            headroom.resize(n_coeffs);
+            failed = new bool[n_coeffs];
+
+            thread_pool::init_group(&group, POOL_PRIORITY_BACKGROUND);
+
+            for (n = 0; n < n_coeffs; n++)
+            {
+                failed[n] = false;
+
+                thread_pool::submit(&group, boost::bind(&analyze_channel,
+                                                        plan,
+                                                        (const double *)coeffs[n],
+                                                        length,
+                                                        fft_length,
+                                                        *sampling_rate,
+                                                        estimate_music,
+                                                        &headroom[n],
+                                                        &failed[n]));
+            }
+
+            thread_pool::wait(&group);
+
+            // a channel left out would understate the headroom
+            result = true;
+
+            for (n = 0; n < n_coeffs; n++)
+            {
+                if (failed[n])
+                {
+                    result = false;
+                }
+            }
+
+            delete [] failed;
+
+            {
+                boost::lock_guard<boost::recursive_mutex> lock(fftw_convolver::planner_mutex);
+                fftw_destroy_plan(plan);
+            }
+        }
+
+        if (planbuf != NULL)
+        {
+            fftw_free(planbuf);
+        }
+
+        if (!result)
+        {
+            headroom.clear();
+        }
+
+        // free coefficients
+        for (n = 0; n < n_coeffs; n++)
+        {
+            if (coeffs[n] != NULL)
+            {
+                _aligned_free(coeffs[n]);
+                coeffs[n] = NULL;
+            }
+        }
+
+        _aligned_free(coeffs);
+
+        return result;
+    }
+
+    // Calculates the attenuation in dB for an impulse response
+    // to avoid clipping.
+    //
+    // The attenuation is derived from the maximum magnitude response
+    // over all channels, which is the largest gain any steady-state
+    // signal can see.  The attenuation for the worst-case input,
+    // which no signal exceeds, and the attenuation estimated for
+    // program material are returned alongside, and bound it from
+    // above and below.
+    //
+    // Parameters:
+    //   filename           the name of impulse response file
+    //   attenuation        returns the attenuation in dB
+    //   peak_attenuation   returns the worst-case attenuation in dB
+    //   music_attenuation  returns the attenuation for music in dB
+    //   n_channels         returns the number of channels in the file
+    //   n_frames           returns the number of frames in the file
+    //   sampling_rate      returns the sampling rate of the file
+    //
+    // Returns:
+    //   true if successful, false otherwise.
+    bool
+    calculate_attenuation(std::wstring filename,
+                          double *attenuation,
+                          double *peak_attenuation,
+                          double *music_attenuation,
+                          int *n_channels,
+                          int *n_frames,
+                          int *sampling_rate)
+    {
+        double max_magnitude = 0;
+        double peak_gain = 0;
+        double music_gain = 0;
+        std::vector<struct headroom_info> headroom;
+        std::vector<struct headroom_info>::iterator it;
+
+        *attenuation = 0;
+        *peak_attenuation = 0;
+        *music_attenuation = 0;
+
+        if (!analyze_headroom(filename, headroom, n_frames, sampling_rate, true))
+        {
+            return false;
+        }
+
+        *n_channels = (int)headroom.size();
+
+        for (it = headroom.begin(); it < headroom.end(); it++)
+        {
+            if (it->max_magnitude > max_magnitude)
+            {
+                max_magnitude = it->max_magnitude;
+            }
+
+            if (it->peak_gain > peak_gain)
+            {
+                peak_gain = it->peak_gain;
+            }
+
+            if (it->music_gain > music_gain)
+            {
+                music_gain = it->music_gain;
+            }
+        }
+
+        if (max_magnitude > 1)
+        {
+            *attenuation = -TO_DB(max_magnitude);
+        }
+
+        if (peak_gain > 1)
+        {
+            *peak_attenuation = -TO_DB(peak_gain);
+        }
+
+        if (music_gain > 1)
+        {
+            *music_attenuation = -TO_DB(music_gain);
+        }
+
+        return true;
+    }
+    // Builds the equalizer and impulse files of the filter settings
+    // into a single impulse response.
+    //
+    // Impulse files that do not match the format are resampled if
+    // enabled, otherwise they are left out.
+    //
+    // Parameters:
+    //   settings       the filter settings
+    //   filter_length  the length of convolution filter
+    //   eq_blocks      the number of equalizer filter blocks
+    //   realsize       the "float" size
+    //   n_channels     the number of channels
+    //   sampling_rate  the sampling rate
+    //   scale          returns the scale to apply to the impulse response
+    //
+    // Returns:
+    //   The name of the impulse response file, or empty if no part
+    //   of the filter is enabled.
+    std::wstring
+    build_filter(const struct filter_settings &settings,
+                 int filter_length,
+                 int eq_blocks,
+                 int realsize,
+                 int n_channels,
+                 int sampling_rate,
+                 double *scale)
+    {
+        std::vector<struct impulse_info> impulse_info;
+        struct impulse_info info;
+        std::wstring filename;
+        int n;
+
+        *scale = 1.0;
+
+        if (settings.eq_enable)
+        {
+            double mag[BAND_COUNT];
+            double phase[BAND_COUNT];
+
+            memcpy(mag, settings.eq_mag, BAND_COUNT * sizeof(double));
+            memset(phase, 0, BAND_COUNT * sizeof(double));
+
+            equalizer eq(filter_length,
+                         eq_blocks,
+                         realsize,
+                         n_channels,
+                         sampling_rate);
+
+            info.filename = eq.generate(ISO_BANDS_SIZE,
+                                        (double *) iso_bands,
+                                        mag,
+                                        phase);
+
+            info.scale = settings.eq_scale;
+            impulse_info.push_back(info);
+        }
+
+        for (n = 0; n < FILTER_FILE_COUNT; n++)
+        {
+            const struct filter_file_settings &file = settings.files[n];
+
+            if (!file.enable || file.filename.empty())
+            {
+                continue;
+            }
+
+            filename = file.filename;
+
+            if (!buffer::check_snd_file(filename.c_str(), n_channels, sampling_rate))
+            {
+                if (file.resample)
+                {
+                    filename = buffer::resample_snd_file(filename.c_str(), n_channels, sampling_rate);
+                }
+                else
+                {
+                    filename.clear();
+                }
+            }
+
+            if (!filename.empty())
+            {
+                info.filename = filename;
+                info.scale = file.scale;
+                impulse_info.push_back(info);
+            }
+        }
+
+        filename.clear();
+
+        if (impulse_info.size() == 1)
+        {
+            filename = impulse_info.front().filename;
+            *scale = impulse_info.front().scale;
+        }
+        else if (impulse_info.size() > 1)
+        {
+            // Preconvolve impulse files into a single file
+            filename = convolve_impulses(impulse_info, filter_length, realsize);
+        }
+
+        if (settings.min_phase && !filename.empty())
+        {
+            // the magnitude response and so the scale are unchanged
+            std::wstring min_phase_filename = convert_min_phase(filename);
+
+            if (!min_phase_filename.empty())
+            {
+                filename = min_phase_filename;
+            }
+        }
+
+        if (settings.trim && !filename.empty())
+        {
+            std::wstring trim_filename = trim_impulse(filename, filter_length);
+
+            if (!trim_filename.empty())
+            {
+                filename = trim_filename;
+            }
         }
 
-        return status;
+        return filename;
     }
-}
+}
\ No newline at end of file
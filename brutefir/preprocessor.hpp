@@ -10,27 +10,80 @@
 #include <string>
 #include <vector>
 
+#include "equalizer.hpp"
+
+// number of impulse files in the filter settings
+#define FILTER_FILE_COUNT 3
+
 struct impulse_info
 {
     std::wstring filename;
     double scale;
 };
 
+struct headroom_info
+{
+    double peak_gain;       // worst-case peak gain (L1 norm of the impulse)
+    double max_magnitude;   // maximum of the magnitude response
+    double music_gain;      // estimated gain for typical program material
+};
+
+struct filter_file_settings
+{
+    bool enable;
+    bool resample;          // resample if the sampling rate differs
+    std::wstring filename;
+    double scale;
+};
+
+struct filter_settings
+{
+    bool min_phase;             // convert the filter to minimum phase
+    bool trim;                  // trim the filter tail below the threshold
+    bool eq_enable;
+    double eq_scale;
+    double eq_mag[BAND_COUNT];  // band magnitudes in dB
+    struct filter_file_settings files[FILTER_FILE_COUNT];
+};
+
 namespace preprocessor
 {
     std::wstring
     convolve_impulses(std::vector<struct impulse_info> impulse_info, 
                       int filter_length,
                       int realsize);
+
+    std::wstring
+    convert_min_phase(std::wstring filename);
+
+    std::wstring
+    trim_impulse(std::wstring filename,
+                 int filter_length);
+
+    bool
+    analyze_headroom(std::wstring filename,
+                     std::vector<struct headroom_info> &headroom,
+                     int *n_frames,
+                     int *sampling_rate,
+                     bool estimate_music);
    
     bool
     calculate_attenuation(std::wstring filename,
-                          int filter_length,
-                          int realsize,
                           double *attenuation,
+                          double *peak_attenuation,
+                          double *music_attenuation,
                           int *n_channels,
                           int *n_frames,
                           int *sampling_rate);
+
+    std::wstring
+    build_filter(const struct filter_settings &settings,
+                 int filter_length,
+                 int eq_blocks,
+                 int realsize,
+                 int n_channels,
+                 int sampling_rate,
+                 double *scale);
 }
 
 #endif
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "numunion.h"
 #include "swap.h"
 #include "pinfo.h"
+#include "simd.hpp"
 #include "raw2real.hpp"
 
 namespace raw2real
@@ -26,6 +27,12 @@ namespace raw2real
         numunion_t *realbuf, *rawbuf, sample;
         int n, i;
 
+        // use the vector kernels when the format has one
+        if (simd::raw2realf(_realbuf, _rawbuf, bytes, shift, isfloat, spacing, swap, n_samples))
+        {
+            return;
+        }
+
         realbuf = (numunion_t *)_realbuf;
         rawbuf = (numunion_t *)_rawbuf;
 
@@ -231,6 +238,12 @@ namespace raw2real
         numunion_t *realbuf, *rawbuf, sample;
         int n, i;
 
+        // use the vector kernels when the format has one
+        if (simd::raw2reald(_realbuf, _rawbuf, bytes, shift, isfloat, spacing, swap, n_samples))
+        {
+            return;
+        }
+
         realbuf = (numunion_t *)_realbuf;
         rawbuf = (numunion_t *)_rawbuf;
 
@@ -0,0 +1,196 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#include <math.h>
+#include <samplerate.h>
+
+#include "resampler.hpp"
+#include "pinfo.h"
+
+// Constructor for the class.
+//
+// Parameters:
+//   n_channels         the number of interlaced channels
+//   src_sampling_rate  the input sampling rate
+//   dst_sampling_rate  the output sampling rate
+//   quality            the libsamplerate converter type
+resampler::resampler(int n_channels,
+                     int src_sampling_rate,
+                     int dst_sampling_rate,
+                     int quality)
+    : m_initialized(false), m_state(NULL), m_channels(n_channels),
+      m_dst_sampling_rate(dst_sampling_rate), m_frames_in(0), m_frames_out(0)
+{
+    int error = 0;
+
+    m_ratio = (double)dst_sampling_rate / (double)src_sampling_rate;
+
+    if (src_is_valid_ratio(m_ratio) == 0)
+    {
+        pinfo("Unsupported resampling ratio %u Hz to %u Hz.",
+              src_sampling_rate,
+              dst_sampling_rate);
+
+        return;
+    }
+
+    m_state = src_new(quality, n_channels, &error);
+
+    if (m_state == NULL)
+    {
+        pinfo("Failed to create resampler: %s.", src_strerror(error));
+        return;
+    }
+
+    m_initialized = true;
+}
+
+// Destructor for the class.
+resampler::~resampler()
+{
+    if (m_state != NULL)
+    {
+        src_delete(m_state);
+        m_state = NULL;
+    }
+}
+
+// Returns a value indicating whether the resampler is initialized.
+//
+// Returns:
+//   True if initialized, false otherwise.
+bool
+resampler::is_initialized()
+{
+    return m_initialized;
+}
+
+// Returns the number of output frames to allow for when processing
+// the given number of input frames.  The converter can emit more
+// than the ratio suggests from input it held back earlier.
+//
+// Parameters:
+//   in_frames  the number of input frames
+//
+// Returns:
+//   The maximum number of output frames.
+int
+resampler::get_max_output_frames(int in_frames)
+{
+    return (int)ceil((in_frames + RESAMPLER_HISTORY_FRAMES) * m_ratio) + RESAMPLER_HISTORY_FRAMES;
+}
+
+// Resamples a block of interlaced samples.  The converter state
+// persists between calls, so a continuous stream can be fed
+// in blocks of any size.  Input that does not fit the output
+// buffer is kept and converted first by the next call.
+//
+// Parameters:
+//   inbuf           the interlaced input samples
+//   in_frames       the number of input frames
+//   outbuf          the interlaced output buffer
+//   max_out_frames  the capacity of the output buffer in frames
+//
+// Returns:
+//   The number of frames written to the output buffer
+//   or -1 on error.
+int
+resampler::process(const float *inbuf,
+                   int in_frames,
+                   float *outbuf,
+                   int max_out_frames)
+{
+    int error;
+    int frames_gen = 0;
+    SRC_DATA src_data;
+
+    if (!m_initialized)
+    {
+        return -1;
+    }
+
+    if (!m_backlog.empty())
+    {
+        m_backlog.insert(m_backlog.end(), inbuf, inbuf + in_frames * m_channels);
+
+        inbuf = &m_backlog[0];
+        in_frames = (int)(m_backlog.size() / m_channels);
+    }
+
+    src_data.data_in = (float *)inbuf;
+    src_data.input_frames = in_frames;
+    src_data.end_of_input = 0;
+    src_data.src_ratio = m_ratio;
+
+    // the converter may need several passes to consume the input
+    while ((src_data.input_frames > 0) && (frames_gen < max_out_frames))
+    {
+        src_data.data_out = &outbuf[frames_gen * m_channels];
+        src_data.output_frames = max_out_frames - frames_gen;
+
+        error = src_process(m_state, &src_data);
+
+        if (error != 0)
+        {
+            pinfo("Resampler error: %s.", src_strerror(error));
+            return -1;
+        }
+
+        if ((src_data.input_frames_used == 0) && (src_data.output_frames_gen == 0))
+        {
+            break;
+        }
+
+        src_data.data_in += src_data.input_frames_used * m_channels;
+        src_data.input_frames -= src_data.input_frames_used;
+        frames_gen += src_data.output_frames_gen;
+
+        m_frames_in += src_data.input_frames_used;
+    }
+
+    if (src_data.input_frames > 0)
+    {
+        std::vector<float> rest(src_data.data_in,
+                                src_data.data_in + src_data.input_frames * m_channels);
+
+        m_backlog.swap(rest);
+    }
+    else
+    {
+        m_backlog.clear();
+    }
+
+    m_frames_out += frames_gen;
+
+    return frames_gen;
+}
+
+// Returns the amount of audio held inside the converter.
+//
+// Returns:
+//   The latency in seconds.
+double
+resampler::get_latency()
+{
+    int64_t frames_in = m_frames_in + (int64_t)(m_backlog.size() / m_channels);
+    double frames = (double)frames_in * m_ratio - (double)m_frames_out;
+
+    return (frames > 0) ? frames / m_dst_sampling_rate : 0;
+}
+
+// Discards the converter state, for example on a seek.
+void
+resampler::reset()
+{
+    if (m_state != NULL)
+    {
+        src_reset(m_state);
+    }
+
+    m_frames_in = 0;
+    m_frames_out = 0;
+    m_backlog.clear();
+}
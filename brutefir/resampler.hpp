@@ -0,0 +1,62 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _RESAMPLER_HPP_
+#define _RESAMPLER_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include <samplerate.h>
+
+// frames the converter may hold back, at either rate; more than the
+// longest libsamplerate filter delay
+#define RESAMPLER_HISTORY_FRAMES 256
+
+class resampler
+{
+public:
+    resampler(int n_channels,
+              int src_sampling_rate,
+              int dst_sampling_rate,
+              int quality);
+
+    ~resampler();
+
+    bool
+    is_initialized();
+
+    int
+    get_max_output_frames(int in_frames);
+
+    int
+    process(const float *inbuf,
+            int in_frames,
+            float *outbuf,
+            int max_out_frames);
+
+    double
+    get_latency();
+
+    void
+    reset();
+
+private:
+    bool m_initialized;
+
+    SRC_STATE *m_state;
+
+    int m_channels;
+    int m_dst_sampling_rate;
+    double m_ratio;
+
+    int64_t m_frames_in;
+    int64_t m_frames_out;
+
+    // input that did not fit the last output buffer
+    std::vector<float> m_backlog;
+};
+
+#endif
@@ -0,0 +1,1354 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#include <string.h>
+
+#include "global.h"
+#include "simd.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// the number of samples after a group of four that a kernel
+// may read when loading the group with wide loads
+#define SIMD_GUARD 2
+
+// the size in samples of the staging buffers used for the
+// samples that do not fill a complete group
+#define SIMD_STAGE_SIZE 12
+
+namespace simd
+{
+    // cleared to run the scalar conversions on any processor
+    static volatile bool enabled = true;
+
+    // Returns a value indicating whether the processor supports
+    // the vectorized conversion kernels (SSE2) and they are enabled.
+    //
+    // Returns:
+    //   True if supported, false otherwise.
+    bool
+    is_supported()
+    {
+#ifdef SIMD_SSE2
+        static int supported = -1;
+
+        if (supported == -1)
+        {
+#if defined(_MSC_VER)
+            int info[4];
+
+            __cpuid(info, 1);
+            supported = ((info[3] & (1 << 26)) != 0) ? 1 : 0;
+#else
+            unsigned int eax, ebx, ecx, edx;
+
+            supported = (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+                         ((edx & (1 << 26)) != 0)) ? 1 : 0;
+#endif
+        }
+
+        return (supported == 1) && enabled;
+#else
+        return false;
+#endif
+    }
+
+    // Enables or disables the vectorized kernels, so that the
+    // scalar conversions they replace can be compared with them.
+    // The kernels are enabled by default.
+    //
+    // Parameters:
+    //   enable  false to use the scalar conversions
+    void
+    set_enabled(bool enable)
+    {
+        enabled = enable;
+    }
+
+#ifdef SIMD_SSE2
+    static const int bitcount4[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+    // Swaps the bytes of each 16-bit lane.
+    static inline __m128i
+    swap16(__m128i x)
+    {
+        return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+    }
+
+    // Swaps the bytes of each 32-bit lane.
+    static inline __m128i
+    swap32(__m128i x)
+    {
+        x = swap16(x);
+        x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+        return _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    }
+
+    // Swaps the bytes of each 64-bit lane.
+    static inline __m128i
+    swap64(__m128i x)
+    {
+        x = swap16(x);
+        x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+        return _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+    }
+
+    // Selects b where mask is set, otherwise a.
+    static inline __m128i
+    select_epi32(__m128i mask,
+                 __m128i a,
+                 __m128i b)
+    {
+        return _mm_or_si128(_mm_and_si128(mask, b), _mm_andnot_si128(mask, a));
+    }
+
+    // Returns the lane-wise maximum of signed 32-bit lanes.
+    static inline __m128i
+    max_epi32(__m128i a,
+              __m128i b)
+    {
+        return select_epi32(_mm_cmpgt_epi32(b, a), a, b);
+    }
+
+    // Reads a packed 24-bit sample into the low bytes of an integer.
+    static inline int32_t
+    load24(const uint8_t *p)
+    {
+        return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16));
+    }
+
+    // Loads four strided samples of 2, 3 or 4 bytes. Integer samples
+    // are returned sign extended to 32-bit lanes, 4-byte samples are
+    // returned unchanged so they may also be used for floats.
+    //
+    // Parameters:
+    //   p        the first sample
+    //   bytes    the sample size in bytes
+    //   spacing  the distance between samples in samples
+    //   swap     true if bytes should be swapped
+    static inline __m128i
+    load4(const uint8_t *p,
+          int bytes,
+          int spacing,
+          bool swap)
+    {
+        __m128i v, a, b;
+        int stride = bytes * spacing;
+
+        switch (bytes)
+        {
+        case 2:
+            if (spacing == 1)
+            {
+                v = _mm_loadl_epi64((const __m128i *)p);
+                v = swap ? swap16(v) : v;
+                return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            }
+
+            if (spacing == 2)
+            {
+                // the sample of each frame is in the low half of each lane
+                v = _mm_loadu_si128((const __m128i *)p);
+            }
+            else
+            {
+                v = _mm_set_epi32(*(const uint16_t *)&p[3 * stride],
+                                  *(const uint16_t *)&p[2 * stride],
+                                  *(const uint16_t *)&p[stride],
+                                  *(const uint16_t *)p);
+            }
+
+            v = swap ? swap16(v) : v;
+            return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+
+        case 3:
+            if (spacing == 1)
+            {
+                // deinterleave four packed samples into the low bytes of each lane
+                v = _mm_loadu_si128((const __m128i *)p);
+                a = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+                b = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+                v = _mm_unpacklo_epi64(a, b);
+            }
+            else
+            {
+                v = _mm_set_epi32(load24(&p[3 * stride]),
+                                  load24(&p[2 * stride]),
+                                  load24(&p[stride]),
+                                  load24(p));
+            }
+
+            if (swap)
+            {
+                a = _mm_set1_epi32(0xFF);
+                v = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, a), 16),
+                                              _mm_and_si128(v, _mm_set1_epi32(0xFF00))),
+                                 _mm_and_si128(_mm_srli_epi32(v, 16), a));
+            }
+
+            return _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+
+        default:
+            if (spacing == 1)
+            {
+                v = _mm_loadu_si128((const __m128i *)p);
+            }
+            else if (spacing == 2)
+            {
+                a = _mm_loadu_si128((const __m128i *)p);
+                b = _mm_loadu_si128((const __m128i *)&p[16]);
+                v = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a),
+                                                    _mm_castsi128_ps(b),
+                                                    _MM_SHUFFLE(2, 0, 2, 0)));
+            }
+            else
+            {
+                v = _mm_set_epi32(*(const int32_t *)&p[3 * stride],
+                                  *(const int32_t *)&p[2 * stride],
+                                  *(const int32_t *)&p[stride],
+                                  *(const int32_t *)p);
+            }
+
+            return swap ? swap32(v) : v;
+        }
+    }
+
+    // Loads two strided 64-bit floating point samples.
+    static inline __m128d
+    load2d(const uint8_t *p,
+           int spacing,
+           bool swap)
+    {
+        __m128i v;
+
+        if (spacing == 1)
+        {
+            v = _mm_loadu_si128((const __m128i *)p);
+        }
+        else
+        {
+            v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)p),
+                                   _mm_loadl_epi64((const __m128i *)&p[8 * spacing]));
+        }
+
+        return _mm_castsi128_pd(swap ? swap64(v) : v);
+    }
+
+    // Stores four integer samples of 2, 3 or 4 bytes to strided
+    // locations, truncating each lane to the sample size.
+    static inline void
+    store4(uint8_t *p,
+           __m128i v,
+           int bytes,
+           int spacing,
+           bool swap)
+    {
+        int32_t lanes[4];
+        int n, stride = bytes * spacing;
+
+        if (bytes == 2)
+        {
+            v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+            v = _mm_packs_epi32(v, v);
+            v = swap ? swap16(v) : v;
+
+            if (spacing == 1)
+            {
+                _mm_storel_epi64((__m128i *)p, v);
+                return;
+            }
+        }
+        else if (bytes == 4)
+        {
+            v = swap ? swap32(v) : v;
+
+            if (spacing == 1)
+            {
+                _mm_storeu_si128((__m128i *)p, v);
+                return;
+            }
+        }
+
+        _mm_storeu_si128((__m128i *)lanes, v);
+
+        switch (bytes)
+        {
+        case 2:
+            for (n = 0; n < 4; n++)
+            {
+                *(uint16_t *)&p[n * stride] = ((uint16_t *)lanes)[n];
+            }
+            break;
+        case 3:
+            for (n = 0; n < 4; n++)
+            {
+                if (swap)
+                {
+                    p[n * stride] = (uint8_t)(lanes[n] >> 16);
+                    p[n * stride + 1] = (uint8_t)(lanes[n] >> 8);
+                    p[n * stride + 2] = (uint8_t)lanes[n];
+                }
+                else
+                {
+                    p[n * stride] = (uint8_t)lanes[n];
+                    p[n * stride + 1] = (uint8_t)(lanes[n] >> 8);
+                    p[n * stride + 2] = (uint8_t)(lanes[n] >> 16);
+                }
+            }
+            break;
+        default:
+            for (n = 0; n < 4; n++)
+            {
+                *(int32_t *)&p[n * stride] = lanes[n];
+            }
+            break;
+        }
+    }
+
+    // Stores two 64-bit floating point samples to strided locations.
+    static inline void
+    store2d(uint8_t *p,
+            __m128d v,
+            int spacing,
+            bool swap)
+    {
+        __m128i x = _mm_castpd_si128(v);
+
+        x = swap ? swap64(x) : x;
+
+        if (spacing == 1)
+        {
+            _mm_storeu_si128((__m128i *)p, x);
+        }
+        else
+        {
+            _mm_storel_epi64((__m128i *)p, x);
+            _mm_storel_epi64((__m128i *)&p[8 * spacing], _mm_unpackhi_epi64(x, x));
+        }
+    }
+
+    // Converts groups of four raw samples to floats.
+    static void
+    raw2realf_groups(float *realbuf,
+                     const uint8_t *rawbuf,
+                     int bytes,
+                     int shift,
+                     bool isfloat,
+                     int spacing,
+                     bool swap,
+                     int n_groups)
+    {
+        __m128i v;
+        __m128i count = _mm_cvtsi32_si128(shift);
+        int n, stride = bytes * spacing;
+
+        for (n = 0; n < n_groups; n++, realbuf += 4, rawbuf += 4 * stride)
+        {
+            if (isfloat && bytes == 8)
+            {
+                _mm_storeu_ps(realbuf,
+                              _mm_movelh_ps(_mm_cvtpd_ps(load2d(rawbuf, spacing, swap)),
+                                            _mm_cvtpd_ps(load2d(&rawbuf[2 * stride], spacing, swap))));
+            }
+            else if (isfloat)
+            {
+                _mm_storeu_ps(realbuf, _mm_castsi128_ps(load4(rawbuf, 4, spacing, swap)));
+            }
+            else
+            {
+                v = _mm_sra_epi32(load4(rawbuf, bytes, spacing, swap), count);
+                _mm_storeu_ps(realbuf, _mm_cvtepi32_ps(v));
+            }
+        }
+    }
+
+    // Converts groups of four raw samples to doubles.
+    static void
+    raw2reald_groups(double *realbuf,
+                     const uint8_t *rawbuf,
+                     int bytes,
+                     int shift,
+                     bool isfloat,
+                     int spacing,
+                     bool swap,
+                     int n_groups)
+    {
+        __m128i v;
+        __m128 f;
+        __m128i count = _mm_cvtsi32_si128(shift);
+        int n, stride = bytes * spacing;
+
+        for (n = 0; n < n_groups; n++, realbuf += 4, rawbuf += 4 * stride)
+        {
+            if (isfloat && bytes == 8)
+            {
+                _mm_storeu_pd(realbuf, load2d(rawbuf, spacing, swap));
+                _mm_storeu_pd(&realbuf[2], load2d(&rawbuf[2 * stride], spacing, swap));
+            }
+            else if (isfloat)
+            {
+                f = _mm_castsi128_ps(load4(rawbuf, 4, spacing, swap));
+                _mm_storeu_pd(realbuf, _mm_cvtps_pd(f));
+                _mm_storeu_pd(&realbuf[2], _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+            }
+            else
+            {
+                v = _mm_sra_epi32(load4(rawbuf, bytes, spacing, swap), count);
+                _mm_storeu_pd(realbuf, _mm_cvtepi32_pd(v));
+                _mm_storeu_pd(&realbuf[2], _mm_cvtepi32_pd(_mm_srli_si128(v, 8)));
+            }
+        }
+    }
+
+    // Returns a value indicating whether a raw format has a kernel.
+    static bool
+    is_raw_supported(int bytes,
+                     int shift,
+                     bool isfloat,
+                     int spacing)
+    {
+        if (spacing < 1 || !is_supported())
+        {
+            return false;
+        }
+
+        return isfloat ? ((bytes == 4 || bytes == 8) && shift == 0)
+                       : (bytes >= 2 && bytes <= 4);
+    }
+#endif
+
+    // Converts raw samples to floats using vector instructions.
+    //
+    // Parameters and results are the same as raw2real::raw2realf.
+    //
+    // Returns:
+    //   True if the samples were converted, false if the format
+    //   has no vector kernel and must be converted by the caller.
+    bool
+    raw2realf(void *realbuf,
+              const void *rawbuf,
+              int bytes,
+              int shift,
+              bool isfloat,
+              int spacing,
+              bool swap,
+              int n_samples)
+    {
+#ifdef SIMD_SSE2
+        uint8_t stage_raw[SIMD_STAGE_SIZE * 8];
+        float stage_real[SIMD_STAGE_SIZE];
+        int n, n_groups, tail;
+
+        if (!is_raw_supported(bytes, shift, isfloat, spacing))
+        {
+            return false;
+        }
+
+        n_groups = (n_samples > SIMD_GUARD) ? (n_samples - SIMD_GUARD) >> 2 : 0;
+
+        raw2realf_groups((float *)realbuf, (const uint8_t *)rawbuf, bytes, shift,
+                         isfloat, spacing, swap, n_groups);
+
+        // gather the remaining samples into a padded buffer
+        tail = n_samples - (n_groups << 2);
+
+        if (tail > 0)
+        {
+            memset(stage_raw, 0, sizeof(stage_raw));
+
+            for (n = 0; n < tail; n++)
+            {
+                memcpy(&stage_raw[n * bytes],
+                       &((const uint8_t *)rawbuf)[((n_groups << 2) + n) * bytes * spacing],
+                       bytes);
+            }
+
+            raw2realf_groups(stage_real, stage_raw, bytes, shift, isfloat, 1, swap, (tail + 3) >> 2);
+            memcpy(&((float *)realbuf)[n_groups << 2], stage_real, tail * sizeof(float));
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Converts raw samples to doubles using vector instructions.
+    //
+    // Parameters and results are the same as raw2real::raw2reald.
+    //
+    // Returns:
+    //   True if the samples were converted, false if the format
+    //   has no vector kernel and must be converted by the caller.
+    bool
+    raw2reald(void *realbuf,
+              const void *rawbuf,
+              int bytes,
+              int shift,
+              bool isfloat,
+              int spacing,
+              bool swap,
+              int n_samples)
+    {
+#ifdef SIMD_SSE2
+        uint8_t stage_raw[SIMD_STAGE_SIZE * 8];
+        double stage_real[SIMD_STAGE_SIZE];
+        int n, n_groups, tail;
+
+        if (!is_raw_supported(bytes, shift, isfloat, spacing))
+        {
+            return false;
+        }
+
+        n_groups = (n_samples > SIMD_GUARD) ? (n_samples - SIMD_GUARD) >> 2 : 0;
+
+        raw2reald_groups((double *)realbuf, (const uint8_t *)rawbuf, bytes, shift,
+                         isfloat, spacing, swap, n_groups);
+
+        // gather the remaining samples into a padded buffer
+        tail = n_samples - (n_groups << 2);
+
+        if (tail > 0)
+        {
+            memset(stage_raw, 0, sizeof(stage_raw));
+
+            for (n = 0; n < tail; n++)
+            {
+                memcpy(&stage_raw[n * bytes],
+                       &((const uint8_t *)rawbuf)[((n_groups << 2) + n) * bytes * spacing],
+                       bytes);
+            }
+
+            raw2reald_groups(stage_real, stage_raw, bytes, shift, isfloat, 1, swap, (tail + 3) >> 2);
+            memcpy(&((double *)realbuf)[n_groups << 2], stage_real, tail * sizeof(double));
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#ifdef SIMD_SSE2
+    // Accumulated overflow statistics of a vector kernel.
+    struct overflow_acc_t
+    {
+        unsigned int n_overflows;
+        __m128d largest;
+        __m128i intlargest;
+    };
+
+    // Writes four quantized samples, or four float samples when
+    // isfloat is set, given as two pairs of doubles.
+    static inline void
+    store_reals(uint8_t *p,
+                __m128d lo,
+                __m128d hi,
+                int bytes,
+                int spacing,
+                bool swap)
+    {
+        if (bytes == 8)
+        {
+            store2d(p, lo, spacing, swap);
+            store2d(&p[16 * spacing], hi, spacing, swap);
+        }
+        else
+        {
+            store4(p, _mm_castps_si128(_mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi))),
+                   4, spacing, swap);
+        }
+    }
+
+    // Quantizes four samples, given as two pairs of doubles, without
+    // dither. Matches dither::ditherd_real2int_no_dither.
+    static inline __m128i
+    quantize_d(__m128d lo,
+               __m128d hi,
+               __m128d rmin,
+               __m128d rmax,
+               __m128i imin,
+               __m128i imax,
+               struct overflow_acc_t *acc)
+    {
+        const __m128d half = _mm_set1_pd(0.5);
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d absmask = _mm_castsi128_pd(_mm_set_epi32(0x7FFFFFFF, -1, 0x7FFFFFFF, -1));
+        __m128d nof_lo, nof_hi, pof_lo, pof_hi;
+        __m128i s, neg, neg_of, pos_of, of, sign;
+
+        // mid-tread requantisation by truncating downwards after adding 0.5
+        lo = _mm_add_pd(lo, half);
+        hi = _mm_add_pd(hi, half);
+
+        nof_lo = _mm_cmple_pd(lo, rmin);
+        nof_hi = _mm_cmple_pd(hi, rmin);
+        pof_lo = _mm_cmpgt_pd(lo, rmax);
+        pof_hi = _mm_cmpgt_pd(hi, rmax);
+
+        // narrow the 64-bit lane masks to 32-bit lanes
+        neg = _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(_mm_cmplt_pd(lo, zero)),
+                                              _mm_castpd_ps(_mm_cmplt_pd(hi, zero)),
+                                              _MM_SHUFFLE(2, 0, 2, 0)));
+        neg_of = _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(nof_lo), _mm_castpd_ps(nof_hi),
+                                                 _MM_SHUFFLE(2, 0, 2, 0)));
+        pos_of = _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(pof_lo), _mm_castpd_ps(pof_hi),
+                                                 _MM_SHUFFLE(2, 0, 2, 0)));
+        of = _mm_or_si128(neg_of, pos_of);
+
+        acc->n_overflows += bitcount4[_mm_movemask_ps(_mm_castsi128_ps(of))];
+        acc->largest = _mm_max_pd(_mm_and_pd(_mm_or_pd(nof_lo, pof_lo), _mm_and_pd(lo, absmask)),
+                                  acc->largest);
+        acc->largest = _mm_max_pd(_mm_and_pd(_mm_or_pd(nof_hi, pof_hi), _mm_and_pd(hi, absmask)),
+                                  acc->largest);
+
+        s = _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+        s = _mm_add_epi32(s, neg);
+        s = select_epi32(neg_of, s, imin);
+        s = select_epi32(pos_of, s, imax);
+
+        sign = _mm_srai_epi32(s, 31);
+        acc->intlargest = max_epi32(acc->intlargest,
+                                    _mm_andnot_si128(of, _mm_sub_epi32(_mm_xor_si128(s, sign), sign)));
+
+        return s;
+    }
+
+    // Quantizes four float samples without dither. Matches
+    // dither::ditherf_real2int_no_dither.
+    static inline __m128i
+    quantize_f(__m128 x,
+               __m128 rmin,
+               __m128 rmax,
+               __m128i imin,
+               __m128i imax,
+               struct overflow_acc_t *acc)
+    {
+        const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        __m128 ax;
+        __m128i s, neg, neg_of, pos_of, of, sign;
+
+        // mid-tread requantisation by truncating downwards after adding 0.5
+        x = _mm_add_ps(x, _mm_set1_ps(0.5f));
+
+        neg = _mm_castps_si128(_mm_cmplt_ps(x, _mm_setzero_ps()));
+        neg_of = _mm_castps_si128(_mm_cmple_ps(x, rmin));
+        pos_of = _mm_castps_si128(_mm_cmpgt_ps(x, rmax));
+        of = _mm_or_si128(neg_of, pos_of);
+
+        acc->n_overflows += bitcount4[_mm_movemask_ps(_mm_castsi128_ps(of))];
+
+        ax = _mm_and_ps(_mm_castsi128_ps(of), _mm_and_ps(x, absmask));
+        acc->largest = _mm_max_pd(_mm_cvtps_pd(ax), acc->largest);
+        acc->largest = _mm_max_pd(_mm_cvtps_pd(_mm_movehl_ps(ax, ax)), acc->largest);
+
+        s = _mm_add_epi32(_mm_cvttps_epi32(x), neg);
+        s = select_epi32(neg_of, s, imin);
+        s = select_epi32(pos_of, s, imax);
+
+        sign = _mm_srai_epi32(s, 31);
+        acc->intlargest = max_epi32(acc->intlargest,
+                                    _mm_andnot_si128(of, _mm_sub_epi32(_mm_xor_si128(s, sign), sign)));
+
+        return s;
+    }
+
+    // Updates the overflow statistics of four real samples written
+    // to a floating point format, as REAL_OVERFLOW_UPDATE does.
+    static inline void
+    update_real_overflow(__m128d lo,
+                         __m128d hi,
+                         __m128d rmin,
+                         __m128d rmax,
+                         struct overflow_acc_t *acc)
+    {
+        const __m128d absmask = _mm_castsi128_pd(_mm_set_epi32(0x7FFFFFFF, -1, 0x7FFFFFFF, -1));
+
+        acc->n_overflows += bitcount4[_mm_movemask_pd(_mm_or_pd(_mm_cmplt_pd(lo, rmin),
+                                                                _mm_cmpgt_pd(lo, rmax))) |
+                                      (_mm_movemask_pd(_mm_or_pd(_mm_cmplt_pd(hi, rmin),
+                                                                 _mm_cmpgt_pd(hi, rmax))) << 2)];
+
+        acc->largest = _mm_max_pd(_mm_and_pd(lo, absmask), acc->largest);
+        acc->largest = _mm_max_pd(_mm_and_pd(hi, absmask), acc->largest);
+    }
+
+    // Converts groups of four real samples to a raw format.
+    static void
+    real2raw_groups(uint8_t *rawbuf,
+                    const uint8_t *realbuf,
+                    int realsize,
+                    int bits,
+                    int bytes,
+                    int shift,
+                    bool isfloat,
+                    int spacing,
+                    bool swap,
+                    int n_groups,
+                    struct overflow_acc_t *acc,
+                    double max)
+    {
+        __m128d lo, hi, drmin, drmax;
+        __m128 x, frmin, frmax;
+        __m128i s, imin, imax;
+        __m128i count = _mm_cvtsi32_si128(shift);
+        int n, stride = bytes * spacing;
+
+        imin = _mm_set1_epi32(-(1 << (bits - 1)));
+        imax = _mm_set1_epi32((1 << (bits - 1)) - 1);
+
+        if (isfloat)
+        {
+            drmin = _mm_set1_pd(-max);
+            drmax = _mm_set1_pd(max);
+        }
+        else
+        {
+            drmin = _mm_set1_pd((double)-(1 << (bits - 1)));
+            drmax = _mm_set1_pd((double)((1 << (bits - 1)) - 1));
+        }
+
+        frmin = _mm_set1_ps((float)-(1 << (bits - 1)));
+        frmax = _mm_set1_ps((float)((1 << (bits - 1)) - 1));
+
+        for (n = 0; n < n_groups; n++, realbuf += 4 * realsize, rawbuf += 4 * stride)
+        {
+            if (realsize == 4)
+            {
+                x = _mm_loadu_ps((const float *)realbuf);
+
+                if (!isfloat)
+                {
+                    s = quantize_f(x, frmin, frmax, imin, imax, acc);
+                    store4(rawbuf, _mm_sll_epi32(s, count), bytes, spacing, swap);
+                    continue;
+                }
+
+                lo = _mm_cvtps_pd(x);
+                hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+            }
+            else
+            {
+                lo = _mm_loadu_pd((const double *)realbuf);
+                hi = _mm_loadu_pd(&((const double *)realbuf)[2]);
+
+                if (!isfloat)
+                {
+                    s = quantize_d(lo, hi, drmin, drmax, imin, imax, acc);
+                    store4(rawbuf, _mm_sll_epi32(s, count), bytes, spacing, swap);
+                    continue;
+                }
+            }
+
+            update_real_overflow(lo, hi, drmin, drmax, acc);
+
+            if (realsize == 4 && bytes == 4)
+            {
+                store4(rawbuf, _mm_castps_si128(x), 4, spacing, swap);
+            }
+            else
+            {
+                store_reals(rawbuf, lo, hi, bytes, spacing, swap);
+            }
+        }
+    }
+
+    // Converts real samples to a raw format without dither,
+    // staging the samples which do not fill a complete group.
+    static bool
+    real2raw_no_dither(void *rawbuf,
+                       const void *realbuf,
+                       int realsize,
+                       int bits,
+                       int bytes,
+                       int shift,
+                       bool isfloat,
+                       int spacing,
+                       bool swap,
+                       int n_samples,
+                       struct bfoverflow_t *overflow)
+    {
+        uint8_t stage_raw[4 * 8];
+        uint8_t stage_real[4 * 8];
+        double largest[2];
+        int32_t intlargest[4];
+        struct overflow_acc_t acc;
+        int n, n_groups, tail;
+
+        if (spacing < 1 || !is_supported())
+        {
+            return false;
+        }
+
+        if (isfloat ? (shift != 0 || (bytes != 4 && bytes != 8))
+                    : (bytes < 2 || bytes > 4 || bits < 2 || bits > 32))
+        {
+            return false;
+        }
+
+        acc.n_overflows = 0;
+        acc.largest = _mm_setzero_pd();
+        acc.intlargest = _mm_setzero_si128();
+
+        n_groups = n_samples >> 2;
+
+        real2raw_groups((uint8_t *)rawbuf, (const uint8_t *)realbuf, realsize, bits, bytes,
+                        shift, isfloat, spacing, swap, n_groups, &acc, overflow->max);
+
+        // zero padding neither overflows nor raises the peaks
+        tail = n_samples - (n_groups << 2);
+
+        if (tail > 0)
+        {
+            memset(stage_real, 0, sizeof(stage_real));
+            memcpy(stage_real, &((const uint8_t *)realbuf)[(n_groups << 2) * realsize], tail * realsize);
+
+            real2raw_groups(stage_raw, stage_real, realsize, bits, bytes, shift, isfloat,
+                            1, swap, 1, &acc, overflow->max);
+
+            for (n = 0; n < tail; n++)
+            {
+                memcpy(&((uint8_t *)rawbuf)[((n_groups << 2) + n) * bytes * spacing],
+                       &stage_raw[n * bytes],
+                       bytes);
+            }
+        }
+
+        _mm_storeu_pd(largest, acc.largest);
+        _mm_storeu_si128((__m128i *)intlargest, acc.intlargest);
+
+        overflow->n_overflows += acc.n_overflows;
+
+        for (n = 0; n < 2; n++)
+        {
+            if (largest[n] > overflow->largest)
+            {
+                overflow->largest = largest[n];
+            }
+        }
+
+        for (n = 0; n < 4; n++)
+        {
+            if (intlargest[n] > overflow->intlargest)
+            {
+                overflow->intlargest = intlargest[n];
+            }
+        }
+
+        return true;
+    }
+#endif
+
+    // Converts floats to a raw format without dither using vector
+    // instructions.
+    //
+    // Parameters and results are the same as real2raw::real2rawf_no_dither.
+    //
+    // Returns:
+    //   True if the samples were converted, false if the format
+    //   has no vector kernel and must be converted by the caller.
+    bool
+    real2rawf_no_dither(void *rawbuf,
+                        const void *realbuf,
+                        int bits,
+                        int bytes,
+                        int shift,
+                        bool isfloat,
+                        int spacing,
+                        bool swap,
+                        int n_samples,
+                        struct bfoverflow_t *overflow)
+    {
+#ifdef SIMD_SSE2
+        return real2raw_no_dither(rawbuf, realbuf, 4, bits, bytes, shift, isfloat,
+                                  spacing, swap, n_samples, overflow);
+#else
+        return false;
+#endif
+    }
+
+    // Converts doubles to a raw format without dither using vector
+    // instructions.
+    //
+    // Parameters and results are the same as real2raw::real2rawd_no_dither.
+    //
+    // Returns:
+    //   True if the samples were converted, false if the format
+    //   has no vector kernel and must be converted by the caller.
+    bool
+    real2rawd_no_dither(void *rawbuf,
+                        const void *realbuf,
+                        int bits,
+                        int bytes,
+                        int shift,
+                        bool isfloat,
+                        int spacing,
+                        bool swap,
+                        int n_samples,
+                        struct bfoverflow_t *overflow)
+    {
+#ifdef SIMD_SSE2
+        return real2raw_no_dither(rawbuf, realbuf, 8, bits, bytes, shift, isfloat,
+                                  spacing, swap, n_samples, overflow);
+#else
+        return false;
+#endif
+    }
+
+    // Writes quantized samples to a raw integer format using vector
+    // instructions.
+    //
+    // Parameters:
+    //   rawbuf     the raw output buffer
+    //   samples    the quantized samples
+    //   bytes      the raw sample size in bytes
+    //   shift      the number of bits to shift samples left
+    //   spacing    the distance between raw samples in samples
+    //   swap       true if bytes should be swapped
+    //   n_samples  the number of samples
+    //
+    // Returns:
+    //   True if the samples were written, false if the format
+    //   has no vector kernel and must be written by the caller.
+    bool
+    int2raw(void *rawbuf,
+            const int32_t *samples,
+            int bytes,
+            int shift,
+            int spacing,
+            bool swap,
+            int n_samples)
+    {
+#ifdef SIMD_SSE2
+        uint8_t stage_raw[4 * 4];
+        int32_t stage_samples[4];
+        __m128i count = _mm_cvtsi32_si128(shift);
+        uint8_t *p = (uint8_t *)rawbuf;
+        int n, n_groups, tail;
+
+        if (bytes < 2 || bytes > 4 || spacing < 1 || !is_supported())
+        {
+            return false;
+        }
+
+        n_groups = n_samples >> 2;
+
+        for (n = 0; n < n_groups; n++, p += 4 * bytes * spacing)
+        {
+            store4(p, _mm_sll_epi32(_mm_loadu_si128((const __m128i *)&samples[n << 2]), count),
+                   bytes, spacing, swap);
+        }
+
+        tail = n_samples - (n_groups << 2);
+
+        if (tail > 0)
+        {
+            memset(stage_samples, 0, sizeof(stage_samples));
+            memcpy(stage_samples, &samples[n_groups << 2], tail * sizeof(int32_t));
+
+            store4(stage_raw, _mm_sll_epi32(_mm_loadu_si128((const __m128i *)stage_samples), count),
+                   bytes, 1, swap);
+
+            for (n = 0; n < tail; n++)
+            {
+                memcpy(&p[n * bytes * spacing], &stage_raw[n * bytes], bytes);
+            }
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#ifdef SIMD_SSE2
+    // Scans four floats, accumulating lane-wise counts of non-finite
+    // samples and clipped samples, and the largest finite magnitude.
+    static inline void
+    scan4f(__m128 x,
+           __m128 clip,
+           __m128i *nonfinite,
+           __m128i *clipped,
+           __m128 *peak)
+    {
+        __m128i bits, bad;
+
+        bits = _mm_and_si128(_mm_castps_si128(x), _mm_set1_epi32(0x7FFFFFFF));
+        bad = _mm_cmpgt_epi32(bits, _mm_set1_epi32(0x7F7FFFFF));
+        x = _mm_castsi128_ps(_mm_andnot_si128(bad, bits));
+
+        *nonfinite = _mm_sub_epi32(*nonfinite, bad);
+        *clipped = _mm_sub_epi32(*clipped, _mm_castps_si128(_mm_cmpgt_ps(x, clip)));
+        *peak = _mm_max_ps(*peak, x);
+    }
+
+    // Scans two doubles, accumulating 64-bit lane counts of non-finite
+    // samples and clipped samples, and the largest finite magnitude.
+    static inline void
+    scan2d(__m128d x,
+           __m128d clip,
+           __m128i *nonfinite,
+           __m128i *clipped,
+           __m128d *peak)
+    {
+        __m128i bits, bad;
+
+        bits = _mm_and_si128(_mm_castpd_si128(x), _mm_set_epi32(0x7FFFFFFF, -1, 0x7FFFFFFF, -1));
+        bad = _mm_shuffle_epi32(_mm_cmpgt_epi32(bits, _mm_set1_epi32(0x7FEFFFFF)),
+                                _MM_SHUFFLE(3, 3, 1, 1));
+        x = _mm_castsi128_pd(_mm_andnot_si128(bad, bits));
+
+        *nonfinite = _mm_sub_epi64(*nonfinite, bad);
+        *clipped = _mm_sub_epi64(*clipped, _mm_castpd_si128(_mm_cmpgt_pd(x, clip)));
+        *peak = _mm_max_pd(*peak, x);
+    }
+#endif
+
+    // Scans a block of floats for NaN or Inf values, clipping and
+    // peak level in a single pass.
+    //
+    // Parameters:
+    //   realbuf    the samples
+    //   n_samples  the number of samples
+    //   clip       the largest magnitude that does not clip
+    //   scan       the scan results, overwritten on return
+    //
+    // Returns:
+    //   True if the block was scanned, false otherwise.
+    bool
+    scan_realf(const float *realbuf,
+               int n_samples,
+               double clip,
+               struct bfscan_t *scan)
+    {
+#ifdef SIMD_SSE2
+        float stage[4], lanes[4];
+        int32_t counts[8];
+        __m128i nonfinite, clipped;
+        __m128 peak, vclip;
+        int n, n_groups, tail;
+
+        if (!is_supported())
+        {
+            return false;
+        }
+
+        nonfinite = _mm_setzero_si128();
+        clipped = _mm_setzero_si128();
+        peak = _mm_setzero_ps();
+        vclip = _mm_set1_ps((float)clip);
+
+        n_groups = n_samples >> 2;
+
+        for (n = 0; n < n_groups; n++)
+        {
+            scan4f(_mm_loadu_ps(&realbuf[n << 2]), vclip, &nonfinite, &clipped, &peak);
+        }
+
+        tail = n_samples - (n_groups << 2);
+
+        if (tail > 0)
+        {
+            memset(stage, 0, sizeof(stage));
+            memcpy(stage, &realbuf[n_groups << 2], tail * sizeof(float));
+
+            scan4f(_mm_loadu_ps(stage), vclip, &nonfinite, &clipped, &peak);
+        }
+
+        _mm_storeu_si128((__m128i *)counts, nonfinite);
+        _mm_storeu_si128((__m128i *)&counts[4], clipped);
+        _mm_storeu_ps(lanes, peak);
+
+        scan->n_nonfinite = counts[0] + counts[1] + counts[2] + counts[3];
+        scan->n_clipped = counts[4] + counts[5] + counts[6] + counts[7];
+        scan->peak = 0.0;
+
+        for (n = 0; n < 4; n++)
+        {
+            if (lanes[n] > scan->peak)
+            {
+                scan->peak = lanes[n];
+            }
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Scans a block of doubles for NaN or Inf values, clipping and
+    // peak level in a single pass.
+    //
+    // Parameters:
+    //   realbuf    the samples
+    //   n_samples  the number of samples
+    //   clip       the largest magnitude that does not clip
+    //   scan       the scan results, overwritten on return
+    //
+    // Returns:
+    //   True if the block was scanned, false otherwise.
+    bool
+    scan_reald(const double *realbuf,
+               int n_samples,
+               double clip,
+               struct bfscan_t *scan)
+    {
+#ifdef SIMD_SSE2
+        double lanes[2];
+        int64_t counts[4];
+        __m128i nonfinite, clipped;
+        __m128d peak, vclip;
+        int n, n_groups;
+
+        if (!is_supported())
+        {
+            return false;
+        }
+
+        nonfinite = _mm_setzero_si128();
+        clipped = _mm_setzero_si128();
+        peak = _mm_setzero_pd();
+        vclip = _mm_set1_pd(clip);
+
+        n_groups = n_samples >> 1;
+
+        for (n = 0; n < n_groups; n++)
+        {
+            scan2d(_mm_loadu_pd(&realbuf[n << 1]), vclip, &nonfinite, &clipped, &peak);
+        }
+
+        if (n_samples & 1)
+        {
+            scan2d(_mm_set_sd(realbuf[n_samples - 1]), vclip, &nonfinite, &clipped, &peak);
+        }
+
+        _mm_storeu_si128((__m128i *)counts, nonfinite);
+        _mm_storeu_si128((__m128i *)&counts[2], clipped);
+        _mm_storeu_pd(lanes, peak);
+
+        scan->n_nonfinite = (unsigned int)(counts[0] + counts[1]);
+        scan->n_clipped = (unsigned int)(counts[2] + counts[3]);
+        scan->peak = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#ifdef SIMD_SSE2
+    // Advances four interleaved Tausworthe generators and returns
+    // the low byte of each as a signed 8-bit value, producing the
+    // same sequence as the scalar generator in the dither class.
+    static inline __m128i
+    tausrand4(__m128i *s0,
+              __m128i *s1,
+              __m128i *s2)
+    {
+        *s0 = _mm_xor_si128(_mm_slli_epi32(_mm_and_si128(*s0, _mm_set1_epi32(0xFFFFFFFE)), 12),
+                            _mm_srli_epi32(_mm_xor_si128(_mm_slli_epi32(*s0, 13), *s0), 19));
+        *s1 = _mm_xor_si128(_mm_slli_epi32(_mm_and_si128(*s1, _mm_set1_epi32(0xFFFFFFF8)), 4),
+                            _mm_srli_epi32(_mm_xor_si128(_mm_slli_epi32(*s1, 2), *s1), 25));
+        *s2 = _mm_xor_si128(_mm_slli_epi32(_mm_and_si128(*s2, _mm_set1_epi32(0xFFFFFFF0)), 17),
+                            _mm_srli_epi32(_mm_xor_si128(_mm_slli_epi32(*s2, 3), *s2), 11));
+
+        return _mm_srai_epi32(_mm_slli_epi32(_mm_xor_si128(*s0, _mm_xor_si128(*s1, *s2)), 24), 24);
+    }
+
+    // Generates groups of four high pass TPDF dither values, as the
+    // difference of consecutive random numbers plus one, converted
+    // to 32-bit lanes. The last random number is kept in lane 0 of
+    // prev.
+    static inline __m128i
+    tpdf_diff4(__m128i *s0,
+               __m128i *s1,
+               __m128i *s2,
+               __m128i *prev,
+               int32_t *last)
+    {
+        __m128i r, d;
+
+        r = tausrand4(s0, s1, s2);
+        d = _mm_sub_epi32(r, _mm_or_si128(_mm_slli_si128(r, 4), *prev));
+        *prev = _mm_srli_si128(r, 12);
+
+        _mm_storeu_si128((__m128i *)last, r);
+
+        return _mm_add_epi32(d, _mm_set1_epi32(1));
+    }
+
+    // Stores the generator states after a loop. The scalar generator
+    // only advances the lanes it uses, so when the last group is
+    // partial the unused lanes keep their state from before it.
+    //
+    // Parameters:
+    //   taus       the interleaved generator states of the channel
+    //   s0         the first generator states after the loop
+    //   s1         the second generator states after the loop
+    //   s2         the third generator states after the loop
+    //   o0         the first generator states before the last group
+    //   o1         the second generator states before the last group
+    //   o2         the third generator states before the last group
+    //   n_samples  the number of samples
+    static inline void
+    tpdf_store(uint32_t taus[12],
+               __m128i s0,
+               __m128i s1,
+               __m128i s2,
+               __m128i o0,
+               __m128i o1,
+               __m128i o2,
+               int n_samples)
+    {
+        if ((n_samples & 3) != 0)
+        {
+            __m128i mask = _mm_cmpgt_epi32(_mm_set1_epi32(n_samples & 3), _mm_set_epi32(3, 2, 1, 0));
+
+            s0 = _mm_or_si128(_mm_and_si128(mask, s0), _mm_andnot_si128(mask, o0));
+            s1 = _mm_or_si128(_mm_and_si128(mask, s1), _mm_andnot_si128(mask, o1));
+            s2 = _mm_or_si128(_mm_and_si128(mask, s2), _mm_andnot_si128(mask, o2));
+        }
+
+        _mm_storeu_si128((__m128i *)taus, s0);
+        _mm_storeu_si128((__m128i *)&taus[4], s1);
+        _mm_storeu_si128((__m128i *)&taus[8], s2);
+    }
+#endif
+
+    // Generates high pass TPDF dither plus the mid-tread offset
+    // for a loop, four samples at a time.
+    //
+    // Parameters:
+    //   noise      the output, rounded up to a multiple of four samples
+    //   taus       the interleaved generator states of the channel
+    //   rand       the last random number, updated on return
+    //   n_samples  the number of samples
+    //
+    // Returns:
+    //   True if the dither was generated, false otherwise.
+    bool
+    tpdf_noisef(float *noise,
+                uint32_t taus[12],
+                int32_t *rand,
+                int n_samples)
+    {
+#ifdef SIMD_SSE2
+        __m128i s0, s1, s2, o0, o1, o2, prev;
+        int32_t last[4];
+        int n;
+
+        if (!is_supported())
+        {
+            return false;
+        }
+
+        s0 = _mm_loadu_si128((const __m128i *)taus);
+        s1 = _mm_loadu_si128((const __m128i *)&taus[4]);
+        s2 = _mm_loadu_si128((const __m128i *)&taus[8]);
+        prev = _mm_cvtsi32_si128(*rand);
+        o0 = s0;
+        o1 = s1;
+        o2 = s2;
+
+        for (n = 0; n < n_samples; n += 4)
+        {
+            o0 = s0;
+            o1 = s1;
+            o2 = s2;
+
+            _mm_storeu_ps(&noise[n],
+                          _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(tpdf_diff4(&s0, &s1, &s2, &prev, last)),
+                                                _mm_set1_ps(1.0f / 255.0f)),
+                                     _mm_set1_ps(0.5f)));
+        }
+
+        tpdf_store(taus, s0, s1, s2, o0, o1, o2, n_samples);
+
+        if (n_samples > 0)
+        {
+            *rand = last[(n_samples - 1) & 3];
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Generates high pass TPDF dither plus the mid-tread offset
+    // for a loop, four samples at a time.
+    //
+    // Parameters:
+    //   noise      the output, rounded up to a multiple of four samples
+    //   taus       the interleaved generator states of the channel
+    //   rand       the last random number, updated on return
+    //   n_samples  the number of samples
+    //
+    // Returns:
+    //   True if the dither was generated, false otherwise.
+    bool
+    tpdf_noised(double *noise,
+                uint32_t taus[12],
+                int32_t *rand,
+                int n_samples)
+    {
+#ifdef SIMD_SSE2
+        __m128i s0, s1, s2, o0, o1, o2, prev, d;
+        int32_t last[4];
+        int n;
+
+        if (!is_supported())
+        {
+            return false;
+        }
+
+        s0 = _mm_loadu_si128((const __m128i *)taus);
+        s1 = _mm_loadu_si128((const __m128i *)&taus[4]);
+        s2 = _mm_loadu_si128((const __m128i *)&taus[8]);
+        prev = _mm_cvtsi32_si128(*rand);
+        o0 = s0;
+        o1 = s1;
+        o2 = s2;
+
+        for (n = 0; n < n_samples; n += 4)
+        {
+            o0 = s0;
+            o1 = s1;
+            o2 = s2;
+
+            d = tpdf_diff4(&s0, &s1, &s2, &prev, last);
+
+            _mm_storeu_pd(&noise[n],
+                          _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(d), _mm_set1_pd(1.0 / 255.0)),
+                                     _mm_set1_pd(0.5)));
+            _mm_storeu_pd(&noise[n + 2],
+                          _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(d, 8)),
+                                                _mm_set1_pd(1.0 / 255.0)),
+                                     _mm_set1_pd(0.5)));
+        }
+
+        tpdf_store(taus, s0, s1, s2, o0, o1, o2, n_samples);
+
+        if (n_samples > 0)
+        {
+            *rand = last[(n_samples - 1) & 3];
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+}
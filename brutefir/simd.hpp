@@ -0,0 +1,98 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _SIMD_HPP_
+#define _SIMD_HPP_
+
+#include "global.h"
+
+namespace simd
+{
+    bool
+    is_supported();
+
+    void
+    set_enabled(bool enable);
+
+    bool
+    raw2realf(void *realbuf,
+              const void *rawbuf,
+              int bytes,
+              int shift,
+              bool isfloat,
+              int spacing,
+              bool swap,
+              int n_samples);
+
+    bool
+    raw2reald(void *realbuf,
+              const void *rawbuf,
+              int bytes,
+              int shift,
+              bool isfloat,
+              int spacing,
+              bool swap,
+              int n_samples);
+
+    bool
+    real2rawf_no_dither(void *rawbuf,
+                        const void *realbuf,
+                        int bits,
+                        int bytes,
+                        int shift,
+                        bool isfloat,
+                        int spacing,
+                        bool swap,
+                        int n_samples,
+                        struct bfoverflow_t *overflow);
+
+    bool
+    real2rawd_no_dither(void *rawbuf,
+                        const void *realbuf,
+                        int bits,
+                        int bytes,
+                        int shift,
+                        bool isfloat,
+                        int spacing,
+                        bool swap,
+                        int n_samples,
+                        struct bfoverflow_t *overflow);
+
+    bool
+    int2raw(void *rawbuf,
+            const int32_t *samples,
+            int bytes,
+            int shift,
+            int spacing,
+            bool swap,
+            int n_samples);
+
+    bool
+    scan_realf(const float *realbuf,
+               int n_samples,
+               double clip,
+               struct bfscan_t *scan);
+
+    bool
+    scan_reald(const double *realbuf,
+               int n_samples,
+               double clip,
+               struct bfscan_t *scan);
+
+    bool
+    tpdf_noisef(float *noise,
+                uint32_t taus[12],
+                int32_t *rand,
+                int n_samples);
+
+    bool
+    tpdf_noised(double *noise,
+                uint32_t taus[12],
+                int32_t *rand,
+                int n_samples);
+}
+
+#endif
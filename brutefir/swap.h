@@ -15,7 +15,11 @@ extern "C" {
 
 #ifdef __LITTLE_ENDIAN__
 
+#if defined(_WIN32)
 #include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
 
 #define SWAP32(x) ntohl((uint32_t)(x))
 #define SWAP16(x) ntohs((uint16_t)(x))
@@ -0,0 +1,518 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#include <deque>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "thread_pool.hpp"
+#include "timestamp.h"
+#include "atomic.h"
+
+// One pool of worker threads is shared by all engines and the
+// preprocessor, so that running several of them at once does not
+// start more threads than there are cores.  Each worker has its
+// own queues, it runs its newest task first and idle workers steal
+// the oldest tasks of the others.  Tasks submitted by threads
+// outside the pool go to a shared queue.  A thread waiting for a
+// group runs the queued tasks of the group meanwhile.
+namespace thread_pool
+{
+    struct pool_task_t
+    {
+        boost::function<void ()> function;
+        struct pool_group_t *group;
+    };
+
+    typedef std::deque<struct pool_task_t> task_queue;
+
+    // Task queues of a worker, or of the threads outside the pool.
+    struct pool_queue_t
+    {
+        boost::mutex mutex;
+        task_queue tasks[POOL_PRIORITY_COUNT];
+    };
+
+    // one queue per worker, the last one for other threads
+    static std::vector<struct pool_queue_t *> queues;
+    static boost::thread_group *workers = NULL;
+    static int n_workers = 0;
+
+    // the index of the queue of the calling worker
+    static boost::thread_specific_ptr<int> worker_index;
+
+    // guards starting and stopping the workers
+    static boost::mutex pool_mutex;
+    static volatile long started = 0;
+    static volatile long stopping = 0;
+
+    static volatile long n_queued = 0;
+    static volatile long queued[POOL_PRIORITY_COUNT] = { 0 };
+    static volatile long n_active = 0;
+
+    // idle workers sleep until a task is queued
+    static boost::mutex wake_mutex;
+    static boost::condition_variable wake;
+    static int n_sleeping = 0;
+
+    // signalled when the last task of a group has finished
+    static boost::mutex done_mutex;
+    static boost::condition_variable done;
+
+    static boost::mutex stats_mutex;
+    static uint64_t n_tasks = 0;
+    static uint64_t n_steals = 0;
+    static uint64_t busy_cycles = 0;
+
+    static void
+    worker_thread(int index);
+
+    // Starts the workers, one per core, on first use.
+    static void
+    start()
+    {
+        int n;
+
+        boost::lock_guard<boost::mutex> lock(pool_mutex);
+
+        if (atomic_load(&started) != 0)
+        {
+            return;
+        }
+
+        n_workers = (int)boost::thread::hardware_concurrency();
+
+        if (n_workers < 1)
+        {
+            n_workers = 1;
+        }
+
+        for (n = 0; n <= n_workers; n++)
+        {
+            queues.push_back(new pool_queue_t());
+        }
+
+        atomic_store(&stopping, 0);
+
+        workers = new boost::thread_group();
+
+        for (n = 0; n < n_workers; n++)
+        {
+            workers->create_thread(boost::bind(&worker_thread, n));
+        }
+
+        atomic_store(&started, 1);
+    }
+
+    // Gets the queue of the calling thread.
+    //
+    // Returns:
+    //   The index of the worker, or n_workers outside the pool.
+    static int
+    get_queue_index()
+    {
+        int *index = worker_index.get();
+
+        if (index == NULL)
+        {
+            return n_workers;
+        }
+
+        return *index;
+    }
+
+    // Takes a task from a queue.  The queue must be locked.
+    //
+    // Parameters:
+    //   tasks  the queue
+    //   group  takes only tasks of this group, or NULL for any task
+    //   lifo   takes the newest task instead of the oldest
+    //   task   returns the task
+    //
+    // Returns:
+    //   true if a task was taken, false if there was none.
+    static bool
+    take_task(task_queue &tasks,
+              struct pool_group_t *group,
+              bool lifo,
+              struct pool_task_t *task)
+    {
+        task_queue::iterator it;
+
+        if (tasks.empty())
+        {
+            return false;
+        }
+
+        if (group == NULL)
+        {
+            if (lifo)
+            {
+                *task = tasks.back();
+                tasks.pop_back();
+            }
+            else
+            {
+                *task = tasks.front();
+                tasks.pop_front();
+            }
+
+            return true;
+        }
+
+        for (it = tasks.begin(); it != tasks.end(); it++)
+        {
+            if (it->group == group)
+            {
+                *task = *it;
+                tasks.erase(it);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Finds the next task to run, starting with the highest priority.
+    // A thread looks in its own queue first, then in the queue of the
+    // threads outside the pool, then in the queues of the other workers.
+    //
+    // Parameters:
+    //   self    the queue index of the calling thread
+    //   group   finds only tasks of this group, or NULL for any task
+    //   task    returns the task
+    //   stolen  returns true if the task was taken from another worker
+    //
+    // Returns:
+    //   true if a task was found, false if there was none.
+    static bool
+    find_task(int self,
+              struct pool_group_t *group,
+              struct pool_task_t *task,
+              bool *stolen)
+    {
+        int priority, i, index;
+        bool found;
+
+        for (priority = POOL_PRIORITY_COUNT - 1; priority >= 0; priority--)
+        {
+            if ((group != NULL) && (group->priority != priority))
+            {
+                continue;
+            }
+
+            if (atomic_load(&queued[priority]) == 0)
+            {
+                continue;
+            }
+
+            for (i = 0; i < n_workers + 2; i++)
+            {
+                if (i == 0)
+                {
+                    index = self;
+                }
+                else if (i == 1)
+                {
+                    index = n_workers;
+                }
+                else
+                {
+                    // the other workers, starting after this one
+                    index = (self + i - 1) % n_workers;
+                }
+
+                if ((i > 0) && (index == self))
+                {
+                    continue;
+                }
+
+                {
+                    boost::lock_guard<boost::mutex> lock(queues[index]->mutex);
+
+                    found = take_task(queues[index]->tasks[priority],
+                                      group,
+                                      (index == self) && (index != n_workers),
+                                      task);
+                }
+
+                if (found)
+                {
+                    atomic_add(&queued[priority], -1);
+                    atomic_add(&n_queued, -1);
+
+                    *stolen = (index != self) && (index != n_workers);
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    // Runs a task and signals its group if it was the last one.
+    //
+    // Parameters:
+    //   task    the task
+    //   worker  true if run by a worker, the time counts as busy
+    //   stolen  true if the task was taken from another worker
+    static void
+    run_task(struct pool_task_t *task,
+             bool worker,
+             bool stolen)
+    {
+        volatile uint64_t ts_start, ts_end;
+        struct pool_group_t *group = task->group;
+
+        atomic_add(&n_active, 1);
+        timestamp(&ts_start);
+
+        task->function();
+        task->function.clear();
+
+        timestamp(&ts_end);
+        atomic_add(&n_active, -1);
+
+        {
+            boost::lock_guard<boost::mutex> lock(stats_mutex);
+
+            n_tasks++;
+
+            if (stolen)
+            {
+                n_steals++;
+            }
+
+            if (worker)
+            {
+                busy_cycles += ts_end - ts_start;
+            }
+        }
+
+        if (atomic_add(&group->pending, -1) == 0)
+        {
+            boost::lock_guard<boost::mutex> lock(done_mutex);
+            done.notify_all();
+        }
+    }
+
+    // Runs tasks until the pool is shut down and no tasks are left.
+    //
+    // Parameters:
+    //   index  the index of the worker
+    static void
+    worker_thread(int index)
+    {
+        struct pool_task_t task;
+        bool stolen;
+
+        worker_index.reset(new int(index));
+
+        for (;;)
+        {
+            if (find_task(index, NULL, &task, &stolen))
+            {
+                run_task(&task, true, stolen);
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(wake_mutex);
+
+            if (atomic_load(&stopping) != 0)
+            {
+                break;
+            }
+
+            // a task queued after the search wakes this worker
+            if (atomic_load(&n_queued) > 0)
+            {
+                continue;
+            }
+
+            n_sleeping++;
+            wake.wait(lock);
+            n_sleeping--;
+        }
+    }
+
+    // Initializes a task group.
+    //
+    // Parameters:
+    //   group     the group
+    //   priority  the priority of its tasks, one of POOL_PRIORITY_*
+    void
+    init_group(struct pool_group_t *group,
+               int priority)
+    {
+        group->priority = priority;
+        group->pending = 0;
+    }
+
+    // Queues a task.  The pool is started on first use.
+    //
+    // Parameters:
+    //   group  the group of the task
+    //   task   the function to run
+    void
+    submit(struct pool_group_t *group,
+           const boost::function<void ()> &task)
+    {
+        struct pool_task_t entry;
+        int index;
+
+        if (atomic_load(&started) == 0)
+        {
+            start();
+        }
+
+        entry.function = task;
+        entry.group = group;
+
+        atomic_add(&group->pending, 1);
+
+        index = get_queue_index();
+
+        {
+            boost::lock_guard<boost::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks[group->priority].push_back(entry);
+        }
+
+        atomic_add(&queued[group->priority], 1);
+        atomic_add(&n_queued, 1);
+
+        {
+            boost::lock_guard<boost::mutex> lock(wake_mutex);
+
+            if (n_sleeping > 0)
+            {
+                wake.notify_one();
+            }
+        }
+    }
+
+    // Waits until all tasks of a group have finished, running the
+    // queued tasks of the group on the calling thread meanwhile.
+    //
+    // Parameters:
+    //   group  the group
+    void
+    wait(struct pool_group_t *group)
+    {
+        struct pool_task_t task;
+        bool stolen;
+        int self;
+
+        if (atomic_load(&group->pending) == 0)
+        {
+            return;
+        }
+
+        self = get_queue_index();
+
+        while (atomic_load(&group->pending) > 0)
+        {
+            if (find_task(self, group, &task, &stolen))
+            {
+                run_task(&task, false, stolen);
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(done_mutex);
+
+            if (atomic_load(&group->pending) > 0)
+            {
+                done.wait(lock);
+            }
+        }
+    }
+
+    // Gets the number of workers.  The pool is started on first use.
+    //
+    // Returns:
+    //   The number of workers.
+    int
+    get_worker_count()
+    {
+        if (atomic_load(&started) == 0)
+        {
+            start();
+        }
+
+        return n_workers;
+    }
+
+    // Gets the statistics of the pool.  The busy cycles are counted
+    // since the start of the process, the utilization over a period
+    // is the difference of two samples divided by the time stamp
+    // difference times the number of workers.
+    //
+    // Parameters:
+    //   stats  returns the statistics
+    void
+    get_stats(struct pool_stats_t *stats)
+    {
+        int n;
+        volatile uint64_t now;
+
+        stats->n_workers = (atomic_load(&started) != 0) ? n_workers : 0;
+        stats->n_active = (int)atomic_load(&n_active);
+
+        for (n = 0; n < POOL_PRIORITY_COUNT; n++)
+        {
+            stats->queued[n] = (int)atomic_load(&queued[n]);
+        }
+
+        timestamp(&now);
+
+        boost::lock_guard<boost::mutex> lock(stats_mutex);
+
+        stats->n_tasks = n_tasks;
+        stats->n_steals = n_steals;
+        stats->busy_cycles = busy_cycles;
+        stats->timestamp = now;
+    }
+
+    // Stops the workers once the queued tasks have run.  No other
+    // thread may submit tasks meanwhile, the pool is started again
+    // by the next task.
+    void
+    shutdown()
+    {
+        size_t n;
+
+        boost::lock_guard<boost::mutex> lock(pool_mutex);
+
+        if (atomic_load(&started) == 0)
+        {
+            return;
+        }
+
+        {
+            boost::lock_guard<boost::mutex> wake_lock(wake_mutex);
+
+            atomic_store(&stopping, 1);
+            wake.notify_all();
+        }
+
+        workers->join_all();
+
+        delete workers;
+        workers = NULL;
+
+        for (n = 0; n < queues.size(); n++)
+        {
+            delete queues[n];
+        }
+
+        queues.clear();
+        atomic_store(&started, 0);
+    }
+}
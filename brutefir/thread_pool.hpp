@@ -0,0 +1,61 @@
+/*
+ * (c) 2011 Victor Su
+ *
+ * This program is open source. For license terms, see the LICENSE file.
+ *
+ */
+#ifndef _THREAD_POOL_HPP_
+#define _THREAD_POOL_HPP_
+
+#include <stdint.h>
+#include <boost/function.hpp>
+
+// Task priorities.  Queued tasks of a higher priority are started
+// first, a running task is never interrupted.
+#define POOL_PRIORITY_BACKGROUND    0   // coefficient loads, preprocessing, offline renders
+#define POOL_PRIORITY_NORMAL        1
+#define POOL_PRIORITY_REALTIME      2   // blocks of a running engine
+#define POOL_PRIORITY_COUNT         3
+
+// A group of tasks that are waited for together.
+struct pool_group_t
+{
+    int priority;
+    volatile long pending;      // tasks submitted and not yet finished
+};
+
+struct pool_stats_t
+{
+    int n_workers;
+    int n_active;                       // tasks running on any thread
+    int queued[POOL_PRIORITY_COUNT];    // tasks waiting per priority
+    uint64_t n_tasks;
+    uint64_t n_steals;
+    uint64_t busy_cycles;               // time stamp cycles spent running tasks
+    uint64_t timestamp;                 // time stamp counter when sampled
+};
+
+namespace thread_pool
+{
+    void
+    init_group(struct pool_group_t *group,
+               int priority);
+
+    void
+    submit(struct pool_group_t *group,
+           const boost::function<void ()> &task);
+
+    void
+    wait(struct pool_group_t *group);
+
+    int
+    get_worker_count();
+
+    void
+    get_stats(struct pool_stats_t *stats);
+
+    void
+    shutdown();
+}
+
+#endif
@@ -13,12 +13,27 @@ extern "C" {
 #define _TIMESTAMP_H_
 
 #include <stdint.h>
+
+#if defined(_MSC_VER)
 #include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
 
 static inline void
 timestamp(volatile uint64_t *ts)
 {
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
     *ts = __rdtsc();
+#else
+    /* no cycle counter, count nanoseconds instead */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    *ts = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
 }
 
 #endif
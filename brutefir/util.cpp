@@ -8,6 +8,7 @@
 #include <sstream>
 #include <stdint.h>
 
+#include "compat.h"
 #include "util.hpp"
 
 namespace util
@@ -32,6 +32,11 @@ boost::tribool command_parser::consume(command& cmd, char input)
         {
             return false;
         }
+        else if (input == '\n' || input == CMD_DELIM)
+        {
+            // skip line feeds of CR LF terminated commands
+            return boost::indeterminate;
+        }
         else
         {
             state_ = op;
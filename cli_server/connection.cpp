@@ -13,6 +13,7 @@
 #include "connection.hpp"
 #include "connection_manager.hpp"
 #include "command_parser.hpp"
+#include "../foo_dsp_bfir/foo_dsp_bfir.h"
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -25,8 +26,11 @@
 #include <iterator>
 #include <vector>
 #include <algorithm>
-#include "../brutefir/preprocessor.hpp"
 #include "../brutefir/util.hpp"
+#include "../brutefir/metrics.hpp"
+#include "../brutefir/cache.hpp"
+#include "../brutefir/coeff_store.hpp"
+#include "../brutefir/thread_pool.hpp"
 #include "../json_spirit/json_spirit.h"
 
 
@@ -40,7 +44,17 @@ connection::connection(boost::asio::io_service& io_service,
                        const std::string& default_dir)
     : socket_(io_service),
       connection_manager_(manager),
-      default_dir_(default_dir)
+      binary_(false),
+      default_dir_(default_dir),
+      stat_timer_(io_service),
+      stat_interval_(0),
+      stat_busy_cycles_(0),
+      stat_timestamp_(0),
+      reply_bytes_(0),
+      reading_(false),
+      writing_(false),
+      closing_(false),
+      batch_replies_(NULL)
 {
 }
 
@@ -52,17 +66,42 @@ boost::asio::ip::tcp::socket& connection::socket()
 void connection::start()
 {
     configure_socket();
-    socket_.async_read_some(boost::asio::buffer(buffer_),
-                            boost::bind(&connection::handle_read, shared_from_this(),
-                                        boost::asio::placeholders::error,
-                                        boost::asio::placeholders::bytes_transferred));
+    start_read();
 }
 
 void connection::stop()
 {
+    stat_interval_ = 0;
+    stat_timer_.cancel();
     socket_.close();
 }
 
+void connection::execute_command(command& cmd)
+{
+    config_state before, after;
+
+    before.save();
+    handle_command(cmd);
+    after.save();
+
+    // a single engine update per command, however many settings it changed
+    if (!(after == before))
+    {
+        if (!after.filter_equals(before))
+        {
+            g_config_changed();
+        }
+
+        // delays are applied without rebuilding the filter
+        if (after.delay != before.delay)
+        {
+            g_delay_changed();
+        }
+
+        connection_manager_.notify_changes();
+    }
+}
+
 void connection::handle_command(command& cmd)
 {
     int val;
@@ -125,6 +164,49 @@ void connection::handle_command(command& cmd)
             send_reply(STATUS_ERROR);
         }
     }
+    else if (boost::starts_with(cmd.op, "DLY"))
+    {
+        int channel;
+
+        if (parse_int(cmd.op.substr(3), channel) && channel >= 0 && channel < BF_MAXCHANNELS)
+        {
+            std::vector<std::string> delays;
+
+            boost::algorithm::split(
+                delays,
+                std::string(cfg_delay.get_ptr()),
+                boost::is_any_of(","),
+                boost::algorithm::token_compress_on);
+
+            delays.resize(BF_MAXCHANNELS, "0");
+
+            if (!cmd.data.empty())
+            {
+                if (parse_int(cmd.data, val))
+                {
+                    if (val < DelayRangeMin) val = DelayRangeMin;
+                    if (val > DelayRangeMax) val = DelayRangeMax;
+
+                    delays[channel] = boost::lexical_cast<std::string>(val);
+
+                    cfg_delay.set_string(boost::algorithm::join(delays, ",").c_str());
+                    send_reply(STATUS_OK);
+                }
+                else
+                {
+                    send_reply(STATUS_ERROR);
+                }
+            }
+            else
+            {
+                send_reply(delays[channel]);
+            }
+        }
+        else
+        {
+            send_reply(STATUS_ERROR);
+        }
+    }
     else if (cmd.op == "EQEN")
     {
         if (!cmd.data.empty())
@@ -317,29 +399,21 @@ void connection::handle_command(command& cmd)
             }
             else if (boost::filesystem::exists(cmd.data))
             {
-                int n_channels;
-                int n_frames;
-                int sampling_rate;
-                double attenuation;
-
-                // Calculate the optimum attentuation to prevent clipping
-                if (preprocessor::calculate_attenuation(util::str2wstr(cmd.data),
-                                                        FILTER_LEN,
-                                                        REALSIZE,
-                                                        &attenuation,
-                                                        &n_channels,
-                                                        &n_frames,
-                                                        &sampling_rate))
+                file_info fi;
+
+                // Get the optimum attentuation to prevent clipping, analysed
+                // only if the file changed since it was last looked at
+                if (connection_manager_.index().get_file_info(cmd.data, fi))
                 {
                     std::wstringstream info;
 
-                    info << n_frames << L" samples, "
-                         << n_channels << L" channels, "
-                         << sampling_rate << L" Hz";
+                    info << fi.n_frames << L" samples, "
+                         << fi.n_channels << L" channels, "
+                         << fi.sampling_rate << L" Hz";
 
                     cfg_file1_filename.set_string(cmd.data.c_str());
                     cfg_file1_metadata.set_string((util::wstr2str(info.str())).c_str());
-                    cfg_file1_level = (int)(attenuation * FILE_LEVEL_STEPS_PER_DB);
+                    cfg_file1_level = (int)(fi.attenuation * FILE_LEVEL_STEPS_PER_DB);
 					cfg_file1_enable = 1;
 
                     send_reply(STATUS_OK);
@@ -375,29 +449,21 @@ void connection::handle_command(command& cmd)
             }
             else if (boost::filesystem::exists(cmd.data))
             {
-                int n_channels;
-                int n_frames;
-                int sampling_rate;
-                double attenuation;
-
-                // Calculate the optimum attentuation to prevent clipping
-                if (preprocessor::calculate_attenuation(util::str2wstr(cmd.data),
-                                                        FILTER_LEN,
-                                                        REALSIZE,
-                                                        &attenuation,
-                                                        &n_channels,
-                                                        &n_frames,
-                                                        &sampling_rate))
+                file_info fi;
+
+                // Get the optimum attentuation to prevent clipping, analysed
+                // only if the file changed since it was last looked at
+                if (connection_manager_.index().get_file_info(cmd.data, fi))
                 {
                     std::wstringstream info;
 
-                    info << n_frames << L" samples, "
-                         << n_channels << L" channels, "
-                         << sampling_rate << L" Hz";
+                    info << fi.n_frames << L" samples, "
+                         << fi.n_channels << L" channels, "
+                         << fi.sampling_rate << L" Hz";
 
                     cfg_file2_filename.set_string(cmd.data.c_str());
                     cfg_file2_metadata.set_string((util::wstr2str(info.str())).c_str());
-                    cfg_file2_level = (int)(attenuation * FILE_LEVEL_STEPS_PER_DB);
+                    cfg_file2_level = (int)(fi.attenuation * FILE_LEVEL_STEPS_PER_DB);
 					cfg_file2_enable = 1;
 
                     send_reply(STATUS_OK);
@@ -433,29 +499,21 @@ void connection::handle_command(command& cmd)
             }
             else if (boost::filesystem::exists(cmd.data))
             {
-                int n_channels;
-                int n_frames;
-                int sampling_rate;
-                double attenuation;
-
-                // Calculate the optimum attentuation to prevent clipping
-                if (preprocessor::calculate_attenuation(util::str2wstr(cmd.data),
-                                                        FILTER_LEN,
-                                                        REALSIZE,
-                                                        &attenuation,
-                                                        &n_channels,
-                                                        &n_frames,
-                                                        &sampling_rate))
+                file_info fi;
+
+                // Get the optimum attentuation to prevent clipping, analysed
+                // only if the file changed since it was last looked at
+                if (connection_manager_.index().get_file_info(cmd.data, fi))
                 {
                     std::wstringstream info;
 
-                    info << n_frames << L" samples, "
-                         << n_channels << L" channels, "
-                         << sampling_rate << L" Hz";
+                    info << fi.n_frames << L" samples, "
+                         << fi.n_channels << L" channels, "
+                         << fi.sampling_rate << L" Hz";
 
                     cfg_file3_filename.set_string(cmd.data.c_str());
                     cfg_file3_metadata.set_string((util::wstr2str(info.str())).c_str());
-                    cfg_file3_level = (int)(attenuation * FILE_LEVEL_STEPS_PER_DB);
+                    cfg_file3_level = (int)(fi.attenuation * FILE_LEVEL_STEPS_PER_DB);
                     cfg_file3_enable = 1;
 
                     send_reply(STATUS_OK);
@@ -489,14 +547,23 @@ void connection::handle_command(command& cmd)
     }
     else if (cmd.op == "DIR")
     {
-        std:: stringstream out;
+        std::stringstream out;
+        std::string dir;
+        dir_query query;
 
         boost::filesystem::path dir_path;
 
+        // leading options select a page and filter the files
+        if (!query.parse(cmd.data, dir))
+        {
+            send_reply(STATUS_ERROR);
+            return;
+        }
+
         // use default directory if no directory path specified
-        dir_path = cmd.data.empty() 
+        dir_path = dir.empty() 
             ? boost::filesystem::path(default_dir_)
-            : boost::filesystem::path(cmd.data);
+            : boost::filesystem::path(dir);
 
         try
         {
@@ -536,11 +603,14 @@ void connection::handle_command(command& cmd)
                     // create root object
                     json_spirit::Object root_obj;
                     root_obj.push_back(json_spirit::Pair("dir", ""));
+                    root_obj.push_back(json_spirit::Pair("total", (int)subdir_array.size()));
+                    root_obj.push_back(json_spirit::Pair("offset", 0));
                     root_obj.push_back(json_spirit::Pair("subdir", subdir_array));
                     root_obj.push_back(json_spirit::Pair("file", file_array));
 
                     // write to output
-                    json_spirit::write_formatted(root_obj, out);
+                    json_spirit::write(root_obj, out);
+                    send_reply(out.str());
                 }
                 else
                 {
@@ -559,106 +629,108 @@ void connection::handle_command(command& cmd)
                 {
                     // regular file: just list the file
                     out << dir_path;
+                    send_reply(out.str());
                 }
-                else if (boost::filesystem::is_directory(dir_path))
+                else
                 {
-                    // directory: iterate and list
-
-                    // store paths to sort later
-                    typedef std::vector<boost::filesystem::path> vec;
-                    vec v;
-
-                    std::copy(
-                        boost::filesystem::directory_iterator(dir_path),
-                        boost::filesystem::directory_iterator(),
-                        std::back_inserter(v));
+                    // directory: list from the index, rescanned only if it changed
+                    std::string listing;
 
-                    // sort since directory iteration may not be ordered
-                    std::sort(v.begin(), v.end());
-
-                    // add subdirectories
-                    json_spirit::Array subdir_array;
-
-                    // add parent directory (..) if it exists
-                    boost::filesystem::path parent_path = dir_path.parent_path();
-
-                    if (boost::filesystem::exists(parent_path))
-                    {
-                        json_spirit::Object obj;
-                        obj.push_back(json_spirit::Pair("display", "[..]"));
-                        obj.push_back(json_spirit::Pair("name", ".."));
-
-                        // if the parent path ends with a colon, we are below
-                        // the root directory of the drive, so indicate this with
-                        // a special string.
-                        if (boost::algorithm::ends_with(parent_path.generic_string(), ":"))
-                        {
-                            obj.push_back(json_spirit::Pair("path", PATH_SUB_ROOT));
-                        }
-                        else
-                        {
-                            obj.push_back(json_spirit::Pair("path", parent_path.generic_string()));
-                        }
-
-                        subdir_array.push_back(obj);
-                    }
-
-                    for (vec::const_iterator it(v.begin()), it_end(v.end()); it != it_end; ++it)
+                    if (connection_manager_.index().list(dir_path.generic_string(), query, listing))
                     {
+                        send_reply(listing);
                     }
-
-                    // add files and subdirectories
-                    json_spirit::Array file_array;
-                    for (vec::const_iterator it(v.begin()), it_end(v.end()); it != it_end; ++it)
+                    else
                     {
-                        DWORD dwAttrs;
-
-                        dwAttrs = GetFileAttributes(it->wstring().c_str()); 
-                        if (dwAttrs != INVALID_FILE_ATTRIBUTES)
-                        {
-                            if (!(dwAttrs & FILE_ATTRIBUTE_SYSTEM))
-                            {
-                                if (boost::filesystem::is_regular_file(*it))
-                                {
-                                    json_spirit::Object obj;
-                                    obj.push_back(json_spirit::Pair("display", it->filename().generic_string()));
-                                    obj.push_back(json_spirit::Pair("name", it->filename().generic_string()));
-                                    obj.push_back(json_spirit::Pair("path", it->generic_string()));
-                                    file_array.push_back(obj);
-                                }
-                                else if (boost::filesystem::is_directory(*it))
-                                {
-                                    json_spirit::Object obj;
-                                    obj.push_back(json_spirit::Pair("display", it->filename().generic_string()));
-                                    obj.push_back(json_spirit::Pair("name", it->filename().generic_string()));
-                                    obj.push_back(json_spirit::Pair("path", it->generic_string()));
-                                    subdir_array.push_back(obj);
-                                }
-                            }
-                        }
+                        send_reply(STATUS_ERROR);
                     }
+                }
+            }
+        }
+        catch (const boost::filesystem::filesystem_error&)
+        {
+            send_reply(STATUS_ERROR);
+        }
+    }
+    else if (cmd.op == "STAT")
+    {
+        if (!cmd.data.empty())
+        {
+            // subscribe to updates every N milliseconds, 0 unsubscribes
+            if (parse_int(cmd.data, val))
+            {
+                if (val < 0) val = 0;
+                if (val > 0 && val < STAT_MIN_INTERVAL) val = STAT_MIN_INTERVAL;
 
-                    // create root object
-                    json_spirit::Object root_obj;
-                    root_obj.push_back(json_spirit::Pair("dir", dir_path.generic_string()));
-                    root_obj.push_back(json_spirit::Pair("subdir", subdir_array));
-                    root_obj.push_back(json_spirit::Pair("file", file_array));
+                stat_interval_ = val;
+                stat_timer_.cancel();
+                send_reply(STATUS_OK);
 
-                    // write to output
-                    json_spirit::write_formatted(root_obj, out);
+                if (stat_interval_ > 0)
+                {
+                    start_stat_timer();
+                }
+            }
+            else
+            {
+                send_reply(STATUS_ERROR);
+            }
+        }
+        else
+        {
+            send_reply(format_stats());
+        }
+    }
+    else if (cmd.op == "BATCH")
+    {
+        if (batch_replies_ == NULL)
+        {
+            handle_batch(cmd.data);
+        }
+        else
+        {
+            send_reply(STATUS_ERROR);
+        }
+    }
+    else if (cmd.op == "SUB")
+    {
+        if (!cmd.data.empty())
+        {
+            if (parse_int(cmd.data, val))
+            {
+                if (val != 0)
+                {
+                    connection_manager_.subscribe(shared_from_this());
                 }
                 else
                 {
-                    send_reply(STATUS_ERROR);
+                    connection_manager_.unsubscribe(shared_from_this());
                 }
+
+                send_reply(STATUS_OK);
+            }
+            else
+            {
+                send_reply(STATUS_ERROR);
             }
         }
-        catch (const boost::filesystem::filesystem_error&)
+        else
+        {
+            send_reply(connection_manager_.is_subscribed(shared_from_this()) ? "1" : "0");
+        }
+    }
+    else if (cmd.op == FRAME_HANDSHAKE)
+    {
+        if (batch_replies_ == NULL)
+        {
+            // everything after the handshake is read as binary frames
+            send_reply(STATUS_OK);
+            binary_ = true;
+        }
+        else
         {
             send_reply(STATUS_ERROR);
         }
-
-        send_reply(out.str());
     }
     else if (cmd.op == "CLOSE")
     {
@@ -677,25 +749,61 @@ void connection::handle_read(const boost::system::error_code& e,
     if (!e)
     {
         boost::tribool result;
-        boost::tie(result, boost::tuples::ignore) = command_parser_.parse(
-                   command_, buffer_.data(), buffer_.data() + bytes_transferred);
+        char* begin = buffer_.data();
+        char* end = buffer_.data() + bytes_transferred;
+        bool changed = false;
 
-        if (result)
+        reading_ = false;
+
+        // run every complete command in the buffer, a partial command
+        // at the end is kept in the parser until the next read
+        while (begin != end && !closing_)
         {
-            handle_command(command_);
-            command_.clear();
-            command_parser_.reset();
+            if (binary_)
+            {
+                boost::tie(result, begin) = frame_parser_.parse(frame_, begin, end);
+
+                if (result)
+                {
+                    changed |= handle_frame(frame_);
+                    frame_.clear();
+                    frame_parser_.reset();
+                }
+                else if (!result)
+                {
+                    // the stream can not be resynchronised, so give up on it
+                    frame_.op = FRAME_OP_ERROR;
+                    frame_.values.clear();
+                    send_frame(frame_);
+                    disconnect_client();
+                }
+            }
+            else
+            {
+                boost::tie(result, begin) = command_parser_.parse(command_, begin, end);
+
+                if (result)
+                {
+                    execute_command(command_);
+                    command_.clear();
+                    command_parser_.reset();
+                }
+                else if (!result)
+                {
+                    command_.clear();
+                    command_parser_.reset();
+                }
+            }
         }
-        else if (!result)
+
+        // frames received together cause a single engine update
+        if (changed)
         {
-            command_.clear();
-            command_parser_.reset();
+            g_config_changed();
+            connection_manager_.notify_changes();
         }
 
-        socket_.async_read_some(boost::asio::buffer(buffer_),
-                                boost::bind(&connection::handle_read, shared_from_this(),
-                                            boost::asio::placeholders::error,
-                                            boost::asio::placeholders::bytes_transferred));
+        start_read();
     }
     else if (e != boost::asio::error::operation_aborted)
     {
@@ -703,28 +811,610 @@ void connection::handle_read(const boost::system::error_code& e,
     }
 }
 
-void connection::configure_socket()
+void connection::handle_batch(const std::string& data)
+{
+    std::vector<std::string> items;
+    std::vector<std::string> replies;
+    config_state saved;
+    bool failed = false;
+
+    boost::algorithm::split(items, data, boost::is_any_of(BATCH_DELIM));
+
+    saved.save();
+    batch_replies_ = &replies;
+
+    for (std::vector<std::string>::iterator it = items.begin(); it != items.end(); ++it)
+    {
+        boost::algorithm::trim(*it);
+
+        if (it->empty())
+        {
+            continue;
+        }
+
+        command sub;
+        std::string::size_type pos = it->find(CMD_DELIM);
+
+        sub.op = it->substr(0, pos);
+        if (pos != std::string::npos)
+        {
+            sub.data = it->substr(pos + 1);
+        }
+
+        handle_command(sub);
+
+        if (!replies.empty() && replies.back() == STATUS_ERROR)
+        {
+            failed = true;
+            break;
+        }
+    }
+
+    batch_replies_ = NULL;
+
+    if (failed)
+    {
+        // leave the settings as they were before the batch
+        saved.restore();
+        send_reply(STATUS_ERROR);
+    }
+    else if (replies.empty())
+    {
+        send_reply(STATUS_OK);
+    }
+    else
+    {
+        send_reply(boost::algorithm::join(replies, BATCH_DELIM));
+    }
+}
+
+bool connection::handle_frame(const frame& frm)
+{
+    frame reply;
+    std::vector<int> values;
+    int min, max;
+    bool changed = false;
+
+    reply.seq = frm.seq;
+    reply.op = FRAME_OP_ERROR;
+    reply.param = frm.param;
+    reply.index = frm.index;
+
+    if (frm.op == FRAME_OP_CLOSE)
+    {
+        reply.op = FRAME_OP_ACK;
+        send_frame(reply);
+        disconnect_client();
+        return false;
+    }
+
+    if (get_param(frm.param, values, min, max) &&
+        frm.index + frm.values.size() <= values.size())
+    {
+        if (frm.op == FRAME_OP_GET)
+        {
+            // all elements from the index onwards
+            for (std::size_t ix = frm.index; ix < values.size(); ix++)
+            {
+                reply.values.push_back(values[ix]);
+            }
+
+            reply.op = FRAME_OP_VALUE;
+        }
+        else if (frm.op == FRAME_OP_SET)
+        {
+            for (std::size_t ix = 0; ix < frm.values.size(); ix++)
+            {
+                int val = frm.values[ix];
+
+                if (val < min) val = min;
+                if (val > max) val = max;
+
+                if (values[frm.index + ix] != val)
+                {
+                    values[frm.index + ix] = val;
+                    changed = true;
+                }
+            }
+
+            if (changed)
+            {
+                set_param(frm.param, values);
+            }
+
+            reply.op = FRAME_OP_ACK;
+        }
+    }
+
+    send_frame(reply);
+    return changed;
+}
+
+bool connection::get_param(int param, std::vector<int>& values, int& min, int& max)
+{
+    switch (param)
+    {
+    case FRAME_PARAM_EQ_ENABLE:
+        values.assign(1, cfg_eq_enable.get_value());
+        min = 0;
+        max = 1;
+        return true;
+
+    case FRAME_PARAM_EQ_LEVEL:
+        values.assign(1, cfg_eq_level.get_value());
+        min = EQLevelRangeMin;
+        max = EQLevelRangeMax;
+        return true;
+
+    case FRAME_PARAM_EQ_MAG:
+        {
+            std::vector<std::string> mags;
+
+            boost::algorithm::split(
+                mags,
+                std::string(cfg_eq_mag.get_ptr()),
+                boost::is_any_of(","),
+                boost::algorithm::token_compress_on);
+
+            values.clear();
+            for (std::size_t ix = 0; ix < mags.size(); ix++)
+            {
+                int val = 0;
+                parse_int(mags[ix], val);
+                values.push_back(val);
+            }
+        }
+        min = EQLevelRangeMin;
+        max = EQLevelRangeMax;
+        return true;
+
+    case FRAME_PARAM_FILE_ENABLE:
+        values.clear();
+        values.push_back(cfg_file1_enable.get_value());
+        values.push_back(cfg_file2_enable.get_value());
+        values.push_back(cfg_file3_enable.get_value());
+        min = 0;
+        max = 1;
+        return true;
+
+    case FRAME_PARAM_FILE_LEVEL:
+        values.clear();
+        values.push_back(cfg_file1_level.get_value());
+        values.push_back(cfg_file2_level.get_value());
+        values.push_back(cfg_file3_level.get_value());
+        min = FileLevelRangeMin;
+        max = FileLevelRangeMax;
+        return true;
+    }
+
+    return false;
+}
+
+void connection::set_param(int param, const std::vector<int>& values)
+{
+    switch (param)
+    {
+    case FRAME_PARAM_EQ_ENABLE:
+        cfg_eq_enable = values[0];
+        break;
+
+    case FRAME_PARAM_EQ_LEVEL:
+        cfg_eq_level = values[0];
+        break;
+
+    case FRAME_PARAM_EQ_MAG:
+        {
+            // the whole array is joined once, however many bands changed
+            std::stringstream out;
+
+            for (std::size_t ix = 0; ix < values.size(); ix++)
+            {
+                if (ix != 0)
+                {
+                    out << ",";
+                }
+
+                out << values[ix];
+            }
+
+            cfg_eq_mag.set_string(out.str().c_str());
+        }
+        break;
+
+    case FRAME_PARAM_FILE_ENABLE:
+        cfg_file1_enable = values[0];
+        cfg_file2_enable = values[1];
+        cfg_file3_enable = values[2];
+        break;
+
+    case FRAME_PARAM_FILE_LEVEL:
+        cfg_file1_level = values[0];
+        cfg_file2_level = values[1];
+        cfg_file3_level = values[2];
+        break;
+    }
+}
+
+void connection::start_read()
+{
+    // stop reading commands from a client that does not read its replies
+    if (reading_ || closing_ || reply_bytes_ > REPLY_QUEUE_HIGH_WATER)
+    {
+        return;
+    }
+
+    reading_ = true;
+    socket_.async_read_some(boost::asio::buffer(buffer_),
+                            boost::bind(&connection::handle_read, shared_from_this(),
+                                        boost::asio::placeholders::error,
+                                        boost::asio::placeholders::bytes_transferred));
+}
+
+void connection::start_write()
+{
+    std::vector<boost::asio::const_buffer> buffers;
+
+    if (writing_ || reply_queue_.empty())
+    {
+        return;
+    }
+
+    // gather everything queued so far into one write
+    reply_sending_.assign(reply_queue_.begin(), reply_queue_.end());
+    reply_queue_.clear();
+
+    buffers.reserve(reply_sending_.size());
+    for (std::vector<reply_ptr>::const_iterator it = reply_sending_.begin();
+         it != reply_sending_.end(); ++it)
+    {
+        buffers.push_back(boost::asio::buffer(**it));
+    }
+
+    writing_ = true;
+    boost::asio::async_write(socket_, buffers,
+                             boost::bind(&connection::handle_write, shared_from_this(),
+                                         boost::asio::placeholders::error));
+}
+
+void connection::handle_write(const boost::system::error_code& e)
+{
+    writing_ = false;
+
+    if (!e)
+    {
+        for (std::vector<reply_ptr>::const_iterator it = reply_sending_.begin();
+             it != reply_sending_.end(); ++it)
+        {
+            reply_bytes_ -= (*it)->length();
+        }
+
+        reply_sending_.clear();
+
+        if (!reply_queue_.empty())
+        {
+            start_write();
+        }
+        else if (closing_)
+        {
+            connection_manager_.stop(shared_from_this());
+            return;
+        }
+
+        if (reply_bytes_ < REPLY_QUEUE_LOW_WATER)
+        {
+            start_read();
+        }
+    }
+    else if (e != boost::asio::error::operation_aborted)
+    {
+        connection_manager_.stop(shared_from_this());
+    }
+}
+
+void connection::start_stat_timer()
+{
+    stat_timer_.expires_from_now(boost::posix_time::milliseconds(stat_interval_));
+    stat_timer_.async_wait(boost::bind(&connection::handle_stat_timer, shared_from_this(),
+                                       boost::asio::placeholders::error));
+}
+
+void connection::handle_stat_timer(const boost::system::error_code& e)
+{
+    if (!e && stat_interval_ > 0)
+    {
+        // skip the update while the previous one is still being written,
+        // a slow subscriber only needs the latest statistics
+        if (reply_bytes_ > 0 || send_reply(format_stats()))
+        {
+            start_stat_timer();
+        }
+        else
+        {
+            stat_interval_ = 0;
+        }
+    }
+}
+
+std::string connection::format_stats()
 {
-    native_socket_ = socket_.native();
-    if (native_socket_ != INVALID_SOCKET)
+    static const char *stage_names[METRICS_STAGE_COUNT] =
+    {
+        "input", "fft", "mix", "mac", "ifft", "output", "resample"
+    };
+
+    std::stringstream out;
+    struct metrics_t m;
+    struct cache_stats_t cs;
+    struct coeff_store_stats_t ss;
+    struct pool_stats_t ps;
+
+    json_spirit::Array instance_array;
+
+    for (int slot = 0; slot < METRICS_MAX_SLOTS; slot++)
+    {
+        if (!metrics::read(slot, &m))
+        {
+            continue;
+        }
+
+        // time stamp counter rate, measured against the performance counter
+        double cycle_rate = (m.block_seconds > 0.0) ? m.block_cycles / m.block_seconds : 0.0;
+
+        json_spirit::Object stage_obj;
+        for (int i = 0; i < METRICS_STAGE_COUNT; i++)
+        {
+            double usec = 0.0;
+
+            if (m.n_blocks > 0 && cycle_rate > 0.0)
+            {
+                usec = 1e6 * m.stage_cycles[i] / (cycle_rate * m.n_blocks);
+            }
+
+            stage_obj.push_back(json_spirit::Pair(stage_names[i], usec));
+        }
+
+        json_spirit::Array channel_array;
+        for (int n = 0; n < m.n_channels && n < BF_MAXCHANNELS; n++)
+        {
+            json_spirit::Object obj;
+            obj.push_back(json_spirit::Pair("active_blocks", m.active_blocks[n]));
+            obj.push_back(json_spirit::Pair("peak", m.peak[n]));
+            obj.push_back(json_spirit::Pair("clipped", (uint64_t)m.n_clipped[n]));
+            obj.push_back(json_spirit::Pair("nonfinite", (uint64_t)m.n_nonfinite[n]));
+            channel_array.push_back(obj);
+        }
+
+        json_spirit::Object obj;
+        obj.push_back(json_spirit::Pair("id", slot));
+        obj.push_back(json_spirit::Pair("channels", m.n_channels));
+        obj.push_back(json_spirit::Pair("rate", m.sampling_rate));
+        obj.push_back(json_spirit::Pair("block_length", m.block_length));
+        obj.push_back(json_spirit::Pair("filter_blocks", m.filter_blocks));
+        obj.push_back(json_spirit::Pair("blocks", m.n_blocks));
+        obj.push_back(json_spirit::Pair("overruns", m.n_overruns));
+        obj.push_back(json_spirit::Pair("load", m.load));
+        obj.push_back(json_spirit::Pair("load_max", m.max_load));
+        obj.push_back(json_spirit::Pair("load_p50", metrics::get_load_percentile(&m, 0.50)));
+        obj.push_back(json_spirit::Pair("load_p90", metrics::get_load_percentile(&m, 0.90)));
+        obj.push_back(json_spirit::Pair("load_p99", metrics::get_load_percentile(&m, 0.99)));
+        obj.push_back(json_spirit::Pair("latency_ms", 1e3 * m.latency));
+        obj.push_back(json_spirit::Pair("pipeline_blocks", m.pipeline_blocks));
+        obj.push_back(json_spirit::Pair("stalls", m.n_stalls));
+        obj.push_back(json_spirit::Pair("rebuilds", (uint64_t)m.n_rebuilds));
+        obj.push_back(json_spirit::Pair("rebuild_ms", 1e3 * m.rebuild_seconds));
+        obj.push_back(json_spirit::Pair("stage_us", stage_obj));
+        obj.push_back(json_spirit::Pair("channel", channel_array));
+        instance_array.push_back(obj);
+    }
+
+    cache::get_stats(&cs);
+
+    json_spirit::Object cache_obj;
+    cache_obj.push_back(json_spirit::Pair("hits", cs.hits));
+    cache_obj.push_back(json_spirit::Pair("misses", cs.misses));
+    cache_obj.push_back(json_spirit::Pair("hit_rate", (cs.hits + cs.misses > 0)
+                                          ? (double)cs.hits / (cs.hits + cs.misses)
+                                          : 0.0));
+    cache_obj.push_back(json_spirit::Pair("evictions", cs.evictions));
+    cache_obj.push_back(json_spirit::Pair("size", cs.size));
+    cache_obj.push_back(json_spirit::Pair("max_size", cs.max_size));
+    cache_obj.push_back(json_spirit::Pair("entries", cs.n_entries));
+
+    coeff_store::get_stats(&ss);
+
+    // coefficient sets shared by the engines of all instances
+    json_spirit::Object coeff_obj;
+    coeff_obj.push_back(json_spirit::Pair("sets", ss.n_sets));
+    coeff_obj.push_back(json_spirit::Pair("references", ss.n_references));
+    coeff_obj.push_back(json_spirit::Pair("size", ss.size));
+
+    thread_pool::get_stats(&ps);
+
+    // busy share of the workers since the previous statistics of
+    // this connection, each subscriber keeps its own sample
+    double utilization = 0.0;
+
+    if (ps.n_workers > 0 && stat_timestamp_ != 0 && ps.timestamp > stat_timestamp_)
     {
-        int optval = 1000;
-        setsockopt(native_socket_, SOL_SOCKET, SO_SNDTIMEO, (const char *)&optval, sizeof(optval));
-        setsockopt(native_socket_, SOL_SOCKET, SO_RCVTIMEO, (const char *)&optval, sizeof(optval));
+        utilization = (double)(ps.busy_cycles - stat_busy_cycles_) /
+                      ((double)(ps.timestamp - stat_timestamp_) * ps.n_workers);
+
+        if (utilization > 1.0)
+        {
+            utilization = 1.0;
+        }
     }
+
+    stat_busy_cycles_ = ps.busy_cycles;
+    stat_timestamp_ = ps.timestamp;
+
+    // worker threads shared by the engines of all instances
+    json_spirit::Object queued_obj;
+    queued_obj.push_back(json_spirit::Pair("realtime", ps.queued[POOL_PRIORITY_REALTIME]));
+    queued_obj.push_back(json_spirit::Pair("normal", ps.queued[POOL_PRIORITY_NORMAL]));
+    queued_obj.push_back(json_spirit::Pair("background", ps.queued[POOL_PRIORITY_BACKGROUND]));
+
+    json_spirit::Object pool_obj;
+    pool_obj.push_back(json_spirit::Pair("workers", ps.n_workers));
+    pool_obj.push_back(json_spirit::Pair("active", ps.n_active));
+    pool_obj.push_back(json_spirit::Pair("queued", queued_obj));
+    pool_obj.push_back(json_spirit::Pair("tasks", ps.n_tasks));
+    pool_obj.push_back(json_spirit::Pair("steals", ps.n_steals));
+    pool_obj.push_back(json_spirit::Pair("utilization", utilization));
+
+    // create root object
+    json_spirit::Object root_obj;
+    root_obj.push_back(json_spirit::Pair("instance", instance_array));
+    root_obj.push_back(json_spirit::Pair("cache", cache_obj));
+    root_obj.push_back(json_spirit::Pair("coeffs", coeff_obj));
+    root_obj.push_back(json_spirit::Pair("pool", pool_obj));
+
+    // single line output so that subscribers can split updates on the terminator
+    json_spirit::write(root_obj, out);
+
+    return out.str();
+}
+
+void connection::configure_socket()
+{
+    boost::system::error_code ec;
+
+    // replies are small and already batched by the write queue
+    socket_.set_option(boost::asio::ip::tcp::no_delay(true), ec);
 }
 
 bool connection::send_reply( std::string data)
 {
-    std::string message = data + CMD_TERM;
+    if (batch_replies_ != NULL)
+    {
+        batch_replies_->push_back(data);
+        return true;
+    }
+
+    data.push_back(CMD_TERM);
+    return queue_reply(reply_ptr(new std::string(data)));
+}
+
+bool connection::send_frame(const frame& frm)
+{
+    return queue_reply(reply_ptr(new std::string(frm.encode())));
+}
+
+bool connection::send_notification(reply_ptr data)
+{
+    // notifications are text, clients using binary frames do not get them
+    if (binary_)
+    {
+        return false;
+    }
 
-    bool result = (send(native_socket_, message.c_str(), message.length(), 0) != SOCKET_ERROR);
-    return result;
+    return queue_reply(data);
+}
+
+bool connection::queue_reply(reply_ptr data)
+{
+    if (closing_)
+    {
+        return false;
+    }
+
+    // drop a client whose replies keep piling up
+    if (reply_bytes_ + data->length() > REPLY_QUEUE_MAX)
+    {
+        connection_manager_.stop(shared_from_this());
+        return false;
+    }
+
+    reply_bytes_ += data->length();
+    reply_queue_.push_back(data);
+
+    start_write();
+    return true;
 }
 
 void connection::disconnect_client()
 {
-    connection_manager_.stop(shared_from_this());
+    if (reply_bytes_ == 0)
+    {
+        connection_manager_.stop(shared_from_this());
+    }
+    else
+    {
+        closing_ = true;
+    }
+}
+
+void config_state::save()
+{
+    eq_enable = cfg_eq_enable.get_value();
+    eq_level = cfg_eq_level.get_value();
+    eq_mag = cfg_eq_mag.get_ptr();
+
+    file_enable[0] = cfg_file1_enable.get_value();
+    file_enable[1] = cfg_file2_enable.get_value();
+    file_enable[2] = cfg_file3_enable.get_value();
+
+    file_level[0] = cfg_file1_level.get_value();
+    file_level[1] = cfg_file2_level.get_value();
+    file_level[2] = cfg_file3_level.get_value();
+
+    file_filename[0] = cfg_file1_filename.get_ptr();
+    file_filename[1] = cfg_file2_filename.get_ptr();
+    file_filename[2] = cfg_file3_filename.get_ptr();
+
+    file_metadata[0] = cfg_file1_metadata.get_ptr();
+    file_metadata[1] = cfg_file2_metadata.get_ptr();
+    file_metadata[2] = cfg_file3_metadata.get_ptr();
+
+    delay = cfg_delay.get_ptr();
+}
+
+void config_state::restore() const
+{
+    cfg_eq_enable = eq_enable;
+    cfg_eq_level = eq_level;
+    cfg_eq_mag.set_string(eq_mag.c_str());
+
+    cfg_file1_enable = file_enable[0];
+    cfg_file2_enable = file_enable[1];
+    cfg_file3_enable = file_enable[2];
+
+    cfg_file1_level = file_level[0];
+    cfg_file2_level = file_level[1];
+    cfg_file3_level = file_level[2];
+
+    cfg_file1_filename.set_string(file_filename[0].c_str());
+    cfg_file2_filename.set_string(file_filename[1].c_str());
+    cfg_file3_filename.set_string(file_filename[2].c_str());
+
+    cfg_file1_metadata.set_string(file_metadata[0].c_str());
+    cfg_file2_metadata.set_string(file_metadata[1].c_str());
+    cfg_file3_metadata.set_string(file_metadata[2].c_str());
+
+    cfg_delay.set_string(delay.c_str());
+}
+
+bool config_state::operator==(const config_state& other) const
+{
+    return filter_equals(other) && delay == other.delay;
+}
+
+bool config_state::filter_equals(const config_state& other) const
+{
+    for (int ix = 0; ix < 3; ix++)
+    {
+        if (file_enable[ix] != other.file_enable[ix] ||
+            file_level[ix] != other.file_level[ix] ||
+            file_filename[ix] != other.file_filename[ix] ||
+            file_metadata[ix] != other.file_metadata[ix])
+        {
+            return false;
+        }
+    }
+
+    return eq_enable == other.eq_enable &&
+           eq_level == other.eq_level &&
+           eq_mag == other.eq_mag;
 }
 
 bool connection::parse_int(std::string str, int &val)
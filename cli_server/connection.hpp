@@ -18,15 +18,34 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/cstdint.hpp>
+#include <deque>
+#include <vector>
 #include "command.hpp"
 #include "command_parser.hpp"
+#include "frame.hpp"
+#include "frame_parser.hpp"
+#include "dir_index.hpp"
 
 #define STATUS_OK     "OK"
 #define STATUS_ERROR  "ERR"
 
 #define FILENAME_NONE "?"
 
-#define PATH_SUB_ROOT "|"
+#define STAT_MIN_INTERVAL 100
+
+#define BATCH_DELIM   ";"
+
+#define NOTIFY_PREFIX "EVT "
+
+/// Queued reply bytes above which no more commands are read from a client.
+#define REPLY_QUEUE_HIGH_WATER (256 * 1024)
+
+/// Queued reply bytes below which reading resumes.
+#define REPLY_QUEUE_LOW_WATER  (64 * 1024)
+
+/// Queued reply bytes above which a client is disconnected.
+#define REPLY_QUEUE_MAX        (4 * 1024 * 1024)
 
 namespace cli
 {
@@ -35,6 +54,33 @@ namespace server
 
 class connection_manager;
 
+/// A reply that may be shared by the write queues of several connections.
+typedef boost::shared_ptr<const std::string> reply_ptr;
+
+/// Copy of the settings that commands can change.
+struct config_state
+{
+    int eq_enable;
+    int eq_level;
+    std::string eq_mag;
+    int file_enable[3];
+    int file_level[3];
+    std::string file_filename[3];
+    std::string file_metadata[3];
+    std::string delay;
+
+    /// Copies the current settings.
+    void save();
+
+    /// Writes the copied settings back.
+    void restore() const;
+
+    /// Check whether the settings that the filter is built from are equal.
+    bool filter_equals(const config_state& other) const;
+
+    bool operator==(const config_state& other) const;
+};
+
 /// Represents a single connection from a client.
 class connection
     : public boost::enable_shared_from_this<connection>,
@@ -55,21 +101,63 @@ public:
     /// Stop all asynchronous operations associated with the connection.
     void stop();
 
+    /// Queues a change notification shared with other subscribers.
+    bool send_notification(reply_ptr data);
+
 private:
+    /// Runs a command and signals the engine if it changed any settings.
+    void execute_command(command& cmd);
+
     /// Handles an incoming command.
     void handle_command(command& cmd);
 
+    /// Runs the commands of a batch, applying all settings or none.
+    void handle_batch(const std::string& data);
+
+    /// Handles an incoming binary frame, returns true if settings changed.
+    bool handle_frame(const frame& frm);
+
+    /// Gets the current values and range of a binary parameter.
+    static bool get_param(int param, std::vector<int>& values, int& min, int& max);
+
+    /// Sets the values of a binary parameter.
+    static void set_param(int param, const std::vector<int>& values);
+
+    /// Start an asynchronous read unless one is pending or replies are backed up.
+    void start_read();
+
     /// Handle completion of a read operation.
     void handle_read(const boost::system::error_code& e,
                      std::size_t bytes_transferred);
 
+    /// Start writing all queued replies with a single gather write.
+    void start_write();
+
+    /// Handle completion of a write operation.
+    void handle_write(const boost::system::error_code& e);
+
+    /// Schedules the next statistics update of a subscription.
+    void start_stat_timer();
+
+    /// Handle expiry of the statistics timer.
+    void handle_stat_timer(const boost::system::error_code& e);
+
+    /// Serialises the engine statistics as JSON.
+    std::string format_stats();
+
     /// Configures the native socket.
     void configure_socket();
 
-    /// Sends command reply to the native socket.
+    /// Queues a command reply for writing to the client.
     bool send_reply(std::string data);
 
-    /// Disconnects the client connection.
+    /// Queues a binary reply frame for writing to the client.
+    bool send_frame(const frame& frm);
+
+    /// Queues raw reply data for writing to the client.
+    bool queue_reply(reply_ptr data);
+
+    /// Disconnects the client connection once all replies have been written.
     void disconnect_client();
 
     /// Parses a string to an integer.
@@ -91,11 +179,50 @@ private:
     /// The parser for the commmand.
     command_parser command_parser_;
 
-    /// The underlying native socket.
-    SOCKET native_socket_;
+    /// Whether the client switched to binary frames.
+    bool binary_;
+
+    /// The incoming binary frame.
+    frame frame_;
+
+    /// The parser for binary frames.
+    frame_parser frame_parser_;
 
     /// The default directory.
     std::string default_dir_;
+
+    /// Timer for statistics subscriptions.
+    boost::asio::deadline_timer stat_timer_;
+
+    /// The statistics update interval in milliseconds, 0 if not subscribed.
+    int stat_interval_;
+
+    /// The worker busy cycles at the previous statistics of this connection.
+    boost::uint64_t stat_busy_cycles_;
+
+    /// The time stamp of the previous statistics of this connection, 0 if none.
+    boost::uint64_t stat_timestamp_;
+
+    /// Replies waiting to be written.
+    std::deque<reply_ptr> reply_queue_;
+
+    /// Replies being written, kept alive until the write completes.
+    std::vector<reply_ptr> reply_sending_;
+
+    /// Total size of queued and sending replies in bytes.
+    std::size_t reply_bytes_;
+
+    /// Whether a read operation is pending.
+    bool reading_;
+
+    /// Whether a write operation is pending.
+    bool writing_;
+
+    /// Whether the client is disconnected after the queued replies.
+    bool closing_;
+
+    /// Collects the replies of batched commands, NULL outside a batch.
+    std::vector<std::string>* batch_replies_;
 };
 
 typedef boost::shared_ptr<connection> connection_ptr;
@@ -2,6 +2,7 @@
 // connection_manager.cpp
 // ~~~~~~~~~~~~~~~~~~~~~~
 //
+// Copyright (c) 2011 Victor Su
 // Copyright (c) 2003-2011 Christopher M. Kohlhoff (chris at kohlhoff dot com)
 //
 // Distributed under the Boost Software License, Version 1.0. (See accompanying
@@ -10,13 +11,23 @@
 
 #include "connection_manager.hpp"
 #include <algorithm>
+#include <vector>
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include "../foo_dsp_bfir/foo_dsp_bfir.h"
 
 namespace cli
 {
 namespace server
 {
 
+connection_manager::connection_manager()
+    : notified_generation_(0),
+      notified_delay_generation_(0)
+{
+}
+
 void connection_manager::start(connection_ptr c)
 {
     connections_.insert(c);
@@ -26,6 +37,7 @@ void connection_manager::start(connection_ptr c)
 void connection_manager::stop(connection_ptr c)
 {
     connections_.erase(c);
+    subscribers_.erase(c);
     c->stop();
 }
 
@@ -34,6 +46,180 @@ void connection_manager::stop_all()
     std::for_each(connections_.begin(), connections_.end(),
                   boost::bind(&connection::stop, _1));
     connections_.clear();
+    subscribers_.clear();
+
+    if (timer_)
+    {
+        timer_->cancel();
+    }
+}
+
+void connection_manager::subscribe(connection_ptr c)
+{
+    if (subscribers_.empty())
+    {
+        // start from the current settings, only later changes are sent
+        notified_state_.save();
+        notified_generation_ = g_get_config_generation();
+        notified_delay_generation_ = g_get_delay_generation();
+
+        if (!timer_)
+        {
+            timer_.reset(new boost::asio::deadline_timer(c->socket().get_io_service()));
+        }
+
+        timer_->expires_from_now(boost::posix_time::milliseconds(NOTIFY_POLL_INTERVAL));
+        timer_->async_wait(boost::bind(&connection_manager::handle_timer, this,
+                                       boost::asio::placeholders::error));
+    }
+
+    subscribers_.insert(c);
+}
+
+void connection_manager::unsubscribe(connection_ptr c)
+{
+    subscribers_.erase(c);
+}
+
+bool connection_manager::is_subscribed(connection_ptr c) const
+{
+    return subscribers_.find(c) != subscribers_.end();
+}
+
+void connection_manager::notify_changes()
+{
+    long generation = g_get_config_generation();
+    long delay_generation = g_get_delay_generation();
+
+    if (subscribers_.empty() ||
+        (generation == notified_generation_ && delay_generation == notified_delay_generation_))
+    {
+        return;
+    }
+
+    config_state state;
+    state.save();
+
+    std::string changes = format_changes(notified_state_, state);
+
+    notified_state_ = state;
+    notified_generation_ = generation;
+    notified_delay_generation_ = delay_generation;
+
+    if (changes.empty())
+    {
+        return;
+    }
+
+    // the message is built once and shared by all write queues
+    reply_ptr message(new std::string(NOTIFY_PREFIX + changes + CMD_TERM));
+
+    // a slow subscriber may be dropped while sending, so iterate over a copy
+    std::set<connection_ptr> subscribers(subscribers_);
+    for (std::set<connection_ptr>::iterator it = subscribers.begin(); it != subscribers.end(); ++it)
+    {
+        (*it)->send_notification(message);
+    }
+}
+
+dir_index& connection_manager::index()
+{
+    return index_;
+}
+
+void connection_manager::handle_timer(const boost::system::error_code& e)
+{
+    if (!e && !subscribers_.empty())
+    {
+        notify_changes();
+
+        timer_->expires_from_now(boost::posix_time::milliseconds(NOTIFY_POLL_INTERVAL));
+        timer_->async_wait(boost::bind(&connection_manager::handle_timer, this,
+                                       boost::asio::placeholders::error));
+    }
+}
+
+std::string connection_manager::format_changes(const config_state& from,
+                                               const config_state& to)
+{
+    std::vector<std::string> changes;
+
+    if (from.eq_enable != to.eq_enable)
+    {
+        changes.push_back("EQEN " + boost::lexical_cast<std::string>(to.eq_enable));
+    }
+
+    if (from.eq_level != to.eq_level)
+    {
+        changes.push_back("EQLV " + boost::lexical_cast<std::string>(to.eq_level));
+    }
+
+    if (from.eq_mag != to.eq_mag)
+    {
+        std::vector<std::string> from_mags, to_mags;
+
+        boost::algorithm::split(from_mags, from.eq_mag, boost::is_any_of(","),
+                                boost::algorithm::token_compress_on);
+        boost::algorithm::split(to_mags, to.eq_mag, boost::is_any_of(","),
+                                boost::algorithm::token_compress_on);
+
+        // only the bands that changed
+        for (std::size_t ix = 0; ix < to_mags.size(); ix++)
+        {
+            if (ix >= from_mags.size() || from_mags[ix] != to_mags[ix])
+            {
+                changes.push_back("EQM" + boost::lexical_cast<std::string>(ix) + " " + to_mags[ix]);
+            }
+        }
+    }
+
+    for (int ix = 0; ix < 3; ix++)
+    {
+        std::string prefix = "F" + boost::lexical_cast<std::string>(ix + 1);
+
+        if (from.file_enable[ix] != to.file_enable[ix])
+        {
+            changes.push_back(prefix + "EN " + boost::lexical_cast<std::string>(to.file_enable[ix]));
+        }
+
+        if (from.file_level[ix] != to.file_level[ix])
+        {
+            changes.push_back(prefix + "LV " + boost::lexical_cast<std::string>(to.file_level[ix]));
+        }
+
+        if (from.file_filename[ix] != to.file_filename[ix])
+        {
+            changes.push_back(prefix + "FN " + (to.file_filename[ix].empty()
+                                                ? std::string(FILENAME_NONE)
+                                                : to.file_filename[ix]));
+        }
+
+        if (from.file_metadata[ix] != to.file_metadata[ix])
+        {
+            changes.push_back(prefix + "MD " + to.file_metadata[ix]);
+        }
+    }
+
+    if (from.delay != to.delay)
+    {
+        std::vector<std::string> from_delays, to_delays;
+
+        boost::algorithm::split(from_delays, from.delay, boost::is_any_of(","),
+                                boost::algorithm::token_compress_on);
+        boost::algorithm::split(to_delays, to.delay, boost::is_any_of(","),
+                                boost::algorithm::token_compress_on);
+
+        // only the channels that changed
+        for (std::size_t ix = 0; ix < to_delays.size(); ix++)
+        {
+            if (ix >= from_delays.size() || from_delays[ix] != to_delays[ix])
+            {
+                changes.push_back("DLY" + boost::lexical_cast<std::string>(ix) + " " + to_delays[ix]);
+            }
+        }
+    }
+
+    return boost::algorithm::join(changes, BATCH_DELIM);
 }
 
 } // namespace server
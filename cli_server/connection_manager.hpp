@@ -2,6 +2,7 @@
 // connection_manager.hpp
 // ~~~~~~~~~~~~~~~~~~~~~~
 //
+// Copyright (c) 2011 Victor Su
 // Copyright (c) 2003-2011 Christopher M. Kohlhoff (chris at kohlhoff dot com)
 //
 // Distributed under the Boost Software License, Version 1.0. (See accompanying
@@ -12,8 +13,15 @@
 #define CLI_CONNECTION_MANAGER_HPP
 
 #include <set>
+#include <string>
 #include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/asio.hpp>
 #include "connection.hpp"
+#include "dir_index.hpp"
+
+/// Interval in milliseconds for detecting changes made outside the server.
+#define NOTIFY_POLL_INTERVAL 100
 
 namespace cli
 {
@@ -26,6 +34,9 @@ class connection_manager
     : private boost::noncopyable
 {
 public:
+    /// Construct a manager without connections.
+    connection_manager();
+
     /// Add the specified connection to the manager and start it.
     void start(connection_ptr c);
 
@@ -35,9 +46,49 @@ public:
     /// Stop all connections.
     void stop_all();
 
+    /// Subscribe the specified connection to change notifications.
+    void subscribe(connection_ptr c);
+
+    /// Unsubscribe the specified connection from change notifications.
+    void unsubscribe(connection_ptr c);
+
+    /// Check whether the specified connection is subscribed.
+    bool is_subscribed(connection_ptr c) const;
+
+    /// Broadcast settings changed since the last notification.
+    void notify_changes();
+
+    /// Get the directory index shared by all connections.
+    dir_index& index();
+
 private:
+    /// Handle expiry of the change polling timer.
+    void handle_timer(const boost::system::error_code& e);
+
+    /// Formats the differences between two settings copies.
+    static std::string format_changes(const config_state& from,
+                                      const config_state& to);
+
     /// The managed connections.
     std::set<connection_ptr> connections_;
+
+    /// The connections subscribed to change notifications.
+    std::set<connection_ptr> subscribers_;
+
+    /// The settings as last notified.
+    config_state notified_state_;
+
+    /// The configuration generation as last notified.
+    long notified_generation_;
+
+    /// The delay generation as last notified.
+    long notified_delay_generation_;
+
+    /// Timer polling for changes made outside the server.
+    boost::scoped_ptr<boost::asio::deadline_timer> timer_;
+
+    /// Cached directory listings and file metadata.
+    dir_index index_;
 };
 
 } // namespace server
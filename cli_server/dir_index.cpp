@@ -0,0 +1,475 @@
+//
+// dir_index.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#include "../foo_dsp_bfir/common.h"
+#include "dir_index.hpp"
+#include <algorithm>
+#include <iterator>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include "../brutefir/buffer.hpp"
+#include "../brutefir/preprocessor.hpp"
+#include "../brutefir/util.hpp"
+#include "../json_spirit/json_spirit.h"
+
+namespace cli
+{
+namespace server
+{
+
+void dir_query::clear()
+{
+    offset = 0;
+    count = 0;
+    extensions.clear();
+    n_channels = 0;
+    sampling_rate = 0;
+    metadata = false;
+}
+
+bool dir_query::parse(const std::string& data, std::string& path)
+{
+    std::size_t pos = 0;
+
+    clear();
+
+    // options come first, the first token that is not a known option
+    // starts the path, which may contain spaces
+    while (pos < data.size())
+    {
+        std::size_t end = data.find(' ', pos);
+        std::string token = data.substr(pos, end == std::string::npos ? end : end - pos);
+        std::size_t eq = token.find('=');
+
+        if (eq == std::string::npos)
+        {
+            break;
+        }
+
+        std::string name = token.substr(0, eq);
+        std::string value = token.substr(eq + 1);
+
+        try
+        {
+            if (name == "offset")
+            {
+                offset = boost::lexical_cast<std::size_t>(value);
+            }
+            else if (name == "count")
+            {
+                count = boost::lexical_cast<std::size_t>(value);
+            }
+            else if (name == "channels")
+            {
+                n_channels = boost::lexical_cast<int>(value);
+            }
+            else if (name == "rate")
+            {
+                sampling_rate = boost::lexical_cast<int>(value);
+            }
+            else if (name == "meta")
+            {
+                metadata = boost::lexical_cast<int>(value) != 0;
+            }
+            else if (name == "ext")
+            {
+                std::vector<std::string> exts;
+
+                boost::split(exts, value, boost::is_any_of(","));
+
+                for (std::vector<std::string>::iterator it = exts.begin(); it != exts.end(); ++it)
+                {
+                    std::string ext = boost::to_lower_copy(*it);
+
+                    if (boost::starts_with(ext, "."))
+                    {
+                        ext.erase(0, 1);
+                    }
+
+                    if (!ext.empty())
+                    {
+                        extensions.push_back(ext);
+                    }
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+        catch (const boost::bad_lexical_cast&)
+        {
+            return false;
+        }
+
+        if (n_channels < 0 || sampling_rate < 0)
+        {
+            return false;
+        }
+
+        pos = (end == std::string::npos) ? data.size() : end + 1;
+    }
+
+    path = data.substr(pos);
+
+    return true;
+}
+
+dir_index::dir_index()
+    : tick_(0)
+{
+}
+
+bool dir_index::list(const std::string& dir, const dir_query& query, std::string& out)
+{
+    boost::filesystem::path dir_path(dir);
+    const listing* l;
+
+    try
+    {
+        l = get_listing(dir_path.generic_string());
+    }
+    catch (const boost::filesystem::filesystem_error&)
+    {
+        return false;
+    }
+
+    if (l == NULL)
+    {
+        return false;
+    }
+
+    // add subdirectories
+    json_spirit::Array subdir_array;
+
+    // add parent directory (..) if it exists, it is not paged
+    boost::filesystem::path parent_path = dir_path.parent_path();
+
+    if (boost::filesystem::exists(parent_path))
+    {
+        json_spirit::Object obj;
+        obj.push_back(json_spirit::Pair("display", "[..]"));
+        obj.push_back(json_spirit::Pair("name", ".."));
+
+        // if the parent path ends with a colon, we are below
+        // the root directory of the drive, so indicate this with
+        // a special string.
+        if (boost::algorithm::ends_with(parent_path.generic_string(), ":"))
+        {
+            obj.push_back(json_spirit::Pair("path", PATH_SUB_ROOT));
+        }
+        else
+        {
+            obj.push_back(json_spirit::Pair("path", parent_path.generic_string()));
+        }
+
+        subdir_array.push_back(obj);
+    }
+
+    // add the requested page of subdirectories and matching files
+    json_spirit::Array file_array;
+    std::size_t total = 0;
+    bool audio_filter = (query.n_channels > 0 || query.sampling_rate > 0);
+
+    for (std::vector<entry>::const_iterator it = l->entries.begin(); it != l->entries.end(); ++it)
+    {
+        file_info info;
+        bool has_info = false;
+
+        if (!it->is_dir)
+        {
+            if (!matches_extension(it->name, query.extensions))
+            {
+                continue;
+            }
+
+            // only the header is needed to filter, the attenuation is
+            // analysed for the entries on the page alone
+            if (audio_filter)
+            {
+                has_info = get_file_params(it->path, info);
+
+                if (!has_info ||
+                    (query.n_channels > 0 && info.n_channels != query.n_channels) ||
+                    (query.sampling_rate > 0 && info.sampling_rate != query.sampling_rate))
+                {
+                    continue;
+                }
+            }
+        }
+
+        if (total >= query.offset && (query.count == 0 || total < query.offset + query.count))
+        {
+            json_spirit::Object obj;
+            obj.push_back(json_spirit::Pair("display", it->name));
+            obj.push_back(json_spirit::Pair("name", it->name));
+            obj.push_back(json_spirit::Pair("path", it->path));
+
+            if (it->is_dir)
+            {
+                subdir_array.push_back(obj);
+            }
+            else
+            {
+                if (query.metadata && get_file_info(it->path, info))
+                {
+                    obj.push_back(json_spirit::Pair("channels", info.n_channels));
+                    obj.push_back(json_spirit::Pair("rate", info.sampling_rate));
+                    obj.push_back(json_spirit::Pair("frames", info.n_frames));
+                    obj.push_back(json_spirit::Pair("attenuation", info.attenuation));
+                    obj.push_back(json_spirit::Pair("peak_attenuation", info.peak_attenuation));
+                    obj.push_back(json_spirit::Pair("music_attenuation", info.music_attenuation));
+                }
+
+                file_array.push_back(obj);
+            }
+        }
+
+        total++;
+    }
+
+    // create root object
+    json_spirit::Object root_obj;
+    root_obj.push_back(json_spirit::Pair("dir", dir_path.generic_string()));
+    root_obj.push_back(json_spirit::Pair("total", (boost::uint64_t)total));
+    root_obj.push_back(json_spirit::Pair("offset", (boost::uint64_t)query.offset));
+    root_obj.push_back(json_spirit::Pair("subdir", subdir_array));
+    root_obj.push_back(json_spirit::Pair("file", file_array));
+
+    // write without formatting to keep large listings small
+    out = json_spirit::write(root_obj);
+
+    return true;
+}
+
+bool dir_index::get_file_info(const std::string& path, file_info& info)
+{
+    return get_record(path, true, info);
+}
+
+bool dir_index::get_file_params(const std::string& path, file_info& info)
+{
+    return get_record(path, false, info);
+}
+
+void dir_index::clear()
+{
+    listings_.clear();
+    records_.clear();
+}
+
+bool dir_index::get_record(const std::string& path, bool analyse, file_info& info)
+{
+    boost::filesystem::path file_path(path);
+    boost::system::error_code ec;
+    std::time_t mtime;
+    boost::uintmax_t size;
+
+    mtime = boost::filesystem::last_write_time(file_path, ec);
+
+    if (!ec)
+    {
+        size = boost::filesystem::file_size(file_path, ec);
+    }
+
+    if (ec)
+    {
+        return false;
+    }
+
+    std::string key = file_path.generic_string();
+    std::map<std::string, record>::iterator it = records_.find(key);
+
+    if (it == records_.end() || !it->second.settled ||
+        it->second.mtime != mtime || it->second.size != size)
+    {
+        record r;
+
+        r.mtime = mtime;
+        r.size = size;
+        r.settled = (std::time(NULL) - mtime > 1);
+        r.analysed = false;
+        r.analysis_valid = false;
+        r.info.attenuation = 0.0;
+        r.info.peak_attenuation = 0.0;
+        r.info.music_attenuation = 0.0;
+
+        r.valid = buffer::get_snd_file_params(util::str2wstr(path).c_str(),
+                                              &r.info.n_channels,
+                                              &r.info.n_frames,
+                                              &r.info.sampling_rate);
+
+        it = records_.insert(std::make_pair(key, r)).first;
+        it->second = r;
+    }
+
+    record& r = it->second;
+
+    if (analyse && r.valid && !r.analysed)
+    {
+        // Calculate the optimum attentuation to prevent clipping
+        r.analysis_valid = preprocessor::calculate_attenuation(util::str2wstr(path),
+                                                               &r.info.attenuation,
+                                                               &r.info.peak_attenuation,
+                                                               &r.info.music_attenuation,
+                                                               &r.info.n_channels,
+                                                               &r.info.n_frames,
+                                                               &r.info.sampling_rate);
+        r.analysed = true;
+    }
+
+    r.last_used = ++tick_;
+
+    bool valid = r.valid && (!analyse || r.analysis_valid);
+
+    if (valid)
+    {
+        info = r.info;
+    }
+
+    evict(records_, DIR_INDEX_MAX_FILES);
+
+    return valid;
+}
+
+const dir_index::listing* dir_index::get_listing(const std::string& dir)
+{
+    boost::filesystem::path dir_path(dir);
+    boost::system::error_code ec;
+    std::time_t mtime;
+
+    // adding, removing or renaming an entry updates the directory's time
+    mtime = boost::filesystem::last_write_time(dir_path, ec);
+
+    if (ec)
+    {
+        return NULL;
+    }
+
+    std::map<std::string, listing>::iterator cached = listings_.find(dir);
+
+    if (cached != listings_.end() && cached->second.settled && cached->second.mtime == mtime)
+    {
+        cached->second.last_used = ++tick_;
+        return &cached->second;
+    }
+
+    // store paths to sort later
+    typedef std::vector<boost::filesystem::path> vec;
+    vec v;
+
+    std::copy(
+        boost::filesystem::directory_iterator(dir_path),
+        boost::filesystem::directory_iterator(),
+        std::back_inserter(v));
+
+    // sort since directory iteration may not be ordered
+    std::sort(v.begin(), v.end());
+
+    listing& l = listings_[dir];
+    std::vector<entry> files;
+
+    l.mtime = mtime;
+    l.settled = (std::time(NULL) - mtime > 1);
+    l.last_used = ++tick_;
+    l.entries.clear();
+
+    for (vec::const_iterator it(v.begin()), it_end(v.end()); it != it_end; ++it)
+    {
+        DWORD dwAttrs;
+
+        dwAttrs = GetFileAttributes(it->wstring().c_str());
+        if (dwAttrs != INVALID_FILE_ATTRIBUTES)
+        {
+            if (!(dwAttrs & FILE_ATTRIBUTE_SYSTEM))
+            {
+                entry e;
+                e.name = it->filename().generic_string();
+                e.path = it->generic_string();
+
+                if (boost::filesystem::is_regular_file(*it))
+                {
+                    e.is_dir = false;
+                    files.push_back(e);
+                }
+                else if (boost::filesystem::is_directory(*it))
+                {
+                    e.is_dir = true;
+                    l.entries.push_back(e);
+                }
+            }
+        }
+    }
+
+    l.entries.insert(l.entries.end(), files.begin(), files.end());
+
+    evict(listings_, DIR_INDEX_MAX_DIRS);
+
+    return &l;
+}
+
+bool dir_index::matches_extension(const std::string& name,
+                                  const std::vector<std::string>& extensions)
+{
+    if (extensions.empty())
+    {
+        return true;
+    }
+
+    std::size_t dot = name.rfind('.');
+
+    if (dot == std::string::npos)
+    {
+        return false;
+    }
+
+    std::string ext = boost::to_lower_copy(name.substr(dot + 1));
+
+    return std::find(extensions.begin(), extensions.end(), ext) != extensions.end();
+}
+
+template <typename Map>
+void dir_index::evict(Map& map, std::size_t max_size)
+{
+    std::vector<unsigned long> ticks;
+    typename Map::iterator it;
+
+    if (map.size() <= max_size)
+    {
+        return;
+    }
+
+    // drop to three quarters of the limit so that a full cache does not
+    // search for the oldest entry on every insertion
+    std::size_t n_remove = map.size() - max_size * 3 / 4;
+
+    ticks.reserve(map.size());
+
+    for (it = map.begin(); it != map.end(); ++it)
+    {
+        ticks.push_back(it->second.last_used);
+    }
+
+    std::nth_element(ticks.begin(), ticks.begin() + (n_remove - 1), ticks.end());
+    unsigned long cutoff = ticks[n_remove - 1];
+
+    for (it = map.begin(); it != map.end(); )
+    {
+        if (it->second.last_used <= cutoff)
+        {
+            map.erase(it++);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+} // namespace server
+} // namespace cli
@@ -0,0 +1,160 @@
+//
+// dir_index.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#ifndef CLI_DIR_INDEX_HPP
+#define CLI_DIR_INDEX_HPP
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+/// Path listing the logical drives.
+#define PATH_SUB_ROOT "|"
+
+/// Maximum number of cached directory listings.
+#define DIR_INDEX_MAX_DIRS  64
+
+/// Maximum number of cached file metadata records.
+#define DIR_INDEX_MAX_FILES 8192
+
+namespace cli
+{
+namespace server
+{
+
+/// Audio parameters of a filter file.
+struct file_info
+{
+    int n_channels;
+    int n_frames;
+    int sampling_rate;
+
+    /// Attenuation in dB that prevents clipping.
+    double attenuation;
+
+    /// Attenuation in dB that prevents clipping for the worst-case input.
+    double peak_attenuation;
+
+    /// Attenuation in dB estimated to prevent clipping with music.
+    double music_attenuation;
+};
+
+/// Options of a directory listing request.
+struct dir_query
+{
+    /// Index of the first entry to list.
+    std::size_t offset;
+
+    /// Maximum number of entries to list, 0 for all.
+    std::size_t count;
+
+    /// Lower case file extensions without the dot, empty for all.
+    std::vector<std::string> extensions;
+
+    /// Required number of channels, 0 for any.
+    int n_channels;
+
+    /// Required sampling rate, 0 for any.
+    int sampling_rate;
+
+    /// Whether file metadata is included.
+    bool metadata;
+
+    /// Reset to list everything without metadata.
+    void clear();
+
+    /// Parses leading name=value options and returns the remaining path.
+    bool parse(const std::string& data, std::string& path);
+};
+
+/// Caches directory listings and file metadata, invalidated by modification
+/// times, for the DIR command.
+class dir_index
+    : private boost::noncopyable
+{
+public:
+    /// Construct an empty index.
+    dir_index();
+
+    /// Lists a directory as compact JSON.
+    bool list(const std::string& dir, const dir_query& query, std::string& out);
+
+    /// Gets the audio parameters of a file, analysing it only if it changed.
+    bool get_file_info(const std::string& path, file_info& info);
+
+    /// Gets the audio parameters of a file from its header, without the
+    /// attenuation, which needs the whole file to be analysed.
+    bool get_file_params(const std::string& path, file_info& info);
+
+    /// Drops all cached listings and metadata.
+    void clear();
+
+private:
+    /// An entry of a directory listing.
+    struct entry
+    {
+        std::string name;
+        std::string path;
+        bool is_dir;
+    };
+
+    /// A cached directory listing, subdirectories first. A listing or record
+    /// is settled once its modification time is older than the time stamp
+    /// resolution, so that later changes can not go unnoticed.
+    struct listing
+    {
+        std::time_t mtime;
+        std::vector<entry> entries;
+        bool settled;
+        unsigned long last_used;
+    };
+
+    /// Cached metadata of a file. The header is read when the record is
+    /// created, the attenuation only once it is asked for.
+    struct record
+    {
+        std::time_t mtime;
+        boost::uintmax_t size;
+        bool settled;
+        bool valid;
+        bool analysed;
+        bool analysis_valid;
+        file_info info;
+        unsigned long last_used;
+    };
+
+    /// Gets the metadata of a file, reading it if it changed.
+    bool get_record(const std::string& path, bool analyse, file_info& info);
+
+    /// Gets the listing of a directory, scanning it if it changed.
+    const listing* get_listing(const std::string& dir);
+
+    /// Checks a file name against the extension filter.
+    static bool matches_extension(const std::string& name,
+                                  const std::vector<std::string>& extensions);
+
+    /// Removes the least recently used listings or records over a limit.
+    template <typename Map>
+    static void evict(Map& map, std::size_t max_size);
+
+    /// Cached listings by directory path.
+    std::map<std::string, listing> listings_;
+
+    /// Cached metadata by file path.
+    std::map<std::string, record> records_;
+
+    /// Counter ordering cache accesses.
+    unsigned long tick_;
+};
+
+} // namespace server
+} // namespace cli
+
+#endif // CLI_DIR_INDEX_HPP
@@ -0,0 +1,55 @@
+//
+// frame.cpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#include "frame.hpp"
+
+namespace cli
+{
+namespace server
+{
+
+void frame::clear()
+{
+    seq = 0;
+    op = 0;
+    param = 0;
+    index = 0;
+    values.clear();
+}
+
+std::string frame::encode() const
+{
+    std::string data;
+    std::size_t count = values.size() > 255 ? 255 : values.size();
+
+    data.reserve(FRAME_HEADER_SIZE + count * 4);
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        data.push_back((char)(seq >> shift));
+    }
+
+    data.push_back((char)op);
+    data.push_back((char)param);
+    data.push_back((char)index);
+    data.push_back((char)count);
+
+    for (std::size_t ix = 0; ix < count; ix++)
+    {
+        boost::uint32_t val = (boost::uint32_t)values[ix];
+
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            data.push_back((char)(val >> shift));
+        }
+    }
+
+    return data;
+}
+
+} // namespace server
+} // namespace cli
@@ -0,0 +1,76 @@
+//
+// frame.hpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#ifndef CLI_FRAME_HPP
+#define CLI_FRAME_HPP
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+/// Text command that switches a connection to binary frames.
+#define FRAME_HANDSHAKE   "BIN1"
+
+/// Size of the frame header in bytes.
+#define FRAME_HEADER_SIZE 8
+
+/// Frame operations.
+#define FRAME_OP_SET      1
+#define FRAME_OP_GET      2
+#define FRAME_OP_ACK      3
+#define FRAME_OP_VALUE    4
+#define FRAME_OP_ERROR    5
+#define FRAME_OP_CLOSE    6
+
+/// Parameter IDs. Array parameters are addressed from the frame index.
+#define FRAME_PARAM_EQ_ENABLE    1
+#define FRAME_PARAM_EQ_LEVEL     2
+#define FRAME_PARAM_EQ_MAG       3
+#define FRAME_PARAM_FILE_ENABLE  4
+#define FRAME_PARAM_FILE_LEVEL   5
+
+namespace cli
+{
+namespace server
+{
+
+/// A binary frame. On the wire, all fields are little endian:
+///
+///   uint32 seq     sequence number, echoed in the reply
+///   uint8  op      operation
+///   uint8  param   parameter ID
+///   uint8  index   first array element
+///   uint8  count   number of values
+///   int32  values  count values
+struct frame
+{
+    /// The sequence number.
+    boost::uint32_t seq;
+
+    /// The operation.
+    int op;
+
+    /// The parameter ID.
+    int param;
+
+    /// The first array element.
+    int index;
+
+    /// The values.
+    std::vector<boost::int32_t> values;
+
+    /// Clears all fields of the frame.
+    void clear();
+
+    /// Encodes the frame for sending.
+    std::string encode() const;
+};
+
+} // namespace server
+} // namespace cli
+
+#endif // CLI_FRAME_HPP
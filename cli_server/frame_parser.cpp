@@ -0,0 +1,91 @@
+//
+// frame_parser.cpp
+// ~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#include "frame_parser.hpp"
+#include "frame.hpp"
+
+namespace cli
+{
+namespace server
+{
+
+frame_parser::frame_parser()
+    : n_bytes_(0), n_values_(0), state_(header)
+{
+}
+
+void frame_parser::reset()
+{
+    n_bytes_ = 0;
+    n_values_ = 0;
+    state_ = header;
+}
+
+boost::tribool frame_parser::consume(frame& frm, char input)
+{
+    bytes_[n_bytes_++] = (unsigned char)input;
+
+    switch (state_)
+    {
+    case header:
+        if (n_bytes_ < FRAME_HEADER_SIZE)
+        {
+            return boost::indeterminate;
+        }
+
+        frm.seq = (boost::uint32_t)bytes_[0] |
+                  ((boost::uint32_t)bytes_[1] << 8) |
+                  ((boost::uint32_t)bytes_[2] << 16) |
+                  ((boost::uint32_t)bytes_[3] << 24);
+        frm.op = bytes_[4];
+        frm.param = bytes_[5];
+        frm.index = bytes_[6];
+        frm.values.clear();
+
+        n_bytes_ = 0;
+        n_values_ = bytes_[7];
+
+        if (frm.op < FRAME_OP_SET || frm.op > FRAME_OP_CLOSE)
+        {
+            return false;
+        }
+
+        if (n_values_ == 0)
+        {
+            return true;
+        }
+
+        frm.values.reserve(n_values_);
+        state_ = value;
+        return boost::indeterminate;
+
+    case value:
+        if (n_bytes_ < 4)
+        {
+            return boost::indeterminate;
+        }
+
+        frm.values.push_back((boost::int32_t)((boost::uint32_t)bytes_[0] |
+                                              ((boost::uint32_t)bytes_[1] << 8) |
+                                              ((boost::uint32_t)bytes_[2] << 16) |
+                                              ((boost::uint32_t)bytes_[3] << 24)));
+        n_bytes_ = 0;
+
+        if (--n_values_ == 0)
+        {
+            state_ = header;
+            return true;
+        }
+
+        return boost::indeterminate;
+    }
+
+    return false;
+}
+
+} // namespace server
+} // namespace cli
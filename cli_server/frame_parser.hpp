@@ -0,0 +1,73 @@
+//
+// frame_parser.hpp
+// ~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#ifndef CLI_FRAME_PARSER_HPP
+#define CLI_FRAME_PARSER_HPP
+
+#include <boost/logic/tribool.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/cstdint.hpp>
+#include "frame.hpp"
+
+namespace cli
+{
+namespace server
+{
+
+class frame_parser
+{
+public:
+    /// Construct ready to parse the frame.
+    frame_parser();
+
+    /// Reset to initial parser state.
+    void reset();
+
+    /// Parse some data. The tribool return value is true when a complete frame
+    /// has been parsed, false if the data is invalid, indeterminate when more
+    /// data is required. The InputIterator return value indicates how much of the
+    /// input has been consumed.
+    template <typename InputIterator>
+    boost::tuple<boost::tribool, InputIterator> parse(frame& frm,
+            InputIterator begin, InputIterator end)
+    {
+        while (begin != end)
+        {
+            boost::tribool result = consume(frm, *begin++);
+            if (result || !result)
+                return boost::make_tuple(result, begin);
+        }
+
+        boost::tribool result = boost::indeterminate;
+        return boost::make_tuple(result, begin);
+    }
+
+private:
+    /// Handle the next byte of input.
+    boost::tribool consume(frame& frm, char input);
+
+    /// The bytes of the current header or value.
+    unsigned char bytes_[FRAME_HEADER_SIZE];
+
+    /// The number of bytes collected.
+    int n_bytes_;
+
+    /// The number of values still to be read.
+    int n_values_;
+
+    /// The current state of the parser.
+    enum state
+    {
+        header,
+        value
+    } state_;
+};
+
+} // namespace server
+} // namespace cli
+
+#endif // CLI_FRAME_PARSER_HPP
@@ -215,6 +215,18 @@ char server_msg_strm::get_pcm_sample_rate(int sample_rate)
 
     switch (sample_rate)
     {
+    case 11025:
+        pcm_sample_rate = '0';
+        break;
+
+    case 22050:
+        pcm_sample_rate = '1';
+        break;
+
+    case 32000:
+        pcm_sample_rate = '2';
+        break;
+
     case 44100:
         pcm_sample_rate = '3';
         break;
@@ -223,6 +235,22 @@ char server_msg_strm::get_pcm_sample_rate(int sample_rate)
         pcm_sample_rate = '4';
         break;
 
+    case 8000:
+        pcm_sample_rate = '5';
+        break;
+
+    case 12000:
+        pcm_sample_rate = '6';
+        break;
+
+    case 16000:
+        pcm_sample_rate = '7';
+        break;
+
+    case 24000:
+        pcm_sample_rate = '8';
+        break;
+
     case 96000:
         pcm_sample_rate = '9';
         break;
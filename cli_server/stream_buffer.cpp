@@ -0,0 +1,130 @@
+//
+// stream_buffer.cpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#include "stream_buffer.hpp"
+#include "../brutefir/atomic.h"
+
+namespace slim
+{
+namespace server
+{
+
+stream_buffer::stream_buffer()
+    : ring_(STREAM_BUFFER_SIZE),
+      write_pos_(0),
+      format_(0),
+      format_pos_(0),
+      n_readers_(0)
+{
+}
+
+void stream_buffer::write(const float* data, unsigned int frames,
+                          unsigned int channels, unsigned int srate)
+{
+    unsigned int out_channels = (channels < STREAM_MAX_CHANNELS) ? channels : STREAM_MAX_CHANNELS;
+    unsigned long pos = (unsigned long)write_pos_;
+    unsigned long mask = STREAM_BUFFER_SIZE - 1;
+    long format = (long)(srate * 8 + out_channels);
+
+    // Readers restart their stream from here with the new format
+    if (format != format_)
+    {
+        atomic_store(&format_pos_, (long)pos);
+        atomic_store(&format_, format);
+    }
+
+    if (atomic_load(&n_readers_) == 0)
+    {
+        return;
+    }
+
+    for (unsigned int i = 0; i < frames; i++)
+    {
+        const float* frame = data + i * channels;
+
+        for (unsigned int ch = 0; ch < out_channels; ch++)
+        {
+            float sample = frame[ch] * 32768.0f;
+            int value;
+
+            if (sample >= 32767.0f)
+            {
+                value = 32767;
+            }
+            else if (sample <= -32768.0f)
+            {
+                value = -32768;
+            }
+            else
+            {
+                value = (int)(sample + ((sample >= 0.0f) ? 0.5f : -0.5f));
+            }
+
+            ring_[pos++ & mask] = (char)value;
+            ring_[pos++ & mask] = (char)(value >> 8);
+        }
+    }
+
+    // Publish the samples
+    atomic_store(&write_pos_, (long)pos);
+}
+
+void stream_buffer::add_reader()
+{
+    atomic_add(&n_readers_, 1);
+}
+
+void stream_buffer::remove_reader()
+{
+    atomic_add(&n_readers_, -1);
+}
+
+unsigned long stream_buffer::get_write_pos()
+{
+    return (unsigned long)atomic_load(&write_pos_);
+}
+
+long stream_buffer::get_format()
+{
+    return atomic_load(&format_);
+}
+
+unsigned long stream_buffer::get_format_pos()
+{
+    return (unsigned long)atomic_load(&format_pos_);
+}
+
+void stream_buffer::get_buffers(unsigned long pos, std::size_t size,
+                                std::vector<boost::asio::const_buffer>& buffers)
+{
+    std::size_t offset = pos & (STREAM_BUFFER_SIZE - 1);
+    std::size_t first = STREAM_BUFFER_SIZE - offset;
+
+    if (first >= size)
+    {
+        buffers.push_back(boost::asio::buffer(&ring_[offset], size));
+    }
+    else
+    {
+        // The data wraps around the end of the ring
+        buffers.push_back(boost::asio::buffer(&ring_[offset], first));
+        buffers.push_back(boost::asio::buffer(&ring_[0], size - first));
+    }
+}
+
+unsigned int stream_buffer::get_format_rate(long format)
+{
+    return (unsigned int)(format / 8);
+}
+
+unsigned int stream_buffer::get_format_channels(long format)
+{
+    return (unsigned int)(format % 8);
+}
+
+} // namespace server
+} // namespace slim
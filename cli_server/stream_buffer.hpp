@@ -0,0 +1,91 @@
+//
+// stream_buffer.hpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#ifndef SLIM_STREAM_BUFFER_HPP
+#define SLIM_STREAM_BUFFER_HPP
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+/// Size of the PCM ring in bytes, a power of two. About 6 seconds of
+/// 16 bit stereo audio at 44.1 kHz.
+#define STREAM_BUFFER_SIZE   (1024 * 1024)
+
+/// Bits per streamed sample.
+#define STREAM_SAMPLE_BITS   16
+
+/// Maximum number of streamed channels.
+#define STREAM_MAX_CHANNELS  2
+
+namespace slim
+{
+namespace server
+{
+
+/// Ring of processed audio converted to little endian PCM. It has a single
+/// writer, the audio thread, which never waits. Readers keep their own
+/// position and send straight from the ring, skipping ahead when they fall
+/// too far behind.
+class stream_buffer
+    : private boost::noncopyable
+{
+public:
+    /// Construct an empty buffer.
+    stream_buffer();
+
+    /// Appends interleaved samples, keeping the first STREAM_MAX_CHANNELS.
+    /// Nothing is converted while no readers are registered.
+    void write(const float* data, unsigned int frames,
+               unsigned int channels, unsigned int srate);
+
+    /// Registers a reader so that audio is converted.
+    void add_reader();
+
+    /// Unregisters a reader.
+    void remove_reader();
+
+    /// Gets the position just after the last written byte.
+    unsigned long get_write_pos();
+
+    /// Gets the current format, 0 if nothing was written yet.
+    long get_format();
+
+    /// Gets the position at which the current format starts.
+    unsigned long get_format_pos();
+
+    /// Appends up to two buffers covering bytes from a position on.
+    void get_buffers(unsigned long pos, std::size_t size,
+                     std::vector<boost::asio::const_buffer>& buffers);
+
+    /// Gets the sampling rate of a format.
+    static unsigned int get_format_rate(long format);
+
+    /// Gets the number of channels of a format.
+    static unsigned int get_format_channels(long format);
+
+private:
+    /// The PCM data.
+    std::vector<char> ring_;
+
+    /// Total bytes written, modulo 2^32.
+    volatile long write_pos_;
+
+    /// Sampling rate and channel count of the written audio.
+    volatile long format_;
+
+    /// Position at which the format last changed.
+    volatile long format_pos_;
+
+    /// Number of registered readers.
+    volatile long n_readers_;
+};
+
+} // namespace server
+} // namespace slim
+
+#endif // SLIM_STREAM_BUFFER_HPP
@@ -0,0 +1,91 @@
+//
+// stream_server.cpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#include "stream_server.hpp"
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <sstream>
+
+namespace slim
+{
+namespace server
+{
+
+stream_server::stream_server(const std::string& address, const int port,
+                             stream_buffer& buffer)
+    : io_service_(),
+      acceptor_(io_service_),
+      buffer_(buffer),
+      port_((unsigned short)port),
+      new_session_(new stream_session(io_service_, *this, buffer, (unsigned short)port))
+{
+    std::string port_str;
+    std::stringstream out;
+    out << port;
+    port_str = out.str();
+
+    // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
+    boost::asio::ip::tcp::resolver resolver(io_service_);
+    boost::asio::ip::tcp::resolver::query query(address, port_str);
+    boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    acceptor_.async_accept(new_session_->socket(),
+                           boost::bind(&stream_server::handle_accept, this,
+                                       boost::asio::placeholders::error));
+}
+
+void stream_server::run()
+{
+    io_service_.run();
+}
+
+void stream_server::stop()
+{
+    // Post a call to the stop function so that stream_server::stop() is safe
+    // to call from any thread.
+    io_service_.post(boost::bind(&stream_server::handle_stop, this));
+}
+
+void stream_server::start_session(stream_session_ptr s)
+{
+    sessions_.insert(s);
+    s->start();
+}
+
+void stream_server::stop_session(stream_session_ptr s)
+{
+    if (sessions_.erase(s) > 0)
+    {
+        s->stop();
+    }
+}
+
+void stream_server::handle_accept(const boost::system::error_code& e)
+{
+    if (!e)
+    {
+        start_session(new_session_);
+        new_session_.reset(new stream_session(io_service_, *this, buffer_, port_));
+        acceptor_.async_accept(new_session_->socket(),
+                               boost::bind(&stream_server::handle_accept, this,
+                                           boost::asio::placeholders::error));
+    }
+}
+
+void stream_server::handle_stop()
+{
+    acceptor_.close();
+    std::for_each(sessions_.begin(), sessions_.end(),
+                  boost::bind(&stream_session::stop, _1));
+    sessions_.clear();
+}
+
+} // namespace server
+} // namespace slim
@@ -0,0 +1,74 @@
+//
+// stream_server.hpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#ifndef SLIM_STREAM_SERVER_HPP
+#define SLIM_STREAM_SERVER_HPP
+
+#include <set>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include "stream_buffer.hpp"
+#include "stream_session.hpp"
+
+namespace slim
+{
+namespace server
+{
+
+/// Streams processed audio to network players. Players connect for control
+/// messages and request the audio as PCM over HTTP, both on the same port.
+class stream_server
+    : private boost::noncopyable
+{
+public:
+    /// Construct the server to listen on the specified TCP address and port.
+    explicit stream_server(const std::string& address, const int port,
+                           stream_buffer& buffer);
+
+    /// Run the server's io_service loop.
+    void run();
+
+    /// Stop the server.
+    void stop();
+
+    /// Add the specified session to the server and start it.
+    void start_session(stream_session_ptr s);
+
+    /// Stop the specified session.
+    void stop_session(stream_session_ptr s);
+
+private:
+    /// Handle completion of an asynchronous accept operation.
+    void handle_accept(const boost::system::error_code& e);
+
+    /// Handle a request to stop the server.
+    void handle_stop();
+
+    /// The io_service used to perform asynchronous operations.
+    boost::asio::io_service io_service_;
+
+    /// Acceptor used to listen for incoming connections.
+    boost::asio::ip::tcp::acceptor acceptor_;
+
+    /// The processed audio.
+    stream_buffer& buffer_;
+
+    /// The port the server listens on.
+    unsigned short port_;
+
+    /// The live sessions.
+    std::set<stream_session_ptr> sessions_;
+
+    /// The next session to be accepted.
+    stream_session_ptr new_session_;
+};
+
+} // namespace server
+} // namespace slim
+
+#endif // SLIM_STREAM_SERVER_HPP
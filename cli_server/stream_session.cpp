@@ -0,0 +1,400 @@
+//
+// stream_session.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#include "stream_session.hpp"
+#include "stream_server.hpp"
+#include "server_msg.hpp"
+#include <boost/bind.hpp>
+
+namespace slim
+{
+namespace server
+{
+
+stream_session::stream_session(boost::asio::io_service& io_service,
+                               stream_server& server,
+                               stream_buffer& buffer,
+                               unsigned short port)
+    : socket_(io_service),
+      server_(server),
+      buffer_(buffer),
+      port_(port),
+      mode_(mode_unknown),
+      writing_(false),
+      timer_(io_service),
+      format_(0),
+      pos_(0),
+      sending_(0),
+      header_sent_(false),
+      n_skips_(0),
+      reader_(false),
+      stopped_(false)
+{
+}
+
+boost::asio::ip::tcp::socket& stream_session::socket()
+{
+    return socket_;
+}
+
+void stream_session::start()
+{
+    boost::system::error_code ec;
+
+    // Audio is sent as it arrives, do not hold back small writes
+    socket_.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+
+    start_read();
+}
+
+void stream_session::stop()
+{
+    stopped_ = true;
+    timer_.cancel();
+    socket_.close();
+
+    if (reader_)
+    {
+        buffer_.remove_reader();
+        reader_ = false;
+    }
+}
+
+void stream_session::start_read()
+{
+    socket_.async_read_some(boost::asio::buffer(read_buffer_),
+        boost::bind(&stream_session::handle_read, shared_from_this(),
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::bytes_transferred));
+}
+
+void stream_session::handle_read(const boost::system::error_code& e,
+                                 std::size_t bytes_transferred)
+{
+    if (!e)
+    {
+        bool ok = true;
+
+        pending_.append(read_buffer_.data(), bytes_transferred);
+
+        // Players request the audio with HTTP, anything else is
+        // a control connection
+        if (mode_ == mode_unknown && pending_.size() >= 4)
+        {
+            mode_ = (pending_.compare(0, 4, "GET ") == 0) ? mode_audio : mode_control;
+        }
+
+        if (mode_ == mode_audio)
+        {
+            if (pending_.find("\r\n\r\n") != std::string::npos)
+            {
+                // The request is complete, nothing more is read
+                pending_.clear();
+                start_audio();
+                return;
+            }
+
+            ok = (pending_.size() <= STREAM_MAX_REQUEST);
+        }
+        else if (mode_ == mode_control)
+        {
+            ok = handle_messages();
+        }
+
+        if (ok)
+        {
+            start_read();
+        }
+        else
+        {
+            server_.stop_session(shared_from_this());
+        }
+    }
+    else if (e != boost::asio::error::operation_aborted)
+    {
+        server_.stop_session(shared_from_this());
+    }
+}
+
+bool stream_session::handle_messages()
+{
+    // A player message is a 4 byte operation and a 4 byte length
+    // in network order followed by the data
+    while (pending_.size() >= 8)
+    {
+        std::size_t length = ((std::size_t)(unsigned char)pending_[4] << 24) |
+                             ((std::size_t)(unsigned char)pending_[5] << 16) |
+                             ((std::size_t)(unsigned char)pending_[6] << 8) |
+                             (std::size_t)(unsigned char)pending_[7];
+
+        if (length > STREAM_MAX_REQUEST)
+        {
+            return false;
+        }
+
+        if (pending_.size() < 8 + length)
+        {
+            break;
+        }
+
+        std::string op = pending_.substr(0, 4);
+        pending_.erase(0, 8 + length);
+
+        if (op == "HELO")
+        {
+            // Enable the outputs at full volume, the level is
+            // set by the filter
+            server_msg_aude aude;
+            aude.spdif_enable = true;
+            aude.dac_enable = true;
+            send_message(aude.to_vector());
+
+            server_msg_audg audg;
+            audg.volume = 128;
+            audg.dvc_enable = false;
+            audg.preamp = 255;
+            send_message(audg.to_vector());
+
+            format_ = buffer_.get_format();
+            send_stream_command('s', format_);
+
+            start_timer();
+        }
+
+        // Status and other player messages need no reply
+    }
+
+    return true;
+}
+
+bool stream_session::send_stream_command(char command, long format)
+{
+    server_msg_strm strm;
+
+    strm.strm_command = command;
+    strm.auto_start = '1';
+    strm.format_byte = 'p';
+    strm.pcm_sample_size = '?';
+    strm.pcm_sample_rate = '?';
+    strm.pcm_channels = '?';
+    strm.pcm_endian = '?';
+    strm.threshold = 0;
+    strm.spdif_enable = '0';
+    strm.trans_period = 0;
+    strm.trans_type = '0';
+    strm.flags = 0;
+    strm.output_threshold = 0;
+    strm.replay_gain[0] = strm.replay_gain[1] = strm.replay_gain[2] = strm.replay_gain[3] = 0;
+    strm.server_port = 0;
+    strm.server_ip_address[0] = strm.server_ip_address[1] = 0;
+    strm.server_ip_address[2] = strm.server_ip_address[3] = 0;
+
+    if (command == 's')
+    {
+        if (format == 0)
+        {
+            return false;
+        }
+
+        strm.pcm_sample_size = strm.get_pcm_sample_size(STREAM_SAMPLE_BITS);
+        strm.pcm_sample_rate = strm.get_pcm_sample_rate(stream_buffer::get_format_rate(format));
+        strm.pcm_channels = (char)('0' + stream_buffer::get_format_channels(format));
+        strm.pcm_endian = '1';
+
+        if (strm.pcm_sample_rate == '?')
+        {
+            return false;
+        }
+
+        // Start playing after 64 KB, about a third of a second
+        strm.threshold = 64;
+        strm.output_threshold = 1;
+
+        // The server address 0 tells the player to use this host
+        strm.server_port = port_;
+        strm.stream_url = STREAM_URL;
+    }
+
+    send_message(strm.to_vector());
+
+    return true;
+}
+
+void stream_session::send_message(const std::vector<char>& msg)
+{
+    message_queue_.push_back(msg);
+
+    if (!writing_)
+    {
+        start_write();
+    }
+}
+
+void stream_session::start_write()
+{
+    writing_ = true;
+
+    boost::asio::async_write(socket_, boost::asio::buffer(message_queue_.front()),
+        boost::bind(&stream_session::handle_write, shared_from_this(),
+            boost::asio::placeholders::error));
+}
+
+void stream_session::handle_write(const boost::system::error_code& e)
+{
+    writing_ = false;
+
+    if (!e)
+    {
+        message_queue_.pop_front();
+
+        if (!message_queue_.empty())
+        {
+            start_write();
+        }
+    }
+    else if (e != boost::asio::error::operation_aborted)
+    {
+        server_.stop_session(shared_from_this());
+    }
+}
+
+void stream_session::start_audio()
+{
+    buffer_.add_reader();
+    reader_ = true;
+
+    // Start with the most recent audio
+    format_ = buffer_.get_format();
+    pos_ = buffer_.get_write_pos();
+
+    send_audio();
+}
+
+void stream_session::send_audio()
+{
+    unsigned long write_pos = buffer_.get_write_pos();
+    std::size_t avail;
+
+    // A new format needs a new stream, the control connection
+    // tells the player to request it
+    if (buffer_.get_format() != format_)
+    {
+        server_.stop_session(shared_from_this());
+        return;
+    }
+
+    avail = (std::size_t)(write_pos - pos_);
+
+    // Data is sent straight from the ring, so a reader must stay
+    // well clear of the writer. Skip to the most recent audio rather
+    // than fall further behind, and give up on a player that keeps
+    // falling behind.
+    if (avail > STREAM_MAX_LAG)
+    {
+        if (++n_skips_ > STREAM_MAX_SKIPS)
+        {
+            server_.stop_session(shared_from_this());
+            return;
+        }
+
+        pos_ = write_pos;
+        avail = 0;
+    }
+
+    sending_ = (avail < STREAM_MAX_SEND) ? avail : STREAM_MAX_SEND;
+    send_buffers_.clear();
+
+    if (!header_sent_)
+    {
+        send_buffers_.push_back(boost::asio::buffer(STREAM_HTTP_RESPONSE, sizeof(STREAM_HTTP_RESPONSE) - 1));
+        header_sent_ = true;
+    }
+
+    if (sending_ > 0)
+    {
+        buffer_.get_buffers(pos_, sending_, send_buffers_);
+    }
+
+    if (send_buffers_.empty())
+    {
+        start_timer();
+        return;
+    }
+
+    writing_ = true;
+
+    boost::asio::async_write(socket_, send_buffers_,
+        boost::bind(&stream_session::handle_audio_write, shared_from_this(),
+            boost::asio::placeholders::error));
+}
+
+void stream_session::handle_audio_write(const boost::system::error_code& e)
+{
+    writing_ = false;
+
+    if (!e)
+    {
+        // The write went out straight from the ring. If the writer got
+        // round to the data while it was in flight, what the player
+        // received is corrupt and the stream can not be resumed.
+        std::size_t ahead = (std::size_t)(buffer_.get_write_pos() - pos_);
+
+        if (ahead > STREAM_BUFFER_SIZE - sending_)
+        {
+            server_.stop_session(shared_from_this());
+            return;
+        }
+
+        pos_ += (unsigned long)sending_;
+        sending_ = 0;
+
+        send_audio();
+    }
+    else if (e != boost::asio::error::operation_aborted)
+    {
+        server_.stop_session(shared_from_this());
+    }
+}
+
+void stream_session::start_timer()
+{
+    timer_.expires_from_now(boost::posix_time::milliseconds(STREAM_POLL_INTERVAL));
+    timer_.async_wait(boost::bind(&stream_session::handle_timer, shared_from_this(),
+                                  boost::asio::placeholders::error));
+}
+
+void stream_session::handle_timer(const boost::system::error_code& e)
+{
+    if (e || stopped_)
+    {
+        return;
+    }
+
+    if (mode_ == mode_audio)
+    {
+        send_audio();
+    }
+    else
+    {
+        long format = buffer_.get_format();
+
+        if (format != format_)
+        {
+            // Stop the current stream, the player then requests the
+            // audio again in the new format
+            send_stream_command('q', 0);
+
+            format_ = format;
+            send_stream_command('s', format_);
+        }
+
+        start_timer();
+    }
+}
+
+} // namespace server
+} // namespace slim
@@ -0,0 +1,178 @@
+//
+// stream_session.hpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2011 Victor C. Su
+//
+
+#ifndef SLIM_STREAM_SESSION_HPP
+#define SLIM_STREAM_SESSION_HPP
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include "stream_buffer.hpp"
+
+/// Interval in milliseconds between checks for new audio and format changes.
+#define STREAM_POLL_INTERVAL  20
+
+/// Maximum number of bytes sent by a single write.
+#define STREAM_MAX_SEND       (STREAM_BUFFER_SIZE / 4)
+
+/// Bytes a reader may fall behind the writer before it skips ahead.
+#define STREAM_MAX_LAG        (STREAM_BUFFER_SIZE / 2)
+
+/// Number of times a reader may skip ahead before it is disconnected.
+#define STREAM_MAX_SKIPS      8
+
+/// Maximum size of an HTTP request or a player message.
+#define STREAM_MAX_REQUEST    4096
+
+/// Path requested by players for the audio stream.
+#define STREAM_URL            "/stream.pcm"
+
+/// Response header preceding the audio stream.
+#define STREAM_HTTP_RESPONSE  "HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\n\r\n"
+
+namespace slim
+{
+namespace server
+{
+
+class stream_server;
+
+/// A connection from a player. Players first connect for control messages
+/// and then open a second connection requesting the audio with HTTP.
+class stream_session
+    : public boost::enable_shared_from_this<stream_session>,
+  private boost::noncopyable
+{
+public:
+    /// Construct a session with the given io_service.
+    explicit stream_session(boost::asio::io_service& io_service,
+                            stream_server& server,
+                            stream_buffer& buffer,
+                            unsigned short port);
+
+    /// Get the socket associated with the session.
+    boost::asio::ip::tcp::socket& socket();
+
+    /// Start the first asynchronous operation for the session.
+    void start();
+
+    /// Stop all asynchronous operations associated with the session.
+    void stop();
+
+private:
+    /// The kind of connection, known after the first bytes are received.
+    enum session_mode
+    {
+        mode_unknown,
+        mode_control,
+        mode_audio
+    };
+
+    /// Start an asynchronous read.
+    void start_read();
+
+    /// Handle completion of a read operation.
+    void handle_read(const boost::system::error_code& e,
+                     std::size_t bytes_transferred);
+
+    /// Handles complete player messages, returns false on a protocol error.
+    bool handle_messages();
+
+    /// Queues a stream command, with the format and URL of the audio for
+    /// 's'. Returns false if players can not play the format.
+    bool send_stream_command(char command, long format);
+
+    /// Queues a control message for writing to the player.
+    void send_message(const std::vector<char>& msg);
+
+    /// Start writing the next queued control message.
+    void start_write();
+
+    /// Handle completion of a control message write.
+    void handle_write(const boost::system::error_code& e);
+
+    /// Registers the session as a reader and starts the audio stream.
+    void start_audio();
+
+    /// Sends the available audio, or waits for more.
+    void send_audio();
+
+    /// Handle completion of an audio write.
+    void handle_audio_write(const boost::system::error_code& e);
+
+    /// Schedules the next check for audio or format changes.
+    void start_timer();
+
+    /// Handle expiry of the polling timer.
+    void handle_timer(const boost::system::error_code& e);
+
+    /// Socket for the session.
+    boost::asio::ip::tcp::socket socket_;
+
+    /// The server owning this session.
+    stream_server& server_;
+
+    /// The processed audio.
+    stream_buffer& buffer_;
+
+    /// The port players request the audio stream from.
+    unsigned short port_;
+
+    /// The kind of connection.
+    session_mode mode_;
+
+    /// Buffer for incoming data.
+    boost::array<char, 1024> read_buffer_;
+
+    /// Incoming data not handled yet.
+    std::string pending_;
+
+    /// Control messages waiting to be written.
+    std::deque<std::vector<char> > message_queue_;
+
+    /// Whether a write operation is pending.
+    bool writing_;
+
+    /// Timer polling for audio and format changes.
+    boost::asio::deadline_timer timer_;
+
+    /// The format being streamed, 0 if none.
+    long format_;
+
+    /// Position of the next audio byte to send.
+    unsigned long pos_;
+
+    /// Ring buffers of the audio write in progress.
+    std::vector<boost::asio::const_buffer> send_buffers_;
+
+    /// Audio bytes of the write in progress.
+    std::size_t sending_;
+
+    /// Whether the HTTP response header was sent.
+    bool header_sent_;
+
+    /// Number of times the session skipped ahead.
+    int n_skips_;
+
+    /// Whether the session is registered as a reader of the buffer.
+    bool reader_;
+
+    /// Whether the session was stopped.
+    bool stopped_;
+};
+
+typedef boost::shared_ptr<stream_session> stream_session_ptr;
+
+} // namespace server
+} // namespace slim
+
+#endif // SLIM_STREAM_SESSION_HPP
@@ -18,10 +18,20 @@
 #define FILTER_LEN                   1024
 #define EQ_FILTER_BLOCKS             64
 #define PATH_MAX                     1024
+#define SRC_QUALITY                  SRC_SINC_MEDIUM_QUALITY
 
 #define default_cfg_cli_enable       0
 #define default_cfg_cli_port         3000
 #define default_cfg_overflow_enable  0
+#define default_cfg_src_enable       0
+#define default_cfg_src_rate         96000
+#define default_cfg_stream_enable    0
+#define default_cfg_stream_port      3483
+#define default_cfg_min_phase_enable 0
+#define default_cfg_trim_enable      0
+#define default_cfg_pipeline_blocks  0
+#define default_cfg_pipeline_cpu     0
+#define default_cfg_delay            "0,0,0,0,0,0,0,0"
 
 #define default_cfg_eq_enable        0
 #define default_cfg_eq_level         0 
@@ -41,18 +51,31 @@
 
 #define EQ_LEVEL_STEPS_PER_DB        10
 #define FILE_LEVEL_STEPS_PER_DB      10
+#define DELAY_STEPS_PER_MS           1000
+#define PIPELINE_MAX_BLOCKS          16
 
 enum
 {
     EQLevelRangeMin = -20 * EQ_LEVEL_STEPS_PER_DB,
     EQLevelRangeMax = 20 * EQ_LEVEL_STEPS_PER_DB,
     FileLevelRangeMin = -20 * FILE_LEVEL_STEPS_PER_DB,
-    FileLevelRangeMax = 20 * FILE_LEVEL_STEPS_PER_DB
+    FileLevelRangeMax = 20 * FILE_LEVEL_STEPS_PER_DB,
+    DelayRangeMin = 0,
+    DelayRangeMax = 100 * DELAY_STEPS_PER_MS
 };
 
 extern cfg_int cfg_cli_enable;
 extern cfg_int cfg_cli_port;
 extern cfg_int cfg_overflow_enable;
+extern cfg_int cfg_src_enable;
+extern cfg_int cfg_src_rate;
+extern cfg_int cfg_stream_enable;
+extern cfg_int cfg_stream_port;
+extern cfg_int cfg_min_phase_enable;
+extern cfg_int cfg_trim_enable;
+extern cfg_int cfg_pipeline_blocks;
+extern cfg_int cfg_pipeline_cpu;
+extern cfg_string cfg_delay;
 
 extern cfg_int cfg_eq_enable;
 extern cfg_int cfg_eq_level;
@@ -14,23 +14,89 @@
 #include <vector>
 #include <malloc.h>
 #include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
 
 #include "../brutefir/brutefir.hpp"
 #include "../brutefir/equalizer.hpp"
+#include "../brutefir/resampler.hpp"
 #include "../brutefir/coeff.hpp"
 #include "../brutefir/buffer.hpp"
 #include "../brutefir/preprocessor.hpp"
 #include "../brutefir/bfir_path.hpp"
+#include "../brutefir/cache.hpp"
+#include "../brutefir/metrics.hpp"
+#include "../brutefir/thread_pool.hpp"
+#include "../brutefir/engine_thread.hpp"
+#include "../brutefir/timestamp.h"
+#include "../brutefir/atomic.h"
 #include "../brutefir/util.hpp"
 #include "../brutefir/pinfo.h"
 #include "../cli_server/server.hpp"
+#include "../cli_server/stream_server.hpp"
 
 cli::server::server * cli_server;
 boost::thread * cli_server_thread = NULL;
 
+// processed audio for network players, outlives the stream server
+slim::server::stream_buffer stream_buffer;
+slim::server::stream_server * stream_server;
+boost::thread * stream_server_thread = NULL;
+
+// the track the host is playing, empty while stopped.  It is
+// published by the play callback on the main thread, since the
+// playback control may not be used on the playback thread, and
+// the generation tells the dsp instances to compare again.
+static boost::mutex now_playing_mutex;
+static metadb_handle::ptr now_playing;
+static volatile long now_playing_generation = 0;
+
+// set while a dsp instance holds the playback role, that is while
+// its track is the one the host is playing.  Only that instance
+// writes to the stream buffer, which takes a single writer.
+static volatile long playback_instance = 0;
+
 std::string app_path;
 
+// incremented whenever settings that affect the filter change
+static volatile long cfg_generation = 0;
+
+// incremented whenever the channel delays change, which does not
+// require the filter to be rebuilt
+static volatile long cfg_delay_generation = 0;
+
+
+// Sets the track the host is playing.
+//
+// Parameters:
+//   track  the track, or an empty handle when stopped
+static void set_now_playing(metadb_handle::ptr track)
+{
+    boost::lock_guard<boost::mutex> lock(now_playing_mutex);
+
+    now_playing = track;
+    atomic_add(&now_playing_generation, 1);
+}
+
+// Gets a value indicating whether a track is the one the host
+// is playing.
+//
+// Parameters:
+//   track  the track
+//
+// Returns:
+//   True if the track is playing, false otherwise.
+static bool is_now_playing(const metadb_handle::ptr & track)
+{
+    boost::lock_guard<boost::mutex> lock(now_playing_mutex);
+
+    return track.is_valid() && (track == now_playing);
+}
+
 
 class initquit_bfir : public initquit
 {
@@ -50,6 +116,9 @@ class initquit_bfir : public initquit
         // Set BruteFIR file path
         bfir_path::set_path(util::str2wstr(app_path));
 
+        // Load the index of files cached by previous sessions
+        cache::load();
+
         // Set print output callback
         set_print_callback(&console::print);
 
@@ -58,6 +127,12 @@ class initquit_bfir : public initquit
         {
             g_start_server();
         }
+
+        // Start audio stream server
+        if (cfg_stream_enable.get_value() != 0)
+        {
+            g_start_stream_server();
+        }
     }
 
     void on_quit()
@@ -65,238 +140,160 @@ class initquit_bfir : public initquit
         // Stop command line interface server
         g_stop_server();
 
-        // Clean up BruteFIR file path
-        bfir_path::clean_path();
+        // Stop audio stream server
+        g_stop_stream_server();
+
+        // Stop the engine worker threads
+        thread_pool::shutdown();
+
+        // Keep cached files for the next session
+        cache::save();
+
+        // Release the track before the services are shut down
+        set_now_playing(metadb_handle::ptr());
     }
 };
 
 static initquit_factory_t<initquit_bfir> g_initquit_bfir_factory;
 
 
+class play_callback_bfir : public play_callback_static
+{
+    unsigned get_flags()
+    {
+        return flag_on_playback_new_track | flag_on_playback_stop;
+    }
+
+    void on_playback_new_track(metadb_handle::ptr p_track)
+    {
+        set_now_playing(p_track);
+    }
+
+    void on_playback_stop(playback_control::t_stop_reason p_reason)
+    {
+        // The next track is announced when it starts
+        if (p_reason != playback_control::stop_reason_starting_another)
+        {
+            set_now_playing(metadb_handle::ptr());
+        }
+    }
+
+    void on_playback_starting(playback_control::t_track_command p_command, bool p_paused) {}
+    void on_playback_seek(double p_time) {}
+    void on_playback_pause(bool p_state) {}
+    void on_playback_edited(metadb_handle::ptr p_track) {}
+    void on_playback_dynamic_info(const file_info & p_info) {}
+    void on_playback_dynamic_info_track(const file_info & p_info) {}
+    void on_playback_time(double p_time) {}
+    void on_volume_change(float p_new_val) {}
+};
+
+static play_callback_static_factory_t<play_callback_bfir> g_play_callback_bfir_factory;
+
+
 class dsp_bfir : public dsp_impl_base
 {
 public:
     dsp_bfir()
-        : m_channels(0), m_srate(0), m_buffer_count(0), m_filter(NULL)
+        : m_channels(0), m_srate(0), m_filter_srate(0), m_buffer_count(0), 
+          m_filter(NULL), m_engine(NULL), m_pipeline_blocks(0),
+          m_in_resampler(NULL), m_out_resampler(NULL),
+          m_srcbuf_size(0), m_dstbuf_size(0), m_metrics_slot(metrics::acquire()),
+          m_cfg_generation(g_get_config_generation()),
+          m_delay_generation(g_get_delay_generation()),
+          m_playing_generation(0), m_playback(false)
     {
         // Initialize arrays
-        memset(m_phase, 0, BAND_COUNT * sizeof(double));
+        memset(&m_metrics, 0, sizeof(struct metrics_t));
 
         // Initialize buffers.  These will be reallocated later when
         // the number of channels is determined.
         m_inbuf = (audio_sample *)  _aligned_malloc(1, ALIGNMENT);
         m_outbuf = (audio_sample *) _aligned_malloc(1, ALIGNMENT);
+        m_srcbuf = (audio_sample *) _aligned_malloc(1, ALIGNMENT);
+        m_dstbuf = (audio_sample *) _aligned_malloc(1, ALIGNMENT);
     }
 
     ~dsp_bfir()
     {
         // Free all allocated memory
+        _aligned_free(m_dstbuf);
+        _aligned_free(m_srcbuf);
         _aligned_free(m_outbuf);
         _aligned_free(m_inbuf);
+        delete m_in_resampler;
+        delete m_out_resampler;
+        delete m_engine;
         delete m_filter;
-        delete m_equalizer;
-    }
-
-    bool on_chunk(audio_chunk * chunk, abort_callback & p_abort)
-    {
-        bool first_init = false;
-        bool re_init = false;
 
-        // This block can be used to determine when a new track is started
-        //metadb_handle::ptr curTrack;
-        //if (get_cur_file(curTrack) && curTrack != m_lastTrack)
-        //{
-        //    m_lastTrack = curTrack;
-        //}
+        metrics::release(m_metrics_slot);
 
-        if (chunk->get_channels() != m_channels)
+        if (m_playback)
         {
-            if (m_channels == 0)
-            {
-                first_init = true;
-            }
-            else
-            {
-                re_init = true;
-            }
-
-            m_channels = chunk->get_channels();
+            atomic_store(&playback_instance, 0);
         }
+    }
 
-        if (chunk->get_srate() != m_srate)
-        {
-            if (m_srate == 0)
-            {
-                first_init = true;
-            }
-            else
-            {
-                re_init = true;
-            }
+    bool on_chunk(audio_chunk * chunk, abort_callback & p_abort)
+    {
+        unsigned int channels = chunk->get_channels();
+        unsigned int srate = chunk->get_srate();
+        long generation = g_get_config_generation();
 
-            m_srate = chunk->get_srate();
-        }
+        update_playback();
 
-        if (first_init || re_init)
-        {
-            // Free memory before re-initializing for settings change
-            if (re_init)
-            {
-                console::print("Reinitializing filter.");
-                delete m_filter;
-                delete m_equalizer;
-            }
+        // Settings changed since the filter was built, rebuild it once
+        // however many settings were changed
+        bool reconfigure = (generation != m_cfg_generation) && (m_channels != 0);
 
-            // Instantiate equalizer
-            m_equalizer = new equalizer(FILTER_LEN,
-                                        EQ_FILTER_BLOCKS, 
-                                        REALSIZE, 
-                                        m_channels, 
-                                        m_srate);
+        m_cfg_generation = generation;
 
-            std::vector<struct impulse_info> impulse_info;
-            struct impulse_info info;
+        if ((channels != m_channels) || (srate != m_srate) || reconfigure)
+        {
+            // The filter runs at the source rate unless a fixed filter
+            // rate is configured, in which case only the sample rate
+            // converters follow the source.
+            unsigned int filter_srate = srate;
 
-            // Load equalizer
-            if (cfg_eq_enable.get_value() != 0)
+            if ((cfg_src_enable.get_value() != 0) && (cfg_src_rate.get_value() > 0))
             {
-                prefs_eq::get_mag(m_mag);
-
-                info.filename = m_equalizer->generate(ISO_BANDS_SIZE,
-                                                      (double *) iso_bands,
-                                                      m_mag,
-                                                      m_phase);
-
-                info.scale = prefs_eq::get_scale();
-                impulse_info.push_back(info);
+                filter_srate = cfg_src_rate.get_value();
             }
 
-            std::wstring filename;
-
-            // Load DRC impulse response files
-            filename = util::str2wstr(cfg_file1_filename.get_ptr());
-
-            if ((cfg_file1_enable.get_value() != 0) && !filename.empty())
+            if ((channels != m_channels) || (filter_srate != m_filter_srate) || reconfigure)
             {
-                if (!buffer::check_snd_file(filename.c_str(), m_channels, m_srate))
+                if (m_channels != 0)
                 {
-                    if (cfg_file1_resample.get_value() != 0)
-                    {
-                        filename = buffer::resample_snd_file(filename.c_str(), m_channels, m_srate);
-                    }
-                    else
-                    {
-                        filename.clear();
-                    }
+                    console::print("Reinitializing filter.");
                 }
 
-                if (!filename.empty())
-                {
-                    info.filename = filename;
-                    info.scale = prefs_file::get_file1_scale();
-                    impulse_info.push_back(info);
-                }
-            }
+                // Blocks still held by the engine thread are in the
+                // old format, emit them before it is torn down
+                flush_engine();
 
-            filename = util::str2wstr(cfg_file2_filename.get_ptr());
+                m_channels = channels;
+                m_filter_srate = filter_srate;
 
-            if ((cfg_file2_enable.get_value() != 0) && !filename.empty())
-            {
-                if (!buffer::check_snd_file(filename.c_str(), m_channels, m_srate))
-                {
-                    if (cfg_file2_resample.get_value() != 0)
-                    {
-                        filename = buffer::resample_snd_file(filename.c_str(), m_channels, m_srate);
-                    }
-                    else
-                    {
-                        filename.clear();
-                    }
-                }
+                double start = metrics::get_time();
 
-                if (!filename.empty())
-                {
-                    info.filename = filename;
-                    info.scale = prefs_file::get_file2_scale();
-                    impulse_info.push_back(info);
-                }
-            }
+                init_filter();
 
-            filename = util::str2wstr(cfg_file3_filename.get_ptr());
+                m_metrics.n_channels = m_channels;
+                m_metrics.sampling_rate = m_filter_srate;
+                m_metrics.block_length = FILTER_LEN;
+                m_metrics.rebuild_seconds = metrics::get_time() - start;
+                m_metrics.n_rebuilds++;
 
-            if ((cfg_file3_enable.get_value() != 0) && !filename.empty())
-            {
-                if (!buffer::check_snd_file(filename.c_str(), m_channels, m_srate))
-                {
-                    if (cfg_file3_resample.get_value() != 0)
-                    {
-                        filename = buffer::resample_snd_file(filename.c_str(), m_channels, m_srate);
-                    }
-                    else
-                    {
-                        filename.clear();
-                    }
-                }
-
-                if (!filename.empty())
-                {
-                    info.filename = filename;
-                    info.scale = prefs_file::get_file3_scale();
-                    impulse_info.push_back(info);
-                }
+                metrics::publish(m_metrics_slot, &m_metrics);
             }
 
-            filename.clear();
-            double scale;
+            m_srate = srate;
 
-            if (impulse_info.size() == 1)
-            {
-                filename = impulse_info.front().filename;
-                scale = impulse_info.front().scale;
-            }
-            else if (impulse_info.size() > 1)
-            {
-                // Preconvolve impulse files into a single file
-                filename = preprocessor::convolve_impulses(impulse_info, FILTER_LEN, REALSIZE);
-                scale = 1.0;
-            }
-
-            if (!filename.empty())
-            {
-                int n_channels, n_frames, sampling_rate;
-            
-                // Get impulse file parameters
-                if (buffer::get_snd_file_params(filename.c_str(), 
-                                                &n_channels, 
-                                                &n_frames, 
-                                                &sampling_rate))
-                {
-                    // calculate filter blocks
-                    int length = util::get_next_multiple(n_frames, FILTER_LEN);
-                    int filter_blocks = length / FILTER_LEN;
-            
-                    // Instantiate filter
-                    m_filter = new brutefir(FILTER_LEN,
-                                            filter_blocks,
-                                            REALSIZE,
-                                            m_channels, 
-                                            BF_SAMPLE_FORMAT_FLOAT_LE, 
-                                            BF_SAMPLE_FORMAT_FLOAT_LE, 
-                                            m_srate, 
-                                            false);
-           
-                    // Assign filter coefficients
-                    m_filter->set_coeff(filename.c_str(), filter_blocks, scale);
-
-                    // Reallocate input and output buffers
-                    m_bufsize = FILTER_LEN * m_channels * sizeof(audio_sample);
-                    m_inbuf = (audio_sample *) _aligned_realloc(m_inbuf, m_bufsize, ALIGNMENT);
-                    m_outbuf = (audio_sample *) _aligned_realloc(m_outbuf, m_bufsize, ALIGNMENT);
-
-                    console::printf("Filter length: %u samples, %u blocks.", FILTER_LEN, filter_blocks);
-                    console::printf("Format: %u channels, %u Hz.", m_channels, m_srate);
-                }
-            }
+            init_resamplers();
+        }
+        else if ((m_filter != NULL) && (g_get_delay_generation() != m_delay_generation))
+        {
+            init_delays();
         }
 
         // Check if initialization completed successfully
@@ -304,49 +301,46 @@ public:
         {
             if (m_filter->is_initialized())
             {
-                t_size sample_count = chunk->get_sample_count();
-                const audio_sample *src = chunk->get_data();
-                audio_sample *dst;
-
-                while (sample_count)
+                if (m_in_resampler != NULL)
                 {
-                    unsigned int todo = FILTER_LEN - m_buffer_count;
+                    // Convert the chunk to the filter rate
+                    int frames = m_in_resampler->get_max_output_frames(chunk->get_sample_count());
+                    size_t size = frames * m_channels * sizeof(audio_sample);
 
-                    if (todo > sample_count)
+                    if (size > m_srcbuf_size)
                     {
-                        todo = sample_count;
+                        m_srcbuf = (audio_sample *) _aligned_realloc(m_srcbuf, size, ALIGNMENT);
+                        m_srcbuf_size = size;
                     }
 
-                    dst = m_inbuf + m_buffer_count * m_channels;
+                    volatile uint64_t ts[2];
 
-                    for (unsigned int i = 0, j = todo * m_channels; i < j; i++)
-                    {
-                        *dst++ = *src++;
-                    }
+                    timestamp(&ts[0]);
 
-                    sample_count -= todo;
-                    m_buffer_count += todo;
+                    frames = m_in_resampler->process(chunk->get_data(),
+                                                     chunk->get_sample_count(),
+                                                     m_srcbuf,
+                                                     frames);
 
-                    if (m_buffer_count == FILTER_LEN)
+                    timestamp(&ts[1]);
+
+                    m_metrics.stage_cycles[METRICS_STAGE_RESAMPLE] += ts[1] - ts[0];
+
+                    if (frames > 0)
                     {
-                        if (m_filter->run(m_inbuf, m_outbuf) == 0)
-                        {
-                            audio_chunk *chk = insert_chunk(m_buffer_count * m_channels);
-                            chk->set_data_32((float *)m_outbuf, m_buffer_count, m_channels, m_srate);
-
-                            if (cfg_overflow_enable.get_value() != 0)
-                            {
-                                m_filter->check_overflows();
-                            }
-                        }
-                        else
-                        {
-                            console::print("Filter processing error.");
-                        }
-
-                        m_buffer_count = 0;
+                        process_samples(m_srcbuf, frames);
                     }
                 }
+                else
+                {
+                    process_samples(chunk->get_data(), chunk->get_sample_count());
+                }
+            }
+            else
+            {
+                // Pass audio through until the first filter blocks
+                // have been loaded
+                return true;
             }
         }
         else
@@ -361,17 +355,68 @@ public:
         return false;
     }
 
-    void on_endofplayback(abort_callback & p_abort) {}
+    void on_endofplayback(abort_callback & p_abort)
+    {
+        // The last blocks would otherwise be lost with the engine
+        flush_engine();
+    }
+
     void on_endoftrack(abort_callback & p_abort) {}
 
     void flush()
     {
         m_buffer_count = 0;
+
+        if (m_engine != NULL)
+        {
+            m_engine->discard();
+        }
+
+        if (m_in_resampler != NULL)
+        {
+            m_in_resampler->reset();
+        }
+
+        if (m_out_resampler != NULL)
+        {
+            m_out_resampler->reset();
+        }
     }
 
     double get_latency()
     {
-        return 0;
+        double latency = 0;
+
+        // Audio waiting for a complete filter block
+        if (m_filter_srate != 0)
+        {
+            latency += (double) m_buffer_count / m_filter_srate;
+        }
+
+        // Blocks queued for or processed by the engine thread
+        if (m_engine != NULL)
+        {
+            latency += (double) m_engine->get_pending() * FILTER_LEN / m_filter_srate;
+        }
+
+        // Alignment delay shared by all channels
+        if (m_filter != NULL)
+        {
+            latency += m_filter->get_common_delay();
+        }
+
+        // Audio held inside the sample rate converters
+        if (m_in_resampler != NULL)
+        {
+            latency += m_in_resampler->get_latency();
+        }
+
+        if (m_out_resampler != NULL)
+        {
+            latency += m_out_resampler->get_latency();
+        }
+
+        return latency;
     }
 
     bool need_track_change_mark()
@@ -392,21 +437,544 @@ public:
     }
 
 private:
+    // Takes the playback role while the track of this instance is
+    // the one the host is playing, and gives it up otherwise.  The
+    // dsp runs ahead of the output, so at a track change the role
+    // is kept while the host still plays the previous track.
+    void update_playback()
+    {
+        metadb_handle::ptr track;
+        long generation = atomic_load(&now_playing_generation);
+
+        if (!get_cur_file(track))
+        {
+            track.release();
+        }
+
+        // Compare again on a track change, or while waiting for
+        // another instance to give up the role
+        if ((track == m_track) && (generation == m_playing_generation) &&
+            (m_playback || !m_playing_track.is_valid()))
+        {
+            return;
+        }
+
+        m_track = track;
+        m_playing_generation = generation;
+
+        if (is_now_playing(track))
+        {
+            m_playing_track = track;
+        }
+        else if (!m_playback || !is_now_playing(m_playing_track))
+        {
+            m_playing_track.release();
+        }
+
+        bool playback = m_playing_track.is_valid();
+
+        if (playback && !m_playback)
+        {
+            playback = (atomic_cas(&playback_instance, 1, 0) == 0);
+        }
+        else if (!playback && m_playback)
+        {
+            atomic_store(&playback_instance, 0);
+        }
+
+        set_playback(playback);
+    }
+
+    // Moves the filter to or from real time priority and the engine
+    // thread as the playback role is taken or given up.
+    //
+    // Parameters:
+    //   playback  whether this instance holds the playback role
+    void set_playback(bool playback)
+    {
+        if (playback == m_playback)
+        {
+            return;
+        }
+
+        m_playback = playback;
+
+        if (m_filter == NULL)
+        {
+            return;
+        }
+
+        // Blocks held by the engine thread are emitted before it is
+        // stopped, and the partly collected block is kept
+        if (m_engine != NULL)
+        {
+            flush_engine();
+
+            memcpy(m_inbuf, m_engine->get_input(), m_buffer_count * m_channels * sizeof(audio_sample));
+
+            delete m_engine;
+
+            m_engine = NULL;
+            m_pipeline_blocks = 0;
+            m_metrics.pipeline_blocks = 0;
+        }
+
+        m_filter->set_priority(m_playback ? POOL_PRIORITY_REALTIME : POOL_PRIORITY_NORMAL);
+
+        init_engine();
+
+        if (m_engine != NULL)
+        {
+            memcpy(m_engine->get_input(), m_inbuf, m_buffer_count * m_channels * sizeof(audio_sample));
+        }
+    }
+
+    // Builds the equalizer and impulse files into a filter
+    // at the filter sampling rate.
+    void init_filter()
+    {
+        delete m_engine;
+        delete m_filter;
+
+        m_engine = NULL;
+        m_filter = NULL;
+        m_buffer_count = 0;
+        m_metrics.filter_blocks = 0;
+        m_metrics.pipeline_blocks = 0;
+
+        struct filter_settings settings;
+
+        // Gather the equalizer and impulse file settings
+        settings.min_phase = (cfg_min_phase_enable.get_value() != 0);
+        settings.trim = (cfg_trim_enable.get_value() != 0);
+        settings.eq_enable = (cfg_eq_enable.get_value() != 0);
+        settings.eq_scale = prefs_eq::get_scale();
+        prefs_eq::get_mag(settings.eq_mag);
+
+        settings.files[0].enable = (cfg_file1_enable.get_value() != 0);
+        settings.files[0].resample = (cfg_file1_resample.get_value() != 0);
+        settings.files[0].filename = util::str2wstr(cfg_file1_filename.get_ptr());
+        settings.files[0].scale = prefs_file::get_file1_scale();
+
+        settings.files[1].enable = (cfg_file2_enable.get_value() != 0);
+        settings.files[1].resample = (cfg_file2_resample.get_value() != 0);
+        settings.files[1].filename = util::str2wstr(cfg_file2_filename.get_ptr());
+        settings.files[1].scale = prefs_file::get_file2_scale();
+
+        settings.files[2].enable = (cfg_file3_enable.get_value() != 0);
+        settings.files[2].resample = (cfg_file3_resample.get_value() != 0);
+        settings.files[2].filename = util::str2wstr(cfg_file3_filename.get_ptr());
+        settings.files[2].scale = prefs_file::get_file3_scale();
+
+        double scale;
+
+        std::wstring filename = preprocessor::build_filter(settings,
+                                                           FILTER_LEN,
+                                                           EQ_FILTER_BLOCKS,
+                                                           REALSIZE,
+                                                           m_channels,
+                                                           m_filter_srate,
+                                                           &scale);
+
+        if (!filename.empty())
+        {
+            int n_channels, n_frames, sampling_rate;
+        
+            // Get impulse file parameters
+            if (buffer::get_snd_file_params(filename.c_str(), 
+                                            &n_channels, 
+                                            &n_frames, 
+                                            &sampling_rate))
+            {
+                // calculate filter blocks
+                int length = util::get_next_multiple(n_frames, FILTER_LEN);
+                int filter_blocks = length / FILTER_LEN;
+        
+                // Instantiate filter
+                m_filter = new brutefir(FILTER_LEN,
+                                        filter_blocks,
+                                        REALSIZE,
+                                        m_channels, 
+                                        BF_SAMPLE_FORMAT_FLOAT_LE, 
+                                        BF_SAMPLE_FORMAT_FLOAT_LE, 
+                                        m_filter_srate, 
+                                        false,
+                                        m_playback ? POOL_PRIORITY_REALTIME : POOL_PRIORITY_NORMAL);
+       
+                // Assign filter coefficients, remaining blocks are
+                // loaded while the filter is running
+                m_filter->set_coeff_async(filename.c_str(), filter_blocks, scale);
+                m_metrics.filter_blocks = filter_blocks;
+
+                init_delays();
+
+                // Reallocate input and output buffers
+                m_bufsize = FILTER_LEN * m_channels * sizeof(audio_sample);
+                m_inbuf = (audio_sample *) _aligned_realloc(m_inbuf, m_bufsize, ALIGNMENT);
+                m_outbuf = (audio_sample *) _aligned_realloc(m_outbuf, m_bufsize, ALIGNMENT);
+
+                console::printf("Filter length: %u samples, %u blocks.", FILTER_LEN, filter_blocks);
+                console::printf("Format: %u channels, %u Hz.", m_channels, m_filter_srate);
+
+                init_engine();
+            }
+        }
+    }
+
+    // Sets the channel alignment delays of the filter.  The
+    // settings are in microseconds.
+    void init_delays()
+    {
+        std::vector<std::string> delays;
+
+        m_delay_generation = g_get_delay_generation();
+
+        // The filter may only be changed while the engine thread is idle
+        if (m_engine != NULL)
+        {
+            m_engine->drain();
+        }
+
+        boost::algorithm::split(
+            delays,
+            std::string(cfg_delay.get_ptr()),
+            boost::is_any_of(","),
+            boost::algorithm::token_compress_on);
+
+        for (unsigned int n = 0; n < m_channels && n < delays.size(); n++)
+        {
+            int delay;
+
+            try
+            {
+                delay = boost::lexical_cast<int>(delays[n]);
+            }
+            catch (const boost::bad_lexical_cast &)
+            {
+                delay = 0;
+            }
+
+            m_filter->set_delay(n, (double)delay * m_filter_srate / (1000.0 * DELAY_STEPS_PER_MS));
+        }
+    }
+
+    // Starts the engine thread if the filter is to run on it,
+    // the configured number of blocks behind the input.  Only the
+    // instance holding the playback role waits for the output
+    // device, other instances run the filter themselves.
+    void init_engine()
+    {
+        m_pipeline_blocks = cfg_pipeline_blocks.get_value();
+
+        if ((m_pipeline_blocks <= 0) || !m_playback)
+        {
+            m_pipeline_blocks = 0;
+            return;
+        }
+
+        if (m_pipeline_blocks > PIPELINE_MAX_BLOCKS)
+        {
+            m_pipeline_blocks = PIPELINE_MAX_BLOCKS;
+        }
+
+        m_engine = new engine_thread(m_filter,
+                                     m_pipeline_blocks,
+                                     (int) m_bufsize,
+                                     cfg_pipeline_cpu.get_value() - 1);
+
+        m_metrics.pipeline_blocks = m_pipeline_blocks;
+
+        console::printf("Engine thread: %d blocks of added latency.", m_pipeline_blocks);
+    }
+
+    // Creates the sample rate converters between the source
+    // and filter sampling rates, if they differ.
+    void init_resamplers()
+    {
+        delete m_in_resampler;
+        delete m_out_resampler;
+
+        m_in_resampler = NULL;
+        m_out_resampler = NULL;
+
+        if ((m_filter == NULL) || (m_srate == m_filter_srate))
+        {
+            return;
+        }
+
+        m_in_resampler = new resampler(m_channels, m_srate, m_filter_srate, SRC_QUALITY);
+        m_out_resampler = new resampler(m_channels, m_filter_srate, m_srate, SRC_QUALITY);
+
+        if (!m_in_resampler->is_initialized() || !m_out_resampler->is_initialized())
+        {
+            console::printf("Cannot convert %u Hz to %u Hz, filter disabled.", m_srate, m_filter_srate);
+
+            delete m_in_resampler;
+            delete m_out_resampler;
+            delete m_engine;
+            delete m_filter;
+
+            m_in_resampler = NULL;
+            m_out_resampler = NULL;
+            m_engine = NULL;
+            m_filter = NULL;
+            m_filter_srate = 0;
+            return;
+        }
+
+        // Size the output conversion buffer for one filter block
+        m_dstbuf_size = m_out_resampler->get_max_output_frames(FILTER_LEN) * m_channels * sizeof(audio_sample);
+        m_dstbuf = (audio_sample *) _aligned_realloc(m_dstbuf, m_dstbuf_size, ALIGNMENT);
+
+        console::printf("Converting %u Hz to %u Hz.", m_srate, m_filter_srate);
+    }
+
+    // Collects samples into filter blocks and runs the filter
+    // on each completed block.
+    void process_samples(const audio_sample *src, t_size sample_count)
+    {
+        audio_sample *inbuf, *dst;
+
+        // Blocks for the engine thread are collected in its input ring
+        inbuf = (m_engine != NULL) ? (audio_sample *) m_engine->get_input() : m_inbuf;
+
+        while (sample_count)
+        {
+            unsigned int todo = FILTER_LEN - m_buffer_count;
+
+            if (todo > sample_count)
+            {
+                todo = sample_count;
+            }
+
+            dst = inbuf + m_buffer_count * m_channels;
+
+            for (unsigned int i = 0, j = todo * m_channels; i < j; i++)
+            {
+                *dst++ = *src++;
+            }
+
+            sample_count -= todo;
+            m_buffer_count += todo;
+
+            if (m_buffer_count == FILTER_LEN)
+            {
+                if (m_engine != NULL)
+                {
+                    run_engine();
+
+                    inbuf = (audio_sample *) m_engine->get_input();
+                }
+                else
+                {
+                    run_filter();
+                }
+
+                m_buffer_count = 0;
+            }
+        }
+    }
+
+    // Runs the filter on the collected block.
+    void run_filter()
+    {
+        uint64_t stage_cycles[METRICS_STAGE_COUNT];
+        volatile uint64_t ts[2];
+        double start = metrics::get_time();
+
+        timestamp(&ts[0]);
+
+        if (m_filter->run(m_inbuf, m_outbuf) == 0)
+        {
+            output_block(m_outbuf, FILTER_LEN);
+
+            timestamp(&ts[1]);
+
+            m_filter->get_stage_cycles(stage_cycles);
+            update_metrics(ts[1] - ts[0], metrics::get_time() - start, stage_cycles);
+
+            if (cfg_overflow_enable.get_value() != 0)
+            {
+                m_filter->check_overflows();
+            }
+        }
+        else
+        {
+            console::print("Filter processing error.");
+        }
+    }
+
+    // Passes the collected block to the engine thread and emits the
+    // blocks it has processed beyond the configured latency, waiting
+    // for the oldest one if the thread has fallen that far behind.
+    void run_engine()
+    {
+        m_engine->set_check_overflows(cfg_overflow_enable.get_value() != 0);
+        m_engine->push();
+
+        emit_blocks(m_pipeline_blocks);
+    }
+
+    // Waits for the engine thread to process the blocks it holds
+    // and emits them.
+    void flush_engine()
+    {
+        if (m_engine != NULL)
+        {
+            m_engine->drain();
+
+            emit_blocks(0);
+        }
+    }
+
+    // Emits the oldest blocks processed by the engine thread until
+    // a number of blocks are left pending.
+    //
+    // Parameters:
+    //   n_keep  the number of blocks to leave pending
+    void emit_blocks(int n_keep)
+    {
+        struct engine_block_t *result;
+        struct engine_block_t done;
+        audio_sample *buf;
+        bool stalled;
+
+        while (m_engine->get_pending() > n_keep)
+        {
+            buf = (audio_sample *) m_engine->get_output(&result, &stalled);
+
+            if (stalled)
+            {
+                m_metrics.n_stalls++;
+            }
+
+            if (result->status == 0)
+            {
+                output_block(buf, FILTER_LEN);
+            }
+
+            done = *result;
+            m_engine->pop();
+
+            if (done.status == 0)
+            {
+                update_metrics(done.cycles, done.seconds, done.stage_cycles);
+            }
+            else
+            {
+                console::print("Filter processing error.");
+            }
+        }
+    }
+
+    // Adds a processed block to the metrics and publishes them.
+    void update_metrics(uint64_t cycles, double seconds, const uint64_t *stage_cycles)
+    {
+        struct bflevels_t levels;
+
+        for (int i = METRICS_STAGE_INPUT; i <= METRICS_STAGE_OUTPUT; i++)
+        {
+            m_metrics.stage_cycles[i] += stage_cycles[i];
+        }
+
+        metrics::add_block(&m_metrics, cycles, seconds, (double) FILTER_LEN / m_filter_srate);
+
+        for (unsigned int n = 0; n < m_channels && n < BF_MAXCHANNELS; n++)
+        {
+            if (m_filter->get_levels(n, &levels))
+            {
+                m_metrics.peak[n] = levels.peak;
+                m_metrics.n_clipped[n] = levels.n_clipped;
+                m_metrics.n_nonfinite[n] = levels.n_nonfinite;
+            }
+
+            m_metrics.active_blocks[n] = m_filter->get_active_blocks(n);
+        }
+
+        m_metrics.latency = get_latency();
+
+        metrics::publish(m_metrics_slot, &m_metrics);
+    }
+
+    // Emits a processed block, converting it back to the
+    // source rate if needed.
+    void output_block(audio_sample *buf, unsigned int sample_count)
+    {
+        audio_chunk *chk;
+
+        if (m_out_resampler != NULL)
+        {
+            volatile uint64_t ts[2];
+
+            timestamp(&ts[0]);
+
+            int frames = m_out_resampler->process(buf,
+                                                  sample_count,
+                                                  m_dstbuf,
+                                                  m_dstbuf_size / (m_channels * sizeof(audio_sample)));
+
+            timestamp(&ts[1]);
+
+            m_metrics.stage_cycles[METRICS_STAGE_RESAMPLE] += ts[1] - ts[0];
+
+            if (frames > 0)
+            {
+                chk = insert_chunk(frames * m_channels);
+                chk->set_data_32((float *)m_dstbuf, frames, m_channels, m_srate);
+
+                if (m_playback)
+                {
+                    stream_buffer.write((float *)m_dstbuf, frames, m_channels, m_srate);
+                }
+            }
+        }
+        else
+        {
+            chk = insert_chunk(sample_count * m_channels);
+            chk->set_data_32((float *)buf, sample_count, m_channels, m_srate);
+
+            if (m_playback)
+            {
+                stream_buffer.write((float *)buf, sample_count, m_channels, m_srate);
+            }
+        }
+    }
+
     brutefir *m_filter;
-    equalizer *m_equalizer;
+    engine_thread *m_engine;
+    int m_pipeline_blocks;
+    resampler *m_in_resampler;
+    resampler *m_out_resampler;
 
     unsigned int m_channels;
     unsigned int m_srate;
+    unsigned int m_filter_srate;
 
     unsigned int m_buffer_count;
     size_t m_bufsize;
     audio_sample *m_inbuf;
     audio_sample *m_outbuf;
 
-    double m_mag[BAND_COUNT];
-    double m_phase[BAND_COUNT];
+    size_t m_srcbuf_size;
+    size_t m_dstbuf_size;
+    audio_sample *m_srcbuf;
+    audio_sample *m_dstbuf;
+
+    int m_metrics_slot;
+    struct metrics_t m_metrics;
+
+    long m_cfg_generation;
+    long m_delay_generation;
 
-    metadb_handle::ptr m_lastTrack;
+    // the track of the last chunk, and the track the host was
+    // playing when this instance last matched it
+    metadb_handle::ptr m_track;
+    metadb_handle::ptr m_playing_track;
+    long m_playing_generation;
+
+    // whether this instance holds the playback role; other instances
+    // such as converters run alongside it
+    bool m_playback;
 };
 
 static dsp_factory_nopreset_t<dsp_bfir> g_dsp_bfir_factory;
@@ -528,6 +1096,27 @@ void g_stop_server()
     }
 }
 
+void g_stream_server_thread_worker()
+{
+    stream_server = new slim::server::stream_server("0.0.0.0", cfg_stream_port.get_value(), stream_buffer);
+    stream_server->run();
+}
+
+void g_start_stream_server()
+{
+    stream_server_thread = new boost::thread(g_stream_server_thread_worker);
+}
+
+void g_stop_stream_server()
+{
+    if (stream_server_thread != NULL)
+    {
+        stream_server->stop();
+        stream_server_thread->join();
+        stream_server_thread = NULL;
+    }
+}
+
 void g_apply_preferences()
 {
     g_stop_server();
@@ -536,6 +1125,35 @@ void g_apply_preferences()
     {
         g_start_server();
     }
+
+    g_stop_stream_server();
+
+    if (cfg_stream_enable.get_value() != 0)
+    {
+        g_start_stream_server();
+    }
+
+    g_config_changed();
+}
+
+void g_config_changed()
+{
+    atomic_add(&cfg_generation, 1);
+}
+
+long g_get_config_generation()
+{
+    return atomic_load(&cfg_generation);
+}
+
+void g_delay_changed()
+{
+    atomic_add(&cfg_delay_generation, 1);
+}
+
+long g_get_delay_generation()
+{
+    return atomic_load(&cfg_delay_generation);
 }
 
 
@@ -10,6 +10,13 @@
 void g_cli_server_thread_worker();
 void g_start_server();
 void g_stop_server();
+void g_stream_server_thread_worker();
+void g_start_stream_server();
+void g_stop_stream_server();
 void g_apply_preferences();
+void g_config_changed();
+long g_get_config_generation();
+void g_delay_changed();
+long g_get_delay_generation();
 
 #endif
\ No newline at end of file
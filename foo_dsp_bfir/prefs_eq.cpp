@@ -5,6 +5,7 @@
  *
  */
 #include "prefs_eq.h"
+#include "foo_dsp_bfir.h"
 #include <string>
 #include <sstream>
 #include <fstream>
@@ -579,6 +580,8 @@ void prefs_eq::apply()
 
     cfg_eq_mag.set_string(out.str().c_str());
 
+    g_config_changed();
+
     OnChanged(); //our dialog content has not changed but the flags have - our currently shown values now match the settings so the apply button can be disabled
 }
 
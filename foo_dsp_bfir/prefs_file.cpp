@@ -5,6 +5,7 @@
  *
  */
 #include "prefs_file.h"
+#include "foo_dsp_bfir.h"
 #include <string>
 #include <sstream>
 #include "../brutefir/util.hpp"
@@ -150,12 +151,14 @@ void prefs_file::LoadFile(int filename_id, int metadata_id,
                         int n_frames;
                         int sampling_rate;
                         double attenuation;
+                        double peak_attenuation;
+                        double music_attenuation;
 
                         // Calculate the optimum attentuation to prevent clipping
                         if (preprocessor::calculate_attenuation(pszFilePath, 
-                                                                FILTER_LEN, 
-                                                                REALSIZE,
                                                                 &attenuation,
+                                                                &peak_attenuation,
+                                                                &music_attenuation,
                                                                 &n_channels,
                                                                 &n_frames,
                                                                 &sampling_rate))
@@ -282,6 +285,8 @@ void prefs_file::apply()
     GetDlgItemText(IDC_LABEL_INFO3, (LPTSTR)wstr, sizeof(wstr));
     cfg_file3_metadata.set_string((util::wstr2str(wstr)).c_str());
     
+    g_config_changed();
+
     OnChanged(); //our dialog content has not changed but the flags have - our currently shown values now match the settings so the apply button can be disabled
 }
 
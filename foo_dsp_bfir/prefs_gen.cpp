@@ -10,6 +10,15 @@
 cfg_int cfg_cli_enable(guid_cfg_cli_enable, default_cfg_cli_enable);
 cfg_int cfg_cli_port(guid_cfg_cli_port, default_cfg_cli_port);
 cfg_int cfg_overflow_enable(guid_cfg_overflow_enable, default_cfg_overflow_enable);
+cfg_int cfg_src_enable(guid_cfg_src_enable, default_cfg_src_enable);
+cfg_int cfg_src_rate(guid_cfg_src_rate, default_cfg_src_rate);
+cfg_int cfg_stream_enable(guid_cfg_stream_enable, default_cfg_stream_enable);
+cfg_int cfg_stream_port(guid_cfg_stream_port, default_cfg_stream_port);
+cfg_int cfg_min_phase_enable(guid_cfg_min_phase_enable, default_cfg_min_phase_enable);
+cfg_int cfg_trim_enable(guid_cfg_trim_enable, default_cfg_trim_enable);
+cfg_int cfg_pipeline_blocks(guid_cfg_pipeline_blocks, default_cfg_pipeline_blocks);
+cfg_int cfg_pipeline_cpu(guid_cfg_pipeline_cpu, default_cfg_pipeline_cpu);
+cfg_string cfg_delay(guid_cfg_delay, default_cfg_delay);
 
 BOOL prefs_gen::OnInitDialog(CWindow, LPARAM)
 {
@@ -20,6 +29,25 @@ BOOL prefs_gen::OnInitDialog(CWindow, LPARAM)
 
     CheckDlgButton(IDC_CHECK_OVERFLOW, cfg_overflow_enable);
 
+    CheckDlgButton(IDC_CHECK_SRC_ENABLE, cfg_src_enable);
+
+    ::SendMessage(GetDlgItem(IDC_EDIT_SRC_RATE), EM_SETLIMITTEXT, 6, 0 );
+    SetDlgItemInt(IDC_EDIT_SRC_RATE, cfg_src_rate, FALSE);
+
+    CheckDlgButton(IDC_CHECK_STREAM_ENABLE, cfg_stream_enable);
+
+    ::SendMessage(GetDlgItem(IDC_EDIT_STREAM_PORT), EM_SETLIMITTEXT, 5, 0 );
+    SetDlgItemInt(IDC_EDIT_STREAM_PORT, cfg_stream_port, FALSE);
+
+    CheckDlgButton(IDC_CHECK_MIN_PHASE, cfg_min_phase_enable);
+    CheckDlgButton(IDC_CHECK_TRIM, cfg_trim_enable);
+
+    ::SendMessage(GetDlgItem(IDC_EDIT_PIPELINE_BLOCKS), EM_SETLIMITTEXT, 2, 0 );
+    SetDlgItemInt(IDC_EDIT_PIPELINE_BLOCKS, cfg_pipeline_blocks, FALSE);
+
+    ::SendMessage(GetDlgItem(IDC_EDIT_PIPELINE_CPU), EM_SETLIMITTEXT, 2, 0 );
+    SetDlgItemInt(IDC_EDIT_PIPELINE_CPU, cfg_pipeline_cpu, FALSE);
+
     return FALSE;
 }
 
@@ -45,6 +73,14 @@ void prefs_gen::reset()
     CheckDlgButton(IDC_CHECK_CLI_ENABLE, default_cfg_cli_enable);
     SetDlgItemInt(IDC_EDIT_CLI_PORT, default_cfg_cli_port, FALSE);
     CheckDlgButton(IDC_CHECK_OVERFLOW, default_cfg_overflow_enable);
+    CheckDlgButton(IDC_CHECK_SRC_ENABLE, default_cfg_src_enable);
+    SetDlgItemInt(IDC_EDIT_SRC_RATE, default_cfg_src_rate, FALSE);
+    CheckDlgButton(IDC_CHECK_STREAM_ENABLE, default_cfg_stream_enable);
+    SetDlgItemInt(IDC_EDIT_STREAM_PORT, default_cfg_stream_port, FALSE);
+    CheckDlgButton(IDC_CHECK_MIN_PHASE, default_cfg_min_phase_enable);
+    CheckDlgButton(IDC_CHECK_TRIM, default_cfg_trim_enable);
+    SetDlgItemInt(IDC_EDIT_PIPELINE_BLOCKS, default_cfg_pipeline_blocks, FALSE);
+    SetDlgItemInt(IDC_EDIT_PIPELINE_CPU, default_cfg_pipeline_cpu, FALSE);
 
     OnChanged();
 }
@@ -54,6 +90,14 @@ void prefs_gen::apply()
     cfg_cli_enable = IsDlgButtonChecked(IDC_CHECK_CLI_ENABLE);
     cfg_cli_port = GetDlgItemInt(IDC_EDIT_CLI_PORT, NULL, FALSE);
     cfg_overflow_enable = IsDlgButtonChecked(IDC_CHECK_OVERFLOW);
+    cfg_src_enable = IsDlgButtonChecked(IDC_CHECK_SRC_ENABLE);
+    cfg_src_rate = GetDlgItemInt(IDC_EDIT_SRC_RATE, NULL, FALSE);
+    cfg_stream_enable = IsDlgButtonChecked(IDC_CHECK_STREAM_ENABLE);
+    cfg_stream_port = GetDlgItemInt(IDC_EDIT_STREAM_PORT, NULL, FALSE);
+    cfg_min_phase_enable = IsDlgButtonChecked(IDC_CHECK_MIN_PHASE);
+    cfg_trim_enable = IsDlgButtonChecked(IDC_CHECK_TRIM);
+    cfg_pipeline_blocks = GetDlgItemInt(IDC_EDIT_PIPELINE_BLOCKS, NULL, FALSE);
+    cfg_pipeline_cpu = GetDlgItemInt(IDC_EDIT_PIPELINE_CPU, NULL, FALSE);
 
     g_apply_preferences();
 
@@ -65,7 +109,15 @@ bool prefs_gen::HasChanged()
     return
         (IsDlgButtonChecked(IDC_CHECK_CLI_ENABLE) != cfg_cli_enable) ||
         (GetDlgItemInt(IDC_EDIT_CLI_PORT, NULL, FALSE) != cfg_cli_port) ||
-        (IsDlgButtonChecked(IDC_CHECK_OVERFLOW) != cfg_overflow_enable);
+        (IsDlgButtonChecked(IDC_CHECK_OVERFLOW) != cfg_overflow_enable) ||
+        (IsDlgButtonChecked(IDC_CHECK_SRC_ENABLE) != cfg_src_enable) ||
+        (GetDlgItemInt(IDC_EDIT_SRC_RATE, NULL, FALSE) != cfg_src_rate) ||
+        (IsDlgButtonChecked(IDC_CHECK_STREAM_ENABLE) != cfg_stream_enable) ||
+        (GetDlgItemInt(IDC_EDIT_STREAM_PORT, NULL, FALSE) != cfg_stream_port) ||
+        (IsDlgButtonChecked(IDC_CHECK_MIN_PHASE) != cfg_min_phase_enable) ||
+        (IsDlgButtonChecked(IDC_CHECK_TRIM) != cfg_trim_enable) ||
+        (GetDlgItemInt(IDC_EDIT_PIPELINE_BLOCKS, NULL, FALSE) != cfg_pipeline_blocks) ||
+        (GetDlgItemInt(IDC_EDIT_PIPELINE_CPU, NULL, FALSE) != cfg_pipeline_cpu);
 }
 
 void prefs_gen::OnChanged()
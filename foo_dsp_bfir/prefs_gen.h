@@ -21,6 +21,42 @@ static const GUID guid_cfg_cli_port =
 static const GUID guid_cfg_overflow_enable =
 { 0x7F4E8298, 0x5DC2, 0x4124, { 0x8D, 0xE9, 0x3E, 0xC2, 0xF5, 0x6F, 0x5A, 0x42 } };
 
+// {C6BF1CBF-3F6C-47F3-A4F4-50D23C971337}
+static const GUID guid_cfg_src_enable =
+{ 0xC6BF1CBF, 0x3F6C, 0x47F3, { 0xA4, 0xF4, 0x50, 0xD2, 0x3C, 0x97, 0x13, 0x37 } };
+
+// {4D826808-86A0-42B9-8F22-892CE984BA71}
+static const GUID guid_cfg_src_rate =
+{ 0x4D826808, 0x86A0, 0x42B9, { 0x8F, 0x22, 0x89, 0x2C, 0xE9, 0x84, 0xBA, 0x71 } };
+
+// {5B1E0C8A-3D47-4F2E-9C61-2A8F7D4B6E13}
+static const GUID guid_cfg_stream_enable =
+{ 0x5B1E0C8A, 0x3D47, 0x4F2E, { 0x9C, 0x61, 0x2A, 0x8F, 0x7D, 0x4B, 0x6E, 0x13 } };
+
+// {A93F6D25-8B0C-4E71-B2D4-61C5E8F03A97}
+static const GUID guid_cfg_stream_port =
+{ 0xA93F6D25, 0x8B0C, 0x4E71, { 0xB2, 0xD4, 0x61, 0xC5, 0xE8, 0xF0, 0x3A, 0x97 } };
+
+// {C2F85A19-7E4D-4B36-A1C8-5D09E73B2F64}
+static const GUID guid_cfg_min_phase_enable =
+{ 0xC2F85A19, 0x7E4D, 0x4B36, { 0xA1, 0xC8, 0x5D, 0x09, 0xE7, 0x3B, 0x2F, 0x64 } };
+
+// {8A4D17E3-B95C-4F02-9E6B-37C0D2A84F51}
+static const GUID guid_cfg_trim_enable =
+{ 0x8A4D17E3, 0xB95C, 0x4F02, { 0x9E, 0x6B, 0x37, 0xC0, 0xD2, 0xA8, 0x4F, 0x51 } };
+
+// {3E7B9C14-62A8-4D5F-8B07-C4D1A9E26F38}
+static const GUID guid_cfg_delay =
+{ 0x3E7B9C14, 0x62A8, 0x4D5F, { 0x8B, 0x07, 0xC4, 0xD1, 0xA9, 0xE2, 0x6F, 0x38 } };
+
+// {6D0A4E52-19C3-4B8F-A7E1-F25B83C60D94}
+static const GUID guid_cfg_pipeline_blocks =
+{ 0x6D0A4E52, 0x19C3, 0x4B8F, { 0xA7, 0xE1, 0xF2, 0x5B, 0x83, 0xC6, 0x0D, 0x94 } };
+
+// {B41F7C8D-E62A-4035-9D18-7A3E05F9C2B6}
+static const GUID guid_cfg_pipeline_cpu =
+{ 0xB41F7C8D, 0xE62A, 0x4035, { 0x9D, 0x18, 0x7A, 0x3E, 0x05, 0xF9, 0xC2, 0xB6 } };
+
 
 class prefs_gen : public CDialogImpl<prefs_gen>, public preferences_page_instance
 {
@@ -45,6 +81,14 @@ public:
 		COMMAND_HANDLER_EX(IDC_CHECK_CLI_ENABLE, BN_CLICKED, OnButtonClick)
         COMMAND_HANDLER_EX(IDC_EDIT_CLI_PORT, EN_CHANGE, OnFieldChange)
 		COMMAND_HANDLER_EX(IDC_CHECK_OVERFLOW, BN_CLICKED, OnButtonClick)
+		COMMAND_HANDLER_EX(IDC_CHECK_SRC_ENABLE, BN_CLICKED, OnButtonClick)
+        COMMAND_HANDLER_EX(IDC_EDIT_SRC_RATE, EN_CHANGE, OnFieldChange)
+		COMMAND_HANDLER_EX(IDC_CHECK_STREAM_ENABLE, BN_CLICKED, OnButtonClick)
+        COMMAND_HANDLER_EX(IDC_EDIT_STREAM_PORT, EN_CHANGE, OnFieldChange)
+		COMMAND_HANDLER_EX(IDC_CHECK_MIN_PHASE, BN_CLICKED, OnButtonClick)
+		COMMAND_HANDLER_EX(IDC_CHECK_TRIM, BN_CLICKED, OnButtonClick)
+        COMMAND_HANDLER_EX(IDC_EDIT_PIPELINE_BLOCKS, EN_CHANGE, OnFieldChange)
+        COMMAND_HANDLER_EX(IDC_EDIT_PIPELINE_CPU, EN_CHANGE, OnFieldChange)
     END_MSG_MAP()
 
 private:
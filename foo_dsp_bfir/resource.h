@@ -111,6 +111,18 @@
 #define IDC_LABEL_ADJUST                1112
 #define IDC_CHECK_RESAMPLE2             1112
 #define IDC_CHECK_RESAMPLE3             1113
+#define IDC_CHECK_SRC_ENABLE            1114
+#define IDC_LABEL_SRC_RATE              1115
+#define IDC_EDIT_SRC_RATE               1116
+#define IDC_CHECK_STREAM_ENABLE         1117
+#define IDC_LABEL_STREAM_PORT           1118
+#define IDC_EDIT_STREAM_PORT            1119
+#define IDC_CHECK_MIN_PHASE             1120
+#define IDC_CHECK_TRIM                  1121
+#define IDC_LABEL_PIPELINE_BLOCKS       1122
+#define IDC_EDIT_PIPELINE_BLOCKS        1123
+#define IDC_LABEL_PIPELINE_CPU          1124
+#define IDC_EDIT_PIPELINE_CPU           1125
 
 // Next default values for new objects
 // 
@@ -118,7 +130,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        109
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1113
+#define _APS_NEXT_CONTROL_VALUE         1126
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif